@@ -0,0 +1,215 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2019 Red Hat, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation. See file COPYING.
+ *
+ */
+
+#ifndef BPLUS_BLOOM_H
+#define BPLUS_BLOOM_H
+
+#include "compat.h"
+#include "bplus_key.h"
+#ifndef XXH_STATIC_LINKING_ONLY
+#define XXH_STATIC_LINKING_ONLY // for the state struct, to embed it
+#endif
+#include "xxhash.h"
+#include <stdint.h>
+#include <endian.h>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+namespace rgw { namespace bplus {
+
+    /* a blocked Bloom filter:  each key sets k bits of one 64-byte
+     * block (one cache line), picked by its XXH64, so a probe misses
+     * at most one line;  k follows from bits per key, and the false
+     * positive rate is about 0.62^bits_per_key (a little over, for
+     * the blocking);  bits are only ever set, atomically, so adds and
+     * probes may race (a key added is seen by probes after), and a
+     * key removed stays in
+     *
+     * encoded (as stored in a leaf's header):  version, k, bits per
+     * key, a pad byte, the block count (4 bytes, little-endian), the
+     * blocks, then an XXH64 of all of it, so a damaged filter is
+     * refused rather than trusted to deny a key */
+    class bloom_filter
+    {
+    public:
+      static constexpr uint32_t block_bits = 512;
+      static constexpr uint32_t block_words = block_bits / 64;
+      static constexpr uint32_t max_bits_per_key = 32;
+
+      /* bits per key for a false positive rate of fpr */
+      static uint32_t bits_for_fpr(double fpr) {
+	if (! (fpr > 0.0)) {
+	  return 0;
+	}
+	fpr = std::min(fpr, 0.5);
+	double bits = -std::log(fpr) / (M_LN2 * M_LN2);
+	return std::clamp(uint32_t(std::ceil(bits)), 1u, max_bits_per_key);
+      }
+
+      static uint64_t hash(const std::string_view& key) {
+	return XXH64(key.data(), key.length(), 0);
+      }
+      static uint64_t hash(const sv_tuple& tp) {
+	const auto& l = std::get<0>(tp);
+	const auto& r = std::get<1>(tp);
+	if (l.empty()) {
+	  return hash(r);
+	}
+	XXH64_state_t st;
+	XXH64_reset(&st, 0);
+	XXH64_update(&st, l.data(), l.length());
+	XXH64_update(&st, r.data(), r.length());
+	return XXH64_digest(&st);
+      }
+
+      /* sized for nkeys at bits_per_key */
+      bloom_filter(size_t nkeys, uint32_t _bits_per_key)
+	: bits_per_key(std::clamp(_bits_per_key, 1u, max_bits_per_key)),
+	  k(std::clamp(uint32_t(bits_per_key * M_LN2 + 0.5), 1u, 30u)),
+	  nblocks(std::max<size_t>(
+		    1, (std::max<size_t>(nkeys, 1) * bits_per_key +
+			block_bits - 1) / block_bits)),
+	  words(new std::atomic<uint64_t>[nblocks * block_words]) {
+	for (size_t ix = 0; ix < nblocks * block_words; ++ix) {
+	  words[ix].store(0, std::memory_order_relaxed);
+	}
+      }
+
+      uint32_t get_bits_per_key() const { return bits_per_key; }
+      size_t bytes() const { return nblocks * block_bits / 8; }
+
+      void add(uint64_t h) {
+	std::atomic<uint64_t>* blk = words.get() + block_of(h) * block_words;
+	probe_bits(h, k, [blk](uint32_t bit) {
+	  blk[bit / 64].fetch_or(uint64_t(1) << (bit % 64),
+				 std::memory_order_release);
+	  return true;
+	});
+      }
+
+      bool may_contain(uint64_t h) const {
+	const std::atomic<uint64_t>* blk =
+	  words.get() + block_of(h) * block_words;
+	return probe_bits(h, k, [blk](uint32_t bit) {
+	  return (blk[bit / 64].load(std::memory_order_acquire) >>
+		  (bit % 64)) & 1;
+	});
+      }
+
+      /* the fraction of bits set:  past about half, the rate is worse
+       * than bits_per_key promises (the filter holds too many keys) */
+      double fill() const {
+	size_t set{0};
+	for (size_t ix = 0; ix < nblocks * block_words; ++ix) {
+	  set += __builtin_popcountll(words[ix].load(std::memory_order_relaxed));
+	}
+	return double(set) / (nblocks * block_bits);
+      }
+
+      std::string encode() const {
+	std::string s;
+	s.reserve(head_size + bytes() + 8);
+	s.push_back(char(version));
+	s.push_back(char(k));
+	s.push_back(char(bits_per_key));
+	s.push_back(0);
+	for (int ix = 0; ix < 4; ++ix) {
+	  s.push_back(char(uint8_t(nblocks >> (8 * ix))));
+	}
+	for (size_t ix = 0; ix < nblocks * block_words; ++ix) {
+	  uint64_t w = htole64(words[ix].load(std::memory_order_relaxed));
+	  s.append(reinterpret_cast<const char*>(&w), sizeof(w));
+	}
+	uint64_t digest = htole64(XXH64(s.data(), s.length(), 0));
+	s.append(reinterpret_cast<const char*>(&digest), sizeof(digest));
+	return s;
+      }
+
+      /* over encoded bytes, in place:  true iff they are whole */
+      static bool verify(const uint8_t* data, size_t size) {
+	if ((size < head_size + 8) || (data[0] != version)) {
+	  return false;
+	}
+	size_t n = encoded_blocks(data);
+	if ((n == 0) || (size != head_size + n * (block_bits / 8) + 8)) {
+	  return false;
+	}
+	uint64_t digest;
+	::memcpy(&digest, data + size - 8, sizeof(digest));
+	return XXH64(data, size - 8, 0) == le64toh(digest);
+      }
+
+      /* the bits per key encoded */
+      static uint32_t encoded_bits_per_key(const uint8_t* data) {
+	return data[2];
+      }
+
+      /* over encoded bytes that verify() */
+      static bool may_contain(const uint8_t* data, uint64_t h) {
+	uint32_t k = data[1];
+	size_t n = encoded_blocks(data);
+	const uint8_t* blk = data + head_size +
+	  ((uint64_t(uint32_t(h >> 32)) * n) >> 32) * (block_bits / 8);
+	return probe_bits(h, k, [blk](uint32_t bit) {
+	  return (blk[bit / 8] >> (bit % 8)) & 1;
+	});
+      }
+
+    private:
+      static constexpr uint8_t version = 1;
+      static constexpr size_t head_size = 8;
+
+      uint32_t bits_per_key;
+      uint32_t k;
+      size_t nblocks;
+      std::unique_ptr<std::atomic<uint64_t>[]> words;
+
+      /* the high word picks the block (by multiply-shift, not mod) */
+      size_t block_of(uint64_t h) const {
+	return (uint64_t(uint32_t(h >> 32)) * nblocks) >> 32;
+      }
+
+      static size_t encoded_blocks(const uint8_t* data) {
+	size_t n{0};
+	for (int ix = 0; ix < 4; ++ix) {
+	  n |= size_t(data[4 + ix]) << (8 * ix);
+	}
+	return n;
+      }
+
+      /* the low word gives k bit positions in the block, by double
+       * hashing (as LevelDB's);  f is called on each until it fails,
+       * and encoded blocks are little-endian words, so bit b is bit
+       * b % 8 of byte b / 8 either way */
+      template <typename F>
+      static bool probe_bits(uint64_t h, uint32_t k, F&& f) {
+	uint32_t a = uint32_t(h);
+	uint32_t d = (a >> 17) | (a << 15);
+	for (uint32_t ix = 0; ix < k; ++ix) {
+	  if (! f(a % block_bits)) {
+	    return false;
+	  }
+	  a += d;
+	}
+	return true;
+      }
+    }; /* bloom_filter */
+
+}} /* namespace */
+
+#endif /* BPLUS_BLOOM_H */
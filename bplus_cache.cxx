@@ -0,0 +1,456 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2019 Red Hat, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation. See file COPYING.
+ *
+ */
+
+#include "bplus_cache.h"
+
+#include <algorithm>
+
+namespace rgw { namespace bplus {
+
+    static inline size_t node_bytes(node_ptr node,
+				    uint32_t flags = FLAG_NONE) {
+      return std::visit([flags](auto n) { return n->footprint(flags); },
+			node);
+    }
+
+    /* an update-log delta iff the store can take one and still
+     * holds the node's last write */
+    std::vector<uint8_t> node_cache::writeback_bytes(entry* e, bool* delta,
+						     uint32_t flags)
+    {
+      bool can_delta = append && ! e->rewrite.load(std::memory_order_acquire);
+      auto bytes = std::visit(
+	[can_delta, delta, flags](auto n) {
+	  return n->writeback(can_delta, delta, flags);
+	}, e->node);
+      if (! *delta) {
+	e->rewrite.store(false, std::memory_order_release);
+      }
+      return bytes;
+    } /* writeback_bytes */
+
+    /* caller holds write_lock(name) (and not sh.mtx) */
+    int node_cache::write_out(shard& sh, const std::string& name,
+			      const std::vector<uint8_t>& bytes, bool delta)
+    {
+      int ret = delta ? append(name, bytes) : writeback(name, bytes);
+      if (likely(ret == 0)) {
+	lock_guard guard(sh.mtx);
+	++sh.st.writebacks;
+	sh.st.deltas += delta;
+	sh.st.written_bytes += bytes.size();
+      }
+      return ret;
+    } /* write_out */
+
+    node_cache::entry::~entry() {
+      std::visit([](auto n) { delete n; }, node);
+    }
+
+    node_cache::node_cache(size_t _capacity, uint32_t nshards)
+      : capacity(_capacity), shards(std::max(nshards, 1u))
+    {}
+
+    /* nodes still pinned (say, by a Tree whose static lifetime ends
+     * after ours) are leaked, not freed under their holders */
+    node_cache::~node_cache()
+    {
+      for (auto& sh : shards) {
+	for (auto& [name, e] : sh.map) {
+	  if (e->pins.load(std::memory_order_acquire) > 0) {
+	    e.release();
+	  }
+	}
+	for (auto& e : sh.graveyard) {
+	  if (e->pins.load(std::memory_order_acquire) > 0) {
+	    e.release();
+	  }
+	}
+      }
+    } /* ~node_cache */
+
+    /* caller holds sh.mtx */
+    void node_cache::link(shard& sh, uint32_t shard_ix,
+			  std::unique_ptr<entry>&& e)
+    {
+      e->shard_ix = shard_ix;
+      e->ring_ix = sh.ring.size();
+      sh.ring.push_back(e.get());
+      sh.bytes += e->bytes;
+      auto& name = e->name;
+      sh.map.emplace(name, std::move(e));
+    } /* link */
+
+    /* caller holds sh.mtx */
+    std::unique_ptr<node_cache::entry> node_cache::unlink(
+      shard& sh, const std::string& name)
+    {
+      auto it = sh.map.find(name);
+      if (it == sh.map.end()) {
+	return nullptr;
+      }
+      std::unique_ptr<entry> e = std::move(it->second);
+      sh.map.erase(it);
+      ++gen_of(sh, name);
+      entry* last = sh.ring.back();
+      sh.ring[e->ring_ix] = last;
+      last->ring_ix = e->ring_ix;
+      sh.ring.pop_back();
+      sh.bytes -= e->bytes;
+      return e;
+    } /* unlink */
+
+    /* CLOCK sweep until the shard is within its share of capacity,
+     * giving up after two turns of the hand;  caller holds sh.mtx,
+     * so no unpinned node can be pinned (or latched) meanwhile, and
+     * unpinned nodes are read unlatched;  a dirty victim is pinned
+     * and serialized, then written back with sh.mtx dropped */
+    void node_cache::evict(shard& sh, unique_lock& guard)
+    {
+      /* pins on removed nodes only drop */
+      sh.graveyard.erase(
+	std::remove_if(sh.graveyard.begin(), sh.graveyard.end(),
+		       [](const std::unique_ptr<entry>& e) {
+			 return e->pins.load(std::memory_order_acquire) == 0;
+		       }),
+	sh.graveyard.end());
+
+      size_t scan = 2 * sh.ring.size();
+      while ((scan-- > 0) && (! sh.ring.empty()) &&
+	     (sh.bytes > capacity.load(std::memory_order_relaxed) /
+	      shards.size())) {
+	if (sh.hand >= sh.ring.size()) {
+	  sh.hand = 0;
+	}
+	entry* e = sh.ring[sh.hand];
+	if (e->pins.load(std::memory_order_acquire) > 0) {
+	  ++sh.hand;
+	  continue;
+	}
+	/* nodes grow while pinned, so re-measure when the hand passes */
+	sh.bytes -= e->bytes;
+	e->bytes = node_bytes(e->node, FLAG_LOCKED);
+	sh.bytes += e->bytes;
+	if (e->referenced) {
+	  e->referenced = false;
+	  ++sh.hand;
+	  continue;
+	}
+	if (e->dirty.load(std::memory_order_acquire)) {
+	  if (! writeback) {
+	    ++sh.hand;
+	    continue;
+	  }
+	  /* a write to this name is in flight:  pass it by */
+	  std::string name = e->name;
+	  std::unique_lock<std::mutex> wlock(write_lock(name), std::try_to_lock);
+	  if (! wlock.owns_lock()) {
+	    ++sh.hand;
+	    continue;
+	  }
+	  /* serialize while nothing can pin it;  once we drop sh.mtx,
+	   * an update re-dirties it */
+	  ref r(e);
+	  bool delta;
+	  auto bytes = writeback_bytes(e, &delta, FLAG_LOCKED);
+	  e->dirty.store(false, std::memory_order_relaxed);
+	  guard.unlock();
+	  int ret = write_out(sh, name, bytes, delta);
+	  wlock.unlock();
+	  guard.lock();
+	  if (unlikely(ret != 0)) {
+	    e->rewrite.store(true, std::memory_order_release);
+	    e->dirty.store(true, std::memory_order_release);
+	    ++sh.hand;
+	    continue;
+	  }
+	  r.release();
+	  /* evict it now, unless it was used (or moved) meanwhile */
+	  auto it = sh.map.find(name);
+	  if ((it == sh.map.end()) || (it->second.get() != e) ||
+	      (e->pins.load(std::memory_order_acquire) > 0) ||
+	      e->referenced || e->dirty.load(std::memory_order_acquire)) {
+	    continue;
+	  }
+	}
+	/* the ring's last entry moves under the hand */
+	unlink(sh, e->name);
+	++sh.st.evictions;
+      }
+    } /* evict */
+
+    void node_cache::set_capacity(size_t bytes)
+    {
+      capacity.store(bytes, std::memory_order_relaxed);
+      for (auto& sh : shards) {
+	unique_lock guard(sh.mtx);
+	evict(sh, guard);
+      }
+    } /* set_capacity */
+
+    /* a miss is read outside the shard latch, and read again if the
+     * node was cached, and left, meanwhile */
+    node_cache::ref node_cache::get(const std::string& name, bool fill)
+    {
+      shard& sh = shards[shard_of(name)];
+      uint64_t gen;
+      {
+	lock_guard guard(sh.mtx);
+	auto it = sh.map.find(name);
+	if (likely(it != sh.map.end())) {
+	  it->second->referenced = true;
+	  ++sh.st.hits;
+	  return ref(it->second.get());
+	}
+	++sh.st.misses;
+	gen = gen_of(sh, name);
+      }
+      if (! (fill && fetch)) {
+	return ref();
+      }
+      for (;;) {
+	std::vector<uint8_t> bytes;
+	if (fetch(name, bytes) != 0) {
+	  return ref();
+	}
+	ref r = load(name, bytes, gen);
+	uint64_t now = generation(name);
+	if (likely(r || (now == gen))) {
+	  return r;
+	}
+	gen = now;
+      }
+    } /* get */
+
+    bool node_cache::contains(const std::string& name) const
+    {
+      const shard& sh = shards[shard_of(name)];
+      lock_guard guard(sh.mtx);
+      return sh.map.find(name) != sh.map.end();
+    } /* contains */
+
+    uint64_t node_cache::generation(const std::string& name)
+    {
+      shard& sh = shards[shard_of(name)];
+      lock_guard guard(sh.mtx);
+      return gen_of(sh, name);
+    } /* generation */
+
+    node_cache::ref node_cache::load(const std::string& name,
+				     const std::vector<uint8_t>& bytes,
+				     uint64_t gen)
+    {
+      node_ptr node = node_factory::from_object(bytes);
+      if (unlikely(std::visit([](auto n) { return n == nullptr; }, node))) {
+	return ref();
+      }
+      limit(node);
+      uint32_t ix = shard_of(name);
+      shard& sh = shards[ix];
+      auto e = std::make_unique<entry>(name, node);
+      e->bytes = node_bytes(node, FLAG_LOCKED);
+      unique_lock guard(sh.mtx);
+      /* a racing read of the same node may have won */
+      auto it = sh.map.find(name);
+      if (it != sh.map.end()) {
+	return ref(it->second.get());
+      }
+      /* or been changed, and written back, since we read ours */
+      if (unlikely(gen_of(sh, name) != gen)) {
+	return ref();
+      }
+      entry* ep = e.get();
+      link(sh, ix, std::move(e));
+      ref r(ep);
+      evict(sh, guard);
+      return r;
+    } /* load */
+
+    /* node is new, so no other thread can latch it (it is measured
+     * unlatched) */
+    node_cache::ref node_cache::put(const std::string& name, node_ptr node,
+				    bool dirty)
+    {
+      uint32_t ix = shard_of(name);
+      shard& sh = shards[ix];
+      limit(node);
+      auto e = std::make_unique<entry>(name, node);
+      e->bytes = node_bytes(node, FLAG_LOCKED);
+      e->dirty = dirty;
+      unique_lock guard(sh.mtx);
+      if (unlikely(sh.map.find(name) != sh.map.end())) {
+	/* caller keeps node */
+	e->node = static_cast<leaf_node*>(nullptr);
+	return ref();
+      }
+      entry* ep = e.get();
+      link(sh, ix, std::move(e));
+      ref r(ep);
+      evict(sh, guard);
+      return r;
+    } /* put */
+
+    /* store a batch of new nodes, unpinned, taking each shard latch
+     * once */
+    void node_cache::put(std::vector<std::pair<std::string, node_ptr>>& nodes,
+			 bool dirty)
+    {
+      std::vector<std::vector<std::unique_ptr<entry>>> by_shard(
+	shards.size());
+      for (auto& [name, node] : nodes) {
+	limit(node);
+	auto e = std::make_unique<entry>(name, node);
+	e->bytes = node_bytes(node, FLAG_LOCKED);
+	e->dirty = dirty;
+	by_shard[shard_of(name)].push_back(std::move(e));
+      }
+      for (uint32_t ix = 0; ix < shards.size(); ++ix) {
+	if (by_shard[ix].empty()) {
+	  continue;
+	}
+	shard& sh = shards[ix];
+	unique_lock guard(sh.mtx);
+	for (auto& e : by_shard[ix]) {
+	  if (unlikely(sh.map.find(e->name) != sh.map.end())) {
+	    e->node = static_cast<leaf_node*>(nullptr);
+	    continue;
+	  }
+	  link(sh, ix, std::move(e));
+	}
+	evict(sh, guard);
+      }
+    } /* put */
+
+    int node_cache::rename(const std::string& from, const std::string& to)
+    {
+      uint32_t fix = shard_of(from);
+      uint32_t tix = shard_of(to);
+      shard& fsh = shards[fix];
+      shard& tsh = shards[tix];
+      unique_lock flock(fsh.mtx, std::defer_lock);
+      unique_lock tlock(tsh.mtx, std::defer_lock);
+      if (fix == tix) {
+	flock.lock();
+      } else {
+	std::lock(flock, tlock);
+      }
+      if (tsh.map.find(to) != tsh.map.end()) {
+	return EEXIST;
+      }
+      auto e = unlink(fsh, from);
+      if (! e) {
+	return ENOENT;
+      }
+      e->name = to;
+      e->rewrite.store(true, std::memory_order_release);
+      link(tsh, tix, std::move(e));
+      return 0;
+    } /* rename */
+
+    int node_cache::remove(const std::string& name)
+    {
+      shard& sh = shards[shard_of(name)];
+      lock_guard guard(sh.mtx);
+      auto e = unlink(sh, name);
+      if (! e) {
+	return ENOENT;
+      }
+      if (e->pins.load(std::memory_order_acquire) > 0) {
+	sh.graveyard.push_back(std::move(e));
+      }
+      return 0;
+    } /* remove */
+
+    /* pinned nodes are written back too, so outside the shard latch
+     * (a writer may hold their node latch while waiting on it);  dirty
+     * is cleared first, so a concurrent update re-dirties the node
+     * rather than being lost;  written nodes are re-measured;  a node
+     * renamed before its write lock is taken is retried under its
+     * new name */
+    int node_cache::flush()
+    {
+      if (! writeback) {
+	return 0;
+      }
+      int ret{0};
+      for (bool again = true; again; ) {
+	again = false;
+	for (auto& sh : shards) {
+	  uint32_t shard_ix = &sh - shards.data();
+	  std::vector<std::pair<ref, std::string>> dirty;
+	  {
+	    lock_guard guard(sh.mtx);
+	    for (auto e : sh.ring) {
+	      if (e->dirty.load(std::memory_order_acquire)) {
+		dirty.emplace_back(ref(e), e->name);
+	      }
+	    }
+	  }
+	  std::vector<std::pair<entry*, size_t>> written;
+	  for (auto& [r, name] : dirty) {
+	    lock_guard wlock(write_lock(name));
+	    {
+	      lock_guard guard(sh.mtx);
+	      if ((r.e->shard_ix != shard_ix) || (r.e->name != name)) {
+		again = true;
+		continue;
+	      }
+	    }
+	    if (! r.e->dirty.exchange(false, std::memory_order_acq_rel)) {
+	      continue;
+	    }
+	    bool delta;
+	    auto bytes = writeback_bytes(r.e, &delta, FLAG_NONE);
+	    int wret = write_out(sh, name, bytes, delta);
+	    if (unlikely(wret != 0)) {
+	      r.e->rewrite.store(true, std::memory_order_release);
+	      r.e->dirty.store(true, std::memory_order_release);
+	      ret = ret ? ret : wret;
+	      continue;
+	    }
+	    written.emplace_back(r.e, node_bytes(r.e->node));
+	  }
+	  /* still pinned, by dirty */
+	  lock_guard guard(sh.mtx);
+	  for (auto& [e, bytes] : written) {
+	    if (e->shard_ix == shard_ix) {
+	      sh.bytes = sh.bytes - e->bytes + bytes;
+	      e->bytes = bytes;
+	    }
+	  }
+	}
+	if (ret != 0) {
+	  break;
+	}
+      }
+      return ret;
+    } /* flush */
+
+    node_cache::stats node_cache::get_stats() const
+    {
+      stats st;
+      for (auto& sh : shards) {
+	lock_guard guard(sh.mtx);
+	st.hits += sh.st.hits;
+	st.misses += sh.st.misses;
+	st.evictions += sh.st.evictions;
+	st.writebacks += sh.st.writebacks;
+	st.deltas += sh.st.deltas;
+	st.written_bytes += sh.st.written_bytes;
+	st.nodes += sh.map.size();
+	st.bytes += sh.bytes;
+      }
+      return st;
+    } /* get_stats */
+
+}} /* namespace */
@@ -0,0 +1,240 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2019 Red Hat, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation. See file COPYING.
+ *
+ */
+
+#ifndef BPLUS_CACHE_H
+#define BPLUS_CACHE_H
+
+#include "compat.h"
+#include "bplus_node.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <array>
+#include <optional>
+#include <functional>
+#include <unordered_map>
+
+namespace rgw { namespace bplus {
+
+    /* bounded node cache, keyed by node name:  the cache owns the
+     * nodes it holds;  a node may be latched or modified only while
+     * pinned (through a ref), and only unpinned nodes are evicted,
+     * dirty ones after being written back;  each shard has its own
+     * map and CLOCK ring */
+    class node_cache
+    {
+    public:
+      /* the backing store sees stored node objects (see
+       * frame_segment()):  writeback replaces one, append adds an
+       * update-log delta to one */
+      using writeback_func =
+	std::function<int(const std::string& name,
+			  const std::vector<uint8_t>& bytes)>;
+      using append_func = writeback_func;
+      using fetch_func =
+	std::function<int(const std::string& name,
+			  std::vector<uint8_t>& bytes)>;
+
+      struct stats {
+	uint64_t hits{0};
+	uint64_t misses{0};
+	uint64_t evictions{0};
+	uint64_t writebacks{0};
+	uint64_t deltas{0}; // writebacks that were appends
+	uint64_t written_bytes{0};
+	uint64_t nodes{0};
+	uint64_t bytes{0};
+      };
+
+    private:
+      struct entry {
+	std::string name;
+	node_ptr node;
+	std::atomic<uint32_t> pins{0};
+	std::atomic<bool> dirty{false};
+	/* the stored object can't be appended to (a write failed) */
+	std::atomic<bool> rewrite{false};
+	bool referenced{true};
+	size_t bytes{0};
+	size_t ring_ix{0};
+	uint32_t shard_ix{0};
+
+	entry(const std::string& _name, node_ptr _node)
+	  : name(_name), node(_node) {}
+	~entry();
+      }; /* entry */
+
+    public:
+      /* a pin on a cached node;  copies add pins, destruction drops
+       * them */
+      class ref
+      {
+	entry* e{nullptr};
+
+	friend class node_cache;
+	explicit ref(entry* _e) : e(_e) {
+	  e->pins.fetch_add(1, std::memory_order_relaxed);
+	}
+
+      public:
+	ref() {}
+	ref(const ref& rhs) : e(rhs.e) {
+	  if (e) {
+	    e->pins.fetch_add(1, std::memory_order_relaxed);
+	  }
+	}
+	ref(ref&& rhs) : e(rhs.e) {
+	  rhs.e = nullptr;
+	}
+	ref& operator=(ref rhs) {
+	  std::swap(e, rhs.e);
+	  return *this;
+	}
+	~ref() {
+	  release();
+	}
+
+	void release() {
+	  if (e) {
+	    e->pins.fetch_sub(1, std::memory_order_release);
+	    e = nullptr;
+	  }
+	}
+
+	explicit operator bool() const { return e != nullptr; }
+	node_ptr get() const { return e->node; }
+
+	template <typename N>
+	N* as() const { return std::get<N*>(e->node); }
+
+	/* node was modified, and must be written back before eviction;
+	 * true if it was clean */
+	bool dirty() const {
+	  return ! e->dirty.exchange(true, std::memory_order_acq_rel);
+	}
+      }; /* ref */
+
+    private:
+      /* a name's generation, taken before its node is fetched, moves
+       * once the node leaves the cache (evicted, renamed or removed),
+       * after which the store may hold newer bytes than were fetched;
+       * names share n_gens counters per shard, so a fetch is now and
+       * then retried needlessly */
+      static constexpr uint32_t n_gens = 64;
+
+      struct shard {
+	mutable std::mutex mtx;
+	std::unordered_map<std::string, std::unique_ptr<entry>> map;
+	std::vector<entry*> ring; // CLOCK order
+	size_t hand{0};
+	/* removed from map, freed once unpinned */
+	std::vector<std::unique_ptr<entry>> graveyard;
+	size_t bytes{0};
+	stats st;
+	std::array<uint64_t, n_gens> gens{};
+      }; /* shard */
+
+      std::atomic<size_t> capacity; // bytes, across all shards
+      std::vector<shard> shards;
+      writeback_func writeback;
+      append_func append;
+      fetch_func fetch;
+      size_t node_max_bytes{0};
+
+      /* writes to one name are serialized, so that they land in the
+       * order their bytes were taken (appends must follow the write
+       * they extend, and a renamed node's last write must precede
+       * its successor's first) */
+      static constexpr uint32_t n_write_locks = 64;
+      std::array<std::mutex, n_write_locks> write_locks;
+
+      uint32_t shard_of(const std::string& name) const {
+	return std::hash<std::string>{}(name) % shards.size();
+      }
+
+      std::mutex& write_lock(const std::string& name) {
+	return write_locks[std::hash<std::string>{}(name) % n_write_locks];
+      }
+
+      /* caller holds sh.mtx */
+      uint64_t& gen_of(shard& sh, const std::string& name) {
+	return sh.gens[(std::hash<std::string>{}(name) / shards.size()) %
+		       n_gens];
+      }
+
+      std::vector<uint8_t> writeback_bytes(entry* e, bool* delta,
+					   uint32_t flags);
+      int write_out(shard& sh, const std::string& name,
+		    const std::vector<uint8_t>& bytes, bool delta);
+      void link(shard& sh, uint32_t shard_ix, std::unique_ptr<entry>&& e);
+      /* a node entering the cache is new, so unlatched */
+      void limit(node_ptr node) const {
+	std::visit([this](auto n) {
+	  n->set_max_bytes(node_max_bytes, FLAG_LOCKED);
+	}, node);
+      }
+      std::unique_ptr<entry> unlink(shard& sh, const std::string& name);
+      void evict(shard& sh, unique_lock& guard);
+
+    public:
+      node_cache(size_t _capacity, uint32_t nshards);
+      ~node_cache();
+
+      /* backing store hooks, set before the cache is shared:  without
+       * writeback, dirty nodes stay resident;  without fetch, a miss
+       * is a miss;  both return 0 or an errno */
+      void set_writeback(writeback_func wb) { writeback = wb; }
+      /* without append, every writeback is a whole node */
+      void set_append(append_func a) { append = a; }
+      void set_fetch(fetch_func f) { fetch = f; }
+      /* nodes put or loaded are split before they pass bytes
+       * serialized (see Node::set_max_bytes()), 0 for no limit */
+      void set_node_max_bytes(size_t bytes) { node_max_bytes = bytes; }
+      size_t get_node_max_bytes() const { return node_max_bytes; }
+
+      /* shrinking evicts down to the new capacity */
+      void set_capacity(size_t bytes);
+
+      /* the node, pinned;  a miss is fetched iff fill */
+      ref get(const std::string& name, bool fill = true);
+      bool contains(const std::string& name) const;
+      /* name's generation, to take before reading its node from the
+       * store and pass to load() with the bytes read */
+      uint64_t generation(const std::string& name);
+      /* cache (clean) a node read from the store--or, if one is
+       * already cached under name, that one;  none if the bytes are
+       * corrupt, or stale (the node left the cache since gen was
+       * taken, maybe to be written back) */
+      ref load(const std::string& name, const std::vector<uint8_t>& bytes,
+	       uint64_t gen);
+      /* add a new node under an unused name */
+      ref put(const std::string& name, node_ptr node, bool dirty = true);
+      void put(std::vector<std::pair<std::string, node_ptr>>& nodes,
+	       bool dirty = true);
+      /* move a node (and its pins) to an unused name;  its next
+       * writeback is whole */
+      int rename(const std::string& from, const std::string& to);
+      /* drop a node, without writing it back;  freed once unpinned */
+      int remove(const std::string& name);
+      /* write back every dirty node */
+      int flush();
+
+      stats get_stats() const;
+    }; /* node_cache */
+
+}} /* namespace */
+
+#endif /* BPLUS_CACHE_H */
@@ -17,25 +17,206 @@
 
 namespace rgw { namespace bplus {
 
-    IO::IO()
-      : mt(nullptr)
-    {
-      /* seed sequence taken verbatim from
-       * https://www.guyrutenberg.com/2014/05/03/c-mt19937-example/
-       */
-      std::array<int, 624> seed_data;
-      std::random_device r;
-      std::generate_n(seed_data.data(), seed_data.size(), std::ref(r));
-      std::seed_seq seq(std::begin(seed_data), std::end(seed_data));
-      mt = new std::mt19937(seq);
+    IO::IO(size_t cache_bytes, uint32_t cache_shards)
+      : cache(cache_bytes, cache_shards)
+    {}
+
+    /* prefetches in flight reference the cache */
+    IO::~IO()
+    {
+      if (store) {
+	store->drain();
+      }
     }
 
+    /* each thread's generator, seeded on first use */
+    static std::mt19937& thread_mt()
+    {
+      thread_local std::mt19937 mt = []() {
+	/* seed sequence taken verbatim from
+	 * https://www.guyrutenberg.com/2014/05/03/c-mt19937-example/
+	 */
+	std::array<int, 624> seed_data;
+	std::random_device r;
+	std::generate_n(seed_data.data(), seed_data.size(), std::ref(r));
+	std::seed_seq seq(std::begin(seed_data), std::end(seed_data));
+	return std::mt19937(seq);
+      }();
+      return mt;
+    } /* thread_mt */
+
     std::string IO::random_bytes(int cnt)
     {
       std::string s(cnt, ' ');
-      std::generate(std::begin(s), std::end(s), std::ref(*mt));
-      return std::move(s);
+      std::generate(std::begin(s), std::end(s), std::ref(thread_mt()));
+      return s;
     } /* random_bytes */
 
+    /* splitmix64's finalizer:  a bijection on 64-bit words */
+    static inline uint64_t mix64(uint64_t x)
+    {
+      x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+      return x ^ (x >> 31);
+    } /* mix64 */
+
+    node_id IO::next_node_id()
+    {
+      struct id_state {
+	uint64_t salt_hi;
+	uint64_t salt_lo;
+	uint64_t count{0};
+	id_state() {
+	  std::random_device r;
+	  salt_hi = (uint64_t(r()) << 32) | r();
+	  salt_lo = (uint64_t(r()) << 32) | r();
+	}
+      };
+      thread_local id_state st;
+      return node_id{st.salt_hi, mix64(st.salt_lo + st.count++)};
+    } /* next_node_id */
+
+    void IO::set_store(std::shared_ptr<object_store> _store)
+    {
+      store = _store;
+      if (! store) {
+	cache.set_writeback(nullptr);
+	cache.set_append(nullptr);
+	cache.set_fetch(nullptr);
+	cache.set_node_max_bytes(0);
+	return;
+      }
+      cache.set_node_max_bytes(store->capacity());
+      cache.set_writeback(
+	[st = store](const std::string& name,
+		     const std::vector<uint8_t>& bytes) -> int {
+	  return st->write(name, bytes);
+	});
+      if (store->appends()) {
+	cache.set_append(
+	  [st = store](const std::string& name,
+		       const std::vector<uint8_t>& bytes) -> int {
+	    return st->append(name, bytes);
+	  });
+      } else {
+	cache.set_append(nullptr);
+      }
+      cache.set_fetch(
+	[st = store](const std::string& name,
+		     std::vector<uint8_t>& bytes) -> int {
+	  return st->read(name, bytes);
+	});
+    } /* set_store */
+
+    node_cache::ref IO::get_node(const std::string& name)
+    {
+      return cache.get(name);
+    } /* get_node */
+
+    std::vector<node_cache::ref> IO::get_nodes(
+      const std::vector<std::string>& names)
+    {
+      std::vector<node_cache::ref> refs(names.size());
+      std::vector<std::string> miss_names;
+      std::vector<size_t> miss_ix;
+      std::vector<uint64_t> miss_gens;
+      for (size_t ix = 0; ix < names.size(); ++ix) {
+	refs[ix] = cache.get(names[ix], false /* fill */);
+	if (! refs[ix]) {
+	  miss_names.push_back(names[ix]);
+	  miss_ix.push_back(ix);
+	  miss_gens.push_back(cache.generation(names[ix]));
+	}
+      }
+      if (miss_names.empty() || ! store) {
+	return refs;
+      }
+      std::vector<std::vector<uint8_t>> bytes;
+      std::vector<int> rets;
+      (void) store->read_batch(miss_names, bytes, rets);
+      for (size_t ix = 0; ix < miss_names.size(); ++ix) {
+	if (rets[ix] == 0) {
+	  refs[miss_ix[ix]] =
+	    cache.load(miss_names[ix], bytes[ix], miss_gens[ix]);
+	  if (unlikely(! refs[miss_ix[ix]])) {
+	    /* stale (or corrupt):  read it again, alone */
+	    refs[miss_ix[ix]] = cache.get(miss_names[ix]);
+	  }
+	}
+      }
+      return refs;
+    } /* get_nodes */
+
+    void IO::prefetch(const std::vector<std::string>& names)
+    {
+      if (! store) {
+	return;
+      }
+      for (const auto& name : names) {
+	if (cache.contains(name)) {
+	  continue;
+	}
+	uint64_t gen = cache.generation(name);
+	store->aio_read(
+	  name,
+	  [this, name, gen](int ret, std::vector<uint8_t>&& bytes) {
+	    if (ret == 0) {
+	      cache.load(name, bytes, gen); // unpinned at once
+	    }
+	  });
+      }
+    } /* prefetch */
+
+    std::unique_ptr<node_view> IO::view_node(const std::string& name)
+    {
+      if (! store) {
+	return nullptr;
+      }
+      static const object_store::verify_func verify =
+	[](const uint8_t* data, size_t size) {
+	  return node_factory::verify_object(data, size);
+	};
+      size_t size;
+      const uint8_t* data = store->map(name, &size, verify);
+      if (! data) {
+	return nullptr;
+      }
+      /* verified when first mapped */
+      return node_factory::view_object(data, size, false);
+    } /* view_node */
+
+    node_cache::ref IO::put_node(const std::string& name, node_ptr node)
+    {
+      return cache.put(name, node);
+    } /* put_node */
+
+    /* store a batch of nodes, taking each cache shard latch once */
+    void IO::put_nodes(std::vector<std::pair<std::string, node_ptr>>& nodes)
+    {
+      cache.put(nodes);
+    } /* put_nodes */
+
+    int IO::rename_node(const std::string& from, const std::string& to)
+    {
+      return cache.rename(from, to);
+    } /* rename_node */
+
+    int IO::remove_node(const std::string& name)
+    {
+      int ret = cache.remove(name);
+      if (store) {
+	int sret = store->remove(name);
+	if ((ret == ENOENT) && (sret != ENOENT)) {
+	  ret = sret;
+	}
+      }
+      return ret;
+    } /* remove_node */
+
+    int IO::sync()
+    {
+      return cache.flush();
+    } /* sync */
+
     IO io;
 }} /* namespace */
@@ -15,25 +15,72 @@
 #define BPLUS_IO_H
 
 #include <string>
-#include <map>
+#include <vector>
+#include <utility>
+#include <mutex>
+#include <optional>
 #include <iostream>
 #include <random>
+#include <memory>
 #include "bplus_node.h" // uses bplus::Node in the interface
+#include "bplus_cache.h"
+#include "bplus_store.h"
 
 namespace rgw { namespace bplus {
 
+    /* 128 bits naming a node */
+    struct node_id {
+      uint64_t hi;
+      uint64_t lo;
+    };
+
     class IO
     {
     private:
-      std::mt19937* mt;
-      std::map<std::string, node_ptr> node_cache;
+      std::shared_ptr<object_store> store;
 
     public:
-      IO(void);
+      static constexpr size_t default_cache_bytes = size_t(1) << 30;
+      static constexpr uint32_t default_cache_shards = 16;
+
+      node_cache cache;
 
+      IO(size_t cache_bytes = default_cache_bytes,
+	 uint32_t cache_shards = default_cache_shards);
+      ~IO();
+
+      /* from a per-thread generator:  no lock is taken */
       std::string random_bytes(int cnt);
+      /* a new, unique node id, without a lock:  each thread draws two
+       * random words once, then counts;  hi is the first, lo the count
+       * offset by the second through a bijective mix, so a thread never
+       * repeats an id, and ids look uniformly random (which placement
+       * by hash relies on) */
+      static node_id next_node_id();
+
+      /* where nodes are written back to and read from;  set before
+       * use (without one, nodes live only in the cache) */
+      void set_store(std::shared_ptr<object_store> _store);
+      object_store* get_store() const { return store.get(); }
 
-      /* api */
+      /* api:  nodes are returned pinned */
+      node_cache::ref get_node(const std::string& name);
+      /* misses are read concurrently;  a node that can't be read
+       * yields an empty ref */
+      std::vector<node_cache::ref> get_nodes(
+	const std::vector<std::string>& names);
+      /* start reading any of names not cached, without waiting */
+      void prefetch(const std::vector<std::string>& names);
+      /* a read-only view of a node in place, where the store maps
+       * objects (else null);  not cached, so not reflecting any
+       * cached copy of it */
+      std::unique_ptr<node_view> view_node(const std::string& name);
+      node_cache::ref put_node(const std::string& name, node_ptr node);
+      void put_nodes(std::vector<std::pair<std::string, node_ptr>>& nodes);
+      int rename_node(const std::string& from, const std::string& to);
+      int remove_node(const std::string& name);
+      /* write back every dirty node */
+      int sync();
 
     }; /* IO */
     
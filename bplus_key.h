@@ -24,8 +24,13 @@
 #include <functional>
 #include <utility>
 #include <limits>
+#include <optional>
 #include <variant>
 #include <iostream>
+#include <cstring>
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 #include <boost/blank.hpp>
 #include <boost/algorithm/string.hpp>
 
@@ -39,24 +44,56 @@ namespace rgw::bplus {
 
   static constexpr std::string_view nullstr{""};
 
+  /* index of the first byte at which l and r differ, or n;  AVX2 or
+   * SSE2 when the target has them, else word-at-a-time */
+  static inline size_t mismatch(const char* l, const char* r, size_t n) {
+    size_t ix{0};
+#if defined(__AVX2__)
+    for (; ix + 32 <= n; ix += 32) {
+      __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(l + ix));
+      __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r + ix));
+      uint32_t ne = ~uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)));
+      if (ne) {
+	return ix + __builtin_ctz(ne);
+      }
+    }
+#endif
+#if defined(__SSE2__)
+    for (; ix + 16 <= n; ix += 16) {
+      __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l + ix));
+      __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + ix));
+      uint32_t ne = ~uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b))) & 0xffff;
+      if (ne) {
+	return ix + __builtin_ctz(ne);
+      }
+    }
+#endif
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; ix + 8 <= n; ix += 8) {
+      uint64_t a, b;
+      std::memcpy(&a, l + ix, 8);
+      std::memcpy(&b, r + ix, 8);
+      if (a != b) {
+	return ix + (__builtin_ctzll(a ^ b) >> 3);
+      }
+    }
+#endif
+    for (; ix < n; ++ix) {
+      if (l[ix] != r[ix]) {
+	break;
+      }
+    }
+    return ix;
+  } /* mismatch */
+
   static inline std::string common_prefix(
     const std::string& lhs, const std::string& rhs,
     uint16_t min_len) {
-    std::array<const std::string*, 2> sv = {&lhs, &rhs};
-    if (lhs.length() > rhs.length()) {
-      std::swap(sv[0], sv[1]);
-    }
-    uint16_t cnt{0};
-    min_len = std::min(min_len, std::numeric_limits<uint16_t>::max());
-    for (int ix = 0; ix < lhs.length(); ++ix) {
-      if ((*sv[0])[ix] == (*sv[1])[ix])
-	++cnt;
-      else
-	break;
-    }
+    auto cnt = mismatch(lhs.data(), rhs.data(),
+			std::min(lhs.length(), rhs.length()));
     std::string s;
     if (cnt > min_len) {
-      s = (*sv[0]).substr(0, cnt);
+      s = lhs.substr(0, cnt);
     }
     return s;
   } /* common_prefix */
@@ -85,27 +122,56 @@ namespace rgw::bplus {
     return os;
   } /* pretty-print sv_tuple */
 
-  static inline bool less_than(const sv_tuple& lhs, const sv_tuple& rhs)
+  /* length of the common prefix of two split keys, walking the
+   * (at most three) runs in which both sides are contiguous */
+  static inline size_t common_prefix_len(
+    const sv_tuple& lhs, const sv_tuple& rhs) {
+    std::string_view ls = get<0>(lhs), rs = get<0>(rhs);
+    bool lh = false, rh = false; /* on the second half */
+    size_t off{0};
+    for (;;) {
+      if (ls.empty()) {
+	if (lh || get<1>(lhs).empty()) {
+	  break;
+	}
+	ls = get<1>(lhs);
+	lh = true;
+      }
+      if (rs.empty()) {
+	if (rh || get<1>(rhs).empty()) {
+	  break;
+	}
+	rs = get<1>(rhs);
+	rh = true;
+      }
+      auto n = std::min(ls.length(), rs.length());
+      auto ix = mismatch(ls.data(), rs.data(), n);
+      off += ix;
+      if (ix < n) {
+	break;
+      }
+      ls.remove_prefix(n);
+      rs.remove_prefix(n);
+    }
+    return off;
+  } /* common_prefix_len */
+
+  /* three-way comparison of logical sequences, bytes unsigned (as
+   * memcmp and std::string) */
+  static inline int compare(const sv_tuple& lhs, const sv_tuple& rhs)
   {
     const auto lhs_len = len(lhs);
     const auto rhs_len = len(rhs);
-    auto max = std::min(lhs_len, rhs_len);
-    bool ident = true;
-    for (decltype(max) ix = 0; ix < max; ++ix) {
-      if (ident) {
-	auto c1 = at(lhs, ix);
-	auto c2 = at(rhs, ix);
-	if (c1 != c2) {
-	  ident = false;
-	  if (c1 > c2)
-	    return false;
-	}
-      }
-    } /* for ix */
-    if (ident && (lhs_len >= rhs_len)) {
-      return false;
+    auto ix = common_prefix_len(lhs, rhs);
+    if (ix == std::min(lhs_len, rhs_len)) {
+      return (lhs_len < rhs_len) ? -1 : (lhs_len > rhs_len);
     }
-    return true;
+    return int(uint8_t(at(lhs, ix))) - int(uint8_t(at(rhs, ix)));
+  } /* compare(sv_tuple, sv_tuple) */
+
+  static inline bool less_than(const sv_tuple& lhs, const sv_tuple& rhs)
+  {
+    return compare(lhs, rhs) < 0;
   } /* less_than(sv_tuple, sv_tuple) */
 
   class leaf_key
@@ -127,6 +193,9 @@ namespace rgw::bplus {
     leaf_key(uint16_t _prefix, const std::string& _stem)
       : prefix(_prefix), stem(_stem) {}
 
+    leaf_key(uint16_t _prefix, std::string&& _stem)
+      : prefix(_prefix), stem(std::move(_stem)) {}
+
     std::tuple<const std::string_view, const std::string_view>
     tie_prefix(const prefix_vector& pv) const {
       if (prefix) {
@@ -241,12 +310,11 @@ namespace rgw::bplus {
      * all leaf_keys are prefix-compressed */
     auto ltied = lk.tie_prefix(pv);
     auto rtied = rk.tie_prefix(pv);
-    bool res{false};
+    if (len(ltied) != len(rtied))
+      return false;
     if (get<0>(ltied).length() == get<0>(rtied).length())
-      res = (ltied == rtied);
-    else
-      res = (lk.to_string(pv) == rk.to_string(pv));
-    return (res);
+      return (ltied == rtied);
+    return (common_prefix_len(ltied, rtied) == len(ltied));
   }
 
   static inline bool equal_to(
@@ -267,35 +335,234 @@ namespace rgw::bplus {
     return (res);
   }
 
-  /* make prefix keys */
+  static inline sv_tuple tie_prefix(
+    const prefix_vector& pv, const leaf_key& k) {
+    return k.tie_prefix(pv);
+  }
+
+  static inline sv_tuple tie_prefix(
+    const prefix_vector& pv, const fence_key& k) {
+    if (k.unbounded()) {
+      return std::tie(nullstr, nullstr);
+    }
+    return k.as_leaf_key().tie_prefix(pv);
+  }
+
+  /* true iff the logical sequence of tp begins with prefix */
+  static inline bool starts_with(
+    const sv_tuple& tp, const std::string_view prefix) {
+    const auto& lhs = get<0>(tp);
+    const auto& rhs = get<1>(tp);
+    if (len(tp) < prefix.length()) {
+      return false;
+    }
+    if (prefix.length() <= lhs.length()) {
+      return (lhs.compare(0, prefix.length(), prefix) == 0);
+    }
+    return ((prefix.compare(0, lhs.length(), lhs) == 0) &&
+	    (rhs.compare(0, prefix.length() - lhs.length(),
+			 prefix.substr(lhs.length())) == 0));
+  } /* starts_with */
+
+  /* bytes a string holds outside itself (none while it fits the
+   * small-string buffer) */
+  static inline size_t heap_bytes(const std::string& s) {
+    static const size_t sso_cap = std::string().capacity();
+    return (s.capacity() > sso_cap) ? s.capacity() + 1 : 0;
+  }
+
+  static inline size_t heap_bytes(const leaf_key& k) {
+    size_t bytes = heap_bytes(k.stem);
+    if (k.prefix && std::holds_alternative<std::string>(*k.prefix)) {
+      bytes += heap_bytes(get<std::string>(*k.prefix));
+    }
+    return bytes;
+  }
+
+  static inline size_t heap_bytes(const fence_key& k) {
+    return k.unbounded() ? 0 : heap_bytes(k.as_leaf_key());
+  }
+
+  /* expand a (possibly prefix-compressed) key to its logical
+   * sequence, so it can be moved to a node with a different pv */
+  static inline leaf_key expand_key(
+    const prefix_vector& pv, const leaf_key& k) {
+    if (! k.prefix) {
+      return k;
+    }
+    return leaf_key(k.to_string(pv));
+  } /* expand_key(leaf_key) */
+
+  static inline fence_key expand_key(
+    const prefix_vector& pv, const fence_key& k) {
+    if (k.unbounded()) {
+      return k;
+    }
+    return fence_key(expand_key(pv, k.as_leaf_key()));
+  } /* expand_key(fence_key) */
+
+  /* logical key sequence;  an unbounded fence has none */
+  static inline std::string to_string(
+    const prefix_vector& pv, const leaf_key& k) {
+    return k.to_string(pv);
+  }
+
+  static inline std::string to_string(
+    const prefix_vector& pv, const fence_key& k) {
+    if (k.unbounded()) {
+      return std::string{};
+    }
+    return k.as_leaf_key().to_string(pv);
+  }
+
+  /* the first n bytes of a split key */
+  static inline std::string head(const sv_tuple& tp, size_t n) {
+    const auto& l = get<0>(tp);
+    std::string s;
+    s.reserve(n);
+    s.append(l.substr(0, n));
+    if (n > l.length()) {
+      s.append(get<1>(tp).substr(0, n - l.length()));
+    }
+    return s;
+  } /* head */
+
+  /* the bytes of a split key from off on */
+  static inline std::string tail(const sv_tuple& tp, size_t off) {
+    const auto& l = get<0>(tp);
+    if (off >= l.length()) {
+      return std::string(get<1>(tp).substr(off - l.length()));
+    }
+    std::string s;
+    s.reserve(len(tp) - off);
+    s.append(l.substr(off));
+    s.append(get<1>(tp));
+    return s;
+  } /* tail */
+
+  /* the first n bytes of a split key, as views */
+  static inline sv_tuple head_view(const sv_tuple& tp, size_t n) {
+    const auto& l = get<0>(tp);
+    if (n <= l.length()) {
+      return sv_tuple(l.substr(0, n), nullstr);
+    }
+    return sv_tuple(l, get<1>(tp).substr(0, n - l.length()));
+  } /* head_view */
+
+  /* offset of the first d in a split key at or after pos (d may
+   * straddle the split), or npos */
+  static inline size_t find(const sv_tuple& tp, const std::string_view& d,
+			    size_t pos) {
+    const auto& l = get<0>(tp);
+    const auto& r = get<1>(tp);
+    if (pos < l.length()) {
+      auto off = l.find(d, pos);
+      if (off != std::string_view::npos) {
+	return off;
+      }
+      size_t ix = l.length() - std::min(l.length(), d.length() - 1);
+      for (ix = std::max(ix, pos); ix < l.length(); ++ix) {
+	size_t n = l.length() - ix;
+	if ((l.compare(ix, n, d.substr(0, n)) == 0) &&
+	    (r.compare(0, d.length() - n, d.substr(n)) == 0)) {
+	  return ix;
+	}
+      }
+      pos = l.length();
+    }
+    auto off = r.find(d, pos - l.length());
+    return (off == std::string_view::npos) ? off : off + l.length();
+  } /* find */
+
+  /* the least key greater than every key starting with p;  none iff
+   * p is all 0xff */
+  static inline std::optional<std::string> prefix_successor(std::string p) {
+    while (! p.empty()) {
+      if (uint8_t(p.back()) != 0xff) {
+	p.back() = char(uint8_t(p.back()) + 1);
+	return p;
+      }
+      p.pop_back();
+    }
+    return std::nullopt;
+  } /* prefix_successor */
+
+  /* offset in pv of a prefix equal to the first plen bytes of tp,
+   * or pv.size();  a node's newest prefixes are the likeliest, so
+   * search from the back */
+  static inline size_t find_prefix(
+    const prefix_vector& pv, const sv_tuple& tp, size_t plen) {
+    for (size_t ix = pv.size(); ix-- > 0; ) {
+      const auto& p = pv[ix];
+      if ((p.length() == plen) &&
+	  (common_prefix_len(tp, sv_tuple(p, nullstr)) == plen)) {
+	return ix;
+      }
+    }
+    return pv.size();
+  } /* find_prefix */
+
+  /* the pv-offset prefix of a key, if it has one */
+  static inline uint16_t* pv_offset(leaf_key& k) {
+    if (k.prefix && std::holds_alternative<uint16_t>(*k.prefix)) {
+      return &get<uint16_t>(*k.prefix);
+    }
+    return nullptr;
+  }
+
+  static inline uint16_t* pv_offset(fence_key& k) {
+    if (k.unbounded()) {
+      return nullptr;
+    }
+    return pv_offset(get<leaf_key>(k.k));
+  }
+
+  static inline const uint16_t* pv_offset(const leaf_key& k) {
+    return pv_offset(const_cast<leaf_key&>(k));
+  }
+
+  static inline const uint16_t* pv_offset(const fence_key& k) {
+    return pv_offset(const_cast<fence_key&>(k));
+  }
+
+  /* make prefix keys:  prefix k against prevk, its predecessor,
+   * comparing them in place;  a new prefix is added to pv only if
+   * no equal one is there already */
   static inline std::optional<leaf_key> make_prefix_key(
     prefix_vector& pv, const leaf_key& k, const leaf_key& prevk,
     uint16_t min_len) {
-    std::optional<leaf_key> res{};
-    uint16_t pref_off{0};
-    auto kstr = k.to_string(pv); // XXXX costly, wasteful
-    /* case 1: carry forward existing prefix */
-    if (prevk.prefix) {
-      if(std::holds_alternative<uint16_t>(*prevk.prefix)) {
-	pref_off = get<uint16_t>(*prevk.prefix);
-	auto& prefstr = pv[pref_off];
-	if (ba::starts_with(kstr, prefstr)) {
-	  res = leaf_key(pref_off, kstr.substr(prefstr.length()));
-	}
+    auto tk = k.tie_prefix(pv);
+    auto cp = common_prefix_len(tk, prevk.tie_prefix(pv));
+    size_t pref_off{0};
+    size_t plen{0};
+    /* case 1: carry forward existing prefix (k shares all of it
+     * with prevk) */
+    if (prevk.prefix && std::holds_alternative<uint16_t>(*prevk.prefix)) {
+      pref_off = get<uint16_t>(*prevk.prefix);
+      if (cp >= pv[pref_off].length()) {
+	plen = pv[pref_off].length();
       }
     }
-    /* case 2: unprefixed prefk shares a common prefix with k */
-    auto cp = common_prefix(kstr, prevk.to_string(pv), min_len);
-    if (cp.length() > 0) {
-      if ((! res) ||
-	  /* case 3: prefk is prefixed, k and prefk share a common
-	   * prefix longer than prefk's prefix */
-	  (cp.length() > pv[pref_off].length())) {
-	pv.push_back(cp);
-	res = leaf_key(pv.size()-1, kstr.substr(cp.length()));
+    /* case 2: unprefixed prefk shares a common prefix with k, or
+     * case 3: prefk is prefixed, k and prefk share a common prefix
+     * longer than prefk's prefix */
+    if ((cp > min_len) && (cp > plen) &&
+	(cp <= std::numeric_limits<uint16_t>::max())) {
+      auto off = find_prefix(pv, tk, cp);
+      if (off < pv.size()) {
+	pref_off = off;
+	plen = cp;
+      } else if (pv.size() < std::numeric_limits<uint16_t>::max()) {
+	/* tk may view into pv, which can move */
+	auto stem = tail(tk, cp);
+	pv.push_back(head(tk, cp));
+	return leaf_key(uint16_t(pv.size() - 1), std::move(stem));
       }
     }
-    return res;
+    if (plen == 0) {
+      return {};
+    }
+    return leaf_key(uint16_t(pref_off), tail(tk, plen));
   } /* make_prefix_key(leaf_key) */
 
   static inline std::optional<fence_key> make_prefix_key(
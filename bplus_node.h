@@ -16,16 +16,24 @@
 
 #include "compat.h"
 #include "bplus_key.h"
+#include "bplus_bloom.h"
+#include "rgw_cksum.h"
 #include <stdint.h>
+#include <endian.h>
+#include <cstring>
 #include <string>
 #include <string_view>
 #include <array>
 #include <vector>
 #include <iterator>
+#include <atomic>
 #include <mutex>
+#include <shared_mutex>
 #include <limits>
 #include <functional>
+#include <memory>
 #include <utility>
+#include <type_traits>
 #include <boost/variant.hpp>
 #include <boost/blank.hpp>
 #include <boost/algorithm/string.hpp>
@@ -41,6 +49,11 @@ namespace rgw { namespace bplus {
     using lock_guard = std::lock_guard<std::mutex>;
     using unique_lock = std::unique_lock<std::mutex>;
 
+    /* node latches:  shared for readers, exclusive for writers */
+    using latch_type = std::shared_mutex;
+    using excl_latch = std::unique_lock<latch_type>;
+    using shared_latch = std::shared_lock<latch_type>;
+
     static constexpr uint32_t ondisk_version = 1;
 
     static constexpr uint32_t FLAG_NONE = 0x0000;
@@ -48,12 +61,117 @@ namespace rgw { namespace bplus {
     static constexpr uint32_t FLAG_LOCKED = 0x0002;
     static constexpr uint32_t FLAG_STOP = 0x0004;
 
+    /* delimited listing callback:  key, value, and whether the key is
+     * a common prefix (with an empty value) */
+    using delim_list_cb =
+      std::function<int(const sv_tuple&, const std::string_view&, bool)>;
+
     enum class NodeType : uint8_t
     {
       Leaf,
       Branch,
     };
 
+    /* update-log record types */
+    enum class LogOp : uint8_t
+    {
+      Insert = 1,
+      Remove,
+    };
+
+    /* a node's update log is folded into a whole-node write once a
+     * delta would take it past either limit */
+    static constexpr uint32_t log_max_records = 64;
+    static constexpr size_t log_max_bytes = 16 * 1024;
+
+    /* a stored node object is a sequence of segments, each preceded
+     * by its length (4 bytes, little-endian):  the whole node, then
+     * any update-log deltas appended since */
+    static inline std::vector<uint8_t> frame_segment(
+      const std::vector<uint8_t>& seg) {
+      std::vector<uint8_t> framed(4 + seg.size());
+      uint32_t len = seg.size();
+      for (int ix = 0; ix < 4; ++ix) {
+	framed[ix] = uint8_t(len >> (8 * ix));
+      }
+      std::copy(seg.begin(), seg.end(), framed.begin() + 4);
+      return framed;
+    } /* frame_segment */
+
+    /* new nodes' checksum type, unless their tree says otherwise:
+     * a node is hashed a field at a time, and XXH64 leads on such
+     * short updates (see tblake) */
+    static constexpr cksum::CksumType default_cksum = cksum::CksumType::xxh64;
+
+    /* running digest of a node's logical content, in serialized
+     * order:  each field length-prefixed, so boundaries count */
+    class node_cksum
+    {
+      cksum::CksumType type;
+      cksum::DigestVariant dv;
+      cksum::Digest* d;
+
+      void put(const void* p, size_t n) {
+	d->Update(static_cast<const unsigned char*>(p), n);
+      }
+
+    public:
+      explicit node_cksum(cksum::CksumType _type)
+	: type(_type), dv(cksum::digest_factory(_type)),
+	  d(cksum::get_digest(dv)) {}
+
+      node_cksum(const node_cksum&) = delete;
+      node_cksum& operator=(const node_cksum&) = delete;
+
+      /* false if type is none, or not in this build */
+      bool valid() const { return d != nullptr; }
+
+      void add(uint64_t v) {
+	unsigned char b[8];
+	for (int ix = 0; ix < 8; ++ix) {
+	  b[ix] = uint8_t(v >> (8 * ix));
+	}
+	put(b, sizeof(b));
+      }
+
+      void add(const std::string_view& s) {
+	add(uint64_t(s.length()));
+	put(s.data(), s.length());
+      }
+
+      void add(const sv_tuple& tp) {
+	add(uint64_t(len(tp)));
+	put(std::get<0>(tp).data(), std::get<0>(tp).length());
+	put(std::get<1>(tp).data(), std::get<1>(tp).length());
+      }
+
+      void add(const fence_key& fk) {
+	add(uint64_t(! fk.unbounded()));
+	if (! fk.unbounded()) {
+	  add(std::string_view(fk.as_leaf_key().stem));
+	}
+      }
+
+      /* the header fields a checksum covers */
+      void add_header(NodeType type, uint32_t fanout, uint16_t prefix_min_len,
+		      const fence_key& lb, const fence_key& ub,
+		      const std::string& right_sibling) {
+	add(uint64_t(type));
+	add(uint64_t(fanout));
+	add(uint64_t(prefix_min_len));
+	add(lb);
+	add(ub);
+	add(std::string_view(right_sibling));
+      }
+
+      std::string final() {
+	std::string digest(
+	  cksum::Cksum::checksums[uint16_t(type)].digest_size, '\0');
+	d->Final(reinterpret_cast<unsigned char*>(digest.data()));
+	return digest;
+      }
+    }; /* node_cksum */
+
     template <typename K, NodeType T>
     class Node
     {
@@ -63,10 +181,19 @@ namespace rgw { namespace bplus {
       const uint16_t prefix_min_len;
 
     private:
-      mutable std::mutex mtx;
+      mutable latch_type mtx;
 
       fence_key lower_bound;
       fence_key upper_bound;
+      std::string right_sibling; // leaves:  next leaf's name, "" if none
+      cksum::CksumType cksum_type{default_cksum};
+      /* leaves:  bits per key of the key filter stored with the node
+       * (see serialize()), 0 for none */
+      uint8_t filter_bits{0};
+      /* the most the node may take serialized, 0 if unbounded (see
+       * set_max_bytes()), and its entries' share (see entry_bytes()) */
+      size_t max_bytes{0};
+      size_t kv_bytes{0};
 
       class KVEntry
       {
@@ -76,10 +203,10 @@ namespace rgw { namespace bplus {
 	KVEntry(const K& k, const std::string& v)
 	  : key(k), val(v) {}
 	KVEntry(KVEntry&& rhs)
-	  : key(rhs.key), val(rhs.val) {}
+	  : key(std::move(rhs.key)), val(std::move(rhs.val)) {}
 	KVEntry& operator=(KVEntry&& rhs) {
-	  key = rhs.key;
-	  val = rhs.val;
+	  key = std::move(rhs.key);
+	  val = std::move(rhs.val);
 	  return *this;
 	}
       }; /* KVEntry */
@@ -87,8 +214,423 @@ namespace rgw { namespace bplus {
       vector<KVEntry> data; // sorted vector of {k,v}
       prefix_vector pv;
 
+      /* every key starts with head_prefix (not necessarily the
+       * longest such);  heads[ix] packs the 8 bytes of data[ix]'s key
+       * after it, big-endian, so most comparisons in a search are of
+       * integers in one array, not of (prefix-resolved) key bytes */
+      std::string head_prefix;
+      vector<uint64_t> heads;
+
+      uint64_t key_head(const sv_tuple& tp) const {
+	const auto& l = std::get<0>(tp);
+	const auto& r = std::get<1>(tp);
+	unsigned char b[8] = {0};
+	size_t off = head_prefix.length();
+	size_t n{0};
+	if (off < l.length()) {
+	  n = std::min<size_t>(8, l.length() - off);
+	  memcpy(b, l.data() + off, n);
+	  off = l.length();
+	}
+	off -= l.length();
+	if ((n < 8) && (off < r.length())) {
+	  memcpy(b + n, r.data() + off, std::min(8 - n, r.length() - off));
+	}
+	uint64_t h;
+	memcpy(&h, b, sizeof(h));
+	return be64toh(h);
+      } /* key_head */
+
+      /* make room for a key about to enter the node:  the first sets
+       * head_prefix, any other not under it shortens it (and the
+       * heads are recomputed);  the key's head is taken after;  an
+       * unbounded fence needs no room */
+      void admit(const K& key) {
+	bool first = data.empty();
+	if constexpr (std::is_same_v<K, fence_key>) {
+	  if (key.unbounded()) {
+	    return; // its head is 0, below every other
+	  }
+	  first = first || ((data.size() == 1) && data[0].key.unbounded());
+	}
+	auto tp = tie_prefix(pv, key);
+	if (first) {
+	  head_prefix = head(tp, std::min<size_t>(len(tp), max_head_prefix));
+	  return;
+	}
+	shorten_head_prefix(tp);
+      } /* admit */
+
+      void shorten_head_prefix(const sv_tuple& tp) {
+	if (likely(starts_with(tp, head_prefix))) {
+	  return;
+	}
+	head_prefix.resize(
+	  common_prefix_len(tp, sv_tuple(head_prefix, nullstr)));
+	drop_index();
+	for (size_t ix = 0; ix < data.size(); ++ix) {
+	  heads[ix] = key_head(tie_prefix(pv, data[ix].key));
+	}
+      } /* shorten_head_prefix */
+
+      static constexpr size_t max_head_prefix = 256;
+
+      /* index of the first entry at or after from whose head is >= h
+       * (or > h, iff upper), without branching on the comparisons */
+      size_t head_search(uint64_t h, bool upper, size_t from) const {
+	const uint64_t* base = heads.data() + from;
+	size_t n = heads.size() - from;
+	if (n == 0) {
+	  return from;
+	}
+	if (upper) {
+	  while (n > 1) {
+	    size_t half = n / 2;
+	    base = (base[half] <= h) ? base + half : base;
+	    n -= half;
+	  }
+	  return (base - heads.data()) + (*base <= h);
+	}
+	while (n > 1) {
+	  size_t half = n / 2;
+	  base = (base[half] < h) ? base + half : base;
+	  n -= half;
+	}
+	return (base - heads.data()) + (*base < h);
+      } /* head_search */
+
+      /* branches are searched far more often than changed:  once
+       * found through, one of index_min or more entries keeps a
+       * read-only index over its heads, a little B+tree of
+       * cache-line blocks of 8, each entry of an upper level the
+       * largest head of its block below;  a search then misses
+       * about one line per level, where the binary search on heads
+       * misses one per halving;  any change drops it, and the next
+       * find_floor rebuilds it (under index_mtx, as finders hold the
+       * latch shared) */
+      struct alignas(64) head_block {
+	uint64_t h[8];
+      };
+      static constexpr size_t index_min = 128;
+      static constexpr size_t index_max_levels = 8;
+      mutable std::mutex index_mtx;
+      mutable std::atomic<bool> index_valid{false};
+      mutable vector<head_block> head_index; // all levels, root first
+      /* offset of each level, and of the end */
+      mutable std::array<uint32_t, index_max_levels + 1> index_level;
+      mutable uint32_t index_levels{0};
+
+      void drop_index() {
+	if constexpr (T == NodeType::Branch) {
+	  index_valid.store(false, std::memory_order_relaxed);
+	}
+      } /* drop_index */
+
+      void maybe_build_index() const {
+	if constexpr (T == NodeType::Branch) {
+	  if (likely(index_valid.load(std::memory_order_acquire)) ||
+	      (heads.size() < index_min)) {
+	    return;
+	  }
+	  lock_guard guard(index_mtx);
+	  if (index_valid.load(std::memory_order_relaxed)) {
+	    return;
+	  }
+	  /* levels bottom up, each padded with ~0 */
+	  vector<vector<head_block>> levels;
+	  levels.emplace_back((heads.size() + 7) / 8);
+	  auto fill = [](vector<head_block>& lv, size_t ix, uint64_t h) {
+	    lv[ix / 8].h[ix % 8] = h;
+	  };
+	  for (size_t ix = 0; ix < levels[0].size() * 8; ++ix) {
+	    fill(levels[0], ix,
+		 (ix < heads.size()) ? heads[ix]
+		 : std::numeric_limits<uint64_t>::max());
+	  }
+	  while (levels.back().size() > 1) {
+	    const auto& below = levels.back();
+	    vector<head_block> lv((below.size() + 7) / 8);
+	    for (size_t ix = 0; ix < lv.size() * 8; ++ix) {
+	      fill(lv, ix, (ix < below.size()) ? below[ix].h[7]
+		   : std::numeric_limits<uint64_t>::max());
+	    }
+	    levels.push_back(std::move(lv));
+	  }
+	  if (unlikely(levels.size() > index_max_levels)) {
+	    return;
+	  }
+	  head_index.clear();
+	  index_levels = levels.size();
+	  for (size_t lx = 0; lx < index_levels; ++lx) {
+	    const auto& lv = levels[index_levels - 1 - lx];
+	    index_level[lx] = head_index.size();
+	    head_index.insert(head_index.end(), lv.begin(), lv.end());
+	  }
+	  index_level[index_levels] = head_index.size();
+	  index_valid.store(true, std::memory_order_release);
+	}
+      } /* maybe_build_index */
+
+      /* as head_search(h, false, 0), through the index:  at each
+       * level, the count of entries < h in one block picks the block
+       * below;  past the last block (or head), h is above all */
+      size_t index_search(uint64_t h) const {
+	size_t b{0};
+	for (uint32_t lx = 0; lx < index_levels; ++lx) {
+	  const uint64_t* blk = head_index[index_level[lx] + b].h;
+	  size_t c{0};
+	  for (int ix = 0; ix < 8; ++ix) {
+	    c += (blk[ix] < h);
+	  }
+	  b = 8 * b + c;
+	  if ((lx + 1 < index_levels) &&
+	      unlikely(b >= index_level[lx + 2] - index_level[lx + 1])) {
+	    return heads.size();
+	  }
+	}
+	return std::min(b, heads.size());
+      } /* index_search */
+
+      /* index of the first entry at or after from whose key is >= key
+       * (or > key, iff upper):  a branchless search over heads finds
+       * the entries whose head ties key's, and only those are
+       * compared whole */
+      size_t search(const K& key, bool upper = false, size_t from = 0) const {
+	auto tp = tie_prefix(pv, key);
+	if (! head_prefix.empty()) {
+	  int res = compare(head_view(tp, head_prefix.length()),
+			    sv_tuple(head_prefix, nullstr));
+	  if (res > 0) {
+	    return data.size();
+	  }
+	  if (res < 0) {
+	    /* below every bounded key, but not an unbounded fence */
+	    if constexpr (std::is_same_v<K, fence_key>) {
+	      if ((from == 0) && (upper || (! key.unbounded())) &&
+		  (! data.empty()) &&
+		  data[0].key.unbounded()) {
+		return 1;
+	      }
+	    }
+	    return from;
+	  }
+	}
+	uint64_t h = key_head(tp);
+	size_t lo;
+	if ((T == NodeType::Branch) && (from == 0) &&
+	    index_valid.load(std::memory_order_acquire)) {
+	  lo = index_search(h);
+	} else {
+	  lo = head_search(h, false, from);
+	}
+	if ((lo == heads.size()) || (heads[lo] != h)) {
+	  return lo;
+	}
+	/* ties:  search them whole */
+	size_t hi = head_search(h, true, lo);
+	auto it = (upper)
+	  ? std::upper_bound(data.begin() + lo, data.begin() + hi, key,
+			     keysviewLT)
+	  : std::lower_bound(data.begin() + lo, data.begin() + hi, key,
+			     keysviewLT);
+	return it - data.begin();
+      } /* search */
+
+      /* update log:  once the node is stored whole (log_on), inserts
+       * and removes are recorded, to be written back as a delta;  any
+       * other change turns logging off until the next whole write */
+      struct log_rec {
+	LogOp op;
+	std::string key; // logical, "" for an unbounded fence
+	std::string val;
+      };
+      bool log_on{false};
+      vector<log_rec> update_log; // not yet written
+      size_t log_pending_bytes{0};
+      uint32_t log_records{0}; // written as deltas since the whole node
+      size_t log_bytes{0};
+
+      void log_update(LogOp op, const K& key, const std::string& val) {
+	update_log.push_back(log_rec{op, to_string(pv, key), val});
+	log_pending_bytes += update_log.back().key.length() + val.length();
+      } /* log_update */
+
+      void log_off() {
+	log_on = false;
+	update_log.clear();
+	log_pending_bytes = 0;
+      } /* log_off */
+
+      static K log_key(const std::string& s) {
+	if constexpr (std::is_same_v<K, fence_key>) {
+	  if (s.empty()) {
+	    return fence_key(key_range::unbounded);
+	  }
+	}
+	return K(s);
+      } /* log_key */
+
+      static void serialize_log(flexbuffers::Builder& fbb,
+				const vector<log_rec>& recs) {
+	for (const auto& rec : recs) {
+	  fbb.UInt(uint8_t(rec.op));
+	  fbb.String(rec.key.data(), rec.key.length());
+	  fbb.String(rec.val.data(), rec.val.length());
+	}
+      } /* serialize_log */
+
+      static void add_log(node_cksum& ck, const vector<log_rec>& recs) {
+	for (const auto& rec : recs) {
+	  ck.add(uint64_t(rec.op));
+	  ck.add(std::string_view(rec.key));
+	  ck.add(std::string_view(rec.val));
+	}
+      } /* add_log */
+
+      /* apply serialized records (op, key, value) in order;  caller
+       * holds the node lock, if needed;  returns records applied */
+      uint32_t replay(const flexbuffers::Vector& recs) {
+	uint32_t count{0};
+	for (size_t ix = 0; ix + 2 < recs.size(); ix += 3) {
+	  if (unlikely(! recs[ix].IsUInt())) {
+	    break; // not a record
+	  }
+	  auto op = LogOp(recs[ix].AsUInt8());
+	  auto key = recs[ix+1].AsString();
+	  auto k = log_key(std::string(key.c_str(), key.length()));
+	  switch (op) {
+	  case LogOp::Insert:
+	  {
+	    auto val = recs[ix+2].AsString();
+	    insert(k, std::string(val.c_str(), val.length()), FLAG_LOCKED);
+	  }
+	  break;
+	  case LogOp::Remove:
+	    remove(k, FLAG_LOCKED);
+	    break;
+	  default:
+	    continue;
+	  }
+	  ++count;
+	}
+	return count;
+      } /* replay */
+
       using data_iterator = typename decltype(data)::iterator;
 
+      /* dead prefixes tolerated before compact_prefixes() runs */
+      static constexpr size_t prefix_slack = 8;
+
+      /* drop the prefixes no key uses, renumbering the rest;  caller
+       * holds the node lock, if needed */
+      void compact_prefixes() {
+	static constexpr uint16_t unused = std::numeric_limits<uint16_t>::max();
+	std::vector<uint16_t> remap(pv.size(), unused);
+	for (auto& kv : data) {
+	  if (auto off = pv_offset(kv.key)) {
+	    remap[*off] = 0;
+	  }
+	}
+	uint16_t live{0};
+	for (size_t ix = 0; ix < pv.size(); ++ix) {
+	  if (remap[ix] == 0) {
+	    remap[ix] = live;
+	    if (live != ix) {
+	      pv[live] = std::move(pv[ix]);
+	    }
+	    ++live;
+	  }
+	}
+	if (live == pv.size()) {
+	  return;
+	}
+	pv.resize(live);
+	pv.shrink_to_fit();
+	for (auto& kv : data) {
+	  if (auto off = pv_offset(kv.key)) {
+	    *off = remap[*off];
+	  }
+	}
+      } /* compact_prefixes */
+
+      /* every live prefix is used by some key, so past this bound
+       * there are at least prefix_slack dead ones */
+      void maybe_compact_prefixes() {
+	if (pv.size() > data.size() + prefix_slack) {
+	  compact_prefixes();
+	}
+      } /* maybe_compact_prefixes */
+
+      /* add key at the end of data, prefixing it against the current
+       * last key;  caller ensures order and holds the node lock, if
+       * needed */
+      void append(const K& key, const std::string& value) {
+	admit(key);
+	drop_index();
+	heads.push_back(key_head(tie_prefix(pv, key)));
+	if (! data.empty()) {
+	  auto pref_key = make_prefix_key(
+	    pv, key, data.back().key, prefix_min_len);
+	  if (pref_key) {
+	    kv_bytes += entry_bytes(key, value.length());
+	    data.emplace_back(*pref_key, value);
+	    return;
+	  }
+	}
+	kv_bytes += entry_bytes(key, value.length());
+	data.emplace_back(key, value);
+      } /* append */
+
+      size_t entry_bytes(const K& key, size_t vlen) const {
+	return entry_bytes(len(tie_prefix(pv, key)), vlen);
+      }
+
+      static size_t fence_bytes(const fence_key& fk) {
+	return fk.unbounded() ? 0 : fk.as_leaf_key().stem.length();
+      }
+
+      size_t bytes_bound() const {
+	return node_overhead + fence_bytes(lower_bound) +
+	  fence_bytes(upper_bound) + right_sibling.length() + kv_bytes;
+      }
+
+      /* true iff entries of add more bytes fit */
+      bool fits(size_t add) const {
+	return (max_bytes == 0) || (bytes_bound() + add <= max_bytes);
+      }
+
+      template <typename F>
+      int list_impl(
+	const std::optional<std::string>& prefix, F&& f,
+	std::optional<uint32_t> limit, uint32_t flags) {
+	uint32_t count{0};
+	uint32_t lim  =
+	  limit ? *limit : std::numeric_limits<uint32_t>::max() ;
+	shared_latch shared(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  shared.lock();
+	}
+
+	data_iterator it = (prefix)
+	  ? data.begin() + search(K(*prefix))
+	  : data.begin();
+	for (; it != data.end() && count < lim; ++it) {
+	  auto tp = tie_prefix(pv, it->key);
+	  // stop iteration iff prefix search and prefix not found
+	  if (prefix && (flags & FLAG_REQUIRE_PREFIX) &&
+	      !starts_with(tp, *prefix)) {
+	    break;
+	  }
+	  auto ret = f(tp, it->val);
+	  ++count;
+	  /* terminate iteration ?*/
+	  if (ret & FLAG_STOP) {
+	    break;
+	  }
+	} /* foreach data */
+	return count;
+      } /* list_impl */
+
       // indirect compf
       struct KeysViewLT
       {
@@ -137,11 +679,69 @@ namespace rgw { namespace bplus {
 	  keysviewLT(pv), keysviewEQ(pv)
 	{}
 
-      size_t size() const {
-	lock_guard guard(mtx);
+      /* Node is SharedLockable, so that Tree can hold latches across
+       * node operations (which are then called with FLAG_LOCKED) */
+      void lock() const { mtx.lock(); }
+      void unlock() const { mtx.unlock(); }
+      void lock_shared() const { mtx.lock_shared(); }
+      void unlock_shared() const { mtx.unlock_shared(); }
+
+      size_t size(uint32_t flags = FLAG_NONE) const {
+	shared_latch shared(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  shared.lock();
+	}
 	return data.size();
       } /* size */
 
+      /* true iff one more entry fits without a split */
+      bool safe(uint32_t flags = FLAG_NONE) const {
+	shared_latch shared(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  shared.lock();
+	}
+	return (data.size() < fanout) && fits(max_entry_bytes(max_bytes));
+      } /* safe */
+
+      /* bounds on the serialized size, for a store whose objects are
+       * limited (see object_store::capacity()):  per entry, the
+       * framing of its key and value at their widest (size,
+       * terminator, alignment, offset and type, for each) and its
+       * share of a key filter;  per node, the header fields, digest,
+       * filter framing, map keys and segment frame */
+      static constexpr size_t entry_overhead = 2 * (8 + 1 + 7 + 8 + 1) + 4;
+      static constexpr size_t node_overhead = 512;
+
+      static size_t entry_bytes(size_t klen, size_t vlen) {
+	return klen + vlen + entry_overhead;
+      }
+      /* the largest entry a node of max_bytes takes:  small enough
+       * that a split always makes room for one more (each half is
+       * then within half the node, its fences and another entry) */
+      static size_t max_entry_bytes(size_t max_bytes) {
+	return max_bytes / 16;
+      }
+
+      /* past max_bytes serialized (a bound, see entry_bytes()), an
+       * insert fails E2BIG, as past fanout, and a split divides the
+       * entries' bytes, not their count;  0 for no limit */
+      void set_max_bytes(size_t bytes, uint32_t flags = FLAG_NONE) {
+	excl_latch uniq(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  uniq.lock();
+	}
+	max_bytes = bytes;
+      }
+
+      /* bounds the node's serialized size */
+      size_t serialized_bound(uint32_t flags = FLAG_NONE) const {
+	shared_latch shared(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  shared.lock();
+	}
+	return bytes_bound();
+      }
+
       void dump_keys() {
 	std::cout << " data vec: ";
 	for (const auto& kv : data) {
@@ -151,26 +751,170 @@ namespace rgw { namespace bplus {
       }
 
       void clear(uint32_t flags = FLAG_NONE) {
-	unique_lock uniq(mtx, std::defer_lock);
+	excl_latch uniq(mtx, std::defer_lock);
 	if (likely(! (flags & FLAG_LOCKED))) {
 	  uniq.lock();
 	}
 	data.clear();
+	kv_bytes = 0;
+	drop_index();
+	heads.clear();
+	pv.clear();
+	log_off();
       } /* clear */
 
-      int insert(const K& key, const std::string& value) {
-	lock_guard guard(mtx);
-	if (data.size() == fanout) {
-	  // oh, noes!  need split
-	  return E2BIG;
+      /* approximate bytes held by this node (entries, their
+       * out-of-line strings, and the prefix vector) */
+      struct key_stats {
+	size_t logical{0}; // bytes of the keys, unprefixed
+	size_t stored{0}; // bytes of their stems and of pv
+	size_t prefixes{0};
+      };
+
+      /* what prefix compression saves */
+      key_stats get_key_stats(uint32_t flags = FLAG_NONE) const {
+	shared_latch shared(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  shared.lock();
 	}
-	data_iterator kv_it = std::lower_bound(
-	  data.begin(), data.end(), key, keysviewLT);
+	key_stats ks;
+	for (const auto& kv : data) {
+	  auto tp = tie_prefix(pv, kv.key);
+	  ks.logical += len(tp);
+	  ks.stored += len(tp);
+	  if (pv_offset(kv.key)) {
+	    ks.stored -= std::get<0>(tp).length();
+	  }
+	}
+	for (const auto& p : pv) {
+	  ks.stored += p.length();
+	}
+	ks.prefixes = pv.size();
+	return ks;
+      } /* get_key_stats */
+
+      size_t footprint(uint32_t flags = FLAG_NONE) const {
+	shared_latch shared(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  shared.lock();
+	}
+	size_t bytes = sizeof(*this) + data.capacity() * sizeof(KVEntry) +
+	  pv.capacity() * sizeof(std::string) +
+	  heads.capacity() * sizeof(uint64_t) + heap_bytes(head_prefix);
+	{
+	  lock_guard guard(index_mtx);
+	  bytes += head_index.capacity() * sizeof(head_block);
+	}
+	for (const auto& kv : data) {
+	  bytes += heap_bytes(kv.key) + heap_bytes(kv.val);
+	}
+	for (const auto& p : pv) {
+	  bytes += heap_bytes(p);
+	}
+	bytes += update_log.capacity() * sizeof(log_rec) + log_pending_bytes;
+	return bytes;
+      } /* footprint */
+
+      fence_key get_lower_bound(uint32_t flags = FLAG_NONE) const {
+	shared_latch shared(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  shared.lock();
+	}
+	return lower_bound;
+      }
+
+      fence_key get_upper_bound(uint32_t flags = FLAG_NONE) const {
+	shared_latch shared(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  shared.lock();
+	}
+	return upper_bound;
+      }
+
+      std::string get_right_sibling(uint32_t flags = FLAG_NONE) const {
+	shared_latch shared(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  shared.lock();
+	}
+	return right_sibling;
+      }
+
+      /* a delta can't carry the link, so the next writeback is
+       * whole */
+      void set_right_sibling(const std::string& name,
+			     uint32_t flags = FLAG_NONE) {
+	excl_latch uniq(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  uniq.lock();
+	}
+	log_off();
+	right_sibling = name;
+      }
+
+      cksum::CksumType get_cksum_type(uint32_t flags = FLAG_NONE) const {
+	shared_latch shared(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  shared.lock();
+	}
+	return cksum_type;
+      }
+
+      /* as with the link, the next writeback is whole */
+      void set_cksum_type(cksum::CksumType type, uint32_t flags = FLAG_NONE) {
+	excl_latch uniq(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  uniq.lock();
+	}
+	log_off();
+	cksum_type = type;
+      }
+
+      uint32_t get_filter_bits(uint32_t flags = FLAG_NONE) const {
+	shared_latch shared(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  shared.lock();
+	}
+	return filter_bits;
+      }
+
+      /* a leaf's next writeback is whole, with its filter rebuilt
+       * (a delta would leave the stored filter behind its keys) */
+      void set_filter_bits(uint32_t bits, uint32_t flags = FLAG_NONE) {
+	excl_latch uniq(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  uniq.lock();
+	}
+	bits = std::min(bits, bloom_filter::max_bits_per_key);
+	if ((T == NodeType::Leaf) && (bits != filter_bits)) {
+	  log_off();
+	  filter_bits = bits;
+	}
+      }
+
+      int insert(const K& key, const std::string& value,
+		 uint32_t flags = FLAG_NONE) {
+	excl_latch uniq(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  uniq.lock();
+	}
+	data_iterator kv_it = data.begin() + search(key);
 	if (kv_it != data.end()) {
 	  if(unlikely(equal_to(pv, kv_it->key, key))) {
 	    return EEXIST;
 	  }
 	}
+	size_t bytes = entry_bytes(key, value.length());
+	if ((data.size() == fanout) || (! fits(bytes))) {
+	  // oh, noes!  need split
+	  return E2BIG;
+	}
+	if (log_on) {
+	  log_update(LogOp::Insert, key, value);
+	}
+	admit(key);
+	drop_index();
+	heads.insert(heads.begin() + (kv_it - data.begin()),
+		     key_head(tie_prefix(pv, key)));
 	// key prefixing
 	K& ref_key = const_cast<K&>(key);
 	if (kv_it != data.begin()) {
@@ -183,101 +927,568 @@ namespace rgw { namespace bplus {
 	}
 	// now use kv_it to do a positional insert into keys_view
 	data.insert(kv_it, {ref_key, value});
+	kv_bytes += bytes;
 	return 0;
       } /* insert */
 
-      int remove(const K& key) {
-	lock_guard guard(mtx);
+      /* ENOENT if key is absent */
+      int remove(const K& key, uint32_t flags = FLAG_NONE) {
+	excl_latch uniq(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  uniq.lock();
+	}
 	// TODO:  variant backing (local_rep and flatbuffer) */
-	data_iterator kv_it = std::lower_bound(
-	  data.begin(), data.end(), key, keysviewLT);
-	if (kv_it != data.end() &&
-	    equal_to(pv, kv_it->key, key)) {
-	  data.erase(kv_it);
+	data_iterator kv_it = data.begin() + search(key);
+	if ((kv_it == data.end()) ||
+	    (! equal_to(pv, kv_it->key, key))) {
+	  return ENOENT;
+	}
+	if (log_on) {
+	  log_update(LogOp::Remove, key, std::string{});
 	}
+	kv_bytes -= entry_bytes(kv_it->key, kv_it->val.length());
+	drop_index();
+	heads.erase(heads.begin() + (kv_it - data.begin()));
+	data.erase(kv_it);
+	maybe_compact_prefixes();
 	return 0;
       } /* remove */
 
+      /* insert kvs (pairs of key, value) given in strictly increasing
+       * key order, placing them all in one backward pass rather than
+       * shifting the tail once per key;  keys already present are
+       * skipped;  E2BIG, and nothing inserted, unless the new keys all
+       * fit;  *inserted gets the number inserted, and those inserted
+       * are appended to *applied (if given) */
+      template <typename It>
+      int insert_batch(It first, It last, uint32_t* inserted,
+		       uint32_t flags = FLAG_NONE,
+		       std::vector<It>* applied = nullptr) {
+	excl_latch uniq(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  uniq.lock();
+	}
+	*inserted = 0;
+	struct new_entry {
+	  size_t pos; // in data, before the merge
+	  K key;
+	  It from;
+	  uint64_t head;
+	};
+	vector<new_entry> adds;
+	size_t add_bytes{0};
+	auto kv_it = data.begin();
+	for (; first != last; ++first) {
+	  K key(first->first);
+	  kv_it = data.begin() + search(key, false, kv_it - data.begin());
+	  if ((kv_it != data.end()) && equal_to(pv, kv_it->key, key)) {
+	    continue; // EEXIST
+	  }
+	  size_t bytes = entry_bytes(key, first->second.length());
+	  if ((data.size() + adds.size() == fanout) ||
+	      (! fits(add_bytes + bytes))) {
+	    return E2BIG;
+	  }
+	  add_bytes += bytes;
+	  adds.push_back(new_entry{size_t(kv_it - data.begin()),
+				   std::move(key), first, 0});
+	}
+	if (adds.empty()) {
+	  return 0;
+	}
+	admit(adds.front().key);
+	for (const auto& add : adds) {
+	  shorten_head_prefix(tie_prefix(pv, add.key));
+	}
+	/* prefix each new key against its predecessor once merged */
+	for (size_t ix = 0; ix < adds.size(); ++ix) {
+	  auto& add = adds[ix];
+	  if (log_on) {
+	    log_update(LogOp::Insert, add.key, add.from->second);
+	  }
+	  if (applied) {
+	    applied->push_back(add.from);
+	  }
+	  add.head = key_head(tie_prefix(pv, add.key));
+	  const K* prev =
+	    ((ix > 0) && (adds[ix-1].pos == add.pos)) ? &adds[ix-1].key
+	    : (add.pos > 0) ? &data[add.pos-1].key : nullptr;
+	  if (prev) {
+	    auto pref_key = make_prefix_key(pv, add.key, *prev, prefix_min_len);
+	    if (pref_key) {
+	      add.key = std::move(*pref_key);
+	    }
+	  }
+	}
+	size_t old_size = data.size();
+	for (size_t ix = 0; ix < adds.size(); ++ix) {
+	  data.emplace_back(K(std::string{}), std::string{});
+	}
+	drop_index();
+	heads.resize(data.size());
+	/* merge from the back, so each entry moves at most once */
+	size_t out = data.size();
+	size_t in = old_size;
+	for (size_t ix = adds.size(); ix-- > 0;) {
+	  auto& add = adds[ix];
+	  while (in > add.pos) {
+	    --out;
+	    --in;
+	    data[out] = std::move(data[in]);
+	    heads[out] = heads[in];
+	  }
+	  --out;
+	  data[out].key = std::move(add.key);
+	  data[out].val = add.from->second;
+	  heads[out] = add.head;
+	}
+	kv_bytes += add_bytes;
+	*inserted = adds.size();
+	return 0;
+      } /* insert_batch */
+
+      /* remove keys given in strictly increasing order, compacting
+       * the node in one pass;  *removed gets the number removed, and
+       * those removed are appended to *applied (if given) */
+      template <typename It>
+      int remove_batch(It first, It last, uint32_t* removed,
+		       uint32_t flags = FLAG_NONE,
+		       std::vector<It>* applied = nullptr) {
+	excl_latch uniq(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  uniq.lock();
+	}
+	uint32_t count{0};
+	auto out = data.begin();
+	auto kv_it = data.begin();
+	for (; first != last; ++first) {
+	  K k(*first);
+	  while ((kv_it != data.end()) && less_than(pv, kv_it->key, k)) {
+	    if (out != kv_it) {
+	      heads[out - data.begin()] = heads[kv_it - data.begin()];
+	      *out = std::move(*kv_it);
+	    }
+	    ++out;
+	    ++kv_it;
+	  }
+	  if ((kv_it != data.end()) && equal_to(pv, kv_it->key, k)) {
+	    if (log_on) {
+	      log_update(LogOp::Remove, k, std::string{});
+	    }
+	    if (applied) {
+	      applied->push_back(first);
+	    }
+	    kv_bytes -= entry_bytes(kv_it->key, kv_it->val.length());
+	    ++kv_it;
+	    ++count;
+	  }
+	}
+	if (count > 0) {
+	  for (auto it = kv_it; it != data.end(); ++it, ++out) {
+	    heads[out - data.begin()] = heads[it - data.begin()];
+	    *out = std::move(*it);
+	  }
+	  drop_index();
+	  heads.resize(out - data.begin());
+	  data.erase(out, data.end());
+	  maybe_compact_prefixes();
+	}
+	*removed = count;
+	return 0;
+      } /* remove_batch */
+
+      int get(const K& key, std::string* val = nullptr,
+	      uint32_t flags = FLAG_NONE) const {
+	shared_latch shared(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  shared.lock();
+	}
+	auto kv_it = data.begin() + search(key);
+	if (kv_it == data.end() ||
+	    !equal_to(pv, kv_it->key, key)) {
+	  return ENOENT;
+	}
+	if (val) {
+	  *val = kv_it->val;
+	}
+	return 0;
+      } /* get */
+
+      /* branch lookup:  value of the last entry whose key is <= key
+       * (i.e., the child whose key range contains key) */
+      std::optional<std::string> find_floor(
+	const K& key, uint32_t flags = FLAG_NONE) const {
+	shared_latch shared(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  shared.lock();
+	}
+	maybe_build_index();
+	auto kv_it = data.begin() + search(key, true);
+	if (unlikely(kv_it == data.begin())) {
+	  return {};
+	}
+	return std::prev(kv_it)->val;
+      } /* find_floor */
+
+      /* fill an empty node from entries (key, value) in key order,
+       * moving from them;  the one prefix all keys share is computed
+       * once, from the first and last key;  in a branch, a leading ""
+       * key is the unbounded fence */
+      template <typename It>
+      void load_sorted(It first, It last, uint32_t flags = FLAG_NONE) {
+	excl_latch uniq(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  uniq.lock();
+	}
+	log_off();
+	drop_index();
+	data.reserve(data.size() + std::distance(first, last));
+	bool unbounded_first =
+	  (T == NodeType::Branch) && (first != last) && first->first.empty();
+	auto lo_it = unbounded_first ? std::next(first) : first;
+	size_t plen{0};
+	if (lo_it != last) {
+	  const auto& lo = lo_it->first;
+	  const auto& hi = std::prev(last)->first;
+	  plen = mismatch(lo.data(), hi.data(),
+			  std::min(lo.length(), hi.length()));
+	  if ((plen > prefix_min_len) &&
+	      (plen <= std::numeric_limits<uint16_t>::max())) {
+	    pv.push_back(lo.substr(0, plen));
+	  } else {
+	    plen = 0;
+	  }
+	}
+	uint16_t pref_off = pv.size() - 1;
+	if constexpr (std::is_same_v<K, fence_key>) {
+	  if (unbounded_first) {
+	    kv_bytes += entry_bytes(0, first->second.length());
+	    data.emplace_back(fence_key(key_range::unbounded),
+			      std::move(first->second));
+	    heads.push_back(0);
+	    ++first;
+	  }
+	}
+	for (auto it = first; it != last; ++it) {
+	  K k = (plen > 0) ? K(leaf_key(pref_off, it->first.substr(plen)))
+	    : K(leaf_key(std::move(it->first)));
+	  admit(k);
+	  heads.push_back(key_head(tie_prefix(pv, k)));
+	  kv_bytes += entry_bytes(k, it->second.length());
+	  data.emplace_back(std::move(k), std::move(it->second));
+	}
+      } /* load_sorted */
+
+      /* move the upper half of this node's entries (by their bytes,
+       * if those are limited) to rhs, which must be empty, and
+       * becomes our right sibling;  returns the separator (the
+       * logical first key of rhs), which is also the new fence
+       * between the two nodes */
+      std::string split(Node& rhs, uint32_t flags = FLAG_NONE) {
+	excl_latch uniq(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  uniq.lock();
+	}
+	log_off();
+	data_iterator mid_it = data.begin() + (data.size() / 2);
+	if ((max_bytes > 0) && (data.size() > 1)) {
+	  size_t lhs_bytes{0};
+	  mid_it = data.begin();
+	  while ((lhs_bytes < kv_bytes / 2) && (mid_it != data.end())) {
+	    lhs_bytes += entry_bytes(mid_it->key, mid_it->val.length());
+	    ++mid_it;
+	  }
+	  mid_it = std::clamp(mid_it, data.begin() + 1, data.end() - 1);
+	}
+	rhs.max_bytes = max_bytes;
+	for (auto kv_it = mid_it; kv_it != data.end(); ++kv_it) {
+	  kv_bytes -= entry_bytes(kv_it->key, kv_it->val.length());
+	  rhs.append(expand_key(pv, kv_it->key), kv_it->val);
+	}
+	drop_index();
+	heads.resize(mid_it - data.begin());
+	data.erase(mid_it, data.end());
+	compact_prefixes();
+	std::string sep = to_string(rhs.pv, rhs.data.front().key);
+	rhs.lower_bound = fence_key(sep);
+	rhs.upper_bound = upper_bound;
+	rhs.cksum_type = cksum_type;
+	rhs.filter_bits = filter_bits;
+	upper_bound = rhs.lower_bound;
+	return sep;
+      } /* split */
+
+      /* zero-copy listing:  cb sees each key as its (prefix, stem)
+       * views and the value as a view, all valid only for the
+       * duration of the call */
+      int list(
+	const std::optional<std::string>& prefix,
+	std::function<int(const sv_tuple&, const std::string_view&)> cb,
+	std::optional<uint32_t> limit,
+	uint32_t flags = FLAG_NONE) {
+	return list_impl(
+	  prefix,
+	  [&cb] (const sv_tuple& k, const std::string& v) -> int {
+	    return cb(k, v);
+	  }, limit, flags);
+      } /* list */
+
+      /* materializing adapter;  one key buffer is reused across the
+       * listing */
       int list(
 	const std::optional<std::string>& prefix,
 	std::function<int(const std::string*, const std::string*)> cb,
 	std::optional<uint32_t> limit,
 	uint32_t flags = FLAG_NONE) {
+	std::string str;
+	return list_impl(
+	  prefix,
+	  [&str, &cb] (const sv_tuple& k, const std::string& v) -> int {
+	    str.assign(std::get<0>(k));
+	    str.append(std::get<1>(k));
+	    return cb(&str, &v);
+	  }, limit, flags);
+      } /* list */
+
+      /* delimited listing (as S3 ListObjects):  the keys under
+       * prefix, from the first >= from (or prefix) on, except that
+       * keys sharing a common prefix--through the first delim after
+       * prefix--are listed once, as that prefix, and the rest of them
+       * are skipped by seeking past it, not visited */
+      int list(const std::optional<std::string>& prefix,
+	       const std::string& delim, delim_list_cb cb,
+	       std::optional<uint32_t> limit, uint32_t flags = FLAG_NONE,
+	       const std::optional<std::string>& from = std::nullopt) {
 	uint32_t count{0};
-	uint32_t lim  =
-	  limit ? *limit : std::numeric_limits<uint32_t>::max() ;
-	unique_lock uniq(mtx, std::defer_lock);
+	uint32_t lim =
+	  limit ? *limit : std::numeric_limits<uint32_t>::max();
+	shared_latch shared(mtx, std::defer_lock);
 	if (likely(! (flags & FLAG_LOCKED))) {
-	  uniq.lock();
+	  shared.lock();
 	}
-
-	data_iterator it = (prefix)
-	  ? std::lower_bound(data.begin(), data.end(), K(*prefix),
-			     keysviewLT)
+	const auto& start = from ? from : prefix;
+	data_iterator it = (start)
+	  ? data.begin() + search(K(*start))
 	  : data.begin();
-	for (; it != data.end() && count < lim; ++it) {
-	  auto k = it->key;
-	  /* XXXX callback should not induce a string temporary */
-	  auto str = k.to_string(pv);
-	  // stop iteration iff prefix search and prefix not found
-	  if (prefix && (flags & FLAG_REQUIRE_PREFIX) &&
-	      !ba::starts_with(str, *prefix)) {
-	    goto out;
+	size_t plen = prefix ? prefix->length() : 0;
+	while ((it != data.end()) && (count < lim)) {
+	  auto tp = tie_prefix(pv, it->key);
+	  if (prefix && ! starts_with(tp, *prefix)) {
+	    break;
+	  }
+	  size_t off = delim.empty() ? std::string_view::npos
+	    : find(tp, delim, plen);
+	  int ret;
+	  if (off == std::string_view::npos) {
+	    ret = cb(tp, it->val, false);
+	    ++it;
+	  } else {
+	    size_t cplen = off + delim.length();
+	    ret = cb(head_view(tp, cplen), nullstr, true);
+	    auto succ = prefix_successor(head(tp, cplen));
+	    it = (succ)
+	      ? data.begin() + search(K(*succ), false, it - data.begin())
+	      : data.end();
 	  }
-	  //auto ret = cb(&k, &it->val);
-	  auto ret = cb(&str /* XXX */, &it->val);
 	  ++count;
-	  /* terminate iteration ?*/
 	  if (ret & FLAG_STOP) {
 	    break;
 	  }
-	} /* foreach data */
-      out:
+	} /* while data */
 	return count;
       } /* list */
 
-      std::vector<uint8_t> serialize() {
-	lock_guard guard(mtx);
+      std::vector<uint8_t> serialize(uint32_t flags = FLAG_NONE) {
+	shared_latch shared(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  shared.lock();
+	}
 	flexbuffers::Builder fbb;
 
+	std::string kbuf;
 	auto fkv =
-	  [&fbb] (const std::string *k, const std::string *v) -> int {
-	      fbb.String(*k);
-	      fbb.String(*v);
+	  [&fbb, &kbuf] (const sv_tuple& k, const std::string_view& v) -> int {
+	      if (std::get<0>(k).empty()) {
+		fbb.String(std::get<1>(k).data(), std::get<1>(k).length());
+	      } else {
+		kbuf.assign(std::get<0>(k));
+		kbuf.append(std::get<1>(k));
+		fbb.String(kbuf.data(), kbuf.length());
+	      }
+	      fbb.String(v.data(), v.length());
 	      return 0;
 	  };
 
+	/* the checksum covers the header fields before it and the
+	 * kv-data;  a type this build lacks is written as none */
+	auto ck_type = cksum_type;
+	std::string digest;
+	{
+	  node_cksum ck(ck_type);
+	  if (ck.valid()) {
+	    ck.add_header(type, fanout, prefix_min_len, lower_bound,
+			  upper_bound, right_sibling);
+	    list({},
+		 [&ck](const sv_tuple& k, const std::string_view& v) -> int {
+		   ck.add(k);
+		   ck.add(v);
+		   return 0;
+		 }, {}, FLAG_LOCKED);
+	    digest = ck.final();
+	  } else {
+	    ck_type = cksum::CksumType::none;
+	  }
+	}
+
+	/* a leaf's keys, filtered, so a lookup of one it lacks can be
+	 * answered from the stored header (see node_view) */
+	std::string filter;
+	if ((T == NodeType::Leaf) && (filter_bits > 0)) {
+	  bloom_filter bf(data.size(), filter_bits);
+	  list({},
+	       [&bf](const sv_tuple& k, const std::string_view& v) -> int {
+		 bf.add(bloom_filter::hash(k));
+		 return 0;
+	       }, {}, FLAG_LOCKED);
+	  filter = bf.encode();
+	}
+
 	fbb.Map(
-	  [&node = *this, &fbb, fkv]() {
+	  [&node = *this, &fbb, fkv, ck_type, &digest, &filter]() {
 	    fbb.Map(
 	      "rgw-bplus-leaf",
-	      [&fbb, &node, fkv]() {
+	      [&fbb, &node, fkv, ck_type, &digest, &filter]() {
 		fbb.Vector(
 		  "header",
-		  [&fbb, &node, fkv]() {
+		  [&fbb, &node, ck_type, &digest, &filter]() {
 		    fbb.UInt(ondisk_version);
 		    fbb.UInt(uint8_t(node.type));
 		    fbb.UInt(node.fanout);
 		    fbb.UInt(node.prefix_min_len);
-		    //fbb.String("more header fields");
+		    /* fences, null when unbounded */
+		    for (const auto& fk : {node.lower_bound, node.upper_bound}) {
+		      if (fk.unbounded()) {
+			fbb.Null();
+		      } else {
+			fbb.String(fk.as_leaf_key().stem);
+		      }
+		    }
+		    /* right sibling, null if none */
+		    if (node.right_sibling.empty()) {
+		      fbb.Null();
+		    } else {
+		      fbb.String(node.right_sibling);
+		    }
+		    /* checksum type, and digest (null if none) */
+		    fbb.UInt(uint16_t(ck_type));
+		    if (digest.empty()) {
+		      fbb.Null();
+		    } else {
+		      fbb.Blob(digest.data(), digest.length());
+		    }
+		    /* key filter (see bloom_filter), null if none */
+		    if (filter.empty()) {
+		      fbb.Null();
+		    } else {
+		      fbb.Blob(filter.data(), filter.length());
+		    }
 		  });
 		fbb.Vector(
 		  "kv-data",
 		  [&fbb, &node, fkv]() {
 		    node.list({}, fkv, {}, FLAG_LOCKED);
 		  });
-		/* XXXX actually this probably is another segment */
+		/* records are replayed over kv-data on load;  a whole
+		 * node has the log folded in, so this is empty (deltas
+		 * are separate segments) */
 		fbb.Vector(
 		  "update-log",
-		  [&fbb]() {
-		    fbb.String("update log records");
-		  });
+		  []() {});
 	      }); // Vector
 	  }); // Map
 	fbb.Finish();
 	return fbb.GetBuffer();
       } /* serialize */
 
+      /* the updates logged since the last writeback, as a segment
+       * to append after the stored node;  caller holds the node
+       * lock */
+      std::vector<uint8_t> serialize_delta() const {
+	auto ck_type = cksum_type;
+	std::string digest;
+	{
+	  node_cksum ck(ck_type);
+	  if (ck.valid()) {
+	    add_log(ck, update_log);
+	    digest = ck.final();
+	  } else {
+	    ck_type = cksum::CksumType::none;
+	  }
+	}
+	flexbuffers::Builder fbb;
+	fbb.Map(
+	  [&node = *this, &fbb, ck_type, &digest]() {
+	    fbb.Map(
+	      "rgw-bplus-delta",
+	      [&fbb, &node, ck_type, &digest]() {
+		fbb.Vector(
+		  "header",
+		  [&fbb, ck_type, &digest]() {
+		    fbb.UInt(ondisk_version);
+		    /* checksum of the records, as for a whole node */
+		    fbb.UInt(uint16_t(ck_type));
+		    if (digest.empty()) {
+		      fbb.Null();
+		    } else {
+		      fbb.Blob(digest.data(), digest.length());
+		    }
+		  });
+		fbb.Vector(
+		  "update-log",
+		  [&fbb, &node]() {
+		    serialize_log(fbb, node.update_log);
+		  });
+	      });
+	  });
+	fbb.Finish();
+	return fbb.GetBuffer();
+      } /* serialize_delta */
+
+      /* bytes that bring the stored node up to date, framed (see
+       * frame_segment()):  while the node is stored whole, can_delta
+       * and the log stays within limits, a delta of the updates since
+       * the last writeback, to append (*delta set);  else the whole
+       * node, to replace the object with, after which updates are
+       * logged afresh */
+      std::vector<uint8_t> writeback(bool can_delta, bool* delta,
+				     uint32_t flags = FLAG_NONE) {
+	excl_latch uniq(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  uniq.lock();
+	}
+	if (can_delta && log_on && (! update_log.empty()) &&
+	    (log_records + update_log.size() <= log_max_records) &&
+	    (log_bytes + log_pending_bytes <= log_max_bytes)) {
+	  auto seg = serialize_delta();
+	  log_records += update_log.size();
+	  log_bytes += seg.size();
+	  update_log.clear();
+	  log_pending_bytes = 0;
+	  *delta = true;
+	  return frame_segment(seg);
+	}
+	/* the stored form has no prefix vector, but re-pack ours while
+	 * we hold the node exclusive */
+	maybe_compact_prefixes();
+	auto seg = serialize(FLAG_LOCKED);
+	log_off();
+	log_on = true;
+	log_records = 0;
+	log_bytes = 0;
+	*delta = false;
+	return frame_segment(seg);
+      } /* writeback */
+
       friend class node_factory;
     }; /* Node */
 
@@ -285,53 +1496,521 @@ namespace rgw { namespace bplus {
     using branch_node = Node<fence_key, NodeType::Branch>;
     using node_ptr = std::variant<leaf_node*, branch_node*>;
 
+    /* decoded "header" vector of a serialized node */
+    struct node_header
+    {
+      uint32_t ondisk_version;
+      NodeType type;
+      uint32_t fanout;
+      uint16_t prefix_min_len;
+      fence_key lower_bound{key_range::unbounded};
+      fence_key upper_bound{key_range::unbounded};
+      std::string right_sibling;
+      cksum::CksumType cksum_type{cksum::CksumType::none};
+      std::string digest;
+      /* a leaf's encoded key filter, in place, or null */
+      const uint8_t* filter{nullptr};
+      size_t filter_size{0};
+    }; /* node_header */
+
+    class node_view;
+
     class node_factory {
     public:
-      static node_ptr from_flexbuffers(std::vector<uint8_t> flatv) {
-	node_ptr node;
-	auto map = flexbuffers::GetRoot(flatv).AsMap();
+      /* the node's segment vector (header, kv-data, update-log), or
+       * empty if flatv doesn't hold a node of a known version/type */
+      static flexbuffers::Vector node_segments(
+	const uint8_t* data, size_t size, node_header& hdr) {
+	auto map = flexbuffers::GetRoot(data, size).AsMap();
 	auto vec = map["rgw-bplus-leaf"].AsVector();
+	if (unlikely(vec.size() < 2)) {
+	  return flexbuffers::Vector::EmptyVector();
+	}
 	// header
 	auto header = vec[0].AsVector();
-	uint32_t ondisk_version = header[0].AsUInt32();
-	NodeType type = NodeType(header[1].AsUInt8());
-	uint32_t fanout = header[2].AsUInt32();
-	uint16_t prefix_min_len = header[3].AsUInt16();
+	hdr.ondisk_version = header[0].AsUInt32();
+	hdr.type = NodeType(header[1].AsUInt8());
+	hdr.fanout = header[2].AsUInt32();
+	hdr.prefix_min_len = header[3].AsUInt16();
+	/* fences were added to the header later;  absent, they read as
+	 * unbounded */
+	auto fence_at = [&header](size_t ix) -> fence_key {
+	  if ((ix >= header.size()) || header[ix].IsNull()) {
+	    return fence_key(key_range::unbounded);
+	  }
+	  auto s = header[ix].AsString();
+	  return fence_key(std::string(s.c_str(), s.length()));
+	};
+	hdr.lower_bound = fence_at(4);
+	hdr.upper_bound = fence_at(5);
+	if ((header.size() > 6) && header[6].IsString()) {
+	  auto s = header[6].AsString();
+	  hdr.right_sibling.assign(s.c_str(), s.length());
+	}
+	/* so was the checksum;  absent, it reads as none */
+	parse_cksum(header, 7, hdr);
+	/* and the key filter */
+	if ((header.size() > 9) && header[9].IsBlob()) {
+	  auto b = header[9].AsBlob();
+	  hdr.filter = b.data();
+	  hdr.filter_size = b.size();
+	}
+	if (unlikely((hdr.ondisk_version != ondisk_version) ||
+		     ((hdr.type != NodeType::Leaf) &&
+		      (hdr.type != NodeType::Branch)))) {
+	  return flexbuffers::Vector::EmptyVector();
+	}
+	return vec;
+      } /* node_segments */
+
+      /* checksum type and digest at header[ix], header[ix+1] */
+      static void parse_cksum(const flexbuffers::Vector& header, size_t ix,
+			      node_header& hdr) {
+	if (header.size() > ix + 1) {
+	  hdr.cksum_type = cksum::CksumType(header[ix].AsUInt16());
+	  auto b = header[ix + 1].AsBlob();
+	  hdr.digest.assign(reinterpret_cast<const char*>(b.data()), b.size());
+	}
+      } /* parse_cksum */
+
+      /* true iff the digest in hdr matches the node's content (or
+       * there is none);  a type this build lacks fails */
+      static bool verify(const node_header& hdr,
+			 const flexbuffers::Vector& kv_data) {
+	/* outside the digest, but carrying its own */
+	if (hdr.filter &&
+	    unlikely(! bloom_filter::verify(hdr.filter, hdr.filter_size))) {
+	  return false;
+	}
+	if (hdr.cksum_type == cksum::CksumType::none) {
+	  return true;
+	}
+	node_cksum ck(hdr.cksum_type);
+	if (unlikely(! ck.valid())) {
+	  return false;
+	}
+	ck.add_header(hdr.type, hdr.fanout, hdr.prefix_min_len,
+		      hdr.lower_bound, hdr.upper_bound, hdr.right_sibling);
+	for (size_t ix = 0; ix < kv_data.size(); ++ix) {
+	  auto s = kv_data[ix].AsString();
+	  ck.add(std::string_view(s.c_str(), s.length()));
+	}
+	return ck.final() == hdr.digest;
+      } /* verify */
+
+      /* as verify(), for a delta's header and records */
+      static bool verify_delta(const flexbuffers::Vector& header,
+			       const flexbuffers::Vector& recs) {
+	node_header hdr;
+	parse_cksum(header, 1, hdr);
+	if (hdr.cksum_type == cksum::CksumType::none) {
+	  return true;
+	}
+	node_cksum ck(hdr.cksum_type);
+	if (unlikely(! ck.valid())) {
+	  return false;
+	}
+	for (size_t ix = 0; ix + 2 < recs.size(); ix += 3) {
+	  auto key = recs[ix+1].AsString();
+	  auto val = recs[ix+2].AsString();
+	  ck.add(uint64_t(recs[ix].AsUInt8()));
+	  ck.add(std::string_view(key.c_str(), key.length()));
+	  ck.add(std::string_view(val.c_str(), val.length()));
+	}
+	return ck.final() == hdr.digest;
+      } /* verify_delta */
+
+      static node_ptr from_flexbuffers(const std::vector<uint8_t>& flatv) {
+	return from_flexbuffers(flatv.data(), flatv.size());
+      }
+
+      static node_ptr from_flexbuffers(const uint8_t* data, size_t size) {
+	node_ptr node;
+	node_header hdr;
+	auto vec = node_segments(data, size, hdr);
+	if (unlikely(vec.size() < 2)) {
+	  // unknown version or type
+	  return node;
+	}
 	auto kv_data = vec[1].AsVector();
-	// kv-data -- fill vectors, then sort keys_view
-	switch(type) {
+	if (unlikely(! verify(hdr, kv_data))) {
+	  return node;
+	}
+	// kv-data is in key order, so append (and re-prefix) in place
+	switch(hdr.type) {
 	case NodeType::Leaf:
-	  node = new leaf_node(fanout, prefix_min_len);
-	  break;
+	{
+	  auto ln = new leaf_node(hdr.fanout, hdr.prefix_min_len,
+				  hdr.lower_bound, hdr.upper_bound);
+	  ln->right_sibling = std::move(hdr.right_sibling);
+	  ln->cksum_type = hdr.cksum_type;
+	  if (hdr.filter) {
+	    ln->filter_bits = bloom_filter::encoded_bits_per_key(hdr.filter);
+	  }
+	  ln->data.reserve(kv_data.size() / 2);
+	  for (size_t kv_ix = 0; kv_ix < kv_data.size(); kv_ix += 2) {
+	    auto key = kv_data[kv_ix].AsString();
+	    auto val = kv_data[kv_ix+1].AsString();
+	    ln->append(leaf_key(std::string(key.c_str(), key.length())),
+		       std::string(val.c_str(), val.length()));
+	  }
+	  node = ln;
+	}
+	break;
 	case NodeType::Branch:
-	  break;
-	default:
-	  // unknown type
-	  // XXXX
-	  break;
+	{
+	  auto bn = new branch_node(hdr.fanout, hdr.prefix_min_len,
+				    hdr.lower_bound, hdr.upper_bound);
+	  bn->cksum_type = hdr.cksum_type;
+	  bn->data.reserve(kv_data.size() / 2);
+	  for (size_t kv_ix = 0; kv_ix < kv_data.size(); kv_ix += 2) {
+	    auto key = kv_data[kv_ix].AsString();
+	    auto val = kv_data[kv_ix+1].AsString();
+	    /* a leftmost branch entry is serialized as "" */
+	    auto fk = ((kv_ix == 0) && (key.length() == 0))
+	      ? fence_key(key_range::unbounded)
+	      : fence_key(std::string(key.c_str(), key.length()));
+	    bn->append(fk, std::string(val.c_str(), val.length()));
+	  }
+	  node = bn;
+	}
+	break;
 	};
-	for (int kv_ix = 0; kv_ix < kv_data.size(); kv_ix += 2) {
-	  // TODO:  verify sharing rep (i.e., flatv)
-	  auto key = kv_data[kv_ix].AsString().c_str();
-	  auto val = kv_data[kv_ix+1].AsString().c_str();
-	  switch(type) {
-	  case NodeType::Leaf:
-	    get<leaf_node*>(node)->data.emplace_back(leaf_key(key), val);
+	// update log
+	if (vec.size() > 2) {
+	  auto recs = vec[2].AsVector();
+	  std::visit([&recs](auto n) { n->replay(recs); }, node);
+	}
+	return node;
+      } /* from_flexbuffers */
+
+      /* a node from its stored object (see frame_segment()):  the
+       * whole node, with the deltas after it replayed in order (a
+       * torn last segment is ignored, but any checksum mismatch fails
+       * the node);  updates are then logged against it, as stored */
+      static node_ptr from_object(const std::vector<uint8_t>& obj) {
+	auto seg_len = [&obj](size_t off) -> size_t {
+	  if (off + 4 > obj.size()) {
+	    return 0;
+	  }
+	  size_t len{0};
+	  for (int ix = 0; ix < 4; ++ix) {
+	    len |= size_t(obj[off + ix]) << (8 * ix);
+	  }
+	  return (off + 4 + len <= obj.size()) ? len : 0;
+	};
+	size_t len = seg_len(0);
+	if (unlikely(len == 0)) {
+	  return node_ptr(static_cast<leaf_node*>(nullptr));
+	}
+	node_ptr node = from_flexbuffers(obj.data() + 4, len);
+	if (unlikely(std::visit([](auto n) { return n == nullptr; }, node))) {
+	  return node;
+	}
+	uint32_t nrecs{0};
+	size_t nbytes{0};
+	for (size_t off = 4 + len; (len = seg_len(off)) > 0; off += 4 + len) {
+	  auto map = flexbuffers::GetRoot(obj.data() + off + 4, len).AsMap();
+	  auto vec = map["rgw-bplus-delta"].AsVector();
+	  if (unlikely((vec.size() < 2) ||
+		       (vec[0].AsVector()[0].AsUInt32() != ondisk_version))) {
+	    break;
+	  }
+	  auto recs = vec[1].AsVector();
+	  if (unlikely(! verify_delta(vec[0].AsVector(), recs))) {
+	    /* unlike a torn segment, this lost an acknowledged update */
+	    std::visit([](auto n) { delete n; }, node);
+	    return node_ptr(static_cast<leaf_node*>(nullptr));
+	  }
+	  nrecs += std::visit([&recs](auto n) { return n->replay(recs); },
+			      node);
+	  nbytes += len;
+	}
+	std::visit(
+	  [nrecs, nbytes](auto n) {
+	    n->log_on = true;
+	    n->log_records = nrecs;
+	    n->log_bytes = nbytes;
+	  }, node);
+	return node;
+      } /* from_object */
+
+      static std::unique_ptr<node_view> view_flexbuffers(
+	std::vector<uint8_t>&& flatv);
+      /* a view over a stored object in place (data must outlive it),
+       * checked iff verify;  null if it can't be had, as when deltas
+       * follow the node */
+      static std::unique_ptr<node_view> view_object(
+	const uint8_t* data, size_t size, bool verify = true);
+      /* true iff the stored object holds a sound node */
+      static bool verify_object(const uint8_t* data, size_t size) {
+	return static_cast<bool>(view_object(data, size, true));
+      }
+    }; /* node_factory */
+
+    /* read-only node over its serialized form:  lookups and listings
+     * are answered from the flexbuffers kv-data in place, without
+     * decoding entries;  decode() yields a mutable Node once one is
+     * needed */
+    class node_view
+    {
+      std::vector<uint8_t> flatv; // empty, over borrowed bytes
+      const uint8_t* data;
+      size_t data_size;
+      node_header hdr;
+      flexbuffers::Vector kv_data; // points into data
+
+      std::string_view sv_at(size_t ix) const {
+	auto s = kv_data[ix].AsString();
+	return std::string_view(s.c_str(), s.length());
+      }
+
+      sv_tuple key_at(size_t ix) const {
+	return sv_tuple(nullstr, sv_at(2 * ix));
+      }
+
+      /* index of the first entry whose key is >= k (or > k, iff
+       * upper) */
+      size_t search(const sv_tuple& k, bool upper) const {
+	size_t lo{0}, hi{size()};
+	while (lo < hi) {
+	  size_t mid = lo + (hi - lo) / 2;
+	  auto res = compare(key_at(mid), k);
+	  if ((res < 0) || (upper && (res == 0))) {
+	    lo = mid + 1;
+	  } else {
+	    hi = mid;
+	  }
+	}
+	return lo;
+      } /* search */
+
+      void init() {
+	auto vec = node_factory::node_segments(data, data_size, hdr);
+	if (likely(vec.size() >= 2)) {
+	  kv_data = vec[1].AsVector();
+	}
+      }
+
+    public:
+      node_view(std::vector<uint8_t>&& _flatv)
+	: flatv(std::move(_flatv)), data(flatv.data()),
+	  data_size(flatv.size()),
+	  kv_data(flexbuffers::Vector::EmptyVector()) {
+	init();
+      }
+
+      /* over bytes it doesn't own, which must outlive it */
+      node_view(const uint8_t* _data, size_t _size)
+	: data(_data), data_size(_size),
+	  kv_data(flexbuffers::Vector::EmptyVector()) {
+	init();
+      }
+
+      node_view(const node_view&) = delete;
+      node_view& operator=(const node_view&) = delete;
+
+      NodeType type() const { return hdr.type; }
+      size_t size() const { return kv_data.size() / 2; }
+      const std::string& get_right_sibling() const {
+	return hdr.right_sibling;
+      }
+
+      bool has_filter() const { return hdr.filter != nullptr; }
+      /* false iff the leaf's key filter rules key out */
+      bool may_contain(const std::string& key) const {
+	return (! hdr.filter) ||
+	  bloom_filter::may_contain(hdr.filter, bloom_filter::hash(key));
+      }
+
+      int get(const std::string& key, std::string* val = nullptr) const {
+	sv_tuple k{nullstr, key};
+	size_t ix = search(k, false);
+	if ((ix == size()) ||
+	    (compare(key_at(ix), k) != 0)) {
+	  return ENOENT;
+	}
+	if (val) {
+	  *val = sv_at(2 * ix + 1);
+	}
+	return 0;
+      } /* get */
+
+      /* as Node::find_floor() (a leftmost "" key sorts first, as an
+       * unbounded fence would) */
+      std::optional<std::string> find_floor(const std::string& key) const {
+	size_t ix = search(sv_tuple(nullstr, key), true);
+	if (unlikely(ix == 0)) {
+	  return {};
+	}
+	return std::string(sv_at(2 * (ix - 1) + 1));
+      } /* find_floor */
+
+      /* as Node::list(sv_tuple callback) */
+      int list(
+	const std::optional<std::string>& prefix,
+	std::function<int(const sv_tuple&, const std::string_view&)> cb,
+	std::optional<uint32_t> limit,
+	uint32_t flags = FLAG_NONE) const {
+	uint32_t count{0};
+	uint32_t lim  =
+	  limit ? *limit : std::numeric_limits<uint32_t>::max() ;
+	size_t ix = (prefix) ? search(sv_tuple(nullstr, *prefix), false) : 0;
+	for (; ix < size() && count < lim; ++ix) {
+	  auto tp = key_at(ix);
+	  // stop iteration iff prefix search and prefix not found
+	  if (prefix && (flags & FLAG_REQUIRE_PREFIX) &&
+	      !starts_with(tp, *prefix)) {
 	    break;
-	  case NodeType::Branch:
+	  }
+	  auto ret = cb(tp, sv_at(2 * ix + 1));
+	  ++count;
+	  /* terminate iteration ?*/
+	  if (ret & FLAG_STOP) {
 	    break;
-	  default:
-	    // unknown type
+	  }
+	}
+	return count;
+      } /* list */
+
+      node_ptr decode() const {
+	return node_factory::from_flexbuffers(data, data_size);
+      }
+    }; /* node_view */
+
+    inline std::unique_ptr<node_view> node_factory::view_flexbuffers(
+      std::vector<uint8_t>&& flatv) {
+      node_header hdr;
+      auto vec = node_segments(flatv.data(), flatv.size(), hdr);
+      if (unlikely((vec.size() < 2) || (! verify(hdr, vec[1].AsVector())))) {
+	return nullptr;
+      }
+      return std::make_unique<node_view>(std::move(flatv));
+    } /* view_flexbuffers */
+
+    inline std::unique_ptr<node_view> node_factory::view_object(
+      const uint8_t* data, size_t size, bool verify) {
+      /* one segment (see frame_segment()), filling the object */
+      if (unlikely(size < 4)) {
+	return nullptr;
+      }
+      size_t len{0};
+      for (int ix = 0; ix < 4; ++ix) {
+	len |= size_t(data[ix]) << (8 * ix);
+      }
+      if (unlikely(len + 4 != size)) {
+	return nullptr;
+      }
+      node_header hdr;
+      auto vec = node_segments(data + 4, len, hdr);
+      if (unlikely((vec.size() < 2) ||
+		   (verify && (! node_factory::verify(hdr, vec[1].AsVector()))))) {
+	return nullptr;
+      }
+      return std::make_unique<node_view>(data + 4, len);
+    } /* view_object */
+
+    /* a leaf's entries copied out flat, into one arena, to be read
+     * with no latch:  much cheaper to take than serialize() and a
+     * node_view, for copies that are never stored (snapshots' leaf
+     * versions, see Tree) */
+    class leaf_image
+    {
+      struct entry {
+	uint32_t koff;
+	uint32_t klen;
+	uint32_t vlen; // the value follows the key
+      };
+
+      std::string arena;
+      std::vector<entry> ents;
+      fence_key upper_bound{key_range::unbounded};
+      std::string right_sibling;
+
+      std::string_view key_at(size_t ix) const {
+	return std::string_view(arena.data() + ents[ix].koff, ents[ix].klen);
+      }
+      std::string_view val_at(size_t ix) const {
+	return std::string_view(arena.data() + ents[ix].koff + ents[ix].klen,
+				ents[ix].vlen);
+      }
+
+      /* index of the first key >= k */
+      size_t lower_bound(const std::string_view& k) const {
+	size_t lo{0}, hi{ents.size()};
+	while (lo < hi) {
+	  size_t mid = lo + (hi - lo) / 2;
+	  if (key_at(mid) < k) {
+	    lo = mid + 1;
+	  } else {
+	    hi = mid;
+	  }
+	}
+	return lo;
+      } /* lower_bound */
+
+    public:
+      /* of leaf, latched by the caller */
+      explicit leaf_image(leaf_node& leaf)
+	: upper_bound(leaf.get_upper_bound(FLAG_LOCKED)),
+	  right_sibling(leaf.get_right_sibling(FLAG_LOCKED)) {
+	ents.reserve(leaf.size(FLAG_LOCKED));
+	arena.reserve(leaf.size(FLAG_LOCKED) * 64);
+	leaf.list(
+	  {},
+	  [this](const sv_tuple& k, const std::string_view& v) -> int {
+	    uint32_t koff = arena.size();
+	    arena.append(std::get<0>(k));
+	    arena.append(std::get<1>(k));
+	    arena.append(v);
+	    ents.push_back(entry{koff, uint32_t(len(k)), uint32_t(v.length())});
+	    return 0;
+	  }, {}, FLAG_LOCKED);
+      }
+
+      leaf_image(const leaf_image&) = delete;
+      leaf_image& operator=(const leaf_image&) = delete;
+
+      size_t size() const { return ents.size(); }
+      const fence_key& get_upper_bound() const { return upper_bound; }
+      const std::string& get_right_sibling() const { return right_sibling; }
+
+      int get(const std::string& key, std::string* val = nullptr) const {
+	size_t ix = lower_bound(key);
+	if ((ix == ents.size()) || (key_at(ix) != key)) {
+	  return ENOENT;
+	}
+	if (val) {
+	  val->assign(val_at(ix));
+	}
+	return 0;
+      } /* get */
+
+      /* as Node::list(sv_tuple callback) */
+      int list(
+	const std::optional<std::string>& prefix,
+	std::function<int(const sv_tuple&, const std::string_view&)> cb,
+	std::optional<uint32_t> limit,
+	uint32_t flags = FLAG_NONE) const {
+	uint32_t count{0};
+	uint32_t lim =
+	  limit ? *limit : std::numeric_limits<uint32_t>::max();
+	size_t ix = prefix ? lower_bound(*prefix) : 0;
+	for (; (ix < ents.size()) && (count < lim); ++ix) {
+	  auto k = key_at(ix);
+	  if (prefix && (flags & FLAG_REQUIRE_PREFIX) &&
+	      (k.compare(0, prefix->length(), *prefix) != 0)) {
 	    break;
-	  };
+	  }
+	  auto ret = cb(sv_tuple(nullstr, k), val_at(ix));
+	  ++count;
+	  if (ret & FLAG_STOP) {
+	    break;
+	  }
 	}
-	// except keys_view is already sorted!
-	//std::sort(keys_view.begin(), keys_view.end(), keysviewLT);
-	// update log
-	auto update_log = vec[2]; // XXX not used yet
-	return node;
-      } /* from_flexbuffers */
-    }; /* unserialize_node */
+	return count;
+      } /* list */
+    }; /* leaf_image */
 
 }} /* namespace */
 
@@ -0,0 +1,337 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2019 Red Hat, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation. See file COPYING.
+ *
+ */
+
+#include "bplus_paged.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <mutex>
+
+namespace rgw { namespace bplus {
+
+    std::shared_ptr<paged_store> paged_store::open(
+      const std::string& path, bool read_only, bool sync, uint32_t page_size,
+      size_t max_bytes, int* ret)
+    {
+      std::shared_ptr<paged_store> ps(new paged_store(path, read_only, sync));
+      int r = ps->init(page_size, max_bytes);
+      if (ret) {
+	*ret = r;
+      }
+      return (r == 0) ? ps : nullptr;
+    } /* open */
+
+    int paged_store::init(uint32_t _page_size, size_t _max_bytes)
+    {
+      fd = ::open(path.c_str(),
+		  (read_only ? O_RDONLY : (O_RDWR | O_CREAT)) | O_CLOEXEC,
+		  0644);
+      if (fd < 0) {
+	return errno;
+      }
+      struct stat st;
+      if (::fstat(fd, &st) < 0) {
+	return errno;
+      }
+      auto page_size_ok = [](uint32_t ps) {
+	return (ps >= min_page_size) && ((ps & (ps - 1)) == 0);
+      };
+      bool fresh = (st.st_size == 0);
+      if (fresh) {
+	if (read_only || (! page_size_ok(_page_size))) {
+	  return EINVAL;
+	}
+	page_size = _page_size;
+	if (::ftruncate(fd, page_size) < 0) {
+	  return errno;
+	}
+	file_pages = 1;
+      } else {
+	superblock hdr;
+	if ((::pread(fd, &hdr, sizeof(hdr), 0) != ssize_t(sizeof(hdr))) ||
+	    (::memcmp(hdr.magic, sb_magic, sizeof(sb_magic)) != 0) ||
+	    (hdr.version != version) || (! page_size_ok(hdr.page_size)) ||
+	    (uint64_t(st.st_size) < hdr.npages * hdr.page_size)) {
+	  return EINVAL;
+	}
+	page_size = hdr.page_size;
+	file_pages = st.st_size / page_size;
+      }
+      /* read-only, the file can't grow */
+      max_bytes = read_only ? file_pages * page_size
+			    : std::max(_max_bytes, size_t(file_pages) * page_size);
+      void* p = ::mmap(nullptr, max_bytes,
+		       read_only ? PROT_READ : (PROT_READ | PROT_WRITE),
+		       MAP_SHARED, fd, 0);
+      if (p == MAP_FAILED) {
+	base = nullptr;
+	return errno;
+      }
+      base = static_cast<uint8_t*>(p);
+      if (fresh) {
+	/* the rest of the page (the directory) is already zeros */
+	::memcpy(sb()->magic, sb_magic, sizeof(sb_magic));
+	sb()->version = version;
+	sb()->page_size = page_size;
+	sb()->npages = 1;
+	sb()->free_head = 0;
+	sb()->nfree = 0;
+	sync_range(0);
+      }
+      if (read_only) {
+	verified.reset(new std::atomic<uint8_t>[sb()->npages]);
+	for (uint64_t ix = 0; ix < sb()->npages; ++ix) {
+	  verified[ix] = 0;
+	}
+      }
+      return 0;
+    } /* init */
+
+    paged_store::~paged_store()
+    {
+      if (base) {
+	::munmap(base, max_bytes);
+      }
+      if (fd >= 0) {
+	::close(fd);
+      }
+    } /* ~paged_store */
+
+    uint64_t paged_store::page_count() const
+    {
+      std::shared_lock<std::shared_mutex> shared(mtx);
+      return sb()->npages;
+    } /* page_count */
+
+    uint64_t paged_store::free_count() const
+    {
+      std::shared_lock<std::shared_mutex> shared(mtx);
+      return sb()->nfree;
+    } /* free_count */
+
+    paged_store::dir_entry* paged_store::find_dir(
+      const std::string& name) const
+    {
+      if (name.empty() || (name.length() >= dir_name_len)) {
+	return nullptr;
+      }
+      dir_entry* d = dir();
+      for (uint32_t ix = 0; ix < dir_size(); ++ix) {
+	if (::strncmp(d[ix].name, name.c_str(), dir_name_len) == 0) {
+	  return &d[ix];
+	}
+      }
+      return nullptr;
+    } /* find_dir */
+
+    /* the page holding name, or 0 */
+    uint64_t paged_store::resolve(const std::string& name) const
+    {
+      if (name.empty() || (name[0] != '@')) {
+	auto e = find_dir(name);
+	return e ? e->page : 0;
+      }
+      if ((name.length() < 2) || (name.length() > 17)) {
+	return 0;
+      }
+      uint64_t page{0};
+      for (size_t ix = 1; ix < name.length(); ++ix) {
+	char c = name[ix];
+	int d = ((c >= '0') && (c <= '9')) ? (c - '0')
+	  : ((c >= 'a') && (c <= 'f')) ? (c - 'a' + 10) : -1;
+	if (d < 0) {
+	  return 0;
+	}
+	page = (page << 4) | d;
+      }
+      if ((page == 0) || (page >= sb()->npages) ||
+	  (page_at(page)->magic != page_object)) {
+	return 0;
+      }
+      return page;
+    } /* resolve */
+
+    /* from the free list, else by growing the file */
+    int paged_store::alloc_page(uint64_t* page)
+    {
+      superblock* s = sb();
+      if (s->free_head != 0) {
+	*page = s->free_head;
+	s->free_head = page_at(*page)->next_free;
+	--(s->nfree);
+      } else {
+	if ((s->npages + 1) * page_size > max_bytes) {
+	  return ENOSPC;
+	}
+	if (s->npages == file_pages) {
+	  /* in steps of 1/8th, so growth is amortized */
+	  uint64_t grow = std::max(file_pages / 8, uint64_t(16));
+	  grow = std::min(grow, max_bytes / page_size - file_pages);
+	  if (::ftruncate(fd, (file_pages + grow) * page_size) < 0) {
+	    return errno;
+	  }
+	  file_pages += grow;
+	}
+	*page = s->npages++;
+      }
+      page_header* ph = page_at(*page);
+      ph->magic = page_object;
+      ph->len = 0;
+      ph->next_free = 0;
+      sync_range(0);
+      sync_range(*page);
+      return 0;
+    } /* alloc_page */
+
+    void paged_store::free_page(uint64_t page)
+    {
+      superblock* s = sb();
+      page_header* ph = page_at(page);
+      ph->magic = page_free;
+      ph->len = 0;
+      ph->next_free = s->free_head;
+      s->free_head = page;
+      ++(s->nfree);
+      sync_range(page);
+      sync_range(0);
+    } /* free_page */
+
+    void paged_store::sync_range(uint64_t page, uint64_t npages)
+    {
+      if (sync) {
+	::msync(base + page * page_size, npages * page_size, MS_SYNC);
+      }
+    } /* sync_range */
+
+    int paged_store::read(const std::string& name, std::vector<uint8_t>& bytes)
+    {
+      std::shared_lock<std::shared_mutex> shared(mtx);
+      uint64_t page = resolve(name);
+      if (page == 0) {
+	return ENOENT;
+      }
+      page_header* ph = page_at(page);
+      auto data = reinterpret_cast<const uint8_t*>(ph + 1);
+      bytes.assign(data, data + ph->len);
+      return 0;
+    } /* read */
+
+    int paged_store::write(const std::string& name,
+			   const std::vector<uint8_t>& bytes)
+    {
+      if (read_only) {
+	return EROFS;
+      }
+      if (bytes.size() > capacity()) {
+	return EFBIG;
+      }
+      std::unique_lock<std::shared_mutex> uniq(mtx);
+      uint64_t page = resolve(name);
+      if (page == 0) {
+	if (name.empty() || (name[0] == '@')) {
+	  return ENOENT; // not from alloc_name()
+	}
+	if (name.length() >= dir_name_len) {
+	  return ENAMETOOLONG;
+	}
+	dir_entry* e = nullptr;
+	dir_entry* d = dir();
+	for (uint32_t ix = 0; (! e) && (ix < dir_size()); ++ix) {
+	  if (d[ix].name[0] == '\0') {
+	    e = &d[ix];
+	  }
+	}
+	if (! e) {
+	  return ENOSPC;
+	}
+	int ret = alloc_page(&page);
+	if (ret != 0) {
+	  return ret;
+	}
+	::strncpy(e->name, name.c_str(), dir_name_len);
+	e->page = page;
+	sync_range(0);
+      }
+      page_header* ph = page_at(page);
+      ::memcpy(ph + 1, bytes.data(), bytes.size());
+      ph->len = bytes.size();
+      sync_range(page);
+      return 0;
+    } /* write */
+
+    int paged_store::remove(const std::string& name)
+    {
+      if (read_only) {
+	return EROFS;
+      }
+      std::unique_lock<std::shared_mutex> uniq(mtx);
+      uint64_t page = resolve(name);
+      if (page == 0) {
+	return ENOENT;
+      }
+      if (name[0] != '@') {
+	dir_entry* e = find_dir(name);
+	::memset(e, 0, sizeof(*e));
+      }
+      free_page(page);
+      return 0;
+    } /* remove */
+
+    std::string paged_store::alloc_name()
+    {
+      if (read_only) {
+	return std::string();
+      }
+      uint64_t page;
+      {
+	std::unique_lock<std::shared_mutex> uniq(mtx);
+	if (alloc_page(&page) != 0) {
+	  return std::string();
+	}
+      }
+      char buf[20];
+      ::snprintf(buf, sizeof(buf), "@%llx", (unsigned long long) page);
+      return std::string(buf);
+    } /* alloc_name */
+
+    /* read-only, nothing is written under the mapping (so no latch) */
+    const uint8_t* paged_store::map(const std::string& name, size_t* size,
+				    const verify_func& verify)
+    {
+      if (! read_only) {
+	return nullptr;
+      }
+      uint64_t page = resolve(name);
+      if (page == 0) {
+	return nullptr;
+      }
+      page_header* ph = page_at(page);
+      auto data = reinterpret_cast<const uint8_t*>(ph + 1);
+      uint8_t state = verified[page].load(std::memory_order_acquire);
+      if (state == 0) {
+	state = ((! verify) || verify(data, ph->len)) ? 1 : 2;
+	verified[page].store(state, std::memory_order_release);
+      }
+      if (state != 1) {
+	return nullptr;
+      }
+      *size = ph->len;
+      return data;
+    } /* map */
+
+}} /* namespace */
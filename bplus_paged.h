@@ -0,0 +1,147 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2019 Red Hat, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation. See file COPYING.
+ *
+ */
+
+#ifndef BPLUS_PAGED_H
+#define BPLUS_PAGED_H
+
+#include "bplus_store.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <shared_mutex>
+
+namespace rgw { namespace bplus {
+
+    /* trees kept whole in one file of fixed-size pages, mapped:  page
+     * 0 is the superblock (format, geometry, the free-page list, and a
+     * directory of named objects--tree roots);  every other object is
+     * one page, named by its number (see alloc_name()), so nodes link
+     * to each other by page;  reads copy from the mapping, with no
+     * syscall, and a store opened read-only (nothing changing under
+     * them) serves objects in place through map();  writes are in
+     * place, so a torn page is caught only by its node's checksum */
+    class paged_store : public object_store
+    {
+    public:
+      static constexpr uint32_t default_page_size = 16384;
+      static constexpr uint32_t min_page_size = 4096;
+      /* address space reserved for the file to grow into */
+      static constexpr size_t default_max_bytes = size_t(1) << 36;
+
+      /* at path, created (unless read_only) if absent, with page_size
+       * (an existing file keeps its own);  null on error, with *ret
+       * set to an errno */
+      static std::shared_ptr<paged_store> open(
+	const std::string& path, bool read_only = false, bool sync = false,
+	uint32_t page_size = default_page_size,
+	size_t max_bytes = default_max_bytes, int* ret = nullptr);
+
+      ~paged_store();
+
+      uint32_t get_page_size() const { return page_size; }
+      size_t capacity() const override {
+	return page_size - sizeof(page_header);
+      }
+      uint64_t page_count() const;
+      uint64_t free_count() const;
+
+      int read(const std::string& name, std::vector<uint8_t>& bytes) override;
+      /* EFBIG if bytes exceed capacity();  a page name must have come
+       * from alloc_name() */
+      int write(const std::string& name,
+		const std::vector<uint8_t>& bytes) override;
+      int remove(const std::string& name) override;
+
+      /* a page rewrites as cheaply as it appends */
+      bool appends() const override {
+	return false;
+      }
+      /* a free page's name ("@<page, hex>"), the page now allocated */
+      std::string alloc_name() override;
+      const uint8_t* map(const std::string& name, size_t* size,
+			 const verify_func& verify) override;
+
+    private:
+      static constexpr char sb_magic[8] = {'R','G','W','B','P','A','G','E'};
+      static constexpr uint32_t version = 1;
+      static constexpr uint32_t page_object = 0x424f4750; // "PGOB"
+      static constexpr uint32_t page_free = 0x52464750; // "PGFR"
+      static constexpr size_t dir_name_len = 120;
+
+      struct dir_entry {
+	char name[dir_name_len]; // NUL-padded, "" if unused
+	uint64_t page;
+      };
+
+      struct superblock {
+	char magic[8];
+	uint32_t version;
+	uint32_t page_size;
+	uint64_t npages; // the superblock's included
+	uint64_t free_head; // 0 if none
+	uint64_t nfree;
+	/* then the directory, to the end of the page */
+      };
+
+      struct page_header {
+	uint32_t magic;
+	uint32_t len; // of the object
+	uint64_t next_free; // on the free list
+      };
+
+      const std::string path;
+      const bool read_only;
+      const bool sync;
+      uint32_t page_size;
+      size_t max_bytes;
+      uint64_t file_pages{0}; // the file's length, >= npages
+      int fd{-1};
+      uint8_t* base{nullptr}; // the mapping, max_bytes long
+
+      /* shared to read, exclusive to write (or change the layout) */
+      mutable std::shared_mutex mtx;
+
+      /* per page, when read-only:  0 unchecked, 1 sound, 2 not */
+      std::unique_ptr<std::atomic<uint8_t>[]> verified;
+
+      paged_store(const std::string& _path, bool _read_only, bool _sync)
+	: path(_path), read_only(_read_only), sync(_sync) {}
+
+      int init(uint32_t _page_size, size_t _max_bytes);
+
+      superblock* sb() const {
+	return reinterpret_cast<superblock*>(base);
+      }
+      dir_entry* dir() const {
+	return reinterpret_cast<dir_entry*>(base + sizeof(superblock));
+      }
+      uint32_t dir_size() const {
+	return (page_size - sizeof(superblock)) / sizeof(dir_entry);
+      }
+      page_header* page_at(uint64_t page) const {
+	return reinterpret_cast<page_header*>(base + page * page_size);
+      }
+
+      /* callers hold mtx */
+      uint64_t resolve(const std::string& name) const;
+      dir_entry* find_dir(const std::string& name) const;
+      int alloc_page(uint64_t* page);
+      void free_page(uint64_t page);
+      void sync_range(uint64_t page, uint64_t npages = 1);
+    }; /* paged_store */
+
+}} /* namespace */
+
+#endif /* BPLUS_PAGED_H */
@@ -0,0 +1,283 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2019 Red Hat, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation. See file COPYING.
+ *
+ */
+
+#ifndef BPLUS_SLOTTED_H
+#define BPLUS_SLOTTED_H
+
+#include "compat.h"
+#include "bplus_key.h"
+#include "bplus_node.h" // FLAG_*, latch types
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+
+namespace rgw { namespace bplus {
+
+    /* contiguous leaf representation:  a sorted array of fixed-size
+     * slots over one byte heap holding stems, values and the node's
+     * prefixes;  search touches only the slots (and the heap on head
+     * ties), and inserts shift only slots */
+    class slotted_leaf
+    {
+    public:
+      const uint32_t fanout;
+      const uint16_t prefix_min_len;
+
+      struct slot {
+	uint32_t off;  // stem, then value, in heap
+	uint32_t vlen;
+	uint16_t klen; // stem length
+	uint16_t pref; // prefix id, or no_prefix
+	uint32_t head; // first 4 bytes of the logical key, big-endian
+      }; /* slot */
+
+      static constexpr uint16_t no_prefix =
+	std::numeric_limits<uint16_t>::max();
+
+    private:
+      struct prefix_ref {
+	uint32_t off;
+	uint16_t len;
+      }; /* prefix_ref */
+
+      mutable latch_type mtx;
+      std::vector<slot> slots; // sorted by logical key
+      std::vector<prefix_ref> prefixes;
+      std::vector<char> heap;
+      size_t garbage{0}; // heap bytes no slot refers to
+
+      std::string_view prefix_view(uint16_t pref) const {
+	if (pref == no_prefix) {
+	  return nullstr;
+	}
+	return std::string_view(heap.data() + prefixes[pref].off,
+				prefixes[pref].len);
+      }
+
+      sv_tuple key_view(const slot& s) const {
+	return sv_tuple(prefix_view(s.pref),
+			std::string_view(heap.data() + s.off, s.klen));
+      }
+
+      std::string_view val_view(const slot& s) const {
+	return std::string_view(heap.data() + s.off + s.klen, s.vlen);
+      }
+
+      static uint32_t key_head(const sv_tuple& k) {
+	uint32_t head{0};
+	size_t n = std::min(len(k), size_t(4));
+	for (size_t ix = 0; ix < n; ++ix) {
+	  head |= uint32_t(uint8_t(at(k, ix))) << (24 - 8 * ix);
+	}
+	return head;
+      }
+
+      /* index of the first slot whose key is >= k;  heads order keys
+       * exactly except on ties, which fall back to the full key */
+      size_t lower_bound_ix(const sv_tuple& k, uint32_t head) const {
+	size_t lo{0}, hi{slots.size()};
+	while (lo < hi) {
+	  size_t mid = lo + (hi - lo) / 2;
+	  const slot& s = slots[mid];
+	  bool lt = (s.head != head) ? (s.head < head)
+	    : less_than(key_view(s), k);
+	  if (lt) {
+	    lo = mid + 1;
+	  } else {
+	    hi = mid;
+	  }
+	}
+	return lo;
+      } /* lower_bound_ix */
+
+      uint32_t heap_append(std::string_view sv) {
+	uint32_t off = heap.size();
+	heap.insert(heap.end(), sv.begin(), sv.end());
+	return off;
+      }
+
+      /* rewrite the heap with only live stems, values and prefixes */
+      void compact() {
+	std::vector<char> nheap;
+	std::vector<prefix_ref> nprefixes;
+	std::vector<uint16_t> remap(prefixes.size(), no_prefix);
+	nheap.reserve(heap.size() - garbage);
+	for (auto& s : slots) {
+	  if (s.pref != no_prefix) {
+	    if (remap[s.pref] == no_prefix) {
+	      auto pv = prefix_view(s.pref);
+	      remap[s.pref] = nprefixes.size();
+	      nprefixes.push_back(prefix_ref{uint32_t(nheap.size()),
+					     uint16_t(pv.length())});
+	      nheap.insert(nheap.end(), pv.begin(), pv.end());
+	    }
+	    s.pref = remap[s.pref];
+	  }
+	  uint32_t off = nheap.size();
+	  nheap.insert(nheap.end(), heap.begin() + s.off,
+		       heap.begin() + s.off + s.klen + s.vlen);
+	  s.off = off;
+	}
+	heap.swap(nheap);
+	prefixes.swap(nprefixes);
+	garbage = 0;
+      } /* compact */
+
+    public:
+      slotted_leaf(uint32_t _fanout, uint16_t _prefix_min_len)
+	: fanout(_fanout), prefix_min_len(_prefix_min_len)
+	{
+	  slots.reserve(fanout);
+	}
+
+      size_t size(uint32_t flags = FLAG_NONE) const {
+	shared_latch shared(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  shared.lock();
+	}
+	return slots.size();
+      } /* size */
+
+      /* bytes held by this node */
+      size_t footprint() const {
+	shared_latch shared(mtx);
+	return sizeof(*this) + slots.capacity() * sizeof(slot) +
+	  prefixes.capacity() * sizeof(prefix_ref) + heap.capacity();
+      } /* footprint */
+
+      int insert(const std::string& key, const std::string& value,
+		 uint32_t flags = FLAG_NONE) {
+	excl_latch uniq(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  uniq.lock();
+	}
+	sv_tuple k{nullstr, key};
+	uint32_t head = key_head(k);
+	size_t ix = lower_bound_ix(k, head);
+	if (ix < slots.size() &&
+	    unlikely(compare(key_view(slots[ix]), k) == 0)) {
+	  return EEXIST;
+	}
+	if (slots.size() == fanout) {
+	  return E2BIG;
+	}
+	// key prefixing, as make_prefix_key():  carry the predecessor's
+	// prefix forward, or start a longer one shared with it
+	uint16_t pref{no_prefix};
+	size_t plen{0};
+	if (ix > 0) {
+	  const slot& prev = slots[ix-1];
+	  auto cpl = common_prefix_len(key_view(prev), k);
+	  if (prev.pref != no_prefix &&
+	      cpl >= prefixes[prev.pref].len) {
+	    pref = prev.pref;
+	    plen = prefixes[prev.pref].len;
+	  }
+	  if ((cpl > prefix_min_len) && (cpl > plen) &&
+	      (prefixes.size() < no_prefix) &&
+	      (cpl <= std::numeric_limits<uint16_t>::max())) {
+	    prefixes.push_back(
+	      prefix_ref{heap_append(std::string_view(key).substr(0, cpl)),
+			 uint16_t(cpl)});
+	    pref = prefixes.size() - 1;
+	    plen = cpl;
+	  }
+	}
+	slot s;
+	s.off = heap_append(std::string_view(key).substr(plen));
+	heap_append(value);
+	s.vlen = value.length();
+	s.klen = key.length() - plen;
+	s.pref = pref;
+	s.head = head;
+	slots.insert(slots.begin() + ix, s);
+	return 0;
+      } /* insert */
+
+      int remove(const std::string& key, uint32_t flags = FLAG_NONE) {
+	excl_latch uniq(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  uniq.lock();
+	}
+	sv_tuple k{nullstr, key};
+	size_t ix = lower_bound_ix(k, key_head(k));
+	if (ix < slots.size() &&
+	    compare(key_view(slots[ix]), k) == 0) {
+	  garbage += slots[ix].klen + slots[ix].vlen;
+	  slots.erase(slots.begin() + ix);
+	  if (garbage > heap.size() / 2) {
+	    compact();
+	  }
+	}
+	return 0;
+      } /* remove */
+
+      int get(const std::string& key, std::string* val = nullptr,
+	      uint32_t flags = FLAG_NONE) const {
+	shared_latch shared(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  shared.lock();
+	}
+	sv_tuple k{nullstr, key};
+	size_t ix = lower_bound_ix(k, key_head(k));
+	if (ix == slots.size() ||
+	    compare(key_view(slots[ix]), k) != 0) {
+	  return ENOENT;
+	}
+	if (val) {
+	  *val = val_view(slots[ix]);
+	}
+	return 0;
+      } /* get */
+
+      /* as Node::list(sv_tuple callback) */
+      int list(
+	const std::optional<std::string>& prefix,
+	std::function<int(const sv_tuple&, const std::string_view&)> cb,
+	std::optional<uint32_t> limit,
+	uint32_t flags = FLAG_NONE) {
+	uint32_t count{0};
+	uint32_t lim  =
+	  limit ? *limit : std::numeric_limits<uint32_t>::max() ;
+	shared_latch shared(mtx, std::defer_lock);
+	if (likely(! (flags & FLAG_LOCKED))) {
+	  shared.lock();
+	}
+	size_t ix{0};
+	if (prefix) {
+	  sv_tuple k{nullstr, *prefix};
+	  ix = lower_bound_ix(k, key_head(k));
+	}
+	for (; ix < slots.size() && count < lim; ++ix) {
+	  auto tp = key_view(slots[ix]);
+	  // stop iteration iff prefix search and prefix not found
+	  if (prefix && (flags & FLAG_REQUIRE_PREFIX) &&
+	      !starts_with(tp, *prefix)) {
+	    break;
+	  }
+	  auto ret = cb(tp, val_view(slots[ix]));
+	  ++count;
+	  /* terminate iteration ?*/
+	  if (ret & FLAG_STOP) {
+	    break;
+	  }
+	}
+	return count;
+      } /* list */
+    }; /* slotted_leaf */
+
+}} /* namespace */
+
+#endif /* BPLUS_SLOTTED_H */
@@ -0,0 +1,574 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2019 Red Hat, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation. See file COPYING.
+ *
+ */
+
+#include "bplus_store.h"
+#include "xxhash.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cctype>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace rgw { namespace bplus {
+
+    aio_pool::aio_pool(uint32_t nthreads)
+    {
+      for (uint32_t ix = 0; ix < std::max(nthreads, 1u); ++ix) {
+	workers.emplace_back(&aio_pool::worker, this);
+      }
+    }
+
+    aio_pool::~aio_pool()
+    {
+      {
+	std::lock_guard<std::mutex> guard(mtx);
+	stopping = true;
+      }
+      cv.notify_all();
+      for (auto& t : workers) {
+	t.join();
+      }
+    }
+
+    /* runs queued jobs until stopped and the queue is empty */
+    void aio_pool::worker()
+    {
+      std::unique_lock<std::mutex> uniq(mtx);
+      for (;;) {
+	cv.wait(uniq, [this]() { return stopping || ! q.empty(); });
+	if (q.empty()) {
+	  return;
+	}
+	auto fn = std::move(q.front());
+	q.pop_front();
+	++busy;
+	uniq.unlock();
+	fn();
+	uniq.lock();
+	--busy;
+	if (q.empty() && (busy == 0)) {
+	  idle_cv.notify_all();
+	}
+      }
+    } /* worker */
+
+    void aio_pool::submit(std::function<void()> fn)
+    {
+      {
+	std::lock_guard<std::mutex> guard(mtx);
+	q.push_back(std::move(fn));
+      }
+      cv.notify_one();
+    } /* submit */
+
+    void aio_pool::drain()
+    {
+      std::unique_lock<std::mutex> uniq(mtx);
+      idle_cv.wait(uniq, [this]() { return q.empty() && (busy == 0); });
+    } /* drain */
+
+    int object_store::append(const std::string& name,
+			     const std::vector<uint8_t>& bytes)
+    {
+      std::vector<uint8_t> obj;
+      int ret = read(name, obj);
+      if (ret != 0) {
+	return ret;
+      }
+      obj.insert(obj.end(), bytes.begin(), bytes.end());
+      return write(name, obj);
+    } /* append */
+
+    void object_store::aio_read(const std::string& name, read_cb cb)
+    {
+      std::vector<uint8_t> bytes;
+      int ret = read(name, bytes);
+      cb(ret, std::move(bytes));
+    } /* aio_read */
+
+    void object_store::aio_write(const std::string& name,
+				 std::vector<uint8_t>&& bytes, write_cb cb)
+    {
+      cb(write(name, bytes));
+    } /* aio_write */
+
+    namespace {
+      /* counts down completions of one batch */
+      class batch_wait
+      {
+	std::mutex mtx;
+	std::condition_variable cv;
+	size_t outstanding;
+      public:
+	explicit batch_wait(size_t n) : outstanding(n) {}
+	void complete() {
+	  std::lock_guard<std::mutex> guard(mtx);
+	  if (--outstanding == 0) {
+	    cv.notify_all();
+	  }
+	}
+	void wait() {
+	  std::unique_lock<std::mutex> uniq(mtx);
+	  cv.wait(uniq, [this]() { return outstanding == 0; });
+	}
+      }; /* batch_wait */
+
+      int first_error(const std::vector<int>& rets) {
+	for (auto ret : rets) {
+	  if (ret != 0) {
+	    return ret;
+	  }
+	}
+	return 0;
+      }
+
+      /* issue one aio per object (each cb reporting into the batch),
+       * then flush, if given, and wait */
+      using read_issue = std::function<void(const std::string&,
+					    object_store::read_cb)>;
+      using write_issue = std::function<void(const std::string&,
+					     std::vector<uint8_t>&&,
+					     object_store::write_cb)>;
+
+      int read_batch_via(const std::vector<std::string>& names,
+			 std::vector<std::vector<uint8_t>>& bytes,
+			 std::vector<int>& rets, read_issue issue,
+			 std::function<void()> flush) {
+	bytes.assign(names.size(), std::vector<uint8_t>());
+	rets.assign(names.size(), 0);
+	batch_wait bw(names.size());
+	for (size_t ix = 0; ix < names.size(); ++ix) {
+	  issue(
+	    names[ix],
+	    [&bytes, &rets, &bw, ix](int ret, std::vector<uint8_t>&& b) {
+	      rets[ix] = ret;
+	      bytes[ix] = std::move(b);
+	      bw.complete();
+	    });
+	}
+	if (flush) {
+	  flush();
+	}
+	bw.wait();
+	return first_error(rets);
+      }
+
+      int write_batch_via(
+	std::vector<std::pair<std::string, std::vector<uint8_t>>>& objs,
+	std::vector<int>& rets, write_issue issue,
+	std::function<void()> flush) {
+	rets.assign(objs.size(), 0);
+	batch_wait bw(objs.size());
+	for (size_t ix = 0; ix < objs.size(); ++ix) {
+	  issue(
+	    objs[ix].first, std::move(objs[ix].second),
+	    [&rets, &bw, ix](int ret) {
+	      rets[ix] = ret;
+	      bw.complete();
+	    });
+	}
+	if (flush) {
+	  flush();
+	}
+	bw.wait();
+	return first_error(rets);
+      }
+
+      /* names for temporaries, unique in this process */
+      std::string tmp_path_for(const std::string& final_path) {
+	static std::atomic<uint64_t> tmp_seq{0};
+	return final_path + ".tmp." +
+	  std::to_string(tmp_seq.fetch_add(1, std::memory_order_relaxed));
+      }
+
+      /* close a written temporary and, if all went well, rename it
+       * into place (else remove it) */
+      int commit_tmp(int fd, int ret, const std::string& tmp_path,
+		     const std::string& final_path) {
+	if ((::close(fd) < 0) && (ret == 0)) {
+	  ret = errno;
+	}
+	if ((ret == 0) &&
+	    (::rename(tmp_path.c_str(), final_path.c_str()) < 0)) {
+	  ret = errno;
+	}
+	if (ret != 0) {
+	  ::unlink(tmp_path.c_str());
+	}
+	return ret;
+      }
+
+      /* write bytes at fd's offset (the end, if O_APPEND) */
+      int write_all(int fd, const std::vector<uint8_t>& bytes, bool sync) {
+	size_t off{0};
+	while (off < bytes.size()) {
+	  ssize_t n = ::write(fd, bytes.data() + off, bytes.size() - off);
+	  if (n < 0) {
+	    if (errno == EINTR) {
+	      continue;
+	    }
+	    return errno;
+	  }
+	  off += n;
+	}
+	if (sync && (::fsync(fd) < 0)) {
+	  return errno;
+	}
+	return 0;
+      }
+    } /* namespace */
+
+    int object_store::read_batch(const std::vector<std::string>& names,
+				 std::vector<std::vector<uint8_t>>& bytes,
+				 std::vector<int>& rets)
+    {
+      return read_batch_via(
+	names, bytes, rets,
+	[this](const std::string& name, read_cb cb) {
+	  aio_read(name, std::move(cb));
+	}, nullptr);
+    } /* read_batch */
+
+    int object_store::write_batch(
+      std::vector<std::pair<std::string, std::vector<uint8_t>>>& objs,
+      std::vector<int>& rets)
+    {
+      return write_batch_via(
+	objs, rets,
+	[this](const std::string& name, std::vector<uint8_t>&& bytes,
+	       write_cb cb) {
+	  aio_write(name, std::move(bytes), std::move(cb));
+	}, nullptr);
+    } /* write_batch */
+
+    int memory_store::read(const std::string& name,
+			   std::vector<uint8_t>& bytes)
+    {
+      std::shared_lock<std::shared_mutex> shared(mtx);
+      auto it = objs.find(name);
+      if (it == objs.end()) {
+	return ENOENT;
+      }
+      bytes = it->second;
+      return 0;
+    } /* read */
+
+    int memory_store::write(const std::string& name,
+			    const std::vector<uint8_t>& bytes)
+    {
+      std::unique_lock<std::shared_mutex> uniq(mtx);
+      objs[name] = bytes;
+      return 0;
+    } /* write */
+
+    int memory_store::remove(const std::string& name)
+    {
+      std::unique_lock<std::shared_mutex> uniq(mtx);
+      return (objs.erase(name) > 0) ? 0 : ENOENT;
+    } /* remove */
+
+    int memory_store::append(const std::string& name,
+			     const std::vector<uint8_t>& bytes)
+    {
+      std::unique_lock<std::shared_mutex> uniq(mtx);
+      auto it = objs.find(name);
+      if (it == objs.end()) {
+	return ENOENT;
+      }
+      it->second.insert(it->second.end(), bytes.begin(), bytes.end());
+      return 0;
+    } /* append */
+
+    /* node names are z85, so may hold '/' and other characters file
+     * names shouldn't:  keep [A-Za-z0-9_-], %-escape the rest (so
+     * '.' only appears in temporary file names) */
+    std::string file_store::path(const std::string& name) const
+    {
+      static constexpr char hex[] = "0123456789ABCDEF";
+      std::string p{dir};
+      p.reserve(dir.length() + 1 + name.length() * 3);
+      p += '/';
+      for (unsigned char c : name) {
+	if (isalnum(c) || (c == '_') || (c == '-')) {
+	  p += c;
+	} else {
+	  p += '%';
+	  p += hex[c >> 4];
+	  p += hex[c & 0xf];
+	}
+      }
+      return p;
+    } /* path */
+
+    int file_store::read(const std::string& name, std::vector<uint8_t>& bytes)
+    {
+      int fd = ::open(path(name).c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+	return errno;
+      }
+      int ret{0};
+      struct stat st;
+      if (::fstat(fd, &st) < 0) {
+	ret = errno;
+      } else {
+	bytes.resize(st.st_size);
+	size_t off{0};
+	while (off < bytes.size()) {
+	  ssize_t n = ::pread(fd, bytes.data() + off, bytes.size() - off, off);
+	  if (n < 0) {
+	    if (errno == EINTR) {
+	      continue;
+	    }
+	    ret = errno;
+	    break;
+	  }
+	  if (n == 0) {
+	    ret = EIO; // truncated underneath us
+	    break;
+	  }
+	  off += n;
+	}
+      }
+      ::close(fd);
+      return ret;
+    } /* read */
+
+    int file_store::write(const std::string& name,
+			  const std::vector<uint8_t>& bytes)
+    {
+      auto final_path = path(name);
+      auto tmp_path = tmp_path_for(final_path);
+      int fd = ::open(tmp_path.c_str(),
+		      O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (fd < 0) {
+	return errno;
+      }
+      return commit_tmp(fd, write_all(fd, bytes, sync), tmp_path, final_path);
+    } /* write */
+
+    int file_store::remove(const std::string& name)
+    {
+      if (::unlink(path(name).c_str()) < 0) {
+	return errno;
+      }
+      return 0;
+    } /* remove */
+
+    /* no tmp+rename:  a torn append leaves a short last segment,
+     * which readers ignore */
+    int file_store::append(const std::string& name,
+			   const std::vector<uint8_t>& bytes)
+    {
+      int fd = ::open(path(name).c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+      if (fd < 0) {
+	return errno;
+      }
+      int ret = write_all(fd, bytes, sync);
+      if ((::close(fd) < 0) && (ret == 0)) {
+	ret = errno;
+      }
+      return ret;
+    } /* append */
+
+    void file_store::uring_read(const std::string& name, read_cb cb)
+    {
+      int fd = ::open(path(name).c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+	cb(errno, std::vector<uint8_t>());
+	return;
+      }
+      struct stat st;
+      int ret = (::fstat(fd, &st) < 0) ? errno : 0;
+      if ((ret != 0) || (st.st_size == 0)) {
+	::close(fd);
+	cb(ret, std::vector<uint8_t>());
+	return;
+      }
+      auto bytes = std::make_shared<std::vector<uint8_t>>(st.st_size);
+      uring->prep_read(
+	fd, bytes->data(), bytes->size(), 0,
+	[fd, bytes, cb = std::move(cb)](int ret) {
+	  ::close(fd);
+	  cb(ret, std::move(*bytes));
+	});
+    } /* uring_read */
+
+    void file_store::uring_write(const std::string& name,
+				 std::vector<uint8_t>&& bytes, write_cb cb)
+    {
+      auto final_path = path(name);
+      auto tmp_path = tmp_path_for(final_path);
+      int fd = ::open(tmp_path.c_str(),
+		      O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (fd < 0) {
+	cb(errno);
+	return;
+      }
+      if (bytes.empty()) {
+	int ret = (sync && (::fsync(fd) < 0)) ? errno : 0;
+	cb(commit_tmp(fd, ret, tmp_path, final_path));
+	return;
+      }
+      auto obj = std::make_shared<std::vector<uint8_t>>(std::move(bytes));
+      uring->prep_write(
+	fd, obj->data(), obj->size(), 0, sync,
+	[fd, obj, tmp_path, final_path, cb = std::move(cb)](int ret) {
+	  cb(commit_tmp(fd, ret, tmp_path, final_path));
+	});
+    } /* uring_write */
+
+    void file_store::aio_read(const std::string& name, read_cb cb)
+    {
+      if (uring) {
+	uring_read(name, std::move(cb));
+	(void) uring->submit();
+	return;
+      }
+      pool.submit(
+	[this, name, cb = std::move(cb)]() {
+	  std::vector<uint8_t> bytes;
+	  int ret = read(name, bytes);
+	  cb(ret, std::move(bytes));
+	});
+    } /* aio_read */
+
+    void file_store::aio_write(const std::string& name,
+			       std::vector<uint8_t>&& bytes, write_cb cb)
+    {
+      if (uring) {
+	uring_write(name, std::move(bytes), std::move(cb));
+	(void) uring->submit();
+	return;
+      }
+      pool.submit(
+	[this, name, bytes = std::move(bytes), cb = std::move(cb)]() {
+	  cb(write(name, bytes));
+	});
+    } /* aio_write */
+
+    int file_store::read_batch(const std::vector<std::string>& names,
+			       std::vector<std::vector<uint8_t>>& bytes,
+			       std::vector<int>& rets)
+    {
+      if (! uring) {
+	return object_store::read_batch(names, bytes, rets);
+      }
+      return read_batch_via(
+	names, bytes, rets,
+	[this](const std::string& name, read_cb cb) {
+	  uring_read(name, std::move(cb));
+	},
+	[this]() { (void) uring->submit(); });
+    } /* read_batch */
+
+    int file_store::write_batch(
+      std::vector<std::pair<std::string, std::vector<uint8_t>>>& objs,
+      std::vector<int>& rets)
+    {
+      if (! uring) {
+	return object_store::write_batch(objs, rets);
+      }
+      return write_batch_via(
+	objs, rets,
+	[this](const std::string& name, std::vector<uint8_t>&& bytes,
+	       write_cb cb) {
+	  uring_write(name, std::move(bytes), std::move(cb));
+	},
+	[this]() { (void) uring->submit(); });
+    } /* write_batch */
+
+    uint32_t place(const std::string_view& name, uint32_t nshards)
+    {
+      uint64_t key = XXH64(name.data(), name.length(), 0);
+      int64_t b{-1}, j{0};
+      while (j < int64_t(nshards)) {
+	b = j;
+	key = key * 2862933555777941757ULL + 1;
+	j = int64_t((b + 1) *
+		    (double(1LL << 31) / double((key >> 33) + 1)));
+      }
+      return uint32_t(b);
+    } /* place */
+
+    sharded_store::sharded_store(
+      std::vector<std::shared_ptr<object_store>> _shards)
+      : shards(std::move(_shards)),
+	ops(new std::atomic<uint64_t>[shards.size()])
+    {
+      for (size_t ix = 0; ix < shards.size(); ++ix) {
+	ops[ix] = 0;
+      }
+    } /* sharded_store */
+
+    object_store* sharded_store::shard_for(const std::string& name)
+    {
+      uint32_t ix = shard_of(name);
+      ops[ix].fetch_add(1, std::memory_order_relaxed);
+      return shards[ix].get();
+    } /* shard_for */
+
+    std::vector<uint64_t> sharded_store::shard_ops() const
+    {
+      std::vector<uint64_t> counts(shards.size());
+      for (size_t ix = 0; ix < shards.size(); ++ix) {
+	counts[ix] = ops[ix].load(std::memory_order_relaxed);
+      }
+      return counts;
+    } /* shard_ops */
+
+    int sharded_store::read(const std::string& name,
+			    std::vector<uint8_t>& bytes)
+    {
+      return shard_for(name)->read(name, bytes);
+    } /* read */
+
+    int sharded_store::write(const std::string& name,
+			     const std::vector<uint8_t>& bytes)
+    {
+      return shard_for(name)->write(name, bytes);
+    } /* write */
+
+    int sharded_store::remove(const std::string& name)
+    {
+      return shard_for(name)->remove(name);
+    } /* remove */
+
+    int sharded_store::append(const std::string& name,
+			      const std::vector<uint8_t>& bytes)
+    {
+      return shard_for(name)->append(name, bytes);
+    } /* append */
+
+    void sharded_store::aio_read(const std::string& name, read_cb cb)
+    {
+      shard_for(name)->aio_read(name, std::move(cb));
+    } /* aio_read */
+
+    void sharded_store::aio_write(const std::string& name,
+				  std::vector<uint8_t>&& bytes, write_cb cb)
+    {
+      shard_for(name)->aio_write(name, std::move(bytes), std::move(cb));
+    } /* aio_write */
+
+    void sharded_store::drain()
+    {
+      for (auto& shard : shards) {
+	shard->drain();
+      }
+    } /* drain */
+
+}} /* namespace */
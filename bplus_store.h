@@ -0,0 +1,262 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2019 Red Hat, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation. See file COPYING.
+ *
+ */
+
+#ifndef BPLUS_STORE_H
+#define BPLUS_STORE_H
+
+#include "compat.h"
+#include "bplus_uring.h"
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <map>
+#include <utility>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <functional>
+
+namespace rgw { namespace bplus {
+
+    /* worker threads for blocking (file) i/o */
+    class aio_pool
+    {
+      std::mutex mtx;
+      std::condition_variable cv;
+      std::condition_variable idle_cv;
+      std::deque<std::function<void()>> q;
+      std::vector<std::thread> workers;
+      uint32_t busy{0};
+      bool stopping{false};
+
+      void worker();
+
+    public:
+      explicit aio_pool(uint32_t nthreads);
+      ~aio_pool();
+
+      void submit(std::function<void()> fn);
+      /* wait until every submitted job has run */
+      void drain();
+    }; /* aio_pool */
+
+    /* node objects by name:  the interface IO (and the node cache)
+     * persist through;  RADOS in production, memory or local files in
+     * tests */
+    class object_store
+    {
+    public:
+      using read_cb = std::function<void(int ret, std::vector<uint8_t>&& bytes)>;
+      using write_cb = std::function<void(int ret)>;
+
+      virtual ~object_store() {}
+
+      /* 0, or an errno (ENOENT if there is no such object) */
+      virtual int read(const std::string& name,
+		       std::vector<uint8_t>& bytes) = 0;
+      virtual int write(const std::string& name,
+			const std::vector<uint8_t>& bytes) = 0;
+      virtual int remove(const std::string& name) = 0;
+      /* add bytes to the end of an existing object (ENOENT if there
+       * is none);  by default, a read and a write */
+      virtual int append(const std::string& name,
+			 const std::vector<uint8_t>& bytes);
+
+      /* async:  cb runs exactly once, possibly before return and
+       * possibly on another thread;  by default these complete
+       * inline */
+      virtual void aio_read(const std::string& name, read_cb cb);
+      virtual void aio_write(const std::string& name,
+			     std::vector<uint8_t>&& bytes, write_cb cb);
+      /* wait for outstanding aio */
+      virtual void drain() {}
+
+      /* batched:  issued together through aio, so reads and writes
+       * overlap;  rets gets each object's result, and the first error
+       * (if any) is returned */
+      virtual int read_batch(const std::vector<std::string>& names,
+			     std::vector<std::vector<uint8_t>>& bytes,
+			     std::vector<int>& rets);
+      virtual int write_batch(
+	std::vector<std::pair<std::string, std::vector<uint8_t>>>& objs,
+	std::vector<int>& rets);
+
+      /* whether to append deltas at all:  a store that rewrites an
+       * object in place as cheaply wants whole objects */
+      virtual bool appends() const {
+	return true;
+      }
+      /* the most an object can hold, 0 if unbounded:  nodes are
+       * split to fit (see Node::set_max_bytes()) */
+      virtual size_t capacity() const {
+	return 0;
+      }
+      /* a name for a new object, if the store assigns them (else
+       * empty, and the caller names it) */
+      virtual std::string alloc_name() {
+	return std::string();
+      }
+
+      /* true iff an object's bytes are sound */
+      using verify_func = std::function<bool(const uint8_t*, size_t)>;
+      /* an object read in place:  its bytes, valid while the store
+       * lives, with *size set;  or null, if the store doesn't map
+       * objects (the default) or verify--run once per object--fails
+       * it */
+      virtual const uint8_t* map(const std::string& name, size_t* size,
+				 const verify_func& verify) {
+	return nullptr;
+      }
+    }; /* object_store */
+
+    class memory_store : public object_store
+    {
+      mutable std::shared_mutex mtx;
+      std::map<std::string, std::vector<uint8_t>> objs;
+
+    public:
+      int read(const std::string& name, std::vector<uint8_t>& bytes) override;
+      int write(const std::string& name,
+		const std::vector<uint8_t>& bytes) override;
+      int remove(const std::string& name) override;
+      int append(const std::string& name,
+		 const std::vector<uint8_t>& bytes) override;
+
+      size_t size() const {
+	std::shared_lock<std::shared_mutex> shared(mtx);
+	return objs.size();
+      }
+    }; /* memory_store */
+
+    /* how a file_store does aio:  blocking i/o on a pool of threads,
+     * or io_uring (falling back to the pool where it can't be had) */
+    enum class aio_engine : uint8_t {
+      threads,
+      uring,
+    };
+
+    /* one file per object in dir, which must exist;  names are
+     * escaped into file names, and writes replace files atomically
+     * (write to a temporary, then rename) */
+    class file_store : public object_store
+    {
+      const std::string dir;
+      const bool sync; // fsync each object written
+      std::unique_ptr<uring_engine> uring;
+      aio_pool pool; // idle, with uring
+
+      std::string path(const std::string& name) const;
+      /* queue on uring:  opening (and the rename, for writes) is
+       * done inline, the transfer and any fsync by the ring */
+      void uring_read(const std::string& name, read_cb cb);
+      void uring_write(const std::string& name,
+		       std::vector<uint8_t>&& bytes, write_cb cb);
+
+    public:
+      static constexpr uint32_t default_aio_threads = 4;
+
+      file_store(const std::string& _dir, bool _sync = false,
+		 uint32_t aio_threads = default_aio_threads,
+		 aio_engine engine = aio_engine::uring)
+	: dir(_dir), sync(_sync),
+	  uring((engine == aio_engine::uring) ? uring_engine::create()
+					      : nullptr),
+	  pool(uring ? 1 : aio_threads) {}
+
+      ~file_store() {
+	drain();
+      }
+
+      /* the engine in use */
+      aio_engine engine() const {
+	return uring ? aio_engine::uring : aio_engine::threads;
+      }
+
+      int read(const std::string& name, std::vector<uint8_t>& bytes) override;
+      int write(const std::string& name,
+		const std::vector<uint8_t>& bytes) override;
+      int remove(const std::string& name) override;
+      int append(const std::string& name,
+		 const std::vector<uint8_t>& bytes) override;
+
+      void aio_read(const std::string& name, read_cb cb) override;
+      void aio_write(const std::string& name,
+		     std::vector<uint8_t>&& bytes, write_cb cb) override;
+      void drain() override {
+	pool.drain();
+	if (uring) {
+	  uring->drain();
+	}
+      }
+
+      /* with uring, each batch goes to the kernel in one submission */
+      int read_batch(const std::vector<std::string>& names,
+		     std::vector<std::vector<uint8_t>>& bytes,
+		     std::vector<int>& rets) override;
+      int write_batch(
+	std::vector<std::pair<std::string, std::vector<uint8_t>>>& objs,
+	std::vector<int>& rets) override;
+    }; /* file_store */
+
+    /* consistent placement:  which of nshards name goes to, by jump
+     * consistent hash (Lamping & Veach) of its XXH64;  adding a shard
+     * moves only the ~1/(nshards + 1) of names the new one takes */
+    uint32_t place(const std::string_view& name, uint32_t nshards);
+
+    /* objects spread over shards (pools, or stores of any kind) by
+     * place();  operations are counted per shard, to measure how
+     * evenly i/o spreads */
+    class sharded_store : public object_store
+    {
+      const std::vector<std::shared_ptr<object_store>> shards;
+      std::unique_ptr<std::atomic<uint64_t>[]> ops;
+
+      object_store* shard_for(const std::string& name);
+
+    public:
+      explicit sharded_store(
+	std::vector<std::shared_ptr<object_store>> _shards);
+
+      uint32_t size() const {
+	return shards.size();
+      }
+      uint32_t shard_of(const std::string& name) const {
+	return place(name, shards.size());
+      }
+      object_store* get_shard(uint32_t ix) const {
+	return shards[ix].get();
+      }
+      /* operations directed to each shard so far */
+      std::vector<uint64_t> shard_ops() const;
+
+      int read(const std::string& name, std::vector<uint8_t>& bytes) override;
+      int write(const std::string& name,
+		const std::vector<uint8_t>& bytes) override;
+      int remove(const std::string& name) override;
+      int append(const std::string& name,
+		 const std::vector<uint8_t>& bytes) override;
+
+      void aio_read(const std::string& name, read_cb cb) override;
+      void aio_write(const std::string& name,
+		     std::vector<uint8_t>&& bytes, write_cb cb) override;
+      void drain() override;
+    }; /* sharded_store */
+
+}} /* namespace */
+
+#endif /* BPLUS_STORE_H */
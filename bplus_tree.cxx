@@ -12,14 +12,18 @@
  */
 
 #include "bplus_tree.h"
-#include "z85.hpp"
+
+#include <algorithm>
 
 namespace rgw { namespace bplus {
 
-    Tree::Tree(std::string _name, uint32_t _fanout)
-      : name(_name), fanout(_fanout)
+    Tree::Tree(std::string _name, uint32_t _fanout,
+	       uint16_t _prefix_min_len, IO& _io,
+	       cksum::CksumType _cksum_type)
+      : name(_name), fanout(_fanout), prefix_min_len(_prefix_min_len),
+	io(_io), cksum_type(_cksum_type), height_(0)
     {
-    } /* Tree(std::string, uint32_t) */
+    } /* Tree(std::string, uint32_t, uint16_t, IO&, cksum::CksumType) */
 
     std::string Tree::root_name() const {
       std::string s{name_stem};
@@ -29,45 +33,1253 @@ namespace rgw { namespace bplus {
       return s;
     } /* root_name() */
 
+    /* id as z85::encode would give its 16 big-endian bytes:  each 32
+     * bits as 5 base-85 digits, written in place */
+    static constexpr size_t z85_id_len = 20;
+
+    static inline void z85_id(const node_id& id, char* out) {
+      static constexpr char z85_digits[] =
+	"0123456789abcdefghijklmnopqrstuvwxyz"
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZ.-:+=^!/*?&<>()[]{}@%$#";
+      for (uint64_t word : {id.hi, id.lo}) {
+	for (int shift : {32, 0}) {
+	  uint32_t v = uint32_t(word >> shift);
+	  for (int ix = 4; ix >= 0; --ix) {
+	    out[ix] = z85_digits[v % 85];
+	    v /= 85;
+	  }
+	  out += 5;
+	}
+      }
+    } /* z85_id */
+
     std::string Tree::gen_node_name() const {
-      std::string s{name_stem};
-      s.reserve(s.length() + name.length() + 2 + 24);
-      s += "-" + name + "-" +
-	z85::encode(io.random_bytes(16));
+      /* a store that places objects itself names them */
+      if (auto st = io.get_store()) {
+	std::string s = st->alloc_name();
+	if (! s.empty()) {
+	  return s;
+	}
+      }
+      std::string s;
+      s.reserve(name_stem.length() + name.length() + 2 + z85_id_len);
+      s += name_stem;
+      s += '-';
+      s += name;
+      s += '-';
+      size_t off = s.length();
+      s.resize(off + z85_id_len);
+      z85_id(IO::next_node_id(), s.data() + off);
       return s;
     } /* gen_node_name() */
 
-    node_ptr Tree::get_node_for_k(const std::string&) {
-      // XXXX find or create node
+    int Tree::check_entry(const std::string& key,
+			  const std::string& value) const {
+      size_t max_bytes = io.cache.get_node_max_bytes();
+      if (likely(max_bytes == 0)) {
+	return 0;
+      }
+      /* a separator takes the key, with a (generated) node name */
+      size_t name_len = name_stem.length() + name.length() + 2 + z85_id_len;
+      size_t bytes =
+	leaf_node::entry_bytes(key.length(), std::max(value.length(), name_len));
+      return (bytes > leaf_node::max_entry_bytes(max_bytes)) ? EFBIG : 0;
+    } /* check_entry */
+
+    /* child of bn (latched by caller) whose key range contains fk,
+     * pinned */
+    static inline node_cache::ref child_for(
+      IO& io, branch_node* bn, const fence_key& fk) {
+      auto child_name = bn->find_floor(fk, FLAG_LOCKED);
+      if (unlikely(! child_name)) {
+	return node_cache::ref();
+      }
+      return io.get_node(*child_name);
+    } /* child_for */
+
+    void Tree::init_root() {
+      std::call_once(
+	root_once,
+	[this]() {
+	  // find and pin node
+	  root_ref = io.get_node(root_name());
+	  if (! root_ref) {
+	    /* new tree:  the root starts out as an empty leaf */
+	    auto root = new leaf_node(fanout, prefix_min_len);
+	    root->set_cksum_type(cksum_type, FLAG_LOCKED);
+	    root->set_filter_bits(leaf_filter_bits, FLAG_LOCKED);
+	    root_ref = io.put_node(root_name(), root);
+	    height_ = 1;
+	    return;
+	  }
+	  /* existing tree:  measure it down its leftmost edge */
+	  uint32_t h{1};
+	  node_cache::ref node = root_ref;
+	  while (std::holds_alternative<branch_node*>(node.get())) {
+	    auto bn = node.as<branch_node>();
+	    bn->lock_shared();
+	    auto child = child_for(io, bn, fence_key(key_range::unbounded));
+	    bn->unlock_shared();
+	    if (unlikely(! child)) {
+	      break;
+	    }
+	    node = std::move(child);
+	    ++h;
+	  }
+	  height_ = h;
+	});
+    } /* init_root */
 
-      return static_cast<leaf_node*>(nullptr);
+    static inline void latch_node(node_ptr node, bool excl_leaf) {
+      if (excl_leaf && std::holds_alternative<leaf_node*>(node)) {
+	get<leaf_node*>(node)->lock();
+	return;
+      }
+      std::visit([](auto n) { n->lock_shared(); }, node);
+    } /* latch_node */
+
+    /* descend to the leaf for k by latch coupling:  each child is
+     * pinned and latched before its parent is released;  branches are
+     * latched shared, the leaf shared or (iff excl) exclusive, and is
+     * returned latched */
+    node_cache::ref Tree::find_leaf(const std::string& k, bool excl) {
+      fence_key fk{k};
+      shared_latch root_latch(root_mtx);
+      node_cache::ref node = root_ref;
+      latch_node(node.get(), excl);
+      root_latch.unlock();
+      while (std::holds_alternative<branch_node*>(node.get())) {
+	auto bn = node.as<branch_node>();
+	auto child = child_for(io, bn, fk);
+	if (unlikely(! child)) {
+	  bn->unlock_shared();
+	  return node_cache::ref();
+	}
+	latch_node(child.get(), excl);
+	bn->unlock_shared();
+	node = std::move(child);
+      }
+      return node;
+    } /* find_leaf */
+
+    node_cache::ref Tree::get_node_for_k(const std::string& k) {
+      init_root();
+      auto leaf = find_leaf(k, false);
+      if (leaf) {
+	leaf.as<leaf_node>()->unlock_shared();
+      }
+      return leaf;
     } /* get_node_for_k */
 
+    /* as find_leaf(), but a child the store maps is read in place
+     * (see IO::view_node()), it and the subtree under it bypassing the
+     * cache */
+    int Tree::get(const std::string& key, std::string* val)
+    {
+      init_root();
+      auto tf = std::atomic_load(&tree_filter);
+      if (tf) {
+	if (! tf->may_contain(bloom_filter::hash(key))) {
+	  count(fstats.tree_skips);
+	  return ENOENT;
+	}
+	count(fstats.tree_hits);
+      }
+      int leaf_filter{0};
+      int ret = get_impl(key, val, &leaf_filter);
+      if ((ret == ENOENT) && (leaf_filter >= 0) &&
+	  (tf || (leaf_filter > 0))) {
+	count(fstats.false_positives);
+      }
+      return ret;
+    } /* get */
+
+    /* *leaf_filter is set to 1 if a leaf's filter passed the key, -1
+     * if it refused it */
+    int Tree::get_impl(const std::string& key, std::string* val,
+		       int* leaf_filter)
+    {
+      fence_key fk{key};
+      shared_latch root_latch(root_mtx);
+      node_cache::ref node = root_ref;
+      latch_node(node.get(), false);
+      root_latch.unlock();
+      std::unique_ptr<node_view> view;
+      for (;;) {
+	std::optional<std::string> child_name;
+	if (view) {
+	  if (view->type() == NodeType::Leaf) {
+	    if (view->has_filter()) {
+	      if (! view->may_contain(key)) {
+		count(fstats.leaf_skips);
+		*leaf_filter = -1;
+		return ENOENT;
+	      }
+	      count(fstats.leaf_hits);
+	      *leaf_filter = 1;
+	    }
+	    return view->get(key, val);
+	  }
+	  child_name = view->find_floor(key);
+	} else if (std::holds_alternative<leaf_node*>(node.get())) {
+	  auto leaf = node.as<leaf_node>();
+	  int ret = leaf->get(leaf_key(key), val, FLAG_LOCKED);
+	  leaf->unlock_shared();
+	  return ret;
+	} else {
+	  child_name = node.as<branch_node>()->find_floor(fk, FLAG_LOCKED);
+	}
+	auto next_view =
+	  child_name ? io.view_node(*child_name) : std::unique_ptr<node_view>();
+	node_cache::ref child;
+	if ((! next_view) && child_name) {
+	  child = io.get_node(*child_name);
+	  if (child) {
+	    latch_node(child.get(), false);
+	  }
+	}
+	if (! view) {
+	  node.as<branch_node>()->unlock_shared();
+	}
+	if (unlikely((! next_view) && (! child))) {
+	  return EIO;
+	}
+	view = std::move(next_view);
+	node = std::move(child);
+      }
+    } /* get_impl */
+
+    /* split node (latched exclusive by caller), returning the new
+     * right sibling, pinned;  when node is the root (and the caller
+     * holds root_mtx exclusive), it is renamed and a new branch root
+     * is installed over the two halves, so that the root name never
+     * changes;  nothing can reach rhs (or a new root) until the
+     * caller releases its latches, so those are filled unlatched */
+    template <typename N>
+    node_cache::ref Tree::split_node(N* node, bool is_root, std::string& sep,
+				     std::string& rhs_name) {
+      N* rhs = new N(fanout, prefix_min_len);
+      sep = node->split(*rhs, FLAG_LOCKED);
+      rhs_name = gen_node_name();
+      if constexpr (std::is_same_v<N, leaf_node>) {
+	rhs->set_right_sibling(node->get_right_sibling(FLAG_LOCKED),
+			       FLAG_LOCKED);
+	node->set_right_sibling(rhs_name, FLAG_LOCKED);
+      }
+      auto rhs_ref = io.put_node(rhs_name, rhs);
+      if (is_root) {
+	auto lhs_name = gen_node_name();
+	io.rename_node(root_name(), lhs_name);
+	auto new_root = new branch_node(fanout, prefix_min_len);
+	new_root->set_cksum_type(cksum_type, FLAG_LOCKED);
+	new_root->insert(fence_key(key_range::unbounded), lhs_name,
+			 FLAG_LOCKED);
+	new_root->insert(fence_key(sep), rhs_name, FLAG_LOCKED);
+	root_ref = io.put_node(root_name(), new_root);
+	++height_;
+      }
+      return rhs_ref;
+    } /* split_node */
+
     int Tree::insert(const std::string& key, const std::string& value)
     {
-      // get_root();
-      if (! root_node) {
-	// find and ref node
-	root_node = get_node_for_k(root_name());
-	if (! root_node) {
+      int ret = check_entry(key, value);
+      if (unlikely(ret != 0)) {
+	return ret;
+      }
+      init_root();
+      /* before the key can be found, so no lookup is refused it */
+      uint64_t h = bloom_filter::hash(key);
+      auto tf = std::atomic_load(&tree_filter);
+      if (tf) {
+	tf->add(h);
+      }
+      /* optimistic:  branches latched shared, only the leaf exclusive;
+       * this succeeds unless the leaf must split */
+      auto leaf_ref = find_leaf(key, true);
+      if (unlikely(! leaf_ref)) {
+	return EIO;
+      }
+      leaf_node* leaf = leaf_ref.as<leaf_node>();
+      cow(leaf_ref);
+      ret = leaf->insert(leaf_key(key), value, FLAG_LOCKED);
+      uint64_t lsn{0};
+      if (likely(ret == 0)) {
+	dirtied(leaf_ref);
+	lsn = log_op(wal::op::insert, key, value);
+      }
+      leaf->unlock();
+      if (unlikely(ret == E2BIG)) {
+	leaf_ref.release();
+	ret = insert_pessimistic(key, value, &lsn);
+      }
+      filter_late(tf.get(), [h](bloom_filter& bf) { bf.add(h); });
+      return (ret == 0) ? log_commit(lsn) : ret;
+    } /* insert */
+
+    /* descend again latching exclusive, releasing every ancestor of a
+     * node which can absorb one more entry--so only the nodes a split
+     * can reach stay latched;  *lsn gets the insert's record */
+    int Tree::insert_pessimistic(const std::string& key,
+				 const std::string& value, uint64_t* lsn)
+    {
+      fence_key fk{key};
+      excl_latch root_latch(root_mtx);
+      branch_path path; // latched exclusive, top-down
+      auto release_ancestors = [&path, &root_latch]() {
+	for (auto& bn : path) {
+	  bn.as<branch_node>()->unlock();
+	}
+	path.clear();
+	if (root_latch.owns_lock()) {
+	  root_latch.unlock();
+	}
+      };
+      node_cache::ref node = root_ref;
+      std::visit([](auto n) { n->lock(); }, node.get());
+      while (std::holds_alternative<branch_node*>(node.get())) {
+	auto bn = node.as<branch_node>();
+	if (bn->safe(FLAG_LOCKED)) {
+	  release_ancestors();
+	}
+	auto child = child_for(io, bn, fk);
+	path.push_back(std::move(node));
+	if (unlikely(! child)) {
+	  release_ancestors();
 	  return EIO;
 	}
+	std::visit([](auto n) { n->lock(); }, child.get());
+	node = std::move(child);
+      }
+      leaf_node* leaf = node.as<leaf_node>();
+      if (leaf->safe(FLAG_LOCKED)) {
+	release_ancestors();
       }
-      // traverse to candidate leaf
       // try-insert
-      //    !full: insert, done
-      //    full: <split>, choose-leaf, try-insert
+      uint64_t w = cow(node);
+      int ret = leaf->insert(leaf_key(key), value, FLAG_LOCKED);
+      if (ret == E2BIG) {
+	//    full: <split>, choose-leaf, try-insert
+	std::string sep, rhs_name;
+	auto rhs = split_node(
+	  leaf, path.empty() && root_latch.owns_lock(), sep, rhs_name);
+	cow_split(rhs, node, w);
+	ret = (key < sep) ? leaf->insert(leaf_key(key), value, FLAG_LOCKED)
+	  : rhs.as<leaf_node>()->insert(leaf_key(key), value, FLAG_LOCKED);
+	dirtied(node);
+	/* propagate separators up the path until one fits */
+	while (! path.empty()) {
+	  node_cache::ref parent_ref = std::move(path.back());
+	  path.pop_back();
+	  branch_node* parent = parent_ref.as<branch_node>();
+	  dirtied(parent_ref);
+	  if (likely(parent->insert(fence_key(sep), rhs_name, FLAG_LOCKED)
+		     != E2BIG)) {
+	    parent->unlock();
+	    break;
+	  }
+	  std::string psep, prhs_name;
+	  auto prhs = split_node(
+	    parent, path.empty() && root_latch.owns_lock(), psep, prhs_name);
+	  if (sep < psep) {
+	    parent->insert(fence_key(sep), rhs_name, FLAG_LOCKED);
+	  } else {
+	    prhs.as<branch_node>()->insert(fence_key(sep), rhs_name,
+					   FLAG_LOCKED);
+	  }
+	  parent->unlock();
+	  sep = std::move(psep);
+	  rhs_name = std::move(prhs_name);
+	}
+      } else if (ret == 0) {
+	dirtied(node);
+      }
+      if (ret == 0) {
+	*lsn = log_op(wal::op::insert, key, value);
+      }
+      leaf->unlock();
+      release_ancestors();
+      return ret;
+    } /* insert_pessimistic */
+
+    int Tree::bulk_load(kv_source next, double fill)
+    {
+      static constexpr size_t io_batch = 1024;
+
+      init_root();
+      excl_latch root_latch(root_mtx);
+      if (nsnapshots.load() > 0) {
+	return EBUSY; // its snapshots would see the load
+      }
+      node_ptr old_root = root_ref.get();
+      if (std::holds_alternative<branch_node*>(old_root) ||
+	  (std::get<leaf_node*>(old_root)->size() > 0)) {
+	return ENOTEMPTY;
+      }
+      /* with root_mtx held, a filter set_filters() is building has
+       * either been published, or its scan will see the load */
+      auto tf = std::atomic_load(&tree_filter);
+      auto nf = std::atomic_load(&new_filter);
+      uint32_t per_node = std::clamp(uint32_t(fanout * fill), 2u, fanout);
+      /* and, under a store's object capacity, to fill of what is left
+       * of it besides the fences and a sibling's name (at least two
+       * entries, which always fit) */
+      size_t per_node_bytes = std::numeric_limits<size_t>::max();
+      if (size_t max_bytes = io.cache.get_node_max_bytes()) {
+	size_t reserve = leaf_node::node_overhead +
+	  3 * leaf_node::max_entry_bytes(max_bytes);
+	per_node_bytes = (max_bytes > reserve)
+	  ? size_t((max_bytes - reserve) * fill) : 0;
+      }
+      std::vector<std::pair<std::string, node_ptr>> batch;
+      /* the last node (the root) stays in batch until the end */
+      auto put_node = [this, &batch](const std::string& name, node_ptr node) {
+	if (batch.size() >= io_batch) {
+	  io.put_nodes(batch);
+	  batch.clear();
+	}
+	batch.emplace_back(name, node);
+      };
+      /* (lower fence, name) of each node of the level just built, ""
+       * being unbounded */
+      kv_vec level;
+
+      // leaves
+      kv_vec kvs;
+      /* each leaf is put once the next is named, and linked to it */
+      leaf_node* prev_leaf{nullptr};
+      /* on bad input, the leaves built so far are unreachable garbage */
+      auto abandon = [this, &batch, &prev_leaf, &level](int ret) {
+	for (auto& [name, node] : batch) {
+	  std::visit([](auto n) { delete n; }, node);
+	}
+	batch.clear();
+	delete prev_leaf;
+	for (auto& [lb, name] : level) {
+	  io.remove_node(name);
+	}
+	return ret;
+      };
+      kvs.reserve(per_node);
+      std::string key, value, prev;
+      bool have = next(key, value);
+      while (have) {
+	kvs.clear();
+	size_t bytes{0};
+	while (have && (kvs.size() < per_node)) {
+	  if (unlikely((! level.empty() || ! kvs.empty()) && !(prev < key))) {
+	    return abandon(EINVAL);
+	  }
+	  if (unlikely(check_entry(key, value) != 0)) {
+	    return abandon(EFBIG);
+	  }
+	  size_t e = leaf_node::entry_bytes(key.length(), value.length());
+	  if ((kvs.size() >= 2) && (bytes + e > per_node_bytes)) {
+	    break;
+	  }
+	  bytes += e;
+	  prev = key;
+	  if (tf) {
+	    tf->add(bloom_filter::hash(key));
+	  }
+	  if (nf) {
+	    nf->add(bloom_filter::hash(key));
+	  }
+	  kvs.emplace_back(std::move(key), std::move(value));
+	  have = next(key, value);
+	}
+	/* one key of lookahead gives the upper fence */
+	bool first = level.empty();
+	fence_key lb = first ? fence_key(key_range::unbounded)
+	  : fence_key(kvs.front().first);
+	fence_key ub = have ? fence_key(key) : fence_key(key_range::unbounded);
+	auto ln = new leaf_node(fanout, prefix_min_len, lb, ub);
+	ln->set_cksum_type(cksum_type, FLAG_LOCKED);
+	ln->set_filter_bits(leaf_filter_bits, FLAG_LOCKED);
+	level.emplace_back(first ? "" : kvs.front().first,
+			   (first && !have) ? root_name() : gen_node_name());
+	ln->load_sorted(kvs.begin(), kvs.end(), FLAG_LOCKED);
+	if (prev_leaf) {
+	  prev_leaf->set_right_sibling(level.back().second, FLAG_LOCKED);
+	  put_node(level[level.size() - 2].second, prev_leaf);
+	}
+	prev_leaf = ln;
+      }
+      if (level.empty()) {
+	return 0;
+      }
+      put_node(level.back().second, prev_leaf);
+
+      // branches, from the lower fences of the level below
+      uint32_t levels{1};
+      while (level.size() > 1) {
+	kv_vec upper;
+	std::vector<size_t> ends;
+	for (size_t ix = 0; ix < level.size(); ix = ends.back()) {
+	  size_t end = ix;
+	  size_t bytes{0};
+	  while ((end < level.size()) && (end - ix < per_node)) {
+	    size_t e = branch_node::entry_bytes(level[end].first.length(),
+						level[end].second.length());
+	    if ((end - ix >= 2) && (bytes + e > per_node_bytes)) {
+	      break;
+	    }
+	    bytes += e;
+	    ++end;
+	  }
+	  ends.push_back(end);
+	}
+	bool last_level = (ends.size() == 1);
+	size_t ix{0};
+	for (size_t end : ends) {
+	  fence_key lb = level[ix].first.empty()
+	    ? fence_key(key_range::unbounded) : fence_key(level[ix].first);
+	  fence_key ub = (end < level.size())
+	    ? fence_key(level[end].first) : fence_key(key_range::unbounded);
+	  auto bn = new branch_node(fanout, prefix_min_len, lb, ub);
+	  bn->set_cksum_type(cksum_type, FLAG_LOCKED);
+	  upper.emplace_back(level[ix].first,
+			     last_level ? root_name() : gen_node_name());
+	  bn->load_sorted(level.begin() + ix, level.begin() + end,
+			  FLAG_LOCKED);
+	  put_node(upper.back().second, bn);
+	  ix = end;
+	}
+	level.swap(upper);
+	++levels;
+      }
+
+      /* the new root, built last, takes over the root name;  anyone
+       * still in the old (empty) root got there before we took
+       * root_mtx, and holds a pin--the cache frees it once they leave */
+      io.remove_node(root_name());
+      io.put_nodes(batch);
+      root_ref = io.get_node(root_name());
+      height_ = levels;
+      root_latch.unlock();
+      /* not logged, but made durable at once */
+      return checkpoint();
+    } /* bulk_load */
+
+    int Tree::remove(const std::string& key)
+    {
+      init_root();
+      auto leaf_ref = find_leaf(key, true);
+      if (unlikely(! leaf_ref)) {
+	return EIO;
+      }
+      leaf_node* leaf = leaf_ref.as<leaf_node>();
+      leaf_key k{key};
+      /* an absent key changes nothing:  the leaf isn't copied for
+       * snapshots, dirtied or logged */
+      int ret = leaf->get(k, nullptr, FLAG_LOCKED);
+      if (ret == 0) {
+	cow(leaf_ref);
+	ret = leaf->remove(k, FLAG_LOCKED);
+      }
+      uint64_t lsn{0};
+      if (ret == 0) {
+	dirtied(leaf_ref);
+	lsn = log_op(wal::op::remove, key);
+      }
+      leaf->unlock();
+      return (ret == 0) ? log_commit(lsn) : ret;
+    } /* remove */
+
+    /* the end of the run of keys from first, which was routed to a
+     * leaf bounded above by ub, that the leaf holds */
+    template <typename It, typename F>
+    static It leaf_run_end(It first, It last, const fence_key& ub, F&& key_of)
+    {
+      if (ub.unbounded()) {
+	return last;
+      }
+      const auto& bound = ub.as_leaf_key().stem;
+      return std::partition_point(
+	std::next(first), last,
+	[&bound, &key_of](const auto& e) { return key_of(e) < bound; });
+    } /* leaf_run_end */
+
+    int Tree::insert_batch(kv_vec kvs, uint32_t* inserted)
+    {
+      init_root();
+      std::stable_sort(kvs.begin(), kvs.end(),
+		       [](const auto& lhs, const auto& rhs) {
+			 return lhs.first < rhs.first;
+		       });
+      kvs.erase(std::unique(kvs.begin(), kvs.end(),
+			    [](const auto& lhs, const auto& rhs) {
+			      return lhs.first == rhs.first;
+			    }), kvs.end());
+      for (const auto& kv : kvs) {
+	int ret = check_entry(kv.first, kv.second);
+	if (unlikely(ret != 0)) {
+	  if (inserted) {
+	    *inserted = 0;
+	  }
+	  return ret;
+	}
+      }
+      auto tf = std::atomic_load(&tree_filter);
+      if (tf) {
+	for (const auto& kv : kvs) {
+	  tf->add(bloom_filter::hash(kv.first));
+	}
+      }
+      uint32_t count{0};
+      uint64_t lsn{0};
+      int ret{0};
+      auto key_of = [](const kv_vec::value_type& kv) -> const std::string& {
+	return kv.first;
+      };
+      std::vector<kv_vec::iterator> applied; // logged, if there's a log
+      for (auto it = kvs.begin(); it != kvs.end();) {
+	auto leaf_ref = find_leaf(it->first, true);
+	if (unlikely(! leaf_ref)) {
+	  ret = EIO;
+	  break;
+	}
+	leaf_node* leaf = leaf_ref.as<leaf_node>();
+	auto run_end = leaf_run_end(
+	  it, kvs.end(), leaf->get_upper_bound(FLAG_LOCKED), key_of);
+	uint32_t n{0};
+	applied.clear();
+	auto applied_out = log ? &applied : nullptr;
+	cow(leaf_ref);
+	ret = leaf->insert_batch(it, run_end, &n, FLAG_LOCKED, applied_out);
+	bool full = (ret == E2BIG);
+	if (full) {
+	  size_t room = fanout - leaf->size(FLAG_LOCKED);
+	  run_end = it + std::min<size_t>(room, run_end - it);
+	  ret = leaf->insert_batch(it, run_end, &n, FLAG_LOCKED, applied_out);
+	  /* or its bytes ran out first */
+	  while ((ret == E2BIG) && (run_end != it)) {
+	    run_end = it + (run_end - it) / 2;
+	    ret = leaf->insert_batch(it, run_end, &n, FLAG_LOCKED,
+				     applied_out);
+	  }
+	}
+	if (n > 0) {
+	  dirtied(leaf_ref);
+	  for (const auto& kv : applied) {
+	    lsn = log_op(wal::op::insert, kv->first, kv->second);
+	  }
+	}
+	leaf->unlock();
+	leaf_ref.release();
+	count += n;
+	it = run_end;
+	if (unlikely(ret != 0)) {
+	  break;
+	}
+	if (full) {
+	  /* the leaf is full:  the next key splits it, and the rest of
+	   * its run is routed again */
+	  ret = insert_pessimistic(it->first, it->second, &lsn);
+	  if (ret == 0) {
+	    ++count;
+	  } else if (ret != EEXIST) {
+	    break;
+	  }
+	  ret = 0;
+	  ++it;
+	}
+      }
+      filter_late(tf.get(), [&kvs](bloom_filter& bf) {
+	for (const auto& kv : kvs) {
+	  bf.add(bloom_filter::hash(kv.first));
+	}
+      });
+      if (inserted) {
+	*inserted = count;
+      }
+      /* what was applied is logged, even if not all of it was */
+      int cret = log_commit(lsn);
+      return ret ? ret : cret;
+    } /* insert_batch */
+
+    int Tree::remove_batch(std::vector<std::string> keys, uint32_t* removed)
+    {
+      init_root();
+      std::sort(keys.begin(), keys.end());
+      keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+      uint32_t count{0};
+      uint64_t lsn{0};
+      int ret{0};
+      auto key_of = [](const std::string& k) -> const std::string& {
+	return k;
+      };
+      std::vector<std::vector<std::string>::iterator> applied;
+      for (auto it = keys.begin(); it != keys.end();) {
+	auto leaf_ref = find_leaf(*it, true);
+	if (unlikely(! leaf_ref)) {
+	  ret = EIO;
+	  break;
+	}
+	leaf_node* leaf = leaf_ref.as<leaf_node>();
+	auto run_end = leaf_run_end(
+	  it, keys.end(), leaf->get_upper_bound(FLAG_LOCKED), key_of);
+	uint32_t n{0};
+	applied.clear();
+	cow(leaf_ref);
+	ret = leaf->remove_batch(it, run_end, &n, FLAG_LOCKED,
+				 log ? &applied : nullptr);
+	if (n > 0) {
+	  dirtied(leaf_ref);
+	  for (const auto& k : applied) {
+	    lsn = log_op(wal::op::remove, *k);
+	  }
+	}
+	leaf->unlock();
+	count += n;
+	it = run_end;
+	if (unlikely(ret != 0)) {
+	  break;
+	}
+      }
+      if (removed) {
+	*removed = count;
+      }
+      int cret = log_commit(lsn);
+      return ret ? ret : cret;
+    } /* remove_batch */
+
+    /* the right sibling of leaf (latched shared, upper fence ub),
+     * latched shared before leaf is released */
+    node_cache::ref Tree::next_leaf(leaf_node* leaf,
+				    const std::string& next_name,
+				    const fence_key& ub)
+    {
+      node_cache::ref next;
+      if (likely(! next_name.empty())) {
+	next = io.get_node(next_name);
+	if (likely(next)) {
+	  next.as<leaf_node>()->lock_shared();
+	}
+      }
+      leaf->unlock_shared();
+      if (unlikely(! next)) {
+	/* unlinked (stored before links were):  re-descend from the
+	 * fence */
+	next = find_leaf(ub.as_leaf_key().stem, false);
+      }
+      return next;
+    } /* next_leaf */
+
+    /* a cursor over leaves, left to right:  each next leaf is
+     * latched before the current one is released, and fetched ahead,
+     * through its sibling link, while the current one is listed */
+    int Tree::list(const std::optional<std::string>& prefix,
+		  std::function<int(const sv_tuple&, const std::string_view&)> cb,
+		  std::optional<uint32_t> limit,
+		  uint32_t flags)
+    {
+      uint64_t count{0};
+      (void) list_impl(prefix, cb,
+		       limit ? *limit : std::numeric_limits<uint32_t>::max(),
+		       flags, &count);
+      return count;
+    } /* list */
+
+    int Tree::list_impl(const std::optional<std::string>& prefix,
+		  std::function<int(const sv_tuple&, const std::string_view&)> cb,
+		  uint64_t lim, uint32_t flags, uint64_t* count)
+    {
+      *count = 0;
+      init_root();
+      auto leaf_ref = find_leaf(prefix ? *prefix : std::string{}, false);
+      if (unlikely(! leaf_ref)) {
+	return EIO;
+      }
+      bool stop{false};
+      auto stop_cb =
+	[&cb, &stop](const sv_tuple& k, const std::string_view& v) -> int {
+	  int ret = cb(k, v);
+	  if (ret & FLAG_STOP) {
+	    stop = true;
+	  }
+	  return ret;
+	};
+      for (;;) {
+	leaf_node* leaf = leaf_ref.as<leaf_node>();
+	auto next_name = leaf->get_right_sibling(FLAG_LOCKED);
+	if (! next_name.empty()) {
+	  io.prefetch({next_name});
+	}
+	*count += leaf->list(
+	  prefix, stop_cb,
+	  uint32_t(std::min<uint64_t>(lim - *count,
+				      std::numeric_limits<uint32_t>::max())),
+	  flags | FLAG_LOCKED);
+	auto ub = leaf->get_upper_bound(FLAG_LOCKED);
+	/* keys to the right are >= ub, so none has the prefix once ub
+	 * sorts after all that do */
+	if (stop || (*count >= lim) || ub.unbounded() ||
+	    (prefix && (flags & FLAG_REQUIRE_PREFIX) &&
+	     (ub.as_leaf_key().stem.compare(
+	       0, prefix->length(), *prefix) > 0))) {
+	  leaf->unlock_shared();
+	  break;
+	}
+	leaf_ref = next_leaf(leaf, next_name, ub);
+	if (unlikely(! leaf_ref)) {
+	  return EIO;
+	}
+      }
       return 0;
-    } /* insert */
+    } /* list_impl */
 
     int Tree::list(const std::optional<std::string>& prefix,
-		  std::function<int(const std::string*, const std::string*)> cb,
+		  const std::string& delim, delim_list_cb cb,
 		  std::optional<uint32_t> limit,
 		  uint32_t flags)
     {
-      int count{0};
-      // TODO: implement
+      init_root();
+      auto leaf_ref = find_leaf(prefix ? *prefix : std::string{}, false);
+      if (unlikely(! leaf_ref)) {
+	return 0;
+      }
+      uint32_t lim = limit ? *limit : std::numeric_limits<uint32_t>::max();
+      bool stop{false};
+      std::optional<std::string> last_cp; // iff the last listed
+      auto stop_cb =
+	[&cb, &stop, &last_cp](const sv_tuple& k, const std::string_view& v,
+			       bool is_prefix) -> int {
+	  int ret = cb(k, v, is_prefix);
+	  if (ret & FLAG_STOP) {
+	    stop = true;
+	  }
+	  if (is_prefix) {
+	    last_cp = head(k, len(k));
+	  } else {
+	    last_cp.reset();
+	  }
+	  return ret;
+	};
+      std::optional<std::string> from;
+      uint32_t count{0};
+      for (;;) {
+	leaf_node* leaf = leaf_ref.as<leaf_node>();
+	auto next_name = leaf->get_right_sibling(FLAG_LOCKED);
+	if (! next_name.empty()) {
+	  io.prefetch({next_name});
+	}
+	count += leaf->list(prefix, delim, stop_cb, lim - count,
+			    flags | FLAG_LOCKED, from);
+	from.reset();
+	auto ub = leaf->get_upper_bound(FLAG_LOCKED);
+	if (stop || (count >= lim) || ub.unbounded() ||
+	    (prefix && (ub.as_leaf_key().stem.compare(
+			  0, prefix->length(), *prefix) > 0))) {
+	  leaf->unlock_shared();
+	  break;
+	}
+	if (last_cp) {
+	  /* the leaf ended under a common prefix:  seek past it, from
+	   * the root iff that skips the next leaf */
+	  auto succ = prefix_successor(std::move(*last_cp));
+	  last_cp.reset();
+	  if (! succ) {
+	    leaf->unlock_shared();
+	    break; // every later key is under it
+	  }
+	  if (! (*succ < ub.as_leaf_key().stem)) {
+	    leaf->unlock_shared();
+	    leaf_ref = find_leaf(*succ, false);
+	    if (unlikely(! leaf_ref)) {
+	      break;
+	    }
+	    from = std::move(succ);
+	    continue;
+	  }
+	}
+	leaf_ref = next_leaf(leaf, next_name, ub);
+	if (unlikely(! leaf_ref)) {
+	  break;
+	}
+      }
       return count;
     } /* list */
 
+    int Tree::list(const std::optional<std::string>& prefix,
+		  std::function<int(const std::string*, const std::string*)> cb,
+		  std::optional<uint32_t> limit,
+		  uint32_t flags)
+    {
+      std::string str, val;
+      auto sv_cb =
+	[&str, &val, &cb] (const sv_tuple& k, const std::string_view& v)
+	-> int {
+	  str.assign(std::get<0>(k));
+	  str.append(std::get<1>(k));
+	  val.assign(v);
+	  return cb(&str, &val);
+	};
+      return list(prefix, sv_cb, limit, flags);
+    } /* list */
+
+    int Tree::set_filters(const filter_options& opts)
+    {
+      init_root();
+      leaf_filter_bits = bloom_filter::bits_for_fpr(opts.leaf_fpr);
+      {
+	shared_latch root_latch(root_mtx);
+	if (leaf_filter_bits &&
+	    std::holds_alternative<leaf_node*>(root_ref.get())) {
+	  root_ref.as<leaf_node>()->set_filter_bits(leaf_filter_bits);
+	}
+      }
+      uint32_t bits = bloom_filter::bits_for_fpr(opts.tree_fpr);
+      if (bits == 0) {
+	std::atomic_store(&tree_filter, std::shared_ptr<bloom_filter>());
+	return 0;
+      }
+      /* sized by a first scan;  the filter is then published to
+       * inserts (see filter_late()) before the second fills it, so a
+       * key inserted meanwhile is either seen by the scan or added by
+       * its insert--and the old filter serves lookups until the swap */
+      static constexpr uint64_t all = std::numeric_limits<uint64_t>::max();
+      uint64_t nkeys{0};
+      int ret = list_impl({},
+			  [](const sv_tuple& k, const std::string_view& v) {
+			    return 0;
+			  }, all, FLAG_NONE, &nkeys);
+      if (unlikely(ret != 0)) {
+	return ret;
+      }
+      nkeys = std::max<uint64_t>(opts.tree_keys, nkeys);
+      if (opts.tree_max_bytes) {
+	size_t most = opts.tree_max_bytes * 8 / std::max<size_t>(nkeys, 1);
+	bits = std::clamp<size_t>(most, 1, bits);
+      }
+      auto bf = std::make_shared<bloom_filter>(nkeys, bits);
+      std::atomic_store(&new_filter, bf);
+      uint64_t n{0};
+      ret = list_impl({},
+		      [&bf](const sv_tuple& k, const std::string_view& v) {
+			bf->add(bloom_filter::hash(k));
+			return 0;
+		      }, all, FLAG_NONE, &n);
+      /* a filter missing the keys of a leaf it couldn't read would
+       * refuse them:  only a complete one is published */
+      if (likely(ret == 0)) {
+	std::atomic_store(&tree_filter, bf);
+      }
+      std::atomic_store(&new_filter, std::shared_ptr<bloom_filter>());
+      return ret;
+    } /* set_filters */
+
+    Tree::filter_stats Tree::get_filter_stats() const
+    {
+      filter_stats st;
+      st.tree_hits = fstats.tree_hits.load(std::memory_order_relaxed);
+      st.tree_skips = fstats.tree_skips.load(std::memory_order_relaxed);
+      st.leaf_hits = fstats.leaf_hits.load(std::memory_order_relaxed);
+      st.leaf_skips = fstats.leaf_skips.load(std::memory_order_relaxed);
+      st.false_positives =
+	fstats.false_positives.load(std::memory_order_relaxed);
+      if (auto tf = std::atomic_load(&tree_filter)) {
+	st.tree_bytes = tf->bytes();
+	st.tree_fill = tf->fill();
+      }
+      return st;
+    } /* get_filter_stats */
+
+    int Tree::set_wal(std::shared_ptr<wal> w, size_t _checkpoint_bytes)
+    {
+      init_root();
+      log.reset();
+      if (! w) {
+	return 0;
+      }
+      /* replayed unlogged:  an insert of a key present (EEXIST), or a
+       * remove of one absent (ENOENT), was applied before the crash (or
+       * is undone by a later record), so isn't an error */
+      int ret = w->replay(
+	[this](wal::op o, const std::string& key,
+	       const std::string& value) -> int {
+	  int r = (o == wal::op::insert) ? insert(key, value) : remove(key);
+	  return ((r == EEXIST) || (r == ENOENT)) ? 0 : r;
+	});
+      if (ret != 0) {
+	return ret;
+      }
+      log = std::move(w);
+      checkpoint_bytes = _checkpoint_bytes;
+      return checkpoint();
+    } /* set_wal */
+
+    int Tree::checkpoint()
+    {
+      /* without a store, the log is all there is */
+      if ((! log) || (! io.get_store())) {
+	return 0;
+      }
+      uint64_t lsn;
+      std::vector<node_cache::ref> synced;
+      int ret;
+      {
+	/* no split runs meanwhile, so the nodes written are of one
+	 * tree;  every change logged up to lsn has been applied, and
+	 * its nodes dirtied, so the sync writes it */
+	shared_latch root_latch(root_mtx);
+	lsn = log->last_lsn();
+	{
+	  std::lock_guard<std::mutex> guard(held_mtx);
+	  synced.swap(held);
+	}
+	ret = io.sync();
+      }
+      if (unlikely(ret != 0)) {
+	std::lock_guard<std::mutex> guard(held_mtx);
+	std::move(synced.begin(), synced.end(), std::back_inserter(held));
+	return ret;
+      }
+      return log->checkpoint(lsn);
+    } /* checkpoint */
+
+    int Tree::log_commit(uint64_t lsn)
+    {
+      if (lsn == 0) {
+	return 0;
+      }
+      int ret = log->commit(lsn);
+      if ((ret == 0) && unlikely(log->log_bytes() >= checkpoint_bytes) &&
+	  ! checkpointing.exchange(true, std::memory_order_acquire)) {
+	/* this change is durable already;  a failed checkpoint leaves
+	 * the log whole, for the next to try */
+	(void) checkpoint();
+	checkpointing.store(false, std::memory_order_release);
+      }
+      return ret;
+    } /* log_commit */
+
+    Tree::snapshot_ref Tree::snapshot()
+    {
+      init_root();
+      std::lock_guard<std::mutex> guard(mvcc_mtx);
+      /* counted before the epoch moves (see cow()) */
+      nsnapshots.fetch_add(1);
+      uint64_t s = next_epoch.fetch_add(1);
+      live.insert(s);
+      return snapshot_ref(this, s);
+    } /* snapshot */
+
+    size_t Tree::versions() const
+    {
+      std::lock_guard<std::mutex> guard(mvcc_mtx);
+      size_t n{0};
+      for (const auto& [leaf, h] : history) {
+	n += h.versions.size();
+      }
+      return n;
+    } /* versions */
+
+    void Tree::release_snapshot(uint64_t s)
+    {
+      decltype(history) dead; // unpinned outside mvcc_mtx
+      {
+	std::lock_guard<std::mutex> guard(mvcc_mtx);
+	live.erase(live.find(s));
+	nsnapshots.fetch_sub(1);
+	if (live.empty()) {
+	  dead.swap(history);
+	  return;
+	}
+	uint64_t oldest = *live.begin();
+	for (auto it = history.begin(); it != history.end();) {
+	  auto& vers = it->second.versions;
+	  vers.erase(vers.begin(),
+		     std::find_if(vers.begin(), vers.end(),
+				  [oldest](const leaf_version& v) {
+				    return v.to > oldest;
+				  }));
+	  if (vers.empty()) {
+	    dead.insert(history.extract(it++));
+	  } else {
+	    ++it;
+	  }
+	}
+      }
+    } /* release_snapshot */
+
+    /* called before a change to leaf (latched exclusive):  copies it
+     * out if a live snapshot sees it, returning the change's epoch;
+     * a snapshot is counted before the epoch moves, so one that sees
+     * the epoch moved (w), and not the count, has none older than w */
+    uint64_t Tree::cow(const node_cache::ref& leaf_ref)
+    {
+      uint64_t w = next_epoch.load();
+      if (likely(nsnapshots.load() == 0)) {
+	return w;
+      }
+      leaf_node* leaf = leaf_ref.as<leaf_node>();
+      uint64_t from;
+      {
+	std::lock_guard<std::mutex> guard(mvcc_mtx);
+	w = next_epoch.load();
+	auto it = history.find(leaf);
+	/* the leaf's content dates from its newest version's end (or
+	 * from before any live snapshot) */
+	from = (it == history.end()) ? 0 : it->second.versions.back().to;
+	if (live.lower_bound(from) == live.end()) {
+	  return w;
+	}
+      }
+      /* copied unlocked;  nothing else can change the leaf */
+      auto view = std::make_shared<const leaf_image>(*leaf);
+      std::lock_guard<std::mutex> guard(mvcc_mtx);
+      if (live.lower_bound(from) != live.end()) {
+	auto& h = history[leaf];
+	if (! h.pin) {
+	  h.pin = leaf_ref;
+	}
+	h.versions.push_back(leaf_version{from, w, std::move(view), {}});
+      }
+      return w;
+    } /* cow */
+
+    /* rhs was split off lhs by a change at epoch w (see cow()):
+     * snapshots older than w find its keys in lhs */
+    void Tree::cow_split(const node_cache::ref& rhs_ref,
+			 const node_cache::ref& lhs_ref, uint64_t w)
+    {
+      if (likely(nsnapshots.load() == 0)) {
+	return;
+      }
+      std::lock_guard<std::mutex> guard(mvcc_mtx);
+      if (live.empty() || (*live.begin() >= w)) {
+	return;
+      }
+      auto& h = history[rhs_ref.as<leaf_node>()];
+      h.pin = rhs_ref;
+      h.versions.push_back(leaf_version{0, w, nullptr, lhs_ref});
+    } /* cow_split */
+
+    /* leaf_ref's content (it's latched shared) as snapshot s sees it,
+     * the leaf then released;  else, if the leaf is unchanged since s
+     * and ! copy, null, leaf_ref (maybe another leaf) left latched */
+    std::shared_ptr<const leaf_image> Tree::frozen(node_cache::ref& leaf_ref,
+						   uint64_t s, bool copy)
+    {
+      for (;;) {
+	leaf_node* leaf = leaf_ref.as<leaf_node>();
+	std::shared_ptr<const leaf_image> view;
+	node_cache::ref split_from;
+	bool found{false};
+	{
+	  std::lock_guard<std::mutex> guard(mvcc_mtx);
+	  auto it = history.find(leaf);
+	  if (it != history.end()) {
+	    for (const auto& v : it->second.versions) {
+	      if ((v.from <= s) && (s < v.to)) {
+		view = v.view;
+		split_from = v.split_from;
+		found = true;
+		break;
+	      }
+	    }
+	  }
+	}
+	if (! found) {
+	  if (! copy) {
+	    return view;
+	  }
+	  view = std::make_shared<const leaf_image>(*leaf);
+	}
+	leaf->unlock_shared();
+	if (view) {
+	  return view;
+	}
+	leaf_ref = std::move(split_from);
+	leaf_ref.as<leaf_node>()->lock_shared();
+      }
+    } /* frozen */
+
+    int Tree::snap_get(uint64_t s, const std::string& key, std::string* val)
+    {
+      auto leaf_ref = find_leaf(key, false);
+      if (unlikely(! leaf_ref)) {
+	return EIO;
+      }
+      auto view = frozen(leaf_ref, s, false);
+      if (view) {
+	return view->get(key, val);
+      }
+      leaf_node* leaf = leaf_ref.as<leaf_node>();
+      int ret = leaf->get(leaf_key(key), val, FLAG_LOCKED);
+      leaf->unlock_shared();
+      return ret;
+    } /* snap_get */
+
+    /* as list(), over frozen leaves, following the sibling links they
+     * had at s */
+    int Tree::snap_list(
+      uint64_t s, const std::optional<std::string>& prefix,
+      std::function<int(const sv_tuple&, const std::string_view&)> cb,
+      std::optional<uint32_t> limit, uint32_t flags)
+    {
+      auto leaf_ref = find_leaf(prefix ? *prefix : std::string{}, false);
+      if (unlikely(! leaf_ref)) {
+	return 0;
+      }
+      uint32_t lim = limit ? *limit : std::numeric_limits<uint32_t>::max();
+      bool stop{false};
+      auto stop_cb =
+	[&cb, &stop](const sv_tuple& k, const std::string_view& v) -> int {
+	  int ret = cb(k, v);
+	  if (ret & FLAG_STOP) {
+	    stop = true;
+	  }
+	  return ret;
+	};
+      uint32_t count{0};
+      for (;;) {
+	auto view = frozen(leaf_ref, s, true);
+	leaf_ref.release();
+	const auto& next_name = view->get_right_sibling();
+	if (! next_name.empty()) {
+	  io.prefetch({next_name});
+	}
+	count += view->list(prefix, stop_cb, lim - count, flags);
+	const auto& ub = view->get_upper_bound();
+	if (stop || (count >= lim) || ub.unbounded() ||
+	    (prefix && (flags & FLAG_REQUIRE_PREFIX) &&
+	     (ub.as_leaf_key().stem.compare(
+	       0, prefix->length(), *prefix) > 0))) {
+	  break;
+	}
+	if (likely(! next_name.empty())) {
+	  leaf_ref = io.get_node(next_name);
+	}
+	if (likely(leaf_ref)) {
+	  leaf_ref.as<leaf_node>()->lock_shared();
+	} else {
+	  leaf_ref = find_leaf(ub.as_leaf_key().stem, false);
+	  if (unlikely(! leaf_ref)) {
+	    break;
+	  }
+	}
+      }
+      return count;
+    } /* snap_list */
+
+    int Tree::snapshot_ref::list(
+      const std::optional<std::string>& prefix,
+      std::function<int(const std::string*, const std::string*)> cb,
+      std::optional<uint32_t> limit,
+      uint32_t flags) const
+    {
+      std::string str, val;
+      auto sv_cb =
+	[&str, &val, &cb] (const sv_tuple& k, const std::string_view& v)
+	-> int {
+	  str.assign(std::get<0>(k));
+	  str.append(std::get<1>(k));
+	  val.assign(v);
+	  return cb(&str, &val);
+	};
+      return t->snap_list(epoch_, prefix, sv_cb, limit, flags);
+    } /* snapshot_ref::list */
+
 }} /* namespace */
@@ -16,6 +16,11 @@
 
 #include "bplus_node.h"
 #include "bplus_io.h"
+#include "bplus_wal.h"
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <unordered_map>
 
 namespace rgw { namespace bplus {
 
@@ -25,26 +30,334 @@ namespace rgw { namespace bplus {
     {
       const std::string name;
       const uint32_t fanout;
+      const uint16_t prefix_min_len;
+      IO& io; // nodes are cached and stored through io
+      const cksum::CksumType cksum_type; // of the nodes it creates
 
-      mutable std::mutex mtx;
-      mutable std::optional<node_ptr> root_node;
+      /* latches root_ref;  held exclusive only by a writer that may
+       * split the root */
+      mutable latch_type root_mtx;
+      std::once_flag root_once;
+      node_cache::ref root_ref; // the root stays pinned
+      std::atomic<uint32_t> height_;
+
+      using branch_path = std::vector<node_cache::ref>;
+
+      /* MVCC:  snapshot s sees every leaf change made before it was
+       * taken (at epoch s) and none after;  a writer about to change a
+       * leaf that a live snapshot sees first copies it out, as a
+       * version that snapshots [from, to) read instead;  a leaf split
+       * off after s gets a version sending s to the leaf it came from;
+       * leaves with versions stay pinned, and versions are dropped
+       * once no live snapshot is older than their to (readers holding
+       * one keep it until they finish) */
+      struct leaf_version {
+	uint64_t from;
+	uint64_t to;
+	std::shared_ptr<const leaf_image> view; // or null, and
+	node_cache::ref split_from;
+      };
+      struct leaf_history {
+	node_cache::ref pin;
+	std::vector<leaf_version> versions; // oldest first, disjoint
+      };
+
+      mutable std::mutex mvcc_mtx; // live, history, and next_epoch
+      std::atomic<uint64_t> next_epoch{1};
+      std::atomic<uint32_t> nsnapshots{0};
+      std::multiset<uint64_t> live; // epochs of live snapshots
+      std::unordered_map<leaf_node*, leaf_history> history;
+
+      /* durability (see set_wal()):  with a log, nodes dirtied since
+       * the last checkpoint stay pinned, so aren't written back
+       * (unless io syncs):  the store holds the tree as checkpointed,
+       * which is what the log replays onto */
+      std::shared_ptr<wal> log;
+      size_t checkpoint_bytes{0};
+      std::atomic<bool> checkpointing{false};
+      std::mutex held_mtx;
+      std::vector<node_cache::ref> held;
+
+      /* key filters (see set_filters()):  the tree filter is swapped
+       * while lookups and inserts use it, so is only loaded and stored
+       * atomically (std::atomic_load/store), as is the one
+       * set_filters() is building, which inserts add to meanwhile */
+      std::atomic<uint32_t> leaf_filter_bits{0};
+      std::shared_ptr<bloom_filter> tree_filter;
+      std::shared_ptr<bloom_filter> new_filter;
+      struct {
+	std::atomic<uint64_t> tree_hits{0};
+	std::atomic<uint64_t> tree_skips{0};
+	std::atomic<uint64_t> leaf_hits{0};
+	std::atomic<uint64_t> leaf_skips{0};
+	std::atomic<uint64_t> false_positives{0};
+      } fstats;
+
+      static void count(std::atomic<uint64_t>& c) {
+	c.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      void init_root();
+      int get_impl(const std::string& key, std::string* val,
+		   int* leaf_filter);
+      /* as list(), but EIO if a leaf it reaches can't be read (list()
+       * stops there, and returns what it had);  *count gets the
+       * number listed */
+      int list_impl(const std::optional<std::string>& prefix,
+	      std::function<int(const sv_tuple&, const std::string_view&)> cb,
+	      uint64_t limit, uint32_t flags, uint64_t* count);
+      node_cache::ref find_leaf(const std::string& k, bool excl);
+      int insert_pessimistic(const std::string& key,
+			     const std::string& value, uint64_t* lsn);
+      node_cache::ref next_leaf(leaf_node* leaf, const std::string& next_name,
+				const fence_key& ub);
+
+      template <typename N>
+      node_cache::ref split_node(N* node, bool is_root, std::string& sep,
+				 std::string& rhs_name);
+
+      uint64_t cow(const node_cache::ref& leaf_ref);
+      void cow_split(const node_cache::ref& rhs_ref,
+		     const node_cache::ref& lhs_ref, uint64_t w);
+      std::shared_ptr<const leaf_image> frozen(node_cache::ref& leaf_ref,
+					       uint64_t s, bool copy);
+      void release_snapshot(uint64_t s);
+      /* once keys inserted can be found:  add them (by add) to a
+       * filter being built, or published since added was loaded, which
+       * a scan for it may have missed them in */
+      template <typename F>
+      void filter_late(const bloom_filter* added, F&& add) {
+	/* new_filter first:  it is cleared only after its swap in */
+	auto nf = std::atomic_load(&new_filter);
+	auto tf = std::atomic_load(&tree_filter);
+	if (nf && (nf.get() != added)) {
+	  add(*nf);
+	}
+	if (tf && (tf != nf) && (tf.get() != added)) {
+	  add(*tf);
+	}
+      }
+      void dirtied(const node_cache::ref& r) {
+	if (leaf_filter_bits &&
+	    std::holds_alternative<leaf_node*>(r.get())) {
+	  r.as<leaf_node>()->set_filter_bits(leaf_filter_bits, FLAG_LOCKED);
+	}
+	if (r.dirty() && log) {
+	  std::lock_guard<std::mutex> guard(held_mtx);
+	  held.push_back(r);
+	}
+      }
+      /* log a change to a leaf, while it is latched (0 without a log) */
+      uint64_t log_op(wal::op o, const std::string& key,
+		      const std::string& value = std::string()) {
+	return log ? log->append(o, key, value) : 0;
+      }
+      /* wait for the log, latches released, then maybe checkpoint */
+      int log_commit(uint64_t lsn);
+      /* EFBIG if key and value would be too large an entry for a node
+       * of the store's capacity (see Node::max_entry_bytes()), as a
+       * leaf's or (with a node's name) a branch's */
+      int check_entry(const std::string& key, const std::string& value) const;
+      int snap_get(uint64_t s, const std::string& key, std::string* val);
+      int snap_list(
+	uint64_t s, const std::optional<std::string>& prefix,
+	std::function<int(const sv_tuple&, const std::string_view&)> cb,
+	std::optional<uint32_t> limit, uint32_t flags);
 
     public:
-      Tree(std::string _name, uint32_t _fanout);
+      /* yields the next (key, value), or false at end of input */
+      using kv_source = std::function<bool(std::string&, std::string&)>;
+      using kv_vec = std::vector<std::pair<std::string, std::string>>;
+
+      static constexpr double default_fill = 0.9;
+
+      /* key filters, for lookups of keys that are absent:  each leaf
+       * stored with a filter of its keys, so a lookup through a view
+       * (see get()) is refused from its header without a search;  and
+       * one filter of the whole tree's keys, in memory, so a lookup
+       * it refuses neither descends nor fetches a node;  filters
+       * only gain keys, so removes leave them no less accurate for
+       * keys never inserted, but a tree filter holding more than
+       * tree_keys degrades (see bloom_filter::fill()) */
+      struct filter_options {
+	double leaf_fpr{0.0}; // 0 leaves leaves as they are stored
+	double tree_fpr{0.0}; // 0 for no tree filter
+	size_t tree_keys{0}; // capacity, at least the keys now held
+	size_t tree_max_bytes{0}; // caps the tree filter (its rate rises)
+      };
+      /* hits pass a filter, skips are refused by one;  a false
+       * positive passed every filter it met, and found no key */
+      struct filter_stats {
+	uint64_t tree_hits{0};
+	uint64_t tree_skips{0};
+	uint64_t leaf_hits{0};
+	uint64_t leaf_skips{0};
+	uint64_t false_positives{0};
+	size_t tree_bytes{0};
+	double tree_fill{0.0};
+      };
+
+      /* a consistent, read-only image of the tree as of one epoch:
+       * its reads latch each node only briefly, never across a
+       * callback, so a slow consumer doesn't hold up writers;  the
+       * versions it reads are kept until it is released, which must
+       * be before its tree is destroyed */
+      class snapshot_ref
+      {
+	Tree* t{nullptr};
+	uint64_t epoch_{0};
+
+	friend class Tree;
+	snapshot_ref(Tree* _t, uint64_t _epoch) : t(_t), epoch_(_epoch) {}
+
+      public:
+	snapshot_ref() {}
+	snapshot_ref(const snapshot_ref&) = delete;
+	snapshot_ref(snapshot_ref&& rhs) : t(rhs.t), epoch_(rhs.epoch_) {
+	  rhs.t = nullptr;
+	}
+	snapshot_ref& operator=(snapshot_ref&& rhs) {
+	  if (this != &rhs) {
+	    release();
+	    t = rhs.t;
+	    epoch_ = rhs.epoch_;
+	    rhs.t = nullptr;
+	  }
+	  return *this;
+	}
+	~snapshot_ref() {
+	  release();
+	}
+
+	void release() {
+	  if (t) {
+	    t->release_snapshot(epoch_);
+	    t = nullptr;
+	  }
+	}
+
+	explicit operator bool() const { return t != nullptr; }
+	uint64_t epoch() const { return epoch_; }
+
+	/* as the Tree's */
+	int get(const std::string& key, std::string* val = nullptr) const {
+	  return t->snap_get(epoch_, key, val);
+	}
+	int list(const std::optional<std::string>& prefix,
+		 std::function<int(const sv_tuple&, const std::string_view&)> cb,
+		 std::optional<uint32_t> limit,
+		 uint32_t flags = FLAG_NONE) const {
+	  return t->snap_list(epoch_, prefix, cb, limit, flags);
+	}
+	int list(const std::optional<std::string>& prefix,
+		 std::function<int(const std::string*, const std::string*)> cb,
+		 std::optional<uint32_t> limit,
+		 uint32_t flags = FLAG_NONE) const;
+      }; /* snapshot_ref */
+
+      /* a tree whose root is already in _io's store is opened, not
+       * created;  nodes it creates are checksummed with _cksum_type
+       * (stored nodes keep theirs) */
+      Tree(std::string _name, uint32_t _fanout,
+	   uint16_t _prefix_min_len = 2, IO& _io = bplus::io,
+	   cksum::CksumType _cksum_type = default_cksum);
 
       std::string root_name() const;
       std::string gen_node_name() const;
-  
+
+      uint32_t height() const {
+	return height_.load(std::memory_order_relaxed);
+      }
+
+      /* durability:  with a log, each change to a leaf is appended to
+       * it while the leaf is latched (so in the order applied), and
+       * acknowledged once the log is synced (see wal)--the nodes it
+       * dirtied are written back when the cache evicts them, or at a
+       * checkpoint:  once checkpoint_bytes have been logged, the next
+       * writer syncs io, and the log drops what that made durable
+       * (as durable as io's store makes it);  set_wal() first replays
+       * w into the tree, so a tree reopened after a crash holds every
+       * change acknowledged;  set it before any change */
+      static constexpr size_t default_checkpoint_bytes = 64 * 1024 * 1024;
+
+      int set_wal(std::shared_ptr<wal> w,
+		  size_t _checkpoint_bytes = default_checkpoint_bytes);
+      int checkpoint();
+
+      /* filter api:  best set before use (the tree filter is built
+       * from a scan of the tree, and the one it replaces serves
+       * lookups until then;  keys inserted during it are added to
+       * both, and it is kept if the scan fails EIO);  leaves get
+       * filters as they are created or changed */
+      int set_filters(const filter_options& opts);
+      filter_stats get_filter_stats() const;
+
+      /* mvcc api */
+      snapshot_ref snapshot();
+      /* leaf versions kept for live snapshots */
+      size_t versions() const;
+
       /* ll api*/
-      node_ptr get_node_for_k(const std::string& k);
+      node_cache::ref get_node_for_k(const std::string& k);
 
       /* kv api */
+      /* ENOENT if key is absent */
+      int get(const std::string& key, std::string* val = nullptr);
+      /* EFBIG if key and value are too large for the store's objects
+       * (past 1/16 of one) */
       int insert(const std::string& key, const std::string& value);
+      /* ENOENT if key is absent;  a leaf left underfull, or empty, is
+       * not merged with a sibling or freed, but stays in the tree */
       int remove(const std::string& key);
+      /* batch api:  keys are sorted and routed to their leaves in one
+       * pass, each leaf's run merged under one latch;  a duplicate key
+       * keeps its first value;  *inserted (*removed) gets the number
+       * of keys inserted (removed);  EFBIG, and nothing inserted, if
+       * any entry is too large (see insert);  as with remove, leaves
+       * emptied stay in the tree (a batch can empty many, and
+       * listings still step through each) */
+      int insert_batch(kv_vec kvs, uint32_t* inserted = nullptr);
+      int remove_batch(std::vector<std::string> keys,
+		       uint32_t* removed = nullptr);
+      /* bulk api:  build an empty tree bottom-up from keys in strictly
+       * increasing order, packing nodes to fill * fanout (and to fill
+       * of the store's object capacity, if bytes run out first; EBUSY
+       * while a snapshot is live);  with a log, it isn't logged, but ends
+       * with a checkpoint */
+      int bulk_load(kv_source next, double fill = default_fill);
+
+      template <typename It>
+      int bulk_load(It first, It last, double fill = default_fill) {
+	return bulk_load(
+	  [&first, &last](std::string& k, std::string& v) -> bool {
+	    if (first == last) {
+	      return false;
+	    }
+	    k = first->first;
+	    v = first->second;
+	    ++first;
+	    return true;
+	  }, fill);
+      }
+
+      /* keys from prefix (or the first) on, in order, across leaves,
+       * until limit, FLAG_STOP from cb, or (with FLAG_REQUIRE_PREFIX)
+       * the first key without prefix;  returns the count listed */
+      int list(const std::optional<std::string>& prefix,
+	      std::function<int(const sv_tuple&, const std::string_view&)> cb,
+	      std::optional<uint32_t> limit,
+	      uint32_t flags = FLAG_NONE);
       int list(const std::optional<std::string>& prefix,
 	      std::function<int(const std::string*, const std::string*)> cb,
 	      std::optional<uint32_t> limit,
 	      uint32_t flags = FLAG_NONE);
+      /* delimited listing (see Node):  each common prefix is listed
+       * once, then sought past--re-descending, when that skips this
+       * leaf--so keys under it aren't visited */
+      int list(const std::optional<std::string>& prefix,
+	      const std::string& delim, delim_list_cb cb,
+	      std::optional<uint32_t> limit,
+	      uint32_t flags = FLAG_NONE);
 
     }; /* Tree */
 
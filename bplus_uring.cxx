@@ -0,0 +1,399 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2019 Red Hat, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation. See file COPYING.
+ *
+ */
+
+#include "bplus_uring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#if __has_include(<linux/io_uring.h>)
+#define BPLUS_WITH_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace rgw { namespace bplus {
+
+#ifdef BPLUS_WITH_URING
+
+    namespace {
+      int uring_setup(uint32_t entries, io_uring_params* p) {
+	return int(::syscall(__NR_io_uring_setup, entries, p));
+      }
+
+      int uring_enter(int fd, uint32_t to_submit, uint32_t min_complete,
+		      uint32_t flags) {
+	return int(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			     flags, nullptr, 0));
+      }
+
+      int uring_register(int fd, uint32_t opcode, void* arg,
+			 uint32_t nr_args) {
+	return int(::syscall(__NR_io_uring_register, fd, opcode, arg,
+			     nr_args));
+      }
+
+      /* one sqe moves at most this much;  the rest is resubmitted */
+      static constexpr size_t max_xfer = size_t(1) << 30;
+    } /* namespace */
+
+    struct uring_engine::op {
+      enum class kind : uint8_t {
+	read,
+	write,
+	fsync,
+      };
+      kind k;
+      bool fsync_after;
+      int fd;
+      uint8_t* buf;
+      size_t len;
+      size_t done{0};
+      uint64_t off;
+      done_cb cb;
+    }; /* op */
+
+    /* the rings, as the kernel maps them */
+    struct uring_engine::ring {
+      int fd{-1};
+      io_uring_params p{};
+      void* sq_ptr{MAP_FAILED};
+      size_t sq_sz{0};
+      void* cq_ptr{MAP_FAILED};
+      size_t cq_sz{0};
+      io_uring_sqe* sqes{static_cast<io_uring_sqe*>(MAP_FAILED)};
+      size_t sqes_sz{0};
+
+      uint32_t* sq_tail;
+      uint32_t sq_mask;
+      uint32_t* sq_array;
+      uint32_t* cq_head;
+      uint32_t* cq_tail;
+      uint32_t cq_mask;
+      io_uring_cqe* cqes;
+
+      template <typename T>
+      static T* at(void* base, uint32_t off) {
+	return reinterpret_cast<T*>(static_cast<char*>(base) + off);
+      }
+
+      /* 0, or an errno */
+      int init(uint32_t entries) {
+	fd = uring_setup(entries, &p);
+	if (fd < 0) {
+	  return errno;
+	}
+	sq_sz = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	  sq_sz = cq_sz = std::max(sq_sz, cq_sz);
+	}
+	sq_ptr = ::mmap(nullptr, sq_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sq_ptr == MAP_FAILED) {
+	  return errno;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	  cq_ptr = sq_ptr;
+	} else {
+	  cq_ptr = ::mmap(nullptr, cq_sz, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	  if (cq_ptr == MAP_FAILED) {
+	    return errno;
+	  }
+	}
+	sqes_sz = p.sq_entries * sizeof(io_uring_sqe);
+	sqes = static_cast<io_uring_sqe*>(
+	  ::mmap(nullptr, sqes_sz, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+	if (sqes == MAP_FAILED) {
+	  return errno;
+	}
+	sq_tail = at<uint32_t>(sq_ptr, p.sq_off.tail);
+	sq_mask = *at<uint32_t>(sq_ptr, p.sq_off.ring_mask);
+	sq_array = at<uint32_t>(sq_ptr, p.sq_off.array);
+	cq_head = at<uint32_t>(cq_ptr, p.cq_off.head);
+	cq_tail = at<uint32_t>(cq_ptr, p.cq_off.tail);
+	cq_mask = *at<uint32_t>(cq_ptr, p.cq_off.ring_mask);
+	cqes = at<io_uring_cqe>(cq_ptr, p.cq_off.cqes);
+	return supported() ? 0 : EOPNOTSUPP;
+      }
+
+      /* the kernel knows every opcode we use */
+      bool supported() {
+	static constexpr uint32_t nops = 256;
+	std::vector<uint8_t> mem(sizeof(io_uring_probe) +
+				 nops * sizeof(io_uring_probe_op));
+	auto probe = reinterpret_cast<io_uring_probe*>(mem.data());
+	if (uring_register(fd, IORING_REGISTER_PROBE, probe, nops) < 0) {
+	  return false;
+	}
+	for (int opc : {IORING_OP_NOP, IORING_OP_READ, IORING_OP_WRITE,
+			IORING_OP_FSYNC}) {
+	  if ((opc > probe->last_op) ||
+	      (! (probe->ops[opc].flags & IO_URING_OP_SUPPORTED))) {
+	    return false;
+	  }
+	}
+	return true;
+      }
+
+      ~ring() {
+	if (sqes != MAP_FAILED) {
+	  ::munmap(sqes, sqes_sz);
+	}
+	if ((cq_ptr != MAP_FAILED) && (cq_ptr != sq_ptr)) {
+	  ::munmap(cq_ptr, cq_sz);
+	}
+	if (sq_ptr != MAP_FAILED) {
+	  ::munmap(sq_ptr, sq_sz);
+	}
+	if (fd >= 0) {
+	  ::close(fd);
+	}
+      }
+    }; /* ring */
+
+    std::unique_ptr<uring_engine> uring_engine::create(uint32_t depth)
+    {
+      auto r = std::make_unique<ring>();
+      if (r->init(depth) != 0) {
+	return nullptr;
+      }
+      /* at most depth ops are in flight, each with at most one sqe
+       * queued, so the submission queue can't overrun */
+      depth = std::min(depth, r->p.sq_entries);
+      return std::unique_ptr<uring_engine>(
+	new uring_engine(depth, std::move(r)));
+    } /* create */
+
+    uring_engine::uring_engine(uint32_t _depth, std::unique_ptr<ring> _r)
+      : depth_(_depth), r(std::move(_r))
+    {
+      reaper = std::thread(&uring_engine::reap, this);
+    } /* uring_engine */
+
+    uring_engine::~uring_engine()
+    {
+      drain();
+      /* a nop with no op wakes the reaper to exit */
+      {
+	std::lock_guard<std::mutex> guard(sq_mtx);
+	uint32_t tail = *r->sq_tail;
+	uint32_t ix = tail & r->sq_mask;
+	io_uring_sqe* sqe = &r->sqes[ix];
+	::memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_NOP;
+	sqe->user_data = 0;
+	r->sq_array[ix] = ix;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++pending;
+      }
+      (void) submit();
+      reaper.join();
+    } /* ~uring_engine */
+
+    /* the next sqe for o, into the submission queue (not yet
+     * submitted) */
+    void uring_engine::push(op* o)
+    {
+      std::lock_guard<std::mutex> guard(sq_mtx);
+      uint32_t tail = *r->sq_tail;
+      uint32_t ix = tail & r->sq_mask;
+      io_uring_sqe* sqe = &r->sqes[ix];
+      ::memset(sqe, 0, sizeof(*sqe));
+      sqe->fd = o->fd;
+      sqe->user_data = reinterpret_cast<uint64_t>(o);
+      switch (o->k) {
+      case op::kind::read:
+      case op::kind::write:
+	sqe->opcode = (o->k == op::kind::read) ? IORING_OP_READ
+					       : IORING_OP_WRITE;
+	sqe->addr = reinterpret_cast<uint64_t>(o->buf + o->done);
+	sqe->len = uint32_t(std::min(o->len - o->done, max_xfer));
+	sqe->off = o->off + o->done;
+	break;
+      case op::kind::fsync:
+	sqe->opcode = IORING_OP_FSYNC;
+	break;
+      };
+      r->sq_array[ix] = ix;
+      __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+      ++pending;
+    } /* push */
+
+    void uring_engine::prep(op* o)
+    {
+      {
+	std::unique_lock<std::mutex> uniq(mtx);
+	if (inflight == depth_) {
+	  /* what's queued (maybe ours) must go, to make room */
+	  uniq.unlock();
+	  (void) submit();
+	  uniq.lock();
+	  cv.wait(uniq, [this]() { return inflight < depth_; });
+	}
+	++inflight;
+      }
+      push(o);
+    } /* prep */
+
+    void uring_engine::prep_read(int fd, uint8_t* buf, size_t len,
+				 uint64_t off, done_cb cb)
+    {
+      prep(new op{op::kind::read, false, fd, buf, len, 0, off,
+		   std::move(cb)});
+    } /* prep_read */
+
+    void uring_engine::prep_write(int fd, const uint8_t* buf, size_t len,
+				  uint64_t off, bool fsync, done_cb cb)
+    {
+      prep(new op{op::kind::write, fsync, fd, const_cast<uint8_t*>(buf), len,
+		   0, off, std::move(cb)});
+    } /* prep_write */
+
+    int uring_engine::submit()
+    {
+      std::lock_guard<std::mutex> guard(sq_mtx);
+      while (pending > 0) {
+	int ret = uring_enter(r->fd, pending, 0, 0);
+	if (ret < 0) {
+	  if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)) {
+	    std::this_thread::yield();
+	    continue;
+	  }
+	  return errno;
+	}
+	pending -= ret;
+      }
+      return 0;
+    } /* submit */
+
+    void uring_engine::drain()
+    {
+      std::unique_lock<std::mutex> uniq(mtx);
+      cv.wait(uniq, [this]() { return inflight == 0; });
+    } /* drain */
+
+    void uring_engine::reap()
+    {
+      for (;;) {
+	int ret = uring_enter(r->fd, 0, 1, IORING_ENTER_GETEVENTS);
+	if ((ret < 0) && (errno != EINTR)) {
+	  return; // the ring is unusable
+	}
+	uint32_t head = *r->cq_head;
+	uint32_t tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	/* what completed by tail was pushed under sq_mtx:  taking it
+	 * orders those ops' fields before our reads (the ring itself is
+	 * outside the memory model) */
+	{
+	  std::lock_guard<std::mutex> guard(sq_mtx);
+	}
+	for (; head != tail; ++head) {
+	  io_uring_cqe* cqe = &r->cqes[head & r->cq_mask];
+	  op* o = reinterpret_cast<op*>(cqe->user_data);
+	  int res = cqe->res;
+	  __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+	  if (! o) {
+	    return; // from ~uring_engine
+	  }
+	  complete(o, res);
+	}
+      }
+    } /* reap */
+
+    /* one sqe of o finished with res:  resubmit, or finish o */
+    void uring_engine::complete(op* o, int res)
+    {
+      if (res < 0) {
+	if ((res == -EINTR) || (res == -EAGAIN)) {
+	  push(o);
+	  (void) submit();
+	  return;
+	}
+	finish(o, -res);
+	return;
+      }
+      switch (o->k) {
+      case op::kind::read:
+      case op::kind::write:
+	if (res == 0) {
+	  finish(o, EIO); // short:  truncated underneath us
+	  return;
+	}
+	o->done += res;
+	if (o->done < o->len) {
+	  break;
+	}
+	if (o->fsync_after) {
+	  o->k = op::kind::fsync;
+	  break;
+	}
+	finish(o, 0);
+	return;
+      case op::kind::fsync:
+	finish(o, 0);
+	return;
+      };
+      push(o);
+      (void) submit();
+    } /* complete */
+
+    void uring_engine::finish(op* o, int ret)
+    {
+      done_cb cb = std::move(o->cb);
+      delete o;
+      cb(ret);
+      std::lock_guard<std::mutex> guard(mtx);
+      --inflight;
+      cv.notify_all();
+    } /* finish */
+
+#else /* ! BPLUS_WITH_URING */
+
+    struct uring_engine::ring {};
+    struct uring_engine::op {};
+
+    std::unique_ptr<uring_engine> uring_engine::create(uint32_t depth)
+    {
+      return nullptr;
+    }
+
+    uring_engine::~uring_engine() {}
+
+    void uring_engine::prep_read(int fd, uint8_t* buf, size_t len,
+				 uint64_t off, done_cb cb)
+    {
+      cb(ENOSYS);
+    }
+
+    void uring_engine::prep_write(int fd, const uint8_t* buf, size_t len,
+				  uint64_t off, bool fsync, done_cb cb)
+    {
+      cb(ENOSYS);
+    }
+
+    int uring_engine::submit()
+    {
+      return ENOSYS;
+    }
+
+    void uring_engine::drain() {}
+
+#endif /* BPLUS_WITH_URING */
+
+}} /* namespace */
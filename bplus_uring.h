@@ -0,0 +1,88 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2019 Red Hat, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation. See file COPYING.
+ *
+ */
+
+#ifndef BPLUS_URING_H
+#define BPLUS_URING_H
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace rgw { namespace bplus {
+
+    /* file reads and writes through io_uring, by raw syscall (no
+     * liburing):  ops queued with prep_* go to the kernel together on
+     * submit();  a reaper thread completes them, resubmitting short
+     * transfers, then runs each op's cb with 0 or an errno--on the
+     * reaper, so a cb must not wait on this engine */
+    class uring_engine
+    {
+    public:
+      using done_cb = std::function<void(int ret)>;
+
+      static constexpr uint32_t default_depth = 64;
+
+      /* null where io_uring can't be used (an old kernel, a seccomp
+       * filter, or a build without its header) */
+      static std::unique_ptr<uring_engine> create(
+	uint32_t depth = default_depth);
+
+      ~uring_engine();
+
+      /* queue a transfer of len bytes at off;  fd and buf must stay
+       * valid until cb runs;  blocks while depth ops are in flight */
+      void prep_read(int fd, uint8_t* buf, size_t len, uint64_t off,
+		     done_cb cb);
+      /* with fsync, cb runs once the data is also synced */
+      void prep_write(int fd, const uint8_t* buf, size_t len, uint64_t off,
+		      bool fsync, done_cb cb);
+      /* hand everything queued to the kernel:  0, or an errno */
+      int submit();
+      /* wait until every op has completed and run its cb */
+      void drain();
+
+      uint32_t depth() const {
+	return depth_;
+      }
+
+    private:
+      struct ring;
+      struct op;
+
+      const uint32_t depth_;
+      std::unique_ptr<ring> r;
+
+      std::mutex sq_mtx; // the submission queue and pending
+      uint32_t pending{0}; // queued, not yet submitted
+
+      std::mutex mtx;
+      std::condition_variable cv;
+      uint32_t inflight{0}; // prepped, cb not yet run
+
+      std::thread reaper;
+
+      uring_engine(uint32_t _depth, std::unique_ptr<ring> _r);
+
+      void prep(op* o);
+      void push(op* o);
+      void reap();
+      void complete(op* o, int res);
+      void finish(op* o, int ret);
+    }; /* uring_engine */
+
+}} /* namespace */
+
+#endif /* BPLUS_URING_H */
@@ -0,0 +1,397 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2019 Red Hat, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation. See file COPYING.
+ *
+ */
+
+#include "bplus_wal.h"
+#include "compat.h"
+#include "xxhash.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <iterator>
+
+namespace rgw { namespace bplus {
+
+    /* length, lsn, op, key length;  then key, value, hash */
+    static constexpr size_t rec_head = 4 + 8 + 1 + 4;
+    static constexpr size_t rec_tail = 8;
+
+    static inline void put_le(std::string& s, uint64_t v, int n)
+    {
+      for (int ix = 0; ix < n; ++ix) {
+	s.push_back(char(uint8_t(v >> (8 * ix))));
+      }
+    } /* put_le */
+
+    static inline uint64_t get_le(const char* p, int n)
+    {
+      uint64_t v{0};
+      for (int ix = 0; ix < n; ++ix) {
+	v |= uint64_t(uint8_t(p[ix])) << (8 * ix);
+      }
+      return v;
+    } /* get_le */
+
+    static inline size_t hist_bucket(uint64_t v)
+    {
+      size_t b = (v == 0) ? 0 : (64 - __builtin_clzll(v));
+      return std::min(b, wal::hist_buckets - 1);
+    } /* hist_bucket */
+
+    static std::string segment_path(const std::string& dir, uint64_t first)
+    {
+      char buf[32];
+      ::snprintf(buf, sizeof(buf), "/wal-%016llx", (unsigned long long) first);
+      return dir + buf;
+    } /* segment_path */
+
+    static int write_all(int fd, const std::string& s)
+    {
+      const char* p = s.data();
+      size_t left = s.size();
+      while (left > 0) {
+	ssize_t n = ::write(fd, p, left);
+	if (n < 0) {
+	  if (errno == EINTR) {
+	    continue;
+	  }
+	  return errno;
+	}
+	p += n;
+	left -= n;
+      }
+      return 0;
+    } /* write_all */
+
+    uint64_t wal::percentile(const histogram& h, double q)
+    {
+      uint64_t total{0};
+      for (auto n : h) {
+	total += n;
+      }
+      if (total == 0) {
+	return 0;
+      }
+      uint64_t want = std::max<uint64_t>(1, q * total + 0.5);
+      uint64_t sum{0};
+      for (size_t ix = 0; ix < h.size(); ++ix) {
+	sum += h[ix];
+	if (sum >= want) {
+	  return (ix == 0) ? 0 : (uint64_t(1) << ix);
+	}
+      }
+      return uint64_t(1) << (h.size() - 1);
+    } /* percentile */
+
+    std::shared_ptr<wal> wal::open(const std::string& dir,
+				   const options& opts, int* ret)
+    {
+      std::shared_ptr<wal> w(new wal(dir, opts));
+      int r = w->init();
+      if (ret) {
+	*ret = r;
+      }
+      return (r == 0) ? w : nullptr;
+    } /* open */
+
+    wal::~wal()
+    {
+      if (fd >= 0) {
+	::close(fd);
+      }
+    } /* ~wal */
+
+    int wal::init()
+    {
+      DIR* d = ::opendir(dir.c_str());
+      if (! d) {
+	return errno;
+      }
+      while (struct dirent* de = ::readdir(d)) {
+	const char* name = de->d_name;
+	if ((::strncmp(name, "wal-", 4) != 0) || (::strlen(name) != 20)) {
+	  continue;
+	}
+	char* end;
+	uint64_t first = ::strtoull(name + 4, &end, 16);
+	if ((*end == '\0') && (first != 0)) {
+	  segments[first] = dir + "/" + name;
+	}
+      }
+      ::closedir(d);
+      if (segments.empty()) {
+	return open_segment(1);
+      }
+      /* only the last segment can be torn:  one is started only once
+       * everything before it is synced */
+      uint64_t next = segments.begin()->first;
+      off_t end{0};
+      for (auto it = segments.begin(); it != segments.end(); ++it) {
+	if (it->first != next) {
+	  return EIO;
+	}
+	int ret = scan(it->second, it->first, nullptr, &next, &end);
+	if (ret != 0) {
+	  return ret;
+	}
+      }
+      next_lsn = next;
+      synced_lsn = next - 1;
+      const std::string& last = segments.rbegin()->second;
+      fd = ::open(last.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+      if (fd < 0) {
+	return errno;
+      }
+      if (::ftruncate(fd, end) < 0) {
+	return errno;
+      }
+      return 0;
+    } /* init */
+
+    int wal::scan(const std::string& path, uint64_t first,
+		  const record_cb* cb, uint64_t* next, off_t* end)
+    {
+      int sfd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (sfd < 0) {
+	return errno;
+      }
+      std::string data;
+      char chunk[65536];
+      for (;;) {
+	ssize_t n = ::read(sfd, chunk, sizeof(chunk));
+	if (n < 0) {
+	  if (errno == EINTR) {
+	    continue;
+	  }
+	  int ret = errno;
+	  ::close(sfd);
+	  return ret;
+	}
+	if (n == 0) {
+	  break;
+	}
+	data.append(chunk, n);
+      }
+      ::close(sfd);
+      uint64_t lsn = first;
+      size_t off{0};
+      std::string key, value;
+      while (data.size() - off >= rec_head + rec_tail) {
+	const char* p = data.data() + off;
+	size_t len = get_le(p, 4);
+	if ((len < rec_head - 4 + rec_tail) || (len > data.size() - off - 4)) {
+	  break;
+	}
+	size_t klen = get_le(p + 13, 4);
+	if (klen > len - (rec_head - 4) - rec_tail) {
+	  break;
+	}
+	uint64_t hash = get_le(p + 4 + len - rec_tail, 8);
+	if ((XXH64(p + 4, len - rec_tail, 0) != hash) ||
+	    (get_le(p + 4, 8) != lsn)) {
+	  break;
+	}
+	if (cb) {
+	  size_t vlen = len - (rec_head - 4) - rec_tail - klen;
+	  key.assign(p + rec_head, klen);
+	  value.assign(p + rec_head + klen, vlen);
+	  int ret = (*cb)(op(uint8_t(p[12])), key, value);
+	  if (ret != 0) {
+	    return ret;
+	  }
+	}
+	++lsn;
+	off += 4 + len;
+      }
+      *next = lsn;
+      *end = off;
+      return 0;
+    } /* scan */
+
+    int wal::replay(const record_cb& cb)
+    {
+      std::unique_lock<std::mutex> uniq(mtx);
+      auto segs = segments;
+      uniq.unlock();
+      for (const auto& [first, path] : segs) {
+	uint64_t next;
+	off_t end;
+	int ret = scan(path, first, &cb, &next, &end);
+	if (ret != 0) {
+	  return ret;
+	}
+      }
+      return 0;
+    } /* replay */
+
+    int wal::sync_dir()
+    {
+      if (! opts.sync) {
+	return 0;
+      }
+      int dfd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (dfd < 0) {
+	return errno;
+      }
+      int ret = (::fsync(dfd) < 0) ? errno : 0;
+      ::close(dfd);
+      return ret;
+    } /* sync_dir */
+
+    int wal::open_segment(uint64_t first)
+    {
+      std::string path = segment_path(dir, first);
+      int nfd = ::open(path.c_str(),
+		       O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+		       0644);
+      if (nfd < 0) {
+	return errno;
+      }
+      int ret = sync_dir();
+      if (ret != 0) {
+	::close(nfd);
+	::unlink(path.c_str());
+	return ret;
+      }
+      if (fd >= 0) {
+	::close(fd);
+      }
+      fd = nfd;
+      segments[first] = path;
+      return 0;
+    } /* open_segment */
+
+    uint64_t wal::append(op o, const std::string& key,
+			 const std::string& value)
+    {
+      std::lock_guard<std::mutex> guard(mtx);
+      uint64_t lsn = next_lsn++;
+      size_t len = (rec_head - 4) + key.size() + value.size() + rec_tail;
+      size_t off = buf.size();
+      put_le(buf, len, 4);
+      put_le(buf, lsn, 8);
+      buf.push_back(char(o));
+      put_le(buf, key.size(), 4);
+      buf.append(key);
+      buf.append(value);
+      put_le(buf, XXH64(buf.data() + off + 4, len - rec_tail, 0), 8);
+      ++buf_records;
+      ++st.records;
+      st.bytes += 4 + len;
+      since_checkpoint += 4 + len;
+      if (unlikely(buf.size() >= opts.max_batch_bytes)) {
+	/* a leader waiting out its window can go now */
+	cv.notify_all();
+      }
+      return lsn;
+    } /* append */
+
+    int wal::commit(uint64_t lsn)
+    {
+      auto t0 = std::chrono::steady_clock::now();
+      std::unique_lock<std::mutex> uniq(mtx);
+      while ((synced_lsn < lsn) && (error == 0)) {
+	if (syncing) {
+	  cv.wait(uniq);
+	  continue;
+	}
+	/* lead */
+	syncing = true;
+	if (opts.window.count() > 0) {
+	  cv.wait_until(uniq, t0 + opts.window, [this]() {
+	    return buf.size() >= opts.max_batch_bytes;
+	  });
+	}
+	std::string out;
+	out.swap(buf);
+	uint64_t upto = next_lsn - 1;
+	uint64_t nrecords = buf_records;
+	buf_records = 0;
+	int wfd = fd;
+	uniq.unlock();
+	int ret = write_all(wfd, out);
+	if ((ret == 0) && opts.sync && (::fdatasync(wfd) < 0)) {
+	  ret = errno;
+	}
+	uniq.lock();
+	syncing = false;
+	if (unlikely(ret != 0)) {
+	  error = ret;
+	} else {
+	  synced_lsn = upto;
+	  ++st.batches;
+	  st.batch_max = std::max(st.batch_max, nrecords);
+	  ++st.batch_hist[hist_bucket(nrecords)];
+	}
+	cv.notify_all();
+      }
+      int ret = (synced_lsn >= lsn) ? 0 : error;
+      uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+	std::chrono::steady_clock::now() - t0).count();
+      ++st.commits;
+      st.commit_us += us;
+      st.commit_us_max = std::max(st.commit_us_max, us);
+      ++st.commit_hist[hist_bucket(us)];
+      return ret;
+    } /* commit */
+
+    int wal::checkpoint(uint64_t lsn)
+    {
+      int ret = commit(last_lsn());
+      if (ret != 0) {
+	return ret;
+      }
+      std::unique_lock<std::mutex> uniq(mtx);
+      cv.wait(uniq, [this]() { return ! syncing; });
+      /* anything still buffered goes in the new segment */
+      uint64_t first = synced_lsn + 1;
+      if (segments.rbegin()->first < first) {
+	ret = open_segment(first);
+	if (ret != 0) {
+	  return ret;
+	}
+      }
+      for (auto it = segments.begin(); std::next(it) != segments.end();) {
+	if (std::next(it)->first > lsn + 1) {
+	  break;
+	}
+	::unlink(it->second.c_str());
+	it = segments.erase(it);
+      }
+      since_checkpoint = buf.size();
+      return sync_dir();
+    } /* checkpoint */
+
+    uint64_t wal::last_lsn() const
+    {
+      std::lock_guard<std::mutex> guard(mtx);
+      return next_lsn - 1;
+    } /* last_lsn */
+
+    uint64_t wal::log_bytes() const
+    {
+      std::lock_guard<std::mutex> guard(mtx);
+      return since_checkpoint;
+    } /* log_bytes */
+
+    wal::stats wal::get_stats() const
+    {
+      std::lock_guard<std::mutex> guard(mtx);
+      return st;
+    } /* get_stats */
+
+}} /* namespace */
@@ -0,0 +1,140 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2019 Red Hat, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation. See file COPYING.
+ *
+ */
+
+#ifndef BPLUS_WAL_H
+#define BPLUS_WAL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+
+namespace rgw { namespace bplus {
+
+    /* group commit tuning (see wal) */
+    struct wal_options {
+      std::chrono::microseconds window{0};
+      size_t max_batch_bytes{1024 * 1024};
+      bool sync{true}; // fdatasync each batch
+    };
+
+    /* a write-ahead log of a tree's mutations, in a directory of
+     * segment files ("wal-<first lsn, hex>"), appended to in lsn
+     * order;  each record is framed by its length (4 bytes,
+     * little-endian), then lsn, op, key length, key, value, and an
+     * XXH64 of all but the length, so a torn tail is found and cut
+     * off on open
+     *
+     * group commit:  records are appended to a buffer, and committing
+     * one waits until it is synced;  the first committer to find no
+     * sync under way leads one, after waiting up to window for others
+     * to join (or until max_batch_bytes are waiting), then writes and
+     * syncs everything appended, for all of them;  records appended
+     * while one sync is under way go in the next */
+    class wal
+    {
+    public:
+      enum class op : uint8_t {
+	insert = 1,
+	remove = 2,
+      };
+
+      using options = wal_options;
+
+      /* latency in us, and batch size in records, counted in log2
+       * buckets:  bucket i holds [2^(i-1), 2^i), bucket 0 just 0 */
+      static constexpr size_t hist_buckets = 32;
+      using histogram = std::array<uint64_t, hist_buckets>;
+
+      struct stats {
+	uint64_t records{0};
+	uint64_t bytes{0};
+	uint64_t batches{0}; // syncs
+	uint64_t commits{0};
+	uint64_t commit_us{0}; // summed, over commits
+	uint64_t commit_us_max{0};
+	uint64_t batch_max{0};
+	histogram commit_hist{};
+	histogram batch_hist{};
+      };
+
+      /* the upper bound of the bucket holding fraction q of h */
+      static uint64_t percentile(const histogram& h, double q);
+
+      using record_cb = std::function<int(op, const std::string& key,
+					  const std::string& value)>;
+
+      /* the log in dir, which must exist;  a torn tail is truncated;
+       * null on error, with *ret set to an errno */
+      static std::shared_ptr<wal> open(const std::string& dir,
+				       const options& opts = options(),
+				       int* ret = nullptr);
+
+      ~wal();
+
+      /* returns the record's lsn */
+      uint64_t append(op o, const std::string& key,
+		      const std::string& value = std::string());
+      /* wait until every record up to lsn is synced */
+      int commit(uint64_t lsn);
+      /* every record in the log, oldest first, until cb fails */
+      int replay(const record_cb& cb);
+      /* records up to lsn are no longer needed:  sync them, start a
+       * new segment, and delete the segments they alone filled */
+      int checkpoint(uint64_t lsn);
+
+      uint64_t last_lsn() const;
+      /* appended since the last checkpoint */
+      uint64_t log_bytes() const;
+      stats get_stats() const;
+
+    private:
+      const std::string dir;
+      const options opts;
+
+      mutable std::mutex mtx;
+      std::condition_variable cv;
+      std::map<uint64_t, std::string> segments; // first lsn -> path
+      int fd{-1}; // the last segment's
+      std::string buf; // appended, not yet written
+      uint64_t buf_records{0};
+      uint64_t next_lsn{1};
+      uint64_t synced_lsn{0};
+      uint64_t since_checkpoint{0};
+      bool syncing{false};
+      int error{0}; // a failed sync fails every later commit
+      stats st;
+
+      wal(const std::string& _dir, const options& _opts)
+	: dir(_dir), opts(_opts) {}
+
+      int init();
+      /* parse a segment, calling cb with each record (if cb), to the
+       * first that is torn or out of sequence;  *end gets its offset */
+      int scan(const std::string& path, uint64_t first,
+	       const record_cb* cb, uint64_t* next, off_t* end);
+      /* callers hold mtx, and no sync is under way */
+      int open_segment(uint64_t first);
+      int sync_dir();
+    }; /* wal */
+
+}} /* namespace */
+
+#endif /* BPLUS_WAL_H */
@@ -16,23 +16,88 @@
 
 #include <stdint.h>
 #include <string>
+#include <string_view>
 #include <array>
+#include <algorithm>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 #include <functional>
 #include <boost/variant.hpp>
 #include <boost/blank.hpp>
+#ifndef XXH_STATIC_LINKING_ONLY
+#define XXH_STATIC_LINKING_ONLY // for the state structs, to embed them
+#endif
+#include "xxhash.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+/* the cryptographic digests come from ceph;  built without it (as
+ * tbplus is), only the xxHash ones are available */
+#if __has_include("ceph_crypto.h")
+#define RGW_CKSUM_WITH_CRYPTO 1
 #include "ceph_crypto.h"
 #include "blake2/sse/blake2.h"
+#endif
 
 namespace rgw { namespace cksum {
 
+/* the two hex digits of each byte value */
+struct hex_table {
+  char d[256][2];
+  constexpr hex_table() : d() {
+    constexpr char digits[] = "0123456789abcdef";
+    for (int i = 0; i < 256; ++i) {
+      d[i][0] = digits[i >> 4];
+      d[i][1] = digits[i & 0xf];
+    }
+  }
+};
+static constexpr hex_table hex_digits;
+
+/* 2 * len hex digits of buf into str, unterminated;  16 bytes at a
+ * time where SSE2 is available */
+static inline void buf_to_hex_n(const unsigned char* const buf,
+				const size_t len,
+				char* const str)
+{
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i lo_mask = _mm_set1_epi8(0x0f);
+  const __m128i nine = _mm_set1_epi8(9);
+  const __m128i zero_ch = _mm_set1_epi8('0');
+  const __m128i alpha_off = _mm_set1_epi8('a' - '0' - 10);
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + i));
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), lo_mask);
+    __m128i lo = _mm_and_si128(v, lo_mask);
+    /* interleave so each byte's high nibble comes first */
+    __m128i n0 = _mm_unpacklo_epi8(hi, lo);
+    __m128i n1 = _mm_unpackhi_epi8(hi, lo);
+    /* nibbles > 9 become 'a'.. */
+    n0 = _mm_add_epi8(_mm_add_epi8(n0, zero_ch),
+		      _mm_and_si128(_mm_cmpgt_epi8(n0, nine), alpha_off));
+    n1 = _mm_add_epi8(_mm_add_epi8(n1, zero_ch),
+		      _mm_and_si128(_mm_cmpgt_epi8(n1, nine), alpha_off));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(str + i*2), n0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(str + i*2 + 16), n1);
+  }
+#endif
+  for (char* out = str + i*2; i < len; ++i) {
+    *out++ = hex_digits.d[buf[i]][0];
+    *out++ = hex_digits.d[buf[i]][1];
+  }
+}
+
 static inline void buf_to_hex(const unsigned char* const buf,
                               const size_t len,
                               char* const str)
 {
-  str[0] = '\0';
-  for (size_t i = 0; i < len; i++) {
-    ::sprintf(&str[i*2], "%02x", static_cast<int>(buf[i]));
-  }
+  buf_to_hex_n(buf, len, str);
+  str[len*2] = '\0';
 }
 
 template<size_t N> static inline std::array<char, N * 2 + 1>
@@ -51,6 +116,8 @@ buf_to_hex(const std::array<unsigned char, N>& buf)
       sha256,
       sha512,
       blake2bp,
+      xxh64,
+      xxh3,
   };
     
   class Desc
@@ -66,12 +133,14 @@ buf_to_hex(const std::array<unsigned char, N>& buf)
 
   class Cksum {
   public:
-    static constexpr std::array<Desc, 4> checksums =
+    static constexpr std::array<Desc, 6> checksums =
     {
       Desc(CksumType::none, "none", 0),
       Desc(CksumType::sha256, "SHA256", 32),
       Desc(CksumType::sha512, "SHA512", 64),
-      Desc(CksumType::blake2bp, "Blake2B", 64)
+      Desc(CksumType::blake2bp, "Blake2B", 64),
+      Desc(CksumType::xxh64, "XXH64", 8),
+      Desc(CksumType::xxh3, "XXH3", 8)
     };
 
     static constexpr uint16_t max_digest_size = 64;
@@ -83,15 +152,13 @@ buf_to_hex(const std::array<unsigned char, N>& buf)
     Cksum(CksumType _type) : type(_type) {}
 
     std::string to_string()  {
-      std::string hs;
       const auto& ckd = checksums[uint16_t(type)];
-      char hex[ckd.digest_size * 2 + 1];
-      buf_to_hex(digest.data(), ckd.digest_size, hex);
-      hs.reserve(ckd.digest_size * 2 + 1 + 10);
-      hs += ckd.name;
+      std::string hs{ckd.name};
       hs += "::";
-      hs += hex;
-      return std::move(hs);
+      size_t off = hs.size();
+      hs.resize(off + ckd.digest_size * 2);
+      buf_to_hex_n(digest.data(), ckd.digest_size, hs.data() + off);
+      return hs;
     }
   }; /* Cksum */
 
@@ -131,23 +198,87 @@ buf_to_hex(const std::array<unsigned char, N>& buf)
     }
   };
 
+  /* non-cryptographic:  for integrity, not authenticity;  the
+   * 64-bit hash is written big-endian (xxHash's canonical form) */
+  class XXH64State
+  {
+    XXH64_state_t st;
+  public:
+    XXH64State() { Restart(); }
+    void Restart() { XXH64_reset(&st, 0); }
+    void Update(const unsigned char* data, uint64_t len) {
+      XXH64_update(&st, data, len);
+    }
+    void Final(unsigned char* digest) {
+      XXH64_canonicalFromHash(
+	reinterpret_cast<XXH64_canonical_t*>(digest), XXH64_digest(&st));
+    }
+  }; /* XXH64State */
+
+  class XXH3State
+  {
+    XXH3_state_t st;
+  public:
+    XXH3State() { Restart(); }
+    void Restart() { XXH3_64bits_reset(&st); }
+    void Update(const unsigned char* data, uint64_t len) {
+      XXH3_64bits_update(&st, data, len);
+    }
+    void Final(unsigned char* digest) {
+      XXH64_canonicalFromHash(
+	reinterpret_cast<XXH64_canonical_t*>(digest),
+	XXH3_64bits_digest(&st));
+    }
+  }; /* XXH3State */
+
+  typedef TDigest<XXH64State> XXHash64;
+  typedef TDigest<XXH3State> XXHash3;
+#ifdef RGW_CKSUM_WITH_CRYPTO
   typedef TDigest<ceph::crypto::Blake2B> Blake2B;
   typedef TDigest<ceph::crypto::SHA256> SHA256;
   typedef TDigest<ceph::crypto::SHA512> SHA512;
-  
+#endif
+
   typedef boost::variant<boost::blank,
+#ifdef RGW_CKSUM_WITH_CRYPTO
 			 Blake2B,
 			 SHA256,
-			 SHA512> DigestVariant;
+			 SHA512,
+#endif
+			 XXHash64,
+			 XXHash3> DigestVariant;
 
   struct get_digest_ptr : public boost::static_visitor<Digest*>
   {
     Digest* operator()(const boost::blank& b) const { return nullptr; }
+#ifdef RGW_CKSUM_WITH_CRYPTO
     Digest* operator()(Blake2B& digest) const { return &digest; }
     Digest* operator()(SHA256& digest) const { return &digest; }
     Digest* operator()(SHA512& digest) const { return &digest; }
+#endif
+    Digest* operator()(XXHash64& digest) const { return &digest; }
+    Digest* operator()(XXHash3& digest) const { return &digest; }
   };
 
+  /* true iff digest_factory(type) yields a digest in this build */
+  static inline bool have_digest(const CksumType type)
+  {
+    switch (type) {
+    case CksumType::xxh64:
+    case CksumType::xxh3:
+      return true;
+#ifdef RGW_CKSUM_WITH_CRYPTO
+    case CksumType::blake2bp:
+    case CksumType::sha256:
+    case CksumType::sha512:
+      return true;
+#endif
+    default:
+      break;
+    };
+    return false;
+  }
+
   static inline Digest* get_digest(DigestVariant& ev)
   {
     return boost::apply_visitor(get_digest_ptr{}, ev);
@@ -156,6 +287,7 @@ buf_to_hex(const std::array<unsigned char, N>& buf)
   static inline DigestVariant digest_factory(const CksumType cksum_type)
   {
     switch (cksum_type) {
+#ifdef RGW_CKSUM_WITH_CRYPTO
     case CksumType::blake2bp:
       return Blake2B();
       break;
@@ -165,7 +297,14 @@ buf_to_hex(const std::array<unsigned char, N>& buf)
     case CksumType::sha512:
       return SHA512();
       break;
-    case CksumType::none:
+#endif
+    case CksumType::xxh64:
+      return XXHash64();
+      break;
+    case CksumType::xxh3:
+      return XXHash3();
+      break;
+    default:
       break;
     };
     return boost::blank();
@@ -181,6 +320,148 @@ buf_to_hex(const std::array<unsigned char, N>& buf)
     return cksum;
   }
 
+  /* digest of one whole buffer:  the xxHash types go one-shot,
+   * skipping streaming state (XXH3 vectorizes within the buffer);
+   * others through dv, which must hold a digest of type */
+  static inline void digest_one(const CksumType type, DigestVariant& dv,
+				const std::string_view& buf,
+				unsigned char* out)
+  {
+    auto data = reinterpret_cast<const unsigned char*>(buf.data());
+    switch (type) {
+    case CksumType::xxh64:
+      XXH64_canonicalFromHash(reinterpret_cast<XXH64_canonical_t*>(out),
+			      XXH64(data, buf.size(), 0));
+      break;
+    case CksumType::xxh3:
+      XXH64_canonicalFromHash(reinterpret_cast<XXH64_canonical_t*>(out),
+			      XXH3_64bits(data, buf.size()));
+      break;
+    default:
+      {
+	Digest* digest = get_digest(dv);
+	if (digest) {
+	  digest->Restart();
+	  digest->Update(data, buf.size());
+	  digest->Final(out);
+	}
+      }
+      break;
+    };
+  }
+
+  /* the threads digest_batch() runs its lanes on, past the caller's:
+   * started on first use and kept, growing to the most lanes asked
+   * for, so a flush or scrub digesting batch after batch doesn't
+   * start and join threads for each */
+  class lane_pool
+  {
+    std::mutex mtx;
+    std::condition_variable work_cv;
+    std::deque<std::function<void()>> work;
+    std::vector<std::thread> threads;
+    bool stopping{false};
+
+    void worker() {
+      std::unique_lock<std::mutex> guard(mtx);
+      for (;;) {
+	work_cv.wait(guard, [this]() { return stopping || ! work.empty(); });
+	if (work.empty()) {
+	  return; // stopping
+	}
+	auto fn = std::move(work.front());
+	work.pop_front();
+	guard.unlock();
+	fn();
+	guard.lock();
+      }
+    }
+
+  public:
+    static lane_pool& instance() {
+      static lane_pool pool;
+      return pool;
+    }
+
+    ~lane_pool() {
+      {
+	std::lock_guard<std::mutex> guard(mtx);
+	stopping = true;
+      }
+      work_cv.notify_all();
+      for (auto& t : threads) {
+	t.join();
+      }
+    }
+
+    /* run fn on nlanes lanes, the caller's thread being one, and
+     * return once every one has */
+    void run(uint32_t nlanes, const std::function<void()>& fn) {
+      std::mutex done_mtx;
+      std::condition_variable done_cv;
+      uint32_t running = nlanes - 1;
+      {
+	std::lock_guard<std::mutex> guard(mtx);
+	while (threads.size() < running) {
+	  threads.emplace_back(&lane_pool::worker, this);
+	}
+	for (uint32_t ix = 0; ix < nlanes - 1; ++ix) {
+	  work.emplace_back([&]() {
+	    fn();
+	    std::lock_guard<std::mutex> done_guard(done_mtx);
+	    if (--running == 0) {
+	      done_cv.notify_one();
+	    }
+	  });
+	}
+      }
+      work_cv.notify_all();
+      fn();
+      std::unique_lock<std::mutex> done_guard(done_mtx);
+      done_cv.wait(done_guard, [&running]() { return running == 0; });
+    }
+  }; /* lane_pool */
+
+  /* batch api:  the digests of many independent buffers (as a flush
+   * or scrub of nodes has), result i for bufs[i];  buffers are taken
+   * in turn by up to nthreads lanes, the caller's thread being one
+   * (the rest pooled, see lane_pool), but batches under min_parallel
+   * bytes stay on the caller's */
+  static constexpr size_t min_parallel = size_t(1) << 20;
+
+  static inline std::vector<Cksum> digest_batch(
+    const CksumType type, const std::vector<std::string_view>& bufs,
+    uint32_t nthreads = 1)
+  {
+    std::vector<Cksum> cksums(bufs.size(), Cksum(type));
+    if (! have_digest(type)) {
+      return cksums;
+    }
+    size_t bytes = 0;
+    for (const auto& buf : bufs) {
+      bytes += buf.size();
+    }
+    if (bytes < min_parallel) {
+      nthreads = 1;
+    }
+    nthreads = std::max(uint32_t(1),
+			std::min<uint32_t>(nthreads, bufs.size()));
+
+    std::atomic<size_t> next{0};
+    auto lane = [&]() {
+      DigestVariant dv = digest_factory(type);
+      for (size_t ix = next++; ix < bufs.size(); ix = next++) {
+	digest_one(type, dv, bufs[ix], cksums[ix].digest.data());
+      }
+    };
+    if (nthreads == 1) {
+      lane();
+    } else {
+      lane_pool::instance().run(nthreads, lane);
+    }
+    return cksums;
+  } /* digest_batch */
+
 }} /* namespace */
 
 #endif /* RGW_CKSUM_H */
@@ -18,6 +18,11 @@
 #include <sstream>
 #include <string>
 #include <vector>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <string_view>
+#include <cstdio>
 
 #include "ceph_types.h"
 #include "rgw_cksum.h"
@@ -32,6 +37,8 @@ namespace {
 
   CksumType t1 = CksumType::blake2bp;
   CksumType t2 = CksumType::sha256;
+  CksumType t3 = CksumType::xxh64;
+  CksumType t4 = CksumType::xxh3;
 
   std::string dolor =
     "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod "
@@ -41,7 +48,127 @@ namespace {
     "velit esse cillum dolore eu fugiat nulla pariatur. Excepteur sint "
     "occaecat cupidatat non proident, sunt in culpa qui officia deserunt "
     "mollit anim id est laborum.";
-  
+
+  /* GB/s of each digest this build has, over a buffer fed in
+   * update_size pieces:  large ones for bulk data, small ones as a
+   * node checksum sees (one field at a time) */
+  void throughput(size_t update_size) {
+    static constexpr size_t buf_size = 1 << 20;
+    static constexpr int reps = 256;
+    std::vector<unsigned char> buf(buf_size);
+    std::mt19937_64 mt{8675309};
+    for (auto& c : buf) {
+      c = mt();
+    }
+    for (const auto& ck : Cksum::checksums) {
+      if (! have_digest(ck.type)) {
+	continue;
+      }
+      DigestVariant dv = rgw::cksum::digest_factory(ck.type);
+      Digest* digest = get_digest(dv);
+      Cksum::value_type out;
+      auto t0 = std::chrono::steady_clock::now();
+      for (int rep = 0; rep < reps; ++rep) {
+	digest->Restart();
+	for (size_t off = 0; off < buf_size; off += update_size) {
+	  digest->Update(buf.data() + off, update_size);
+	}
+	digest->Final(out.data());
+      }
+      std::chrono::duration<double> secs =
+	std::chrono::steady_clock::now() - t0;
+      std::cout << "type: " << to_string(ck.type)
+		<< " update: " << update_size << "B "
+		<< (double(buf_size) * reps / secs.count() / 1e9) << " GB/s"
+		<< std::endl;
+    }
+  }
+
+  using bench_clock = std::chrono::steady_clock;
+
+  double gbps(size_t bytes, bench_clock::time_point t0) {
+    std::chrono::duration<double> secs = bench_clock::now() - t0;
+    return double(bytes) / secs.count() / 1e9;
+  }
+
+  /* many independent buffers (as a flush or scrub of nodes has), one
+   * Digest stream after another vs. digest_batch on 1..n lanes */
+  void batch_throughput(size_t nbufs, size_t buf_size) {
+    static constexpr int reps = 16;
+    std::vector<std::string> bufs(nbufs, std::string(buf_size, '\0'));
+    std::mt19937_64 mt{8675309};
+    for (auto& buf : bufs) {
+      for (auto& c : buf) {
+	c = mt();
+      }
+    }
+    std::vector<std::string_view> views(bufs.begin(), bufs.end());
+    const size_t bytes = nbufs * buf_size * reps;
+    const uint32_t ncpu = std::max(1u, std::thread::hardware_concurrency());
+
+    for (const auto& ck : Cksum::checksums) {
+      if (! have_digest(ck.type)) {
+	continue;
+      }
+      DigestVariant dv = rgw::cksum::digest_factory(ck.type);
+      Digest* digest = get_digest(dv);
+      Cksum::value_type out;
+      auto t0 = bench_clock::now();
+      for (int rep = 0; rep < reps; ++rep) {
+	for (const auto& buf : bufs) {
+	  digest->Restart();
+	  digest->Update((const unsigned char*) buf.data(), buf.size());
+	  digest->Final(out.data());
+	}
+      }
+      std::cout << "type: " << to_string(ck.type)
+		<< " " << nbufs << "x" << buf_size << "B"
+		<< " stream: " << gbps(bytes, t0) << " GB/s";
+      for (uint32_t nthreads : {1u, ncpu}) {
+	/* the lanes' threads are started once, not timed */
+	digest_batch(ck.type, views, nthreads);
+	t0 = bench_clock::now();
+	for (int rep = 0; rep < reps; ++rep) {
+	  auto cksums = digest_batch(ck.type, views, nthreads);
+	}
+	std::cout << " batch(" << nthreads << "): "
+		  << gbps(bytes, t0) << " GB/s";
+      }
+      std::cout << std::endl;
+    }
+  }
+
+  /* digests/s as hex:  the per-byte sprintf this replaced vs.
+   * buf_to_hex */
+  void hex_throughput() {
+    static constexpr int reps = 1 << 20;
+    Cksum::value_type digest;
+    for (size_t ix = 0; ix < digest.size(); ++ix) {
+      digest[ix] = ix * 37;
+    }
+    char hex[Cksum::max_digest_size * 2 + 1];
+    size_t sum = 0; // keeps the loops live
+    auto t0 = bench_clock::now();
+    for (int rep = 0; rep < reps; ++rep) {
+      digest[0] = rep;
+      for (size_t ix = 0; ix < digest.size(); ++ix) {
+	::sprintf(&hex[ix*2], "%02x", static_cast<int>(digest[ix]));
+      }
+      sum += hex[1];
+    }
+    std::chrono::duration<double> sprintf_secs = bench_clock::now() - t0;
+    t0 = bench_clock::now();
+    for (int rep = 0; rep < reps; ++rep) {
+      digest[0] = rep;
+      buf_to_hex(digest.data(), digest.size(), hex);
+      sum += hex[1];
+    }
+    std::chrono::duration<double> table_secs = bench_clock::now() - t0;
+    std::cout << "hex " << digest.size() << "B digests: sprintf: "
+	      << (reps / sprintf_secs.count() / 1e6) << " M/s buf_to_hex: "
+	      << (reps / table_secs.count() / 1e6) << " M/s"
+	      << " (" << sum % 2 << ")" << std::endl;
+  }
 }
 
 int main(int argc, char **argv)
@@ -51,7 +178,7 @@ int main(int argc, char **argv)
   hasher.Update((const unsigned char *)dolor.c_str(), dolor.length());
   hasher.Final(hash.v);
   
-  for (auto t : {t1, t2}) {
+  for (auto t : {t1, t2, t3, t4}) {
     DigestVariant dv = rgw::cksum::digest_factory(t);
     Digest* digest = get_digest(dv);
 
@@ -67,5 +194,12 @@ int main(int argc, char **argv)
     }
   }
 
+  for (size_t update_size : {size_t(1 << 20), size_t(32)}) {
+    throughput(update_size);
+  }
+  batch_throughput(4096, 4096);
+  batch_throughput(256, 65536);
+  hex_throughput();
+
   return 0;
 }
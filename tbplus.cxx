@@ -20,20 +20,37 @@
 #include <string>
 #include <vector>
 #include <optional>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <filesystem>
+#include <stdlib.h>
 #include <boost/program_options.hpp>
 #include "xxhash.h"
 
 #include "bplus_tree.h"
+#include "bplus_slotted.h"
+#include "bplus_paged.h"
+#include "bplus_wal.h"
 
 #define dout_subsys ceph_subsys_rgw
 
 namespace {
 
   using namespace rgw::bplus;
+  namespace cksum = rgw::cksum;
   using std::get;
   using std::string;
 
   bool verbose = false;
+  bool bench = false;
+  uint32_t bench_keys = 1000000;
+  uint32_t bench_fanout = 100;
   static constexpr uint64_t seed = 8675309;
 
   /* test classes */
@@ -60,6 +77,7 @@ namespace {
   std::vector<uint8_t> min1_serialized_bytes;
 
   branch_node bn(Node_Min1::fanout, Node_Min1::prefix_min_len);
+  slotted_leaf sn(Node_Min1::fanout, Node_Min1::prefix_min_len);
 
   class Tree_Min1 : public ::testing::Test {
   public:
@@ -70,6 +88,185 @@ namespace {
     }
   };
   Tree t1("Tree_Min1", Tree_Min1::fanout);
+  Tree t2("Tree_Min1_t2", Tree_Min1::fanout);
+  Tree t3("Tree_Min1_t3", Tree_Min1::fanout);
+  Tree t4("Tree_Min1_t4", Tree_Min1::fanout);
+  Tree t5("Tree_Min1_t5", Tree_Min1::fanout);
+  Tree t6("Tree_Min1_t6", Tree_Min1::fanout);
+
+  class Cache_Min1 : public ::testing::Test {
+  public:
+    static constexpr uint32_t fanout = 100;
+    string pref{"c_"};
+
+    static leaf_node* make_leaf(const string& lb, const string& ub,
+				int nkeys) {
+      auto ln = new leaf_node(fanout, Node_Min1::prefix_min_len,
+			      fence_key(lb), fence_key(ub));
+      for (int ix = 0; ix < nkeys; ++ix) {
+	string k = lb + "_" + std::to_string(ix);
+	ln->insert(leaf_key(k), "val for " + k);
+      }
+      return ln;
+    }
+  };
+
+  /* backing store for cache tests */
+  auto cache_store = std::make_shared<memory_store>();
+
+  void attach_store(node_cache& c) {
+    c.set_writeback(
+      [](const std::string& name, const std::vector<uint8_t>& bytes) -> int {
+	return cache_store->write(name, bytes);
+      });
+    c.set_fetch(
+      [](const std::string& name, std::vector<uint8_t>& bytes) -> int {
+	return cache_store->read(name, bytes);
+      });
+  }
+
+  class Store_Min1 : public ::testing::Test {
+  public:
+    string pref{"s_"};
+    string dir;
+
+    void SetUp() override {
+      char tmpl[] = "/tmp/tbplus_store.XXXXXX";
+      ASSERT_NE(mkdtemp(tmpl), nullptr);
+      dir = tmpl;
+    }
+    void TearDown() override {
+      if (! dir.empty()) {
+	std::filesystem::remove_all(dir);
+      }
+    }
+
+    static std::vector<uint8_t> obj_bytes(const string& name) {
+      return std::vector<uint8_t>(name.begin(), name.end());
+    }
+
+    /* the round trips every object_store must make */
+    void exercise(object_store& os) {
+      /* node names are z85, so may hold '/', '.' or '%' */
+      vector<string> names;
+      for (int ix = 0; ix < 50; ++ix) {
+	names.push_back(pref + "a/b.c%" + std::to_string(ix));
+      }
+      std::vector<uint8_t> bytes;
+      ASSERT_EQ(os.read(names[0], bytes), ENOENT);
+      ASSERT_EQ(os.remove(names[0]), ENOENT);
+      for (const auto& name : names) {
+	ASSERT_EQ(os.write(name, obj_bytes(name)), 0);
+      }
+      ASSERT_EQ(os.read(names[7], bytes), 0);
+      ASSERT_EQ(bytes, obj_bytes(names[7]));
+      /* replaced whole */
+      ASSERT_EQ(os.write(names[7], obj_bytes("x")), 0);
+      ASSERT_EQ(os.read(names[7], bytes), 0);
+      ASSERT_EQ(bytes, obj_bytes("x"));
+      ASSERT_EQ(os.write(names[7], obj_bytes(names[7])), 0);
+      ASSERT_EQ(os.remove(names[49]), 0);
+      ASSERT_EQ(os.read(names[49], bytes), ENOENT);
+      /* batches report per object */
+      std::vector<std::vector<uint8_t>> batch_bytes;
+      std::vector<int> rets;
+      ASSERT_EQ(os.read_batch(names, batch_bytes, rets), ENOENT);
+      for (int ix = 0; ix < 49; ++ix) {
+	ASSERT_EQ(rets[ix], 0);
+	ASSERT_EQ(batch_bytes[ix], obj_bytes(names[ix]));
+      }
+      ASSERT_EQ(rets[49], ENOENT);
+      std::vector<std::pair<string, std::vector<uint8_t>>> objs;
+      for (const auto& name : names) {
+	objs.emplace_back(name + "_w", obj_bytes(name));
+      }
+      ASSERT_EQ(os.write_batch(objs, rets), 0);
+      /* aio completes exactly once */
+      std::atomic<int> done{0};
+      for (const auto& name : names) {
+	os.aio_read(name + "_w",
+		    [&done, name](int ret, std::vector<uint8_t>&& b) {
+		      if ((ret == 0) && (b == obj_bytes(name))) {
+			++done;
+		      }
+		    });
+      }
+      os.drain();
+      ASSERT_EQ(done, 50);
+    }
+  };
+
+  class Bench_Base : public ::testing::Test {
+  public:
+    std::mt19937_64 mt{seed};
+
+    void SetUp() override {
+      if (! bench) {
+	GTEST_SKIP() << "benchmarks run with --bench";
+      }
+    }
+  };
+
+  class Strings_Bench1 : public Bench_Base {
+  public:
+    /* the pre-kernel comparison, one byte at a time through at() */
+    static bool less_than_bytewise(const sv_tuple& lhs, const sv_tuple& rhs) {
+      const auto lhs_len = len(lhs);
+      const auto rhs_len = len(rhs);
+      auto max = std::min(lhs_len, rhs_len);
+      for (decltype(max) ix = 0; ix < max; ++ix) {
+	auto c1 = uint8_t(at(lhs, ix));
+	auto c2 = uint8_t(at(rhs, ix));
+	if (c1 != c2) {
+	  return (c1 < c2);
+	}
+      }
+      return (lhs_len < rhs_len);
+    }
+
+    /* S3-style keys (as in Strings_Min1) sharing a prefix of ~plen */
+    static std::pair<string, string> key_pair(uint32_t plen) {
+      string p;
+      while (p.length() < plen) {
+	p += "/sub1/docrequest/D/";
+      }
+      p.resize(plen);
+      return {p + "DOC597z85", p + "PDF448x79"};
+    }
+  };
+
+  class Tree_Bench1 : public Bench_Base {
+  public:
+    using key_gen = std::function<string(uint32_t)>;
+
+    /* keys are generated up front, so only inserts are timed */
+    void insert_keys(const string& tree_name, key_gen gen) {
+      vector<string> keys;
+      keys.reserve(bench_keys);
+      for (uint32_t ix = 0; ix < bench_keys; ++ix) {
+	keys.push_back(gen(ix));
+      }
+      Tree t(tree_name, bench_fanout);
+      uint32_t dups{0};
+      auto t0 = std::chrono::steady_clock::now();
+      for (const auto& k : keys) {
+	auto ret = t.insert(k, "v");
+	if (unlikely(ret == EEXIST)) {
+	  ++dups;
+	} else {
+	  ASSERT_EQ(ret, 0);
+	}
+      }
+      auto t1 = std::chrono::steady_clock::now();
+      std::chrono::duration<double> secs = t1 - t0;
+      std::cout << tree_name << ": " << keys.size() << " keys ("
+		<< dups << " dups) fanout " << bench_fanout
+		<< " in " << secs.count() << "s "
+		<< uint64_t(keys.size() / secs.count()) << " inserts/s"
+		<< " height " << t.height()
+		<< std::endl;
+    }
+  };
 } /* namespace */
 
 TEST_F(Node_Min1, fill1) {
@@ -175,6 +372,433 @@ TEST_F(Node_Min1, unserialize1) {
   ASSERT_EQ(count, Node_Min1::fanout-3);
 }
 
+TEST_F(Node_Min1, update_log1) {
+  /* once written whole, small updates are written as deltas, which
+   * loading replays */
+  leaf_node ln(fanout, prefix_min_len);
+  auto key = [this](int ix) { return pref + "ul_" + std::to_string(ix); };
+  for (int ix = 0; ix < 50; ++ix) {
+    ln.insert(leaf_key(key(ix)), "v" + std::to_string(ix));
+  }
+  bool delta;
+  auto obj = ln.writeback(true, &delta);
+  ASSERT_FALSE(delta);
+  ln.insert(leaf_key(key(50)), "v50");
+  ln.insert(leaf_key(key(51)), "v51");
+  ln.remove(leaf_key(key(7)));
+  auto d = ln.writeback(true, &delta);
+  ASSERT_TRUE(delta);
+  ASSERT_LT(d.size() * 4, obj.size());
+  obj.insert(obj.end(), d.begin(), d.end());
+  /* a torn last segment is ignored */
+  ln.remove(leaf_key(key(8)));
+  d = ln.writeback(true, &delta);
+  ASSERT_TRUE(delta);
+  auto torn = obj;
+  torn.insert(torn.end(), d.begin(), d.end() - 1);
+  for (const auto& o : {obj, torn}) {
+    leaf_node* n2 = get<leaf_node*>(node_factory::from_object(o));
+    ASSERT_NE(n2, nullptr);
+    ASSERT_EQ(n2->size(), 51);
+    string val;
+    ASSERT_EQ(n2->get(leaf_key(key(51)), &val), 0);
+    ASSERT_EQ(val, "v51");
+    ASSERT_EQ(n2->get(leaf_key(key(7))), ENOENT);
+    ASSERT_EQ(n2->get(leaf_key(key(8))), 0);
+    delete n2;
+  }
+  /* past the log limits (or without a stored base), it's whole
+   * again */
+  for (int ix = 100; ix < 100 + int(log_max_records); ++ix) {
+    ln.insert(leaf_key(key(ix)), "v");
+    ln.remove(leaf_key(key(ix)));
+  }
+  d = ln.writeback(true, &delta);
+  ASSERT_FALSE(delta);
+  ln.insert(leaf_key(key(0)), "v0");
+  d = ln.writeback(false, &delta);
+  ASSERT_FALSE(delta);
+  /* a split (say) isn't logged */
+  ln.insert(leaf_key(key(1)), "v1");
+  leaf_node rhs(fanout, prefix_min_len);
+  ln.split(rhs);
+  d = ln.writeback(true, &delta);
+  ASSERT_FALSE(delta);
+}
+
+TEST_F(Node_Min1, cksum1) {
+  /* a flipped byte anywhere in a node's keys, values or header--or in
+   * a delta--fails its load */
+  auto key = [this](int ix) { return pref + "ck_" + std::to_string(ix); };
+  for (auto type : {cksum::CksumType::xxh64, cksum::CksumType::xxh3,
+		    cksum::CksumType::none}) {
+    leaf_node ln(fanout, prefix_min_len, fence_key(pref),
+		 fence_key(key_range::unbounded));
+    ln.set_cksum_type(type);
+    for (int ix = 0; ix < 50; ++ix) {
+      ln.insert(leaf_key(key(ix)), "v" + std::to_string(ix));
+    }
+    auto flat = ln.serialize();
+    leaf_node* n2 = get<leaf_node*>(node_factory::from_flexbuffers(flat));
+    ASSERT_NE(n2, nullptr);
+    ASSERT_EQ(n2->size(), 50);
+    ASSERT_EQ(n2->get_cksum_type(), type);
+    delete n2;
+    ASSERT_NE(node_factory::view_flexbuffers(std::vector<uint8_t>(flat)),
+	      nullptr);
+    for (const auto& s : {string("v17"), key(33), pref}) {
+      auto bad = flat;
+      auto it = std::search(bad.begin(), bad.end(), s.begin(), s.end());
+      ASSERT_NE(it, bad.end());
+      *(it + s.length() - 1) ^= 1;
+      n2 = get<leaf_node*>(node_factory::from_flexbuffers(bad));
+      if (type == cksum::CksumType::none) {
+	ASSERT_NE(n2, nullptr);
+	delete n2;
+	continue;
+      }
+      ASSERT_EQ(n2, nullptr);
+      ASSERT_EQ(node_factory::view_flexbuffers(std::move(bad)), nullptr);
+    }
+    bool delta;
+    auto obj = ln.writeback(true, &delta);
+    ln.insert(leaf_key(key(50)), "v50");
+    auto d = ln.writeback(true, &delta);
+    ASSERT_TRUE(delta);
+    obj.insert(obj.end(), d.begin(), d.end());
+    n2 = get<leaf_node*>(node_factory::from_object(obj));
+    ASSERT_NE(n2, nullptr);
+    ASSERT_EQ(n2->size(), 51);
+    delete n2;
+    string v50{"v50"};
+    auto it = std::search(obj.end() - d.size(), obj.end(),
+			  v50.begin(), v50.end());
+    ASSERT_NE(it, obj.end());
+    *(it + 2) ^= 1;
+    n2 = get<leaf_node*>(node_factory::from_object(obj));
+    ASSERT_EQ(n2 == nullptr, type != cksum::CksumType::none);
+    delete n2;
+  }
+}
+
+TEST_F(Node_Min1, cksum_batch1) {
+  /* hex of every byte value, at lengths that straddle the 16-byte
+   * vector step, matches printf's */
+  vector<unsigned char> bytes(256 + 17);
+  for (size_t ix = 0; ix < bytes.size(); ++ix) {
+    bytes[ix] = ix * 7;
+  }
+  for (size_t len : {0, 1, 15, 16, 17, 33, 273}) {
+    string hex(len * 2 + 1, 'x');
+    cksum::buf_to_hex(bytes.data(), len, hex.data());
+    string expect;
+    char pair[3];
+    for (size_t ix = 0; ix < len; ++ix) {
+      snprintf(pair, sizeof(pair), "%02x", bytes[ix]);
+      expect += pair;
+    }
+    ASSERT_EQ(string(hex.c_str()), expect);
+  }
+
+  /* a batch, on one lane or several, digests as the streams do */
+  vector<string> bufs;
+  std::mt19937 mt{seed};
+  for (int ix = 0; ix < 300; ++ix) {
+    bufs.push_back(string(mt() % 8192, 'a' + ix % 26));
+  }
+  vector<std::string_view> views(bufs.begin(), bufs.end());
+  for (auto type : {cksum::CksumType::xxh64, cksum::CksumType::xxh3}) {
+    for (uint32_t nthreads : {1, 4}) {
+      auto cksums = cksum::digest_batch(type, views, nthreads);
+      ASSERT_EQ(cksums.size(), bufs.size());
+      for (size_t ix = 0; ix < bufs.size(); ++ix) {
+	auto dv = cksum::digest_factory(type);
+	auto digest = cksum::get_digest(dv);
+	digest->Update(
+	  reinterpret_cast<const unsigned char*>(bufs[ix].data()),
+	  bufs[ix].size());
+	auto ck = cksum::finalize_digest(digest, type);
+	ASSERT_EQ(cksums[ix].to_string(), ck.to_string());
+      }
+    }
+  }
+}
+
+TEST_F(Node_Min1, prefix_gc1) {
+  /* random-order inserts of S3-style keys share a few prefixes,
+   * which are dropped when no key uses them */
+  static constexpr int nkeys = 90;
+  string dir{"/sub1/docrequest/D/2019/03/"};
+  vector<string> keys;
+  for (int ix = 0; ix < nkeys; ++ix) {
+    keys.push_back(dir + "DOC" + std::to_string(ix * 37));
+  }
+  std::mt19937 mt{seed};
+  std::shuffle(keys.begin(), keys.end(), mt);
+  leaf_node ln(fanout, prefix_min_len);
+  for (const auto& k : keys) {
+    ASSERT_EQ(ln.insert(leaf_key(k), "v"), 0);
+  }
+  auto ks = ln.get_key_stats();
+  ASSERT_LT(ks.prefixes, nkeys / 2); // one per insert, undeduplicated
+  ASSERT_LT(ks.stored * 2, ks.logical);
+  /* prefixes outlive their last key only within slack */
+  for (int ix = 0; ix < 80; ++ix) {
+    ASSERT_EQ(ln.remove(leaf_key(keys[ix])), 0);
+  }
+  ASSERT_EQ(ln.remove(leaf_key(keys[0])), ENOENT);
+  ks = ln.get_key_stats();
+  ASSERT_LE(ks.prefixes, ln.size() + 8);
+  std::sort(keys.begin() + 80, keys.end());
+  vector<string> listed;
+  ln.list({}, [&listed](const std::string* k, const std::string* v) -> int {
+      listed.push_back(*k);
+      return 0;
+    }, {});
+  ASSERT_EQ(listed, vector<string>(keys.begin() + 80, keys.end()));
+  /* a split leaves the lower half only the prefixes it uses */
+  for (int ix = 0; ix < 80; ++ix) {
+    ASSERT_EQ(ln.insert(leaf_key(keys[ix]), "v"), 0);
+  }
+  leaf_node rhs(fanout, prefix_min_len);
+  ln.split(rhs);
+  ASSERT_LE(ln.get_key_stats().prefixes, ln.size());
+  ASSERT_LE(rhs.get_key_stats().prefixes, rhs.size());
+  for (const auto& k : keys) {
+    ASSERT_EQ((ln.get(leaf_key(k)) == 0) + (rhs.get(leaf_key(k)) == 0), 1);
+  }
+}
+
+TEST_F(Node_Min1, batch1) {
+  /* odd keys singly, then even (and some odd) keys merged in one
+   * batch */
+  string dir{"/sub1/docrequest/D/2019/03/"};
+  auto key = [&dir](int ix) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "DOC%04d", ix);
+    return dir + buf;
+  };
+  leaf_node ln(fanout, prefix_min_len);
+  for (int ix = 1; ix < 80; ix += 2) {
+    ASSERT_EQ(ln.insert(leaf_key(key(ix)), "odd"), 0);
+  }
+  vector<std::pair<string, string>> kvs;
+  for (int ix = 0; ix < 80; ix += 2) {
+    kvs.emplace_back(key(ix), "even");
+    if (ix % 10 == 0) {
+      kvs.emplace_back(key(ix + 1), "dup");
+    }
+  }
+  uint32_t n;
+  ASSERT_EQ(ln.insert_batch(kvs.begin(), kvs.end(), &n), 0);
+  ASSERT_EQ(n, 40);
+  ASSERT_EQ(ln.size(), 80);
+  for (int ix = 0; ix < 80; ++ix) {
+    string val;
+    ASSERT_EQ(ln.get(leaf_key(key(ix)), &val), 0);
+    ASSERT_EQ(val, (ix % 2) ? "odd" : "even");
+  }
+  auto ks = ln.get_key_stats();
+  ASSERT_LT(ks.prefixes, 16);
+  ASSERT_LT(ks.stored * 2, ks.logical);
+  /* all or nothing */
+  kvs.clear();
+  for (int ix = 80; ix < 101; ++ix) {
+    kvs.emplace_back(key(ix), "v");
+  }
+  ASSERT_EQ(ln.insert_batch(kvs.begin(), kvs.end(), &n), E2BIG);
+  ASSERT_EQ(ln.size(), 80);
+  vector<string> rms;
+  for (int ix = 0; ix < 100; ix += 3) {
+    rms.push_back(key(ix));
+  }
+  ASSERT_EQ(ln.remove_batch(rms.begin(), rms.end(), &n), 0);
+  ASSERT_EQ(n, 27);
+  ASSERT_EQ(ln.size(), 53);
+  for (int ix = 0; ix < 80; ++ix) {
+    ASSERT_EQ(ln.get(leaf_key(key(ix))), (ix % 3) ? 0 : ENOENT);
+  }
+}
+
+TEST_F(Node_Min1, list_delim1) {
+  leaf_node ln(fanout, prefix_min_len);
+  for (const auto& k : {"a/1", "a/2", "a/3/x", "b", "c/x/1", "c/x/2",
+			"c/y", "c/z/", "d", "d/"}) {
+    ASSERT_EQ(ln.insert(leaf_key(k), "v"), 0);
+  }
+  vector<string> listed;
+  auto collect = [&listed](const sv_tuple& k, const std::string_view& v,
+			   bool is_prefix) -> int {
+    string s{std::get<0>(k)};
+    s += std::get<1>(k);
+    listed.push_back(is_prefix ? "[" + s + "]" : s);
+    return 0;
+  };
+  ASSERT_EQ(ln.list({}, "/", collect, {}), 5);
+  ASSERT_EQ(listed, (vector<string>{"[a/]", "b", "[c/]", "d", "[d/]"}));
+  listed.clear();
+  ASSERT_EQ(ln.list("c/", "/", collect, {}), 3);
+  ASSERT_EQ(listed, (vector<string>{"[c/x/]", "c/y", "[c/z/]"}));
+  /* continued from a key, with a limit */
+  listed.clear();
+  ASSERT_EQ(ln.list({}, "/", collect, 2, FLAG_NONE, string("a0")), 2);
+  ASSERT_EQ(listed, (vector<string>{"b", "[c/]"}));
+  /* no delimiter, no collapsing */
+  listed.clear();
+  ASSERT_EQ(ln.list("c/", "", collect, {}), 4);
+}
+
+TEST_F(Node_Min1, key_heads1) {
+  /* keys tying on their first 8 bytes past the shared head, keys
+   * that are prefixes of others, and a late key that shares less */
+  leaf_node ln(fanout, prefix_min_len);
+  string dir{"/sub1/docrequest/D/2019/03/"};
+  vector<string> keys;
+  for (int ix = 0; ix < 30; ++ix) {
+    keys.push_back(dir + "DOC00000" + std::to_string(ix));
+    keys.push_back(dir + "DOC" + std::to_string(ix));
+  }
+  keys.push_back(dir);
+  keys.push_back(dir + "D");
+  keys.push_back(dir + string(1, '\0'));
+  for (const auto& k : keys) {
+    ASSERT_EQ(ln.insert(leaf_key(k), "v"), 0);
+  }
+  ASSERT_EQ(ln.insert(leaf_key("/sub0"), "v"), 0);
+  keys.push_back("/sub0");
+  std::sort(keys.begin(), keys.end());
+  vector<string> listed;
+  ln.list({}, [&listed](const string* k, const string* v) -> int {
+      listed.push_back(*k);
+      return 0;
+    }, {});
+  ASSERT_EQ(listed, keys);
+  for (const auto& k : keys) {
+    ASSERT_EQ(ln.get(leaf_key(k)), 0);
+  }
+  for (const auto& k : {string("/"), string("/sub2"), dir + "DOC0000000",
+			dir + "DOC00000", dir + string(2, '\0')}) {
+    ASSERT_EQ(ln.get(leaf_key(k)), ENOENT);
+  }
+  /* in a branch, keys below every bounded fence route to the
+   * unbounded one */
+  branch_node bn2(10, 2);
+  bn2.insert(fence_key(key_range::unbounded), "child0");
+  bn2.insert(fence_key(dir + "m"), "child1");
+  bn2.insert(fence_key(dir + "t"), "child2");
+  ASSERT_EQ(*bn2.find_floor(fence_key("+")), "child0");
+  ASSERT_EQ(*bn2.find_floor(fence_key(dir)), "child0");
+  ASSERT_EQ(*bn2.find_floor(fence_key(dir + "s")), "child1");
+  ASSERT_EQ(*bn2.find_floor(fence_key("zz")), "child2");
+}
+
+TEST_F(Node_Min1, view1) {
+  /* lookups and listings straight from the serialized bytes */
+  auto bytes = min1_serialized_bytes;
+  auto view = node_factory::view_flexbuffers(std::move(bytes));
+  ASSERT_NE(view, nullptr);
+  ASSERT_EQ(view->type(), NodeType::Leaf);
+  ASSERT_EQ(view->size(), Node_Min1::fanout - 3);
+  for (uint32_t ix = 0; ix < Node_Min1::fanout; ++ix) {
+    string k = pref + std::to_string(ix);
+    string v;
+    if (ix == 92 || ix == 94 || ix == 97) {
+      ASSERT_EQ(view->get(k, &v), ENOENT);
+    } else {
+      ASSERT_EQ(view->get(k, &v), 0);
+      ASSERT_EQ(v, "val for " + k);
+    }
+  }
+  int count{0};
+  auto count_keys =
+    [&count] (const sv_tuple& k, const std::string_view& v) -> int {
+      ++count;
+      return 0;
+    };
+  ASSERT_EQ(view->list("f_9", count_keys, {}, FLAG_REQUIRE_PREFIX), 8);
+  /* decode on demand */
+  leaf_node* n2 = get<leaf_node*>(view->decode());
+  ASSERT_NE(n2, nullptr);
+  ASSERT_EQ(n2->size(), Node_Min1::fanout - 3);
+  ASSERT_EQ(n2->insert(leaf_key("f_92"), "val for f_92"), 0);
+  delete n2;
+  std::vector<uint8_t> junk{1, 2, 3};
+  ASSERT_EQ(node_factory::view_flexbuffers(std::move(junk)), nullptr);
+}
+
+TEST_F(Node_Min1, filter1) {
+  /* a filter holds every key added, refuses most others at about the
+   * rate asked for, and reads the same encoded;  a leaf stores one
+   * of its keys, which its view consults */
+  static constexpr int nkeys = 10000;
+  auto key = [this](int ix) { return pref + "bf_" + std::to_string(ix); };
+  uint32_t bits = bloom_filter::bits_for_fpr(0.01);
+  ASSERT_EQ(bits, 10);
+  ASSERT_EQ(bloom_filter::bits_for_fpr(0), 0);
+  bloom_filter bf(nkeys, bits);
+  ASSERT_EQ(bf.bytes(), (nkeys * bits / 8 + 63) / 64 * 64);
+  for (int ix = 0; ix < nkeys; ++ix) {
+    bf.add(bloom_filter::hash(key(ix)));
+  }
+  auto enc = bf.encode();
+  auto data = reinterpret_cast<const uint8_t*>(enc.data());
+  ASSERT_TRUE(bloom_filter::verify(data, enc.size()));
+  ASSERT_EQ(bloom_filter::encoded_bits_per_key(data), bits);
+  for (int ix = 0; ix < nkeys; ++ix) {
+    uint64_t h = bloom_filter::hash(key(ix));
+    ASSERT_TRUE(bf.may_contain(h));
+    ASSERT_TRUE(bloom_filter::may_contain(data, h));
+  }
+  int fp{0};
+  for (int ix = nkeys; ix < 11 * nkeys; ++ix) {
+    uint64_t h = bloom_filter::hash(key(ix));
+    bool maybe = bf.may_contain(h);
+    ASSERT_EQ(bloom_filter::may_contain(data, h), maybe);
+    fp += maybe;
+  }
+  ASSERT_LT(fp, 10 * nkeys * 0.02);
+  ASSERT_GT(bf.fill(), 0.3);
+  ASSERT_LT(bf.fill(), 0.6);
+  /* a sum of pieces hashes as their concatenation */
+  ASSERT_EQ(bloom_filter::hash(sv_tuple("ab", "cd")),
+	    bloom_filter::hash(std::string_view("abcd")));
+  enc[20] ^= 1;
+  ASSERT_FALSE(bloom_filter::verify(data, enc.size()));
+
+  leaf_node ln(fanout, prefix_min_len);
+  ln.set_filter_bits(bits);
+  for (int ix = 0; ix < 80; ++ix) {
+    ln.insert(leaf_key(key(ix)), "v");
+  }
+  auto flat = ln.serialize();
+  auto view = node_factory::view_flexbuffers(std::vector<uint8_t>(flat));
+  ASSERT_NE(view, nullptr);
+  ASSERT_TRUE(view->has_filter());
+  int refused{0};
+  for (int ix = 0; ix < 1000; ++ix) {
+    ASSERT_TRUE((ix >= 80) || view->may_contain(key(ix)));
+    refused += ! view->may_contain(key(ix));
+  }
+  ASSERT_GT(refused, 900);
+  leaf_node* n2 = get<leaf_node*>(view->decode());
+  ASSERT_NE(n2, nullptr);
+  ASSERT_EQ(n2->get_filter_bits(), bits);
+  delete n2;
+  /* the filter is checked on load like the rest */
+  auto bad = flat;
+  ASSERT_GT(bad.size(), 200);
+  auto blob = std::search(bad.begin(), bad.end(), enc.begin(), enc.begin() + 4);
+  ASSERT_NE(blob, bad.end());
+  *(blob + 12) ^= 0x10;
+  ASSERT_EQ(node_factory::view_flexbuffers(std::move(bad)), nullptr);
+  /* without bits, no filter */
+  ln.set_filter_bits(0);
+  view = node_factory::view_flexbuffers(ln.serialize());
+  ASSERT_NE(view, nullptr);
+  ASSERT_FALSE(view->has_filter());
+  ASSERT_TRUE(view->may_contain(key(500)));
+}
+
 TEST_F(Node_Min1, list4) {
   /* list in a prefix */
   ASSERT_EQ(n.size(), Node_Min1::fanout - 3);
@@ -191,6 +815,111 @@ TEST_F(Node_Min1, list4) {
   ASSERT_EQ(count, Node_Min1::fanout - 3);
 }
 
+TEST_F(Node_Min1, list_sv1) {
+  /* zero-copy listing sees the same keys as the string adapter */
+  vector<string> keys;
+  auto str_keys =
+    [&keys] (const std::string *k, const std::string *v) -> int {
+      keys.push_back(*k);
+      return 0;
+    };
+  n.list("f_9", str_keys, {}, FLAG_REQUIRE_PREFIX);
+  ASSERT_EQ(keys.size(), 8);
+  int ix{0};
+  auto sv_keys =
+    [&keys, &ix] (const sv_tuple& k, const std::string_view& v) -> int {
+      EXPECT_EQ(len(k), keys[ix].length());
+      EXPECT_TRUE(starts_with(k, keys[ix]));
+      EXPECT_EQ(v, "val for " + keys[ix]);
+      ++ix;
+      return 0;
+    };
+  auto count = n.list("f_9", sv_keys, {}, FLAG_REQUIRE_PREFIX);
+  ASSERT_EQ(count, 8);
+  ASSERT_EQ(ix, 8);
+}
+
+TEST_F(Node_Min1, slotted_fill1) {
+  for (uint32_t ix = 0; ix < Node_Min1::fanout; ++ix) {
+    string k = pref + std::to_string(ix);
+    string v = "val for " + k;
+    auto ret = sn.insert(k, v);
+    ASSERT_EQ(ret, 0);
+    /* forbids duplicates */
+    if (ix == 5) {
+      ret = sn.insert(k, v);
+      ASSERT_EQ(ret, EEXIST);
+    }
+  }
+  ASSERT_EQ(sn.size(), Node_Min1::fanout);
+  auto ret = sn.insert("foo", "bar");
+  ASSERT_EQ(ret, E2BIG);
+  for (uint32_t ix = 0; ix < Node_Min1::fanout; ++ix) {
+    string k = pref + std::to_string(ix);
+    string v;
+    ASSERT_EQ(sn.get(k, &v), 0);
+    ASSERT_EQ(v, "val for " + k);
+  }
+  ASSERT_EQ(sn.get("f_", nullptr), ENOENT);
+}
+
+TEST_F(Node_Min1, slotted_list1) {
+  /* same order and prefix semantics as leaf_node */
+  vector<string> keys;
+  auto str_keys =
+    [&keys] (const std::string *k, const std::string *v) -> int {
+      keys.push_back(*k);
+      return 0;
+    };
+  n.list({}, str_keys, {});
+  int ix{0};
+  for (auto& k : keys) {
+    if (sn.get(k) != 0) {
+      sn.insert(k, "val for " + k);
+    }
+  }
+  auto sv_keys =
+    [&keys, &ix] (const sv_tuple& k, const std::string_view& v) -> int {
+      EXPECT_EQ(compare(k, sv_tuple(nullstr, keys[ix])), 0);
+      ++ix;
+      return 0;
+    };
+  for (auto rk : {92, 94, 97}) {
+    sn.remove(pref + std::to_string(rk));
+  }
+  ASSERT_EQ(sn.list({}, sv_keys, {}), Node_Min1::fanout - 3);
+  ix = 0;
+  auto count_keys =
+    [&ix] (const sv_tuple& k, const std::string_view& v) -> int {
+      ++ix;
+      return 0;
+    };
+  ASSERT_EQ(sn.list("f_9", count_keys, {}, FLAG_REQUIRE_PREFIX), 8);
+}
+
+TEST_F(Node_Min1, slotted_remove1) {
+  /* removing most entries compacts the heap, keeping the rest */
+  slotted_leaf sl(Node_Min1::fanout, Node_Min1::prefix_min_len);
+  for (uint32_t ix = 0; ix < Node_Min1::fanout; ++ix) {
+    string k = pref + std::to_string(ix);
+    ASSERT_EQ(sl.insert(k, "val for " + k), 0);
+  }
+  auto before = sl.footprint();
+  for (uint32_t ix = 0; ix < Node_Min1::fanout; ++ix) {
+    if (ix % 10) {
+      sl.remove(pref + std::to_string(ix));
+    }
+  }
+  ASSERT_EQ(sl.size(), Node_Min1::fanout / 10);
+  ASSERT_LT(sl.footprint(), before);
+  for (uint32_t ix = 0; ix < Node_Min1::fanout; ix += 10) {
+    string k = pref + std::to_string(ix);
+    string v;
+    ASSERT_EQ(sl.get(k, &v), 0);
+    ASSERT_EQ(v, "val for " + k);
+  }
+}
+
 TEST_F(Node_Min1, branch_fill1) {
   for (int ix = 0; ix < Node_Min1::fanout; ++ix) {
     string k = branch_pref + std::to_string(ix);
@@ -208,6 +937,74 @@ TEST_F(Node_Min1, branch_fill1) {
   ASSERT_EQ(ret, E2BIG);
 }
 
+TEST_F(Node_Min1, branch_view1) {
+  branch_node bn2(10, 2);
+  bn2.insert(fence_key(key_range::unbounded), "child0");
+  bn2.insert(fence_key("m"), "child1");
+  bn2.insert(fence_key("t"), "child2");
+  auto view = node_factory::view_flexbuffers(bn2.serialize());
+  ASSERT_NE(view, nullptr);
+  ASSERT_EQ(view->type(), NodeType::Branch);
+  ASSERT_EQ(*view->find_floor("a"), "child0");
+  ASSERT_EQ(*view->find_floor("m"), "child1");
+  ASSERT_EQ(*view->find_floor("s"), "child1");
+  ASSERT_EQ(*view->find_floor("zz"), "child2");
+  branch_node* bn3 = get<branch_node*>(view->decode());
+  ASSERT_NE(bn3, nullptr);
+  ASSERT_EQ(bn3->size(), 3);
+  ASSERT_EQ(*bn3->find_floor(fence_key("a")), "child0");
+  ASSERT_EQ(*bn3->find_floor(fence_key("u")), "child2");
+  delete bn3;
+}
+
+TEST_F(Node_Min1, branch_index1) {
+  /* find_floor agrees with a plain search as a large branch is
+   * searched (building its head index), changed and searched
+   * again */
+  vector<string> seps;
+  for (int ix = 0; ix < 300; ix += 2) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%04d", ix);
+    seps.push_back(branch_pref + buf);
+  }
+  branch_node bn2(1000, 2);
+  bn2.insert(fence_key(key_range::unbounded), "");
+  for (const auto& s : seps) {
+    bn2.insert(fence_key(s), s);
+  }
+  auto check = [this, &bn2, &seps]() {
+    for (int ix = 0; ix < 310; ++ix) {
+      char buf[16];
+      snprintf(buf, sizeof(buf), "%04d", ix);
+      string k = branch_pref + buf;
+      auto it = std::upper_bound(seps.begin(), seps.end(), k);
+      string expect = (it == seps.begin()) ? "" : *std::prev(it);
+      auto v = bn2.find_floor(fence_key(k));
+      ASSERT_TRUE(v);
+      ASSERT_EQ(*v, expect);
+    }
+    ASSERT_EQ(*bn2.find_floor(fence_key(branch_pref)), "");
+  };
+  check();
+  check();
+  bn2.insert(fence_key(branch_pref + "0101"), branch_pref + "0101");
+  seps.insert(std::upper_bound(seps.begin(), seps.end(), branch_pref + "0101"),
+	      branch_pref + "0101");
+  check();
+  bn2.remove(fence_key(seps.back()));
+  seps.pop_back();
+  bn2.remove(fence_key(seps.front()));
+  seps.erase(seps.begin());
+  /* concurrent finders race to rebuild */
+  vector<std::thread> finders;
+  for (int ix = 0; ix < 4; ++ix) {
+    finders.emplace_back(check);
+  }
+  for (auto& t : finders) {
+    t.join();
+  }
+}
+
 TEST_F(Tree_Min1, names) {
   for (int ix = 0; ix < 10; ++ix) {
     auto node_name = t1.gen_node_name();
@@ -241,6 +1038,35 @@ TEST_F(Tree_Min1, names2) {
 
 }
 
+TEST_F(Tree_Min1, names_mt1) {
+  /* threads generate names concurrently, never the same one */
+  static constexpr int nthreads = 4;
+  static constexpr int nnames = 20000;
+  vector<vector<string>> names(nthreads);
+  vector<std::thread> threads;
+  for (int tx = 0; tx < nthreads; ++tx) {
+    threads.emplace_back([this, &names, tx]() {
+	for (int ix = 0; ix < nnames; ++ix) {
+	  names[tx].push_back(t1.gen_node_name());
+	}
+      });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  vector<string> all;
+  for (auto& v : names) {
+    all.insert(all.end(), v.begin(), v.end());
+  }
+  std::sort(all.begin(), all.end());
+  ASSERT_EQ(std::adjacent_find(all.begin(), all.end()), all.end());
+  string stem = string(name_stem) + "-" + "Tree_Min1" + "-";
+  for (const auto& name : all) {
+    ASSERT_EQ(name.compare(0, stem.length(), stem), 0);
+    ASSERT_EQ(name.length(), stem.length() + 20);
+  }
+}
+
 TEST_F(Tree_Min1, fill1) {
   for (int ix = 0; ix < Tree_Min1::fanout; ++ix) {
     string k = pref + std::to_string(ix);
@@ -260,6 +1086,1618 @@ TEST_F(Tree_Min1, fill1) {
 #endif
 }
 
+TEST_F(Tree_Min1, fill2) {
+  /* enough keys, inserted out of order, to split leaves and branches */
+  static constexpr int nkeys = 1000;
+  for (int ix = 0; ix < nkeys; ++ix) {
+    string k = pref + std::to_string((ix * 7919) % nkeys);
+    auto ret = t2.insert(k, "val for " + k);
+    ASSERT_EQ(ret, 0);
+  }
+  ASSERT_GT(t2.height(), 2);
+  for (int ix = 0; ix < nkeys; ++ix) {
+    string k = pref + std::to_string(ix);
+    ASSERT_EQ(t2.insert(k, "dup"), EEXIST);
+    auto leaf_ref = t2.get_node_for_k(k);
+    ASSERT_TRUE(leaf_ref);
+    leaf_node* leaf = leaf_ref.as<leaf_node>();
+    /* k lies within the leaf's fence keys */
+    auto lb = leaf->get_lower_bound();
+    auto ub = leaf->get_upper_bound();
+    ASSERT_TRUE(lb.unbounded() || lb.as_leaf_key().stem <= k);
+    ASSERT_TRUE(ub.unbounded() || k < ub.as_leaf_key().stem);
+    int count{0};
+    auto match_key =
+      [&count, &k] (const std::string *lk, const std::string *v) -> int {
+	if (*lk == k) {
+	  ++count;
+	}
+	return 0;
+      };
+    leaf->list(k, match_key, 1);
+    ASSERT_EQ(count, 1);
+  }
+}
+
+TEST_F(Tree_Min1, mt_insert1) {
+  /* concurrent writers on disjoint keys, racing a lister */
+  static constexpr int nthreads = 4;
+  static constexpr int nkeys = 2000;
+  std::atomic<bool> done{false};
+  std::vector<std::thread> writers;
+  for (int tix = 0; tix < nthreads; ++tix) {
+    writers.emplace_back(
+      [this, tix]() {
+	for (int ix = 0; ix < nkeys; ++ix) {
+	  string k = pref + std::to_string(tix) + "_" +
+	    std::to_string((ix * 7919) % nkeys);
+	  ASSERT_EQ(t3.insert(k, "v"), 0);
+	}
+      });
+  }
+  std::thread lister(
+    [this, &done]() {
+      auto check_key =
+	[] (const std::string *k, const std::string *v) -> int {
+	  EXPECT_EQ(*v, "v");
+	  return 0;
+	};
+      while (! done) {
+	t3.list(pref, check_key, 10);
+      }
+    });
+  for (auto& w : writers) {
+    w.join();
+  }
+  done = true;
+  lister.join();
+  for (int tix = 0; tix < nthreads; ++tix) {
+    for (int ix = 0; ix < nkeys; ++ix) {
+      string k = pref + std::to_string(tix) + "_" + std::to_string(ix);
+      ASSERT_EQ(t3.insert(k, "dup"), EEXIST);
+    }
+  }
+}
+
+TEST_F(Tree_Min1, bulk_load1) {
+  static constexpr int nkeys = 5000;
+  vector<std::pair<string, string>> kvs;
+  for (int ix = 0; ix < nkeys; ++ix) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s%06d", pref.c_str(), ix);
+    kvs.emplace_back(buf, string("val for ") + buf);
+  }
+  /* ordering is validated */
+  auto bad = kvs;
+  std::swap(bad[100], bad[101]);
+  Tree tb("Tree_Min1_bad", Tree_Min1::fanout);
+  ASSERT_EQ(tb.bulk_load(bad.begin(), bad.end()), EINVAL);
+
+  ASSERT_EQ(t4.bulk_load(kvs.begin(), kvs.end(), 0.8), 0);
+  ASSERT_GT(t4.height(), 3);
+  ASSERT_EQ(t4.bulk_load(kvs.begin(), kvs.end()), ENOTEMPTY);
+  for (const auto& [k, v] : kvs) {
+    ASSERT_EQ(t4.insert(k, "dup"), EEXIST);
+    auto leaf_ref = t4.get_node_for_k(k);
+    ASSERT_TRUE(leaf_ref);
+    leaf_node* leaf = leaf_ref.as<leaf_node>();
+    auto lb = leaf->get_lower_bound();
+    auto ub = leaf->get_upper_bound();
+    ASSERT_TRUE(lb.unbounded() || lb.as_leaf_key().stem <= k);
+    ASSERT_TRUE(ub.unbounded() || k < ub.as_leaf_key().stem);
+    string val;
+    ASSERT_EQ(leaf->get(leaf_key(k), &val), 0);
+    ASSERT_EQ(val, v);
+  }
+  /* and the loaded tree takes inserts (and splits) as usual */
+  for (int ix = 0; ix < nkeys; ++ix) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s%06d_x", pref.c_str(), ix);
+    ASSERT_EQ(t4.insert(buf, "v"), 0);
+  }
+}
+
+TEST_F(Tree_Min1, insert_batch1) {
+  static constexpr int nkeys = 2000;
+  Tree::kv_vec kvs;
+  for (int ix = 0; ix < nkeys; ++ix) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s%06d", pref.c_str(), ix);
+    kvs.emplace_back(buf, string("val for ") + buf);
+  }
+  std::mt19937 mt{seed};
+  std::shuffle(kvs.begin(), kvs.end(), mt);
+  /* a few batches, overlapping, so some keys are already present */
+  uint32_t n, total{0};
+  for (int b = 0; b < 4; ++b) {
+    int first = b * nkeys / 4 - ((b > 0) ? 50 : 0);
+    Tree::kv_vec batch(kvs.begin() + first, kvs.begin() + (b + 1) * nkeys / 4);
+    ASSERT_EQ(t5.insert_batch(batch, &n), 0);
+    total += n;
+  }
+  ASSERT_EQ(total, nkeys);
+  ASSERT_GT(t5.height(), 3);
+  for (const auto& [k, v] : kvs) {
+    auto leaf_ref = t5.get_node_for_k(k);
+    ASSERT_TRUE(leaf_ref);
+    string val;
+    ASSERT_EQ(leaf_ref.as<leaf_node>()->get(leaf_key(k), &val), 0);
+    ASSERT_EQ(val, v);
+  }
+  vector<string> rms;
+  for (int ix = 0; ix < nkeys; ix += 2) {
+    rms.push_back(kvs[ix].first);
+  }
+  rms.push_back("not there");
+  ASSERT_EQ(t5.remove_batch(rms, &n), 0);
+  ASSERT_EQ(n, nkeys / 2);
+  for (int ix = 0; ix < nkeys; ++ix) {
+    auto leaf_ref = t5.get_node_for_k(kvs[ix].first);
+    ASSERT_EQ(leaf_ref.as<leaf_node>()->get(leaf_key(kvs[ix].first)),
+	      (ix % 2) ? 0 : ENOENT);
+  }
+}
+
+TEST_F(Tree_Min1, list_scan1) {
+  /* scans cross leaves, of a tree grown by splits and of a
+   * bulk-loaded one */
+  static constexpr int nkeys = 900;
+  vector<string> keys;
+  for (int ix = 0; ix < nkeys; ++ix) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%c/%06d", 'a' + (ix % 3), ix);
+    keys.push_back(buf);
+  }
+  std::mt19937 mt{seed};
+  std::shuffle(keys.begin(), keys.end(), mt);
+  for (const auto& k : keys) {
+    ASSERT_EQ(t6.insert(k, "v"), 0);
+  }
+  std::sort(keys.begin(), keys.end());
+  Tree tb("Tree_Min1_list_scan1", Tree_Min1::fanout);
+  ASSERT_EQ(tb.bulk_load(
+	      [&keys, ix = size_t(0)](string& k, string& v) mutable -> bool {
+		if (ix == keys.size()) {
+		  return false;
+		}
+		k = keys[ix++];
+		v = "v";
+		return true;
+	      }), 0);
+  for (auto t : {&t6, &tb}) {
+    vector<string> listed;
+    auto collect = [&listed](const string* k, const string* v) -> int {
+      listed.push_back(*k);
+      return 0;
+    };
+    ASSERT_EQ(t->list({}, collect, {}), nkeys);
+    ASSERT_EQ(listed, keys);
+    /* from a start key, with a limit */
+    listed.clear();
+    ASSERT_EQ(t->list("a/000500", collect, 100), 100);
+    auto it = std::lower_bound(keys.begin(), keys.end(), "a/000500");
+    ASSERT_EQ(listed, vector<string>(it, it + 100));
+    /* just the prefix */
+    listed.clear();
+    ASSERT_EQ(t->list("b/", collect, {}, FLAG_REQUIRE_PREFIX), nkeys / 3);
+    ASSERT_EQ(listed.front(), "b/000001");
+    ASSERT_EQ(listed.back(), "b/000898");
+    /* cb stops it */
+    int seen{0};
+    ASSERT_EQ(t->list({}, [&seen](const string* k, const string* v) -> int {
+	  return (++seen == 57) ? FLAG_STOP : 0;
+	}, {}), 57);
+  }
+  /* emptied leaves are crossed */
+  for (int ix = 300; ix < 600; ++ix) {
+    ASSERT_EQ(t6.remove(keys[ix]), 0);
+  }
+  string prev;
+  ASSERT_EQ(t6.list({}, [&prev](const string* k, const string* v) -> int {
+	EXPECT_LT(prev, *k);
+	prev = *k;
+	return 0;
+      }, {}), nkeys - 300);
+  ASSERT_EQ(t6.list(keys[300], [](const string* k, const string* v) -> int {
+	return 0;
+      }, 1), 1);
+}
+
+TEST_F(Tree_Min1, list_delim1) {
+  /* a few big pseudo-directories are listed without visiting their
+   * leaves */
+  static constexpr int ndirs = 4;
+  static constexpr int per_dir = 1000;
+  Tree t("Tree_Min1_list_delim1", Tree_Min1::fanout);
+  Tree::kv_vec kvs;
+  for (int dix = 0; dix < ndirs; ++dix) {
+    for (int ix = 0; ix < per_dir; ++ix) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "dir%d/obj%06d", dix, ix);
+      kvs.emplace_back(buf, "v");
+    }
+    kvs.emplace_back("dir" + std::to_string(dix), "v");
+  }
+  ASSERT_EQ(t.insert_batch(kvs), 0);
+  vector<string> listed;
+  auto collect = [&listed](const sv_tuple& k, const std::string_view& v,
+			   bool is_prefix) -> int {
+    string s{std::get<0>(k)};
+    s += std::get<1>(k);
+    listed.push_back(is_prefix ? "[" + s + "]" : s);
+    return 0;
+  };
+  auto gets = [](){
+    auto st = io.cache.get_stats();
+    return st.hits + st.misses;
+  };
+  auto before = gets();
+  ASSERT_EQ(t.list({}, "/", collect, {}), 2 * ndirs);
+  ASSERT_EQ(listed, (vector<string>{"dir0", "[dir0/]", "dir1", "[dir1/]",
+				    "dir2", "[dir2/]", "dir3", "[dir3/]"}));
+  ASSERT_LT(gets() - before, 8 * ndirs * t.height());
+  /* under a prefix, and resumed after a limit */
+  listed.clear();
+  ASSERT_EQ(t.list("dir2/", "/", collect, 3), 3);
+  ASSERT_EQ(listed.back(), "dir2/obj000002");
+  listed.clear();
+  ASSERT_EQ(t.list("dir", "/", collect, {}, FLAG_REQUIRE_PREFIX), 2 * ndirs);
+  listed.clear();
+  ASSERT_EQ(t.list("dir1", "/", collect, {}), 2);
+  ASSERT_EQ(listed, (vector<string>{"dir1", "[dir1/]"}));
+}
+
+TEST_F(Tree_Min1, mt_list1) {
+  /* scans stay ordered while writers split the leaves under them */
+  static constexpr int nthreads = 4;
+  static constexpr int nkeys = 2000;
+  Tree t("Tree_Min1_mt_list1", Tree_Min1::fanout);
+  std::atomic<bool> done{false};
+  std::vector<std::thread> writers;
+  for (int tix = 0; tix < nthreads; ++tix) {
+    writers.emplace_back([&t, tix]() {
+	for (int ix = tix; ix < nkeys; ix += nthreads) {
+	  t.insert(std::to_string((ix * 7919) % nkeys), "v");
+	}
+      });
+  }
+  std::thread scanner([&t, &done]() {
+      while (! done) {
+	string prev;
+	t.list({}, [&prev](const string* k, const string* v) -> int {
+	    EXPECT_LT(prev, *k);
+	    prev = *k;
+	    return 0;
+	  }, {});
+      }
+    });
+  for (auto& w : writers) {
+    w.join();
+  }
+  done = true;
+  scanner.join();
+  ASSERT_EQ(t.list({}, [](const string* k, const string* v) -> int {
+	return 0;
+      }, {}), nkeys);
+}
+
+TEST_F(Tree_Min1, snapshot1) {
+  /* a snapshot keeps seeing the tree as it was, through splits
+   * (of the root too), inserts and removes */
+  static constexpr int nkeys = 1000;
+  auto key = [](int ix) {
+    char buf[16];
+    ::snprintf(buf, sizeof(buf), "sn%05d", ix);
+    return string(buf);
+  };
+  auto keys_of = [](auto& snap_or_tree) {
+    vector<string> keys;
+    snap_or_tree.list({}, [&keys](const string* k, const string* v) -> int {
+	keys.push_back(*k);
+	return 0;
+      }, {});
+    return keys;
+  };
+  Tree t("Tree_Min1_snapshot1", Tree_Min1::fanout);
+  auto s0 = t.snapshot(); // of the empty tree (a lone leaf root)
+  vector<string> evens;
+  for (int ix = 0; ix < nkeys; ix += 2) {
+    ASSERT_EQ(t.insert(key(ix), "v0"), 0);
+    evens.push_back(key(ix));
+  }
+  Tree::kv_vec load{{key(0), "v"}};
+  ASSERT_EQ(t.bulk_load(load.begin(), load.end()), EBUSY);
+  auto s1 = t.snapshot();
+  ASSERT_LT(s0.epoch(), s1.epoch());
+  for (int ix = 1; ix < nkeys; ix += 2) {
+    ASSERT_EQ(t.insert(key(ix), "v1"), 0);
+  }
+  uint32_t removed;
+  vector<string> gone{key(0), key(2), key(500), key(998)};
+  ASSERT_EQ(t.remove_batch(gone, &removed), 0);
+  ASSERT_EQ(removed, 4);
+  auto s2 = t.snapshot();
+  Tree::kv_vec batch;
+  for (int ix = nkeys; ix < nkeys + 100; ++ix) {
+    batch.emplace_back(key(ix), "v2");
+  }
+  ASSERT_EQ(t.insert_batch(batch), 0);
+  ASSERT_GT(t.versions(), 0);
+
+  ASSERT_TRUE(keys_of(s0).empty());
+  ASSERT_EQ(s0.get(key(4)), ENOENT);
+  ASSERT_EQ(keys_of(s1), evens);
+  string val;
+  ASSERT_EQ(s1.get(key(0), &val), 0);
+  ASSERT_EQ(val, "v0");
+  ASSERT_EQ(s1.get(key(1)), ENOENT);
+  auto k2 = keys_of(s2);
+  ASSERT_EQ(k2.size(), nkeys - 4);
+  ASSERT_TRUE(std::is_sorted(k2.begin(), k2.end()));
+  ASSERT_EQ(s2.get(key(2)), ENOENT);
+  ASSERT_EQ(s2.get(key(3), &val), 0);
+  ASSERT_EQ(val, "v1");
+  ASSERT_EQ(s2.get(key(nkeys)), ENOENT);
+  ASSERT_EQ(keys_of(t).size(), nkeys - 4 + 100);
+  /* prefix and limit, as Tree::list */
+  int count{0};
+  ASSERT_EQ(s1.list(string("sn001"),
+		    [&count](const string* k, const string* v) -> int {
+		      EXPECT_EQ(k->compare(0, 5, "sn001"), 0);
+		      ++count;
+		      return 0;
+		    }, {}, FLAG_REQUIRE_PREFIX), 50);
+  ASSERT_EQ(s1.list(string("sn001"),
+		    [](const string* k, const string* v) -> int {
+		      return 0;
+		    }, 7), 7);
+  /* versions go with the snapshots needing them */
+  s1.release();
+  ASSERT_EQ(keys_of(s2).size(), nkeys - 4);
+  s0 = Tree::snapshot_ref();
+  s2.release();
+  ASSERT_EQ(t.versions(), 0);
+  ASSERT_EQ(t.bulk_load(load.begin(), load.end()), ENOTEMPTY);
+}
+
+TEST_F(Tree_Min1, snapshot_mt1) {
+  /* a listing's callback holds no latch:  writers to the leaf it is
+   * in go on, and it sees none of their keys */
+  static constexpr int nkeys = 500;
+  Tree t("Tree_Min1_snapshot_mt1", Tree_Min1::fanout);
+  for (int ix = 0; ix < nkeys; ++ix) {
+    ASSERT_EQ(t.insert("m" + std::to_string(ix * 2 + 1000), "v"), 0);
+  }
+  auto snap = t.snapshot();
+  std::promise<void> wrote;
+  auto wrote_f = wrote.get_future();
+  std::thread writer;
+  int count{0};
+  string prev;
+  snap.list({}, [&](const string* k, const string* v) -> int {
+      EXPECT_LT(prev, *k);
+      prev = *k;
+      if (count++ == 0) {
+	/* into the leaf being listed, and everywhere after it */
+	writer = std::thread([&t, &wrote]() {
+	    for (int ix = 0; ix < 4 * nkeys; ++ix) {
+	      t.insert("m" + std::to_string(ix + 1000) + "x", "w");
+	    }
+	    wrote.set_value();
+	  });
+	EXPECT_EQ(wrote_f.wait_for(std::chrono::seconds(30)),
+		  std::future_status::ready);
+      }
+      EXPECT_EQ(*v, "v");
+      return 0;
+    }, {});
+  writer.join();
+  ASSERT_EQ(count, nkeys);
+  snap.release();
+  /* concurrent snapshots and writers */
+  std::atomic<bool> done{false};
+  std::thread scanner([&t, &done]() {
+      while (! done) {
+	auto s = t.snapshot();
+	int n1 = s.list({}, [](const string* k, const string* v) -> int {
+	    return 0;
+	  }, {});
+	int n2 = s.list({}, [](const string* k, const string* v) -> int {
+	    return 0;
+	  }, {});
+	EXPECT_EQ(n1, n2);
+      }
+    });
+  for (int ix = 0; ix < 4 * nkeys; ++ix) {
+    t.insert("z" + std::to_string(ix * 7919 % (4 * nkeys)), "z");
+  }
+  done = true;
+  scanner.join();
+  ASSERT_EQ(t.versions(), 0);
+}
+
+TEST_F(Cache_Min1, evict1) {
+  static constexpr size_t capacity = 64 * 1024;
+  static constexpr int nnodes = 200;
+  node_cache c(capacity, 4);
+  attach_store(c);
+  auto node_name =
+    [this](int ix) -> string { return pref + "evict1_" + std::to_string(ix); };
+  for (int ix = 0; ix < nnodes; ++ix) {
+    /* unpinned as soon as it's stored */
+    c.put(node_name(ix), make_leaf(node_name(ix), node_name(ix + 1), 20));
+  }
+  auto st = c.get_stats();
+  ASSERT_GT(st.evictions, 0);
+  ASSERT_EQ(st.writebacks, st.evictions); // all were dirty
+  ASSERT_LE(st.bytes, capacity);
+  ASSERT_EQ(st.nodes + st.evictions, nnodes);
+  /* evicted nodes come back from the store, fences and all */
+  for (int ix = 0; ix < nnodes; ++ix) {
+    auto r = c.get(node_name(ix));
+    ASSERT_TRUE(r);
+    leaf_node* ln = r.as<leaf_node>();
+    ASSERT_EQ(ln->size(), 20);
+    string k = node_name(ix) + "_7";
+    string val;
+    ASSERT_EQ(ln->get(leaf_key(k), &val), 0);
+    ASSERT_EQ(val, "val for " + k);
+    ASSERT_EQ(ln->get_lower_bound().as_leaf_key().stem, node_name(ix));
+    ASSERT_EQ(ln->get_upper_bound().as_leaf_key().stem, node_name(ix + 1));
+  }
+  auto st2 = c.get_stats();
+  ASSERT_EQ(st2.hits + st2.misses, nnodes);
+  ASSERT_GT(st2.misses, 0);
+  if (verbose) {
+    std::cout << "evict1: hits " << st2.hits << " misses " << st2.misses
+	      << " evictions " << st2.evictions << " writebacks "
+	      << st2.writebacks << " nodes " << st2.nodes << " bytes "
+	      << st2.bytes << std::endl;
+  }
+}
+
+TEST_F(Cache_Min1, pin1) {
+  /* nothing fits, but pinned nodes stay */
+  node_cache c(1, 1);
+  attach_store(c);
+  auto pinned = c.put(pref + "pin1", make_leaf(pref + "pin1", "z", 10));
+  ASSERT_TRUE(pinned);
+  leaf_node* pn = pinned.as<leaf_node>();
+  for (int ix = 0; ix < 10; ++ix) {
+    string name = pref + "pin1_" + std::to_string(ix);
+    c.put(name, make_leaf(name, "z", 10));
+  }
+  /* put returns its node pinned, so the last one put escapes */
+  auto st = c.get_stats();
+  ASSERT_EQ(st.evictions, 9);
+  ASSERT_EQ(st.nodes, 2);
+  ASSERT_EQ(c.get(pref + "pin1").as<leaf_node>(), pn);
+  /* names are unique */
+  auto dup = make_leaf(pref + "pin1", "z", 1);
+  ASSERT_FALSE(c.put(pref + "pin1", dup));
+  delete dup;
+  /* a removed node outlives its last pin;  it was never written
+   * back, so it's gone */
+  ASSERT_EQ(c.remove(pref + "pin1"), 0);
+  ASSERT_EQ(pn->size(), 10);
+  pinned.release();
+  ASSERT_FALSE(c.get(pref + "pin1"));
+
+  /* without a store, dirty nodes can't be evicted */
+  node_cache c2(1, 1);
+  for (int ix = 0; ix < 10; ++ix) {
+    string name = pref + "pin1_" + std::to_string(ix);
+    c2.put(name, make_leaf(name, "z", 10));
+  }
+  st = c2.get_stats();
+  ASSERT_EQ(st.evictions, 0);
+  ASSERT_EQ(st.nodes, 10);
+}
+
+TEST_F(Cache_Min1, stale_fetch1) {
+  /* a miss whose read overlaps another thread loading the node,
+   * changing it, and writing it back as it's evicted caches what was
+   * written, not what it read */
+  static constexpr size_t capacity = 1024 * 1024;
+  node_cache c(capacity, 1);
+  string name = pref + "stale1";
+  string k = name + "_new";
+  std::promise<void> stalled, go;
+  std::atomic<bool> stall{false};
+  c.set_writeback(
+    [](const std::string& name, const std::vector<uint8_t>& bytes) -> int {
+      return cache_store->write(name, bytes);
+    });
+  c.set_fetch(
+    [&](const std::string& name, std::vector<uint8_t>& bytes) -> int {
+      int ret = cache_store->read(name, bytes);
+      if (stall.exchange(false)) {
+	stalled.set_value();
+	go.get_future().wait();
+      }
+      return ret;
+    });
+  c.put(name, make_leaf(name, "z", 10));
+  c.set_capacity(0); // written back, and evicted
+  ASSERT_FALSE(c.contains(name));
+  c.set_capacity(capacity);
+  stall = true;
+  std::thread reader(
+    [&c, &name, &k]() {
+      auto r = c.get(name);
+      ASSERT_TRUE(r);
+      EXPECT_EQ(r.as<leaf_node>()->get(leaf_key(k)), 0);
+    });
+  stalled.get_future().wait();
+  {
+    auto r = c.get(name);
+    ASSERT_TRUE(r);
+    ASSERT_EQ(r.as<leaf_node>()->insert(leaf_key(k), "v"), 0);
+    r.dirty();
+  }
+  c.set_capacity(0);
+  ASSERT_FALSE(c.contains(name));
+  c.set_capacity(capacity);
+  go.set_value();
+  reader.join();
+  /* and a node removed while it was read isn't brought back */
+  c.set_capacity(0);
+  ASSERT_FALSE(c.contains(name));
+  c.set_capacity(capacity);
+  stalled = std::promise<void>();
+  go = std::promise<void>();
+  stall = true;
+  std::thread reader2(
+    [&c, &name]() {
+      c.get(name);
+    });
+  stalled.get_future().wait();
+  ASSERT_TRUE(c.get(name));
+  /* as IO::remove_node() */
+  ASSERT_EQ(c.remove(name), 0);
+  ASSERT_EQ(cache_store->remove(name), 0);
+  go.set_value();
+  reader2.join();
+  ASSERT_FALSE(c.contains(name));
+}
+
+TEST_F(Cache_Min1, tree_evict1) {
+  /* concurrent writers on a tree many times the size of the cache */
+  static constexpr int nthreads = 2;
+  static constexpr int nkeys = 3000;
+  io.set_store(cache_store);
+  auto st0 = io.cache.get_stats();
+  io.cache.set_capacity(128 * 1024);
+  Tree t("Cache_Min1_tree", Tree_Min1::fanout);
+  std::vector<std::thread> writers;
+  for (int tix = 0; tix < nthreads; ++tix) {
+    writers.emplace_back(
+      [this, &t, tix]() {
+	for (int ix = 0; ix < nkeys; ++ix) {
+	  string k = pref + std::to_string(tix) + "_" +
+	    std::to_string((ix * 7919) % nkeys);
+	  ASSERT_EQ(t.insert(k, "v"), 0);
+	}
+      });
+  }
+  for (auto& w : writers) {
+    w.join();
+  }
+  for (int tix = 0; tix < nthreads; ++tix) {
+    for (int ix = 0; ix < nkeys; ++ix) {
+      string k = pref + std::to_string(tix) + "_" + std::to_string(ix);
+      ASSERT_EQ(t.insert(k, "dup"), EEXIST);
+      auto leaf_ref = t.get_node_for_k(k);
+      ASSERT_TRUE(leaf_ref);
+      ASSERT_EQ(leaf_ref.as<leaf_node>()->get(leaf_key(k)), 0);
+    }
+  }
+  auto st = io.cache.get_stats();
+  ASSERT_GT(st.evictions, st0.evictions);
+  ASSERT_GT(st.misses, st0.misses);
+  /* the store stays attached, for anything evicted meanwhile */
+  io.cache.set_capacity(IO::default_cache_bytes);
+}
+
+TEST_F(Store_Min1, memory1) {
+  memory_store ms;
+  exercise(ms);
+  ASSERT_EQ(ms.size(), 99);
+}
+
+TEST_F(Store_Min1, file1) {
+  file_store fs(dir);
+  exercise(fs);
+  /* a fresh instance sees what the last one wrote */
+  file_store fs2(dir, true /* sync */, 1);
+  std::vector<uint8_t> bytes;
+  ASSERT_EQ(fs2.read(pref + "a/b.c%3_w", bytes), 0);
+  ASSERT_EQ(bytes, obj_bytes(pref + "a/b.c%3"));
+  ASSERT_EQ(fs2.write(pref + "a/b.c%3_w", obj_bytes("y")), 0);
+  ASSERT_EQ(fs.read(pref + "a/b.c%3_w", bytes), 0);
+  ASSERT_EQ(bytes, obj_bytes("y"));
+  /* no temporaries left behind */
+  int nfiles{0};
+  for (const auto& de : std::filesystem::directory_iterator(dir)) {
+    ASSERT_EQ(de.path().filename().string().find('.'), string::npos);
+    ++nfiles;
+  }
+  ASSERT_EQ(nfiles, 99);
+}
+
+TEST_F(Store_Min1, file_engines1) {
+  /* both aio engines, with batches deeper than the ring */
+  static constexpr int nobjs = 200;
+  for (auto engine : {aio_engine::threads, aio_engine::uring}) {
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directory(dir);
+    file_store fs(dir, engine == aio_engine::uring /* sync */, 4, engine);
+    if (fs.engine() != engine) {
+      std::cout << "io_uring unavailable, testing the fallback" << std::endl;
+    }
+    exercise(fs);
+    std::vector<std::pair<string, std::vector<uint8_t>>> objs;
+    vector<string> names;
+    for (int ix = 0; ix < nobjs; ++ix) {
+      names.push_back(pref + "batch/" + std::to_string(ix));
+      objs.emplace_back(names.back(),
+			std::vector<uint8_t>(ix * 97, uint8_t(ix)));
+    }
+    std::vector<int> rets;
+    ASSERT_EQ(fs.write_batch(objs, rets), 0);
+    names.push_back(pref + "batch/missing");
+    std::vector<std::vector<uint8_t>> bytes;
+    ASSERT_EQ(fs.read_batch(names, bytes, rets), ENOENT);
+    for (int ix = 0; ix < nobjs; ++ix) {
+      ASSERT_EQ(rets[ix], 0);
+      ASSERT_EQ(bytes[ix], std::vector<uint8_t>(ix * 97, uint8_t(ix)));
+    }
+    ASSERT_EQ(rets[nobjs], ENOENT);
+    /* completions may land on another thread */
+    std::atomic<int> nread{0};
+    for (int ix = 0; ix < nobjs; ++ix) {
+      fs.aio_read(names[ix],
+		  [&nread, ix](int ret, std::vector<uint8_t>&& b) {
+		    EXPECT_EQ(ret, 0);
+		    EXPECT_EQ(b.size(), size_t(ix * 97));
+		    ++nread;
+		  });
+    }
+    fs.drain();
+    ASSERT_EQ(nread.load(), nobjs);
+  }
+}
+
+TEST_F(Store_Min1, sharded1) {
+  vector<std::shared_ptr<memory_store>> mss;
+  vector<std::shared_ptr<object_store>> shards;
+  for (int ix = 0; ix < 4; ++ix) {
+    mss.push_back(std::make_shared<memory_store>());
+    shards.push_back(mss.back());
+  }
+  sharded_store ss(shards);
+  exercise(ss);
+  size_t total{0};
+  for (const auto& ms : mss) {
+    total += ms->size();
+  }
+  ASSERT_EQ(total, 99);
+  /* each object lives in the shard its name places it in */
+  std::vector<uint8_t> bytes;
+  for (int ix = 0; ix < 49; ++ix) {
+    string name = pref + "a/b.c%" + std::to_string(ix);
+    ASSERT_EQ(mss[ss.shard_of(name)]->read(name, bytes), 0);
+  }
+
+  /* node names spread evenly, and growing from 31 shards to 32 moves
+   * only names the new shard takes--about 1/32 of them */
+  static constexpr int nnames = 64000;
+  Tree t("Store_Min1", Tree_Min1::fanout);
+  std::array<int, 32> counts; counts.fill(0);
+  int moved{0};
+  for (int ix = 0; ix < nnames; ++ix) {
+    auto name = t.gen_node_name();
+    uint32_t p31 = place(name, 31);
+    uint32_t p32 = place(name, 32);
+    ASSERT_LT(p31, 31);
+    if (p32 != p31) {
+      ASSERT_EQ(p32, 31);
+      ++moved;
+    }
+    ++counts[p32];
+  }
+  auto [lo, hi] = std::minmax_element(counts.begin(), counts.end());
+  double mean = double(nnames) / 32;
+  ASSERT_GT(*lo, mean * 0.9);
+  ASSERT_LT(*hi, mean * 1.1);
+  ASSERT_GT(moved, nnames / 32 * 0.9);
+  ASSERT_LT(moved, nnames / 32 * 1.1);
+
+  /* a tree's nodes go everywhere */
+  IO io1(64 * 1024, 4);
+  auto ss2 = std::make_shared<sharded_store>(shards);
+  io1.set_store(ss2);
+  Tree t2("Store_Min1", Tree_Min1::fanout, 2, io1);
+  for (int ix = 0; ix < 2000; ++ix) {
+    ASSERT_EQ(t2.insert(pref + std::to_string((ix * 7919) % 2000), "v"), 0);
+  }
+  ASSERT_EQ(io1.sync(), 0);
+  for (auto ops : ss2->shard_ops()) {
+    ASSERT_GT(ops, 0);
+  }
+}
+
+TEST_F(Store_Min1, tree_reopen1) {
+  /* a tree written through one IO is read back through another */
+  static constexpr int nkeys = 2000;
+  auto key = [this](int ix) { return pref + "k/" + std::to_string(ix); };
+  uint32_t height;
+  {
+    IO io1(64 * 1024, 4);
+    io1.set_store(std::make_shared<file_store>(dir));
+    Tree t("Store_Min1", Tree_Min1::fanout, 2, io1);
+    for (int ix = 0; ix < nkeys; ++ix) {
+      ASSERT_EQ(t.insert(key((ix * 7919) % nkeys), "v" + std::to_string(ix)),
+		0);
+    }
+    ASSERT_GT(io1.cache.get_stats().evictions, 0);
+    ASSERT_EQ(io1.sync(), 0);
+    height = t.height();
+  }
+  IO io2(64 * 1024, 4);
+  io2.set_store(std::make_shared<file_store>(dir));
+  Tree t("Store_Min1", Tree_Min1::fanout, 2, io2);
+  for (int ix = 0; ix < nkeys; ++ix) {
+    ASSERT_EQ(t.insert(key(ix), "dup"), EEXIST);
+    auto leaf_ref = t.get_node_for_k(key(ix));
+    ASSERT_TRUE(leaf_ref);
+    ASSERT_EQ(leaf_ref.as<leaf_node>()->get(leaf_key(key(ix))), 0);
+  }
+  ASSERT_EQ(t.height(), height);
+  ASSERT_GT(io2.cache.get_stats().misses, 0);
+  /* and it keeps growing */
+  ASSERT_EQ(t.insert(key(nkeys), "v"), 0);
+  /* a scan follows the stored sibling links */
+  string prev;
+  ASSERT_EQ(t.list({}, [&prev](const string* k, const string* v) -> int {
+	EXPECT_LT(prev, *k);
+	prev = *k;
+	return 0;
+      }, {}), nkeys + 1);
+}
+
+TEST_F(Store_Min1, delta1) {
+  /* updates between syncs are appended to stored nodes as deltas,
+   * and replayed when the tree is reopened */
+  static constexpr int nkeys = 3000;
+  static constexpr uint32_t fanout = 100;
+  auto key = [this](int ix) { return pref + "d/" + std::to_string(ix); };
+  {
+    IO io1(IO::default_cache_bytes, 4);
+    io1.set_store(std::make_shared<file_store>(dir));
+    Tree t("Store_Min1_delta", fanout, 2, io1);
+    for (int ix = 0; ix < nkeys; ix += 2) {
+      ASSERT_EQ(t.insert(key((ix * 7919) % nkeys), "v"), 0);
+    }
+    ASSERT_EQ(io1.sync(), 0);
+    auto st0 = io1.cache.get_stats();
+    ASSERT_EQ(st0.deltas, 0);
+    /* a few keys per sync */
+    for (int ix = 1; ix < 600; ix += 2) {
+      ASSERT_EQ(t.insert(key((ix * 7919) % nkeys), "v"), 0);
+      if (ix % 10 == 9) {
+	ASSERT_EQ(io1.sync(), 0);
+      }
+    }
+    ASSERT_EQ(t.remove(key(0)), 0);
+    ASSERT_EQ(io1.sync(), 0);
+    auto st = io1.cache.get_stats();
+    uint64_t deltas = st.deltas - st0.deltas;
+    uint64_t writes = st.writebacks - st0.writebacks;
+    ASSERT_GT(deltas, writes / 2);
+    if (verbose) {
+      std::cout << "delta1: " << writes << " writebacks " << deltas
+		<< " deltas " << (st.written_bytes - st0.written_bytes)
+		<< "B (whole: " << st0.written_bytes << "B for "
+		<< st0.writebacks << ")" << std::endl;
+    }
+  }
+  IO io2(IO::default_cache_bytes, 4);
+  io2.set_store(std::make_shared<file_store>(dir));
+  Tree t("Store_Min1_delta", fanout, 2, io2);
+  for (int ix = 0; ix < nkeys; ++ix) {
+    bool present = (ix > 0) && ((ix % 2 == 0) || (ix < 600));
+    string k = key((ix * 7919) % nkeys);
+    auto leaf_ref = t.get_node_for_k(k);
+    ASSERT_TRUE(leaf_ref);
+    ASSERT_EQ(leaf_ref.as<leaf_node>()->get(leaf_key(k)),
+	      present ? 0 : ENOENT);
+  }
+}
+
+TEST_F(Store_Min1, get_nodes1) {
+  /* misses are read together;  prefetched nodes arrive unpinned */
+  auto ms = std::make_shared<memory_store>();
+  vector<string> names;
+  {
+    IO io1(IO::default_cache_bytes, 4);
+    io1.set_store(ms);
+    for (int ix = 0; ix < 20; ++ix) {
+      names.push_back(pref + "gn_" + std::to_string(ix));
+      io1.put_node(names.back(), Cache_Min1::make_leaf(names.back(), "z", 5));
+    }
+    ASSERT_EQ(io1.sync(), 0);
+  }
+  ASSERT_EQ(ms->size(), 20);
+  IO io2(IO::default_cache_bytes, 4);
+  io2.set_store(ms);
+  io2.prefetch(vector<string>(names.begin(), names.begin() + 5));
+  auto st = io2.cache.get_stats();
+  ASSERT_EQ(st.nodes, 5);
+  ASSERT_EQ(st.misses, 0);
+  names.push_back(pref + "gn_none");
+  auto refs = io2.get_nodes(names);
+  ASSERT_EQ(refs.size(), 21);
+  for (int ix = 0; ix < 20; ++ix) {
+    ASSERT_TRUE(refs[ix]);
+    ASSERT_EQ(refs[ix].as<leaf_node>()->size(), 5);
+  }
+  ASSERT_FALSE(refs[20]);
+  st = io2.cache.get_stats();
+  ASSERT_EQ(st.hits, 5);
+  ASSERT_EQ(st.misses, 16);
+  ASSERT_EQ(st.nodes, 20);
+  /* removal reaches the store */
+  refs.clear();
+  ASSERT_EQ(io2.remove_node(names[0]), 0);
+  ASSERT_EQ(ms->size(), 19);
+  ASSERT_FALSE(io2.get_node(names[0]));
+}
+
+TEST_F(Store_Min1, paged1) {
+  /* a tree in one file of pages, then read in place through views */
+  static constexpr int nkeys = 2000;
+  auto key = [this](int ix) { return pref + "p/" + std::to_string(ix); };
+  string path = dir + "/tree.pages";
+  {
+    auto ps = paged_store::open(dir + "/objs.pages");
+    ASSERT_NE(ps, nullptr);
+    exercise(*ps);
+    /* a freed page is reused */
+    uint64_t npages = ps->page_count();
+    ASSERT_EQ(ps->free_count(), 0);
+    ASSERT_EQ(ps->remove(pref + "a/b.c%0"), 0);
+    ASSERT_EQ(ps->free_count(), 1);
+    string name = ps->alloc_name();
+    ASSERT_EQ(name[0], '@');
+    ASSERT_EQ(ps->page_count(), npages);
+    ASSERT_EQ(ps->free_count(), 0);
+    ASSERT_EQ(ps->write(name, obj_bytes(name)), 0);
+    ASSERT_EQ(ps->write("@ffff", obj_bytes(name)), ENOENT);
+    /* an object is one page */
+    ASSERT_EQ(ps->write(name, std::vector<uint8_t>(ps->capacity())), 0);
+    ASSERT_EQ(ps->write(name, std::vector<uint8_t>(ps->capacity() + 1)),
+	      EFBIG);
+    /* not mapped while writable */
+    size_t size;
+    ASSERT_EQ(ps->map(name, &size, nullptr), nullptr);
+  }
+  {
+    IO io1(64 * 1024, 4);
+    io1.set_store(paged_store::open(path));
+    Tree t("Store_Min1_paged", Tree_Min1::fanout, 2, io1);
+    for (int ix = 0; ix < nkeys; ++ix) {
+      ASSERT_EQ(t.insert(key((ix * 7919) % nkeys), "v" + std::to_string(ix)),
+		0);
+    }
+    ASSERT_GT(io1.cache.get_stats().evictions, 0);
+    ASSERT_EQ(io1.sync(), 0);
+    ASSERT_EQ(io1.cache.get_stats().deltas, 0);
+    ASSERT_EQ(t.get(key(7919 % nkeys)), 0);
+    ASSERT_EQ(t.get(key(nkeys)), ENOENT);
+  }
+  int ret;
+  auto ro = paged_store::open(path, true /* read_only */, false, 0, 0, &ret);
+  ASSERT_NE(ro, nullptr);
+  ASSERT_EQ(ro->write(key(0), obj_bytes("x")), EROFS);
+  ASSERT_EQ(ro->alloc_name(), "");
+  IO io2(64 * 1024, 4);
+  io2.set_store(ro);
+  Tree t("Store_Min1_paged", Tree_Min1::fanout, 2, io2);
+  string val;
+  for (int ix = 0; ix < nkeys; ++ix) {
+    ASSERT_EQ(t.get(key((ix * 7919) % nkeys), &val), 0);
+    ASSERT_EQ(val, "v" + std::to_string(ix));
+  }
+  ASSERT_EQ(t.get(key(nkeys)), ENOENT);
+  ASSERT_GT(t.height(), 2);
+  /* only the leftmost path (measured on opening) was cached */
+  ASSERT_EQ(io2.cache.get_stats().nodes, t.height());
+  /* a torn page is caught, not read */
+  uint32_t psize = ro->get_page_size();
+  ro.reset();
+  io2.set_store(nullptr);
+  {
+    /* a key in page 1 (the right half of the first split, so a
+     * leaf), changed */
+    FILE* f = ::fopen(path.c_str(), "r+b");
+    ASSERT_NE(f, nullptr);
+    std::vector<char> page(psize);
+    ASSERT_EQ(::fseek(f, psize, SEEK_SET), 0);
+    ASSERT_EQ(::fread(page.data(), psize, 1, f), 1);
+    string kp = pref + "p/";
+    auto it = std::search(page.begin(), page.end(), kp.begin(), kp.end());
+    ASSERT_NE(it, page.end());
+    it[kp.length()] ^= 0x5a;
+    ASSERT_EQ(::fseek(f, psize, SEEK_SET), 0);
+    ASSERT_EQ(::fwrite(page.data(), psize, 1, f), 1);
+    ::fclose(f);
+  }
+  IO io3(64 * 1024, 4);
+  io3.set_store(paged_store::open(path, true));
+  Tree t3("Store_Min1_paged", Tree_Min1::fanout, 2, io3);
+  int found{0}, lost{0};
+  for (int ix = 0; ix < nkeys; ++ix) {
+    ret = t3.get(key(ix), &val);
+    if (ret == 0) {
+      ++found;
+    } else {
+      ASSERT_EQ(ret, EIO);
+      ++lost;
+    }
+  }
+  ASSERT_GT(found, 0);
+  ASSERT_GT(lost, 0);
+  /* nor is a tree filter built from a scan that couldn't read it */
+  Tree::filter_options opts;
+  opts.tree_fpr = 0.01;
+  ASSERT_EQ(t3.set_filters(opts), EIO);
+  ASSERT_EQ(t3.get_filter_stats().tree_bytes, 0);
+  int found2{0};
+  for (int ix = 0; ix < nkeys; ++ix) {
+    found2 += (t3.get(key(ix)) == 0);
+  }
+  ASSERT_EQ(found2, found);
+}
+
+TEST_F(Store_Min1, paged_large1) {
+  /* at fanout 100, 600-byte keys would take several pages a node:
+   * nodes split on bytes instead, and every one is written back */
+  static constexpr uint32_t fanout = 100;
+  static constexpr int nkeys = 1000;
+  auto key = [this](int ix) {
+    char n[16];
+    snprintf(n, sizeof(n), "%06d/", ix); // in order, for bulk_load
+    string k = pref + "L/" + n;
+    return k + string(600 - k.length(), 'k');
+  };
+  auto val = [](int ix) { return "v" + std::to_string(ix); };
+  string path = dir + "/tree.pages";
+  {
+    auto ps = paged_store::open(path);
+    ASSERT_NE(ps, nullptr);
+    IO io1(256 * 1024, 4);
+    io1.set_store(ps);
+    Tree t("Store_Min1_large", fanout, 2, io1);
+    ASSERT_EQ(t.insert(pref + "L/big", string(ps->capacity() / 16, 'v')),
+	      EFBIG);
+    for (int ix = 0; ix < nkeys; ix += 2) {
+      ASSERT_EQ(t.insert(key((ix * 7919) % nkeys), val((ix * 7919) % nkeys)),
+		0);
+    }
+    Tree::kv_vec kvs;
+    for (int ix = 1; ix < nkeys; ix += 2) {
+      kvs.emplace_back(key(ix), val(ix));
+    }
+    uint32_t n{0};
+    ASSERT_EQ(t.insert_batch(kvs, &n), 0);
+    ASSERT_EQ(n, nkeys / 2);
+    ASSERT_EQ(io1.sync(), 0);
+    /* and built bottom-up, at fill 1 */
+    Tree t2("Store_Min1_large2", fanout, 2, io1);
+    ASSERT_EQ(t2.bulk_load(
+		[&key, &val, ix = 0](string& k, string& v) mutable -> bool {
+		  if (ix == nkeys) {
+		    return false;
+		  }
+		  k = key(ix);
+		  v = val(ix++);
+		  return true;
+		}, 1.0), 0);
+    ASSERT_EQ(io1.sync(), 0);
+  }
+  IO io2(256 * 1024, 4);
+  io2.set_store(paged_store::open(path, true /* read_only */));
+  for (const char* name : {"Store_Min1_large", "Store_Min1_large2"}) {
+    Tree t(name, fanout, 2, io2);
+    string v;
+    for (int ix = 0; ix < nkeys; ++ix) {
+      ASSERT_EQ(t.get(key(ix), &v), 0);
+      ASSERT_EQ(v, val(ix));
+    }
+    ASSERT_GT(t.height(), 2); // 1000 keys, not 10000
+    int count{0};
+    t.list({}, [&count](const sv_tuple& k, const std::string_view& v) {
+      ++count;
+      return 0;
+    }, {});
+    ASSERT_EQ(count, nkeys);
+  }
+}
+
+TEST_F(Store_Min1, wal1) {
+  /* records come back in order after reopening, less a torn tail;
+   * a checkpoint drops the segments behind it */
+  using rec = std::tuple<wal::op, string, string>;
+  auto collect = [](vector<rec>& out) {
+    return [&out](wal::op o, const string& k, const string& v) -> int {
+      out.emplace_back(o, k, v);
+      return 0;
+    };
+  };
+  string wdir = dir + "/wal";
+  ASSERT_TRUE(std::filesystem::create_directory(wdir));
+  wal::options opts;
+  opts.sync = false;
+  vector<rec> recs;
+  {
+    auto w = wal::open(wdir, opts);
+    ASSERT_NE(w, nullptr);
+    for (int ix = 0; ix < 100; ++ix) {
+      auto o = (ix % 3 == 2) ? wal::op::remove : wal::op::insert;
+      string v = (o == wal::op::insert) ? "v" + std::to_string(ix) : "";
+      recs.emplace_back(o, pref + std::to_string(ix), v);
+      ASSERT_EQ(w->append(o, pref + std::to_string(ix), v), ix + 1);
+    }
+    /* one sync for all of them;  an earlier record is synced already */
+    ASSERT_EQ(w->commit(100), 0);
+    ASSERT_EQ(w->commit(50), 0);
+    auto st = w->get_stats();
+    ASSERT_EQ(st.records, 100);
+    ASSERT_EQ(st.commits, 2);
+    ASSERT_EQ(st.batches, 1);
+    ASSERT_EQ(st.batch_max, 100);
+    ASSERT_EQ(wal::percentile(st.batch_hist, 0.5), 128);
+    /* appended, never committed:  may be lost */
+    w->append(wal::op::insert, pref + "lost");
+  }
+  string seg = std::filesystem::directory_iterator(wdir)->path();
+  {
+    FILE* f = ::fopen(seg.c_str(), "ab");
+    ASSERT_NE(f, nullptr);
+    ASSERT_EQ(::fwrite("\x40\0\0\0torn", 8, 1, f), 1);
+    ::fclose(f);
+  }
+  {
+    auto w = wal::open(wdir, opts);
+    ASSERT_NE(w, nullptr);
+    vector<rec> got;
+    ASSERT_EQ(w->replay(collect(got)), 0);
+    ASSERT_EQ(got, recs);
+    ASSERT_EQ(w->last_lsn(), 100);
+    /* appends go on where the tail was cut */
+    ASSERT_EQ(w->append(wal::op::insert, pref + "x", "y"), 101);
+    ASSERT_EQ(w->commit(101), 0);
+    ASSERT_EQ(w->checkpoint(101), 0);
+    ASSERT_EQ(w->log_bytes(), 0);
+    ASSERT_EQ(w->append(wal::op::remove, pref + "x"), 102);
+    ASSERT_EQ(w->commit(102), 0);
+  }
+  auto w = wal::open(wdir, opts);
+  ASSERT_NE(w, nullptr);
+  vector<rec> got;
+  ASSERT_EQ(w->replay(collect(got)), 0);
+  ASSERT_EQ(got, vector<rec>({{wal::op::remove, pref + "x", ""}}));
+  ASSERT_EQ(std::distance(std::filesystem::directory_iterator(wdir),
+			  std::filesystem::directory_iterator()), 1);
+}
+
+TEST_F(Store_Min1, tree_wal1) {
+  /* concurrent writers share syncs, and every change acknowledged
+   * survives a crash:  the store holds the tree as of the last
+   * checkpoint, and the log replays the rest */
+  static constexpr int nthreads = 4;
+  static constexpr int nkeys = 400;
+  auto key = [this](int tix, int ix) {
+    return pref + "w/" + std::to_string(tix) + "_" + std::to_string(ix);
+  };
+  namespace fs = std::filesystem;
+  string nodes = dir + "/nodes", wdir = dir + "/wal", crash = dir + "/crash";
+  ASSERT_TRUE(fs::create_directory(nodes));
+  ASSERT_TRUE(fs::create_directory(wdir));
+  wal::options opts;
+  opts.window = std::chrono::microseconds(500);
+  opts.sync = false; // the crash is of the process, not the machine
+  {
+    IO io1(64 * 1024, 4);
+    io1.set_store(std::make_shared<file_store>(nodes));
+    Tree t("Store_Min1_wal", Tree_Min1::fanout, 2, io1);
+    auto w = wal::open(wdir, opts);
+    ASSERT_NE(w, nullptr);
+    ASSERT_EQ(t.set_wal(w, 32 * 1024), 0);
+    vector<std::thread> writers;
+    for (int tix = 0; tix < nthreads; ++tix) {
+      writers.emplace_back([&, tix]() {
+	for (int ix = 0; ix < nkeys; ++ix) {
+	  ASSERT_EQ(t.insert(key(tix, ix), "v" + std::to_string(ix)), 0);
+	  if (ix % 5 == 4) {
+	    ASSERT_EQ(t.remove(key(tix, ix - 2)), 0);
+	  }
+	}
+      });
+    }
+    for (auto& th : writers) {
+      th.join();
+    }
+    ASSERT_EQ(t.insert_batch({{key(0, nkeys), "b"}, {key(1, nkeys), "b"}}), 0);
+    ASSERT_EQ(t.remove_batch({key(0, 0), key(1, 0)}), 0);
+    /* only changes are logged */
+    auto lsn = w->last_lsn();
+    ASSERT_EQ(t.remove(key(0, 0)), ENOENT);
+    ASSERT_EQ(w->last_lsn(), lsn);
+    uint32_t n{0};
+    ASSERT_EQ(t.insert_batch({{key(0, 1), "x"}, {key(0, 3), "x"},
+			      {key(0, nkeys + 1), "b"}}, &n), 0);
+    ASSERT_EQ(n, 1);
+    ASSERT_EQ(w->last_lsn(), lsn + 1);
+    ASSERT_EQ(t.remove_batch({key(0, 0), key(0, 2), key(0, nkeys + 1)}, &n),
+	      0);
+    ASSERT_EQ(n, 1);
+    ASSERT_EQ(w->last_lsn(), lsn + 2);
+    auto st = w->get_stats();
+    ASSERT_GE(st.commits, nthreads * nkeys);
+    ASSERT_LT(st.batches, st.commits);
+    ASSERT_GT(st.batch_max, 1);
+    ASSERT_GT(st.commit_us_max, 0);
+    /* checkpoints kept the log short */
+    ASSERT_LE(std::distance(fs::directory_iterator(wdir),
+			    fs::directory_iterator()), 2);
+    /* a change in the log alone */
+    ASSERT_EQ(t.checkpoint(), 0);
+    ASSERT_EQ(t.insert(pref + "w/last", "l"), 0);
+    ASSERT_GT(w->log_bytes(), 0);
+    /* crash:  what is on disk now, with io1's dirty nodes lost */
+    ASSERT_TRUE(fs::create_directory(crash));
+    fs::copy(nodes, crash + "/nodes");
+    fs::copy(wdir, crash + "/wal");
+  }
+  IO io2(64 * 1024, 4);
+  io2.set_store(std::make_shared<file_store>(crash + "/nodes"));
+  Tree t("Store_Min1_wal", Tree_Min1::fanout, 2, io2);
+  string val;
+  ASSERT_EQ(t.get(pref + "w/last", &val), ENOENT);
+  auto w = wal::open(crash + "/wal", opts);
+  ASSERT_NE(w, nullptr);
+  ASSERT_EQ(t.set_wal(w), 0);
+  ASSERT_EQ(t.get(pref + "w/last", &val), 0);
+  for (int tix = 0; tix < nthreads; ++tix) {
+    for (int ix = 0; ix < nkeys; ++ix) {
+      bool removed = ((ix % 5) == 2) || ((ix == 0) && (tix < 2));
+      ASSERT_EQ(t.get(key(tix, ix), &val), removed ? ENOENT : 0);
+      if (! removed) {
+	ASSERT_EQ(val, "v" + std::to_string(ix));
+      }
+    }
+  }
+  ASSERT_EQ(t.get(key(1, nkeys), &val), 0);
+  ASSERT_EQ(val, "b");
+  /* replayed, then checkpointed */
+  ASSERT_EQ(w->log_bytes(), 0);
+}
+
+TEST_F(Store_Min1, filters1) {
+  /* lookups of absent keys are refused by the tree's filter before
+   * any descent, or by a stored leaf's filter before its search */
+  static constexpr int nkeys = 2000;
+  auto key = [this](int ix) { return pref + "bf/" + std::to_string(ix); };
+  string path = dir + "/tree.pages";
+  Tree::filter_options opts;
+  opts.leaf_fpr = 0.01;
+  opts.tree_fpr = 0.01;
+  opts.tree_keys = nkeys; // the tree is empty yet
+  {
+    IO io1(64 * 1024, 4);
+    io1.set_store(paged_store::open(path));
+    Tree t("Store_Min1_filters", Tree_Min1::fanout, 2, io1);
+    ASSERT_EQ(t.set_filters(opts), 0);
+    for (int ix = 0; ix < nkeys; ix += 2) {
+      ASSERT_EQ(t.insert(key(ix), "v"), 0);
+    }
+    ASSERT_EQ(t.insert_batch({{key(1), "b"}, {key(3), "b"}}), 0);
+    for (int ix = 0; ix < nkeys; ++ix) {
+      bool present = ((ix % 2) == 0) || (ix == 1) || (ix == 3);
+      ASSERT_EQ(t.get(key(ix)), present ? 0 : ENOENT);
+    }
+    auto st = t.get_filter_stats();
+    ASSERT_EQ(st.tree_hits, nkeys / 2 + 2 + st.false_positives);
+    ASSERT_EQ(st.tree_skips + st.false_positives, nkeys / 2 - 2);
+    ASSERT_LT(st.false_positives, nkeys / 20);
+    ASSERT_GT(st.tree_bytes, 0);
+    ASSERT_EQ(st.leaf_hits + st.leaf_skips, 0); // nothing viewed
+    ASSERT_EQ(io1.sync(), 0);
+  }
+  /* reopened read-only, so read through views */
+  IO io2(64 * 1024, 4);
+  io2.set_store(paged_store::open(path, true));
+  Tree t("Store_Min1_filters", Tree_Min1::fanout, 2, io2);
+  auto absent = [&key](int ix) { return key(nkeys + ix); };
+  for (int ix = 0; ix < nkeys; ++ix) {
+    ASSERT_EQ(t.get(absent(ix)), ENOENT);
+  }
+  auto st = t.get_filter_stats();
+  ASSERT_EQ(st.tree_hits + st.tree_skips, 0);
+  ASSERT_GT(st.leaf_skips, nkeys * 9 / 10);
+  ASSERT_EQ(st.leaf_hits, st.false_positives);
+  /* the tree filter, from a scan */
+  opts.leaf_fpr = 0;
+  opts.tree_max_bytes = 512;
+  ASSERT_EQ(t.set_filters(opts), 0);
+  st = t.get_filter_stats();
+  ASSERT_EQ(st.tree_bytes, 512);
+  string val;
+  ASSERT_EQ(t.get(key(3), &val), 0);
+  ASSERT_EQ(val, "b");
+  for (int ix = 0; ix < nkeys; ++ix) {
+    ASSERT_EQ(t.get(absent(ix)), ENOENT);
+  }
+  auto st2 = t.get_filter_stats();
+  ASSERT_GT(st2.tree_skips, nkeys / 2);
+  ASSERT_LT(st2.tree_skips, nkeys);
+}
+
+TEST_F(Store_Min1, filters_mt1) {
+  /* the tree filter is rebuilt while writers insert, and read back
+   * each key:  none is refused, by the old filter or the new */
+  static constexpr int nthreads = 4;
+  static constexpr int nkeys = 2000;
+  auto key = [this](int tix, int ix) {
+    return pref + "bfmt/" + std::to_string(tix) + "_" + std::to_string(ix);
+  };
+  IO io1(256 * 1024, 4);
+  Tree t("Store_Min1_filters_mt", Tree_Min1::fanout, 2, io1);
+  Tree::filter_options opts;
+  opts.tree_fpr = 0.01;
+  opts.tree_keys = nthreads * nkeys;
+  ASSERT_EQ(t.set_filters(opts), 0);
+  std::atomic<bool> done{false};
+  std::vector<std::thread> writers;
+  for (int tix = 0; tix < nthreads; ++tix) {
+    writers.emplace_back(
+      [&t, &key, tix]() {
+	for (int ix = 0; ix < nkeys; ++ix) {
+	  ASSERT_EQ(t.insert(key(tix, ix), "v"), 0);
+	  ASSERT_EQ(t.get(key(tix, ix)), 0);
+	}
+      });
+  }
+  int rebuilds{0};
+  std::thread builder(
+    [&t, &opts, &done, &rebuilds]() {
+      while (! done) {
+	ASSERT_EQ(t.set_filters(opts), 0);
+	++rebuilds;
+      }
+    });
+  for (auto& w : writers) {
+    w.join();
+  }
+  done = true;
+  builder.join();
+  ASSERT_GT(rebuilds, 0);
+  for (int tix = 0; tix < nthreads; ++tix) {
+    for (int ix = 0; ix < nkeys; ++ix) {
+      ASSERT_EQ(t.get(key(tix, ix)), 0);
+    }
+  }
+  ASSERT_EQ(t.get(key(nthreads, 0)), ENOENT);
+}
+
+TEST_F(Tree_Bench1, insert_seq) {
+  insert_keys("Tree_Bench1_seq",
+	      [] (uint32_t ix) -> string {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "obj_%012u", ix);
+		return buf;
+	      });
+}
+
+TEST_F(Tree_Bench1, insert_rand) {
+  insert_keys("Tree_Bench1_rand",
+	      [this] (uint32_t ix) -> string {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%016lx", uint64_t(mt()));
+		return buf;
+	      });
+}
+
+TEST_F(Tree_Bench1, insert_prefix) {
+  /* S3-style keys, clustered under a few long pseudo-directories */
+  insert_keys("Tree_Bench1_prefix",
+	      [this] (uint32_t ix) -> string {
+		char buf[96];
+		uint64_t r = mt();
+		snprintf(buf, sizeof(buf),
+			 "/sub%u/docrequest/%c/DOC%06u/%012lx",
+			 unsigned(r % 8), (r & 0x100) ? 'D' : 'P',
+			 unsigned((r >> 16) % 64), uint64_t(r >> 24));
+		return buf;
+	      });
+}
+
+TEST_F(Tree_Bench1, list_node) {
+  /* full-node listings, materializing vs. zero-copy callback */
+  static constexpr uint32_t fanout = 1000;
+  leaf_node ln(fanout, 8);
+  for (uint32_t ix = 0; ix < fanout; ++ix) {
+    char buf[96];
+    snprintf(buf, sizeof(buf), "/sub1/docrequest/D/DOC%08u/obj%06u",
+	     ix / 10, ix);
+    ln.insert(leaf_key(buf), "v");
+  }
+  uint32_t passes = std::max(1u, bench_keys / fanout);
+  size_t bytes{0};
+  auto str_cb =
+    [&bytes] (const std::string *k, const std::string *v) -> int {
+      bytes += k->length();
+      return 0;
+    };
+  auto sv_cb =
+    [&bytes] (const sv_tuple& k, const std::string_view& v) -> int {
+      bytes += len(k);
+      return 0;
+    };
+  auto t0 = std::chrono::steady_clock::now();
+  for (uint32_t ix = 0; ix < passes; ++ix) {
+    ln.list({}, str_cb, {});
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  for (uint32_t ix = 0; ix < passes; ++ix) {
+    ln.list({}, sv_cb, {});
+  }
+  auto t2 = std::chrono::steady_clock::now();
+  std::chrono::duration<double, std::nano> str_ns = t1 - t0;
+  std::chrono::duration<double, std::nano> sv_ns = t2 - t1;
+  std::cout << "list_node: " << uint64_t(passes) * fanout << " entries"
+	    << " string* cb " << str_ns.count() / (passes * fanout)
+	    << " ns/entry, sv_tuple cb " << sv_ns.count() / (passes * fanout)
+	    << " ns/entry (" << bytes << " key bytes)" << std::endl;
+}
+
+TEST_F(Strings_Bench1, less_than) {
+  uint32_t iters = bench_keys * 10;
+  for (uint32_t plen : {16, 64, 256}) {
+    auto [s1, s2] = key_pair(plen);
+    /* split like prefix-compressed keys:  lhs at half its prefix */
+    std::string_view v1{s1}, v2{s2};
+    sv_tuple k1{v1.substr(0, plen / 2), v1.substr(plen / 2)};
+    sv_tuple k2{nullstr, v2};
+    volatile int sink{0};
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint32_t ix = 0; ix < iters; ++ix) {
+      sink += less_than_bytewise(k1, k2);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (uint32_t ix = 0; ix < iters; ++ix) {
+      sink += less_than(k1, k2);
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    for (uint32_t ix = 0; ix < iters; ++ix) {
+      sink += common_prefix_len(k1, k2);
+    }
+    auto t3 = std::chrono::steady_clock::now();
+    std::chrono::duration<double, std::nano> ns0 = t1 - t0;
+    std::chrono::duration<double, std::nano> ns1 = t2 - t1;
+    std::chrono::duration<double, std::nano> ns2 = t3 - t2;
+    std::cout << "shared prefix " << plen
+	      << ": bytewise less_than " << ns0.count() / iters
+	      << " ns/op, less_than " << ns1.count() / iters
+	      << " ns/op, common_prefix_len " << ns2.count() / iters
+	      << " ns/op" << std::endl;
+  }
+}
+
+TEST_F(Tree_Bench1, leaf_layout) {
+  /* leaf_node vs. slotted_leaf:  memory per entry, lookup cost */
+  for (uint32_t fanout : {100, 1000}) {
+    leaf_node ln(fanout, 8);
+    slotted_leaf sl(fanout, 8);
+    vector<string> keys;
+    for (uint32_t ix = 0; ix < fanout; ++ix) {
+      char buf[96];
+      snprintf(buf, sizeof(buf), "/sub1/docrequest/D/DOC%08lu/obj%06u",
+	       uint64_t(mt() % 1000), ix);
+      keys.push_back(buf);
+    }
+    for (const auto& k : keys) {
+      ln.insert(leaf_key(k), "etag-0123456789abcdef");
+      sl.insert(k, "etag-0123456789abcdef");
+    }
+    uint32_t lookups = bench_keys;
+    uint32_t found{0};
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint32_t ix = 0; ix < lookups; ++ix) {
+      found += (ln.get(leaf_key(keys[(ix * 7919) % fanout])) == 0);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (uint32_t ix = 0; ix < lookups; ++ix) {
+      found += (sl.get(keys[(ix * 7919) % fanout]) == 0);
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    ASSERT_EQ(found, 2 * lookups);
+    std::chrono::duration<double, std::nano> ln_ns = t1 - t0;
+    std::chrono::duration<double, std::nano> sl_ns = t2 - t1;
+    std::cout << "fanout " << fanout
+	      << ": leaf_node " << double(ln.footprint()) / fanout
+	      << " B/entry " << ln_ns.count() / lookups << " ns/get"
+	      << ", slotted_leaf " << double(sl.footprint()) / fanout
+	      << " B/entry " << sl_ns.count() / lookups << " ns/get"
+	      << std::endl;
+  }
+}
+
+TEST_F(Tree_Bench1, node_view) {
+  /* fetch-and-lookup-once:  full decode vs. in-place view */
+  static constexpr uint32_t fanout = 1000;
+  leaf_node ln(fanout, 8);
+  vector<string> keys;
+  for (uint32_t ix = 0; ix < fanout; ++ix) {
+    char buf[96];
+    snprintf(buf, sizeof(buf), "/sub1/docrequest/D/DOC%08u/obj%06u",
+	     ix / 10, ix);
+    keys.push_back(buf);
+    ln.insert(leaf_key(buf), "etag-0123456789abcdef");
+  }
+  auto bytes = ln.serialize();
+  uint32_t loads = std::max(1u, bench_keys / 100);
+  uint32_t found{0};
+  auto t0 = std::chrono::steady_clock::now();
+  for (uint32_t ix = 0; ix < loads; ++ix) {
+    leaf_node* n2 = get<leaf_node*>(node_factory::from_flexbuffers(bytes));
+    found += (n2->get(leaf_key(keys[ix % fanout])) == 0);
+    delete n2;
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  for (uint32_t ix = 0; ix < loads; ++ix) {
+    auto flatv = bytes; /* as fetched */
+    auto view = node_factory::view_flexbuffers(std::move(flatv));
+    found += (view->get(keys[ix % fanout]) == 0);
+  }
+  auto t2 = std::chrono::steady_clock::now();
+  ASSERT_EQ(found, 2 * loads);
+  std::chrono::duration<double, std::micro> dec_us = t1 - t0;
+  std::chrono::duration<double, std::micro> view_us = t2 - t1;
+  std::cout << "node_view: " << fanout << " entries, " << bytes.size()
+	    << " bytes; decode+get " << dec_us.count() / loads
+	    << " us, view+get " << view_us.count() / loads << " us"
+	    << std::endl;
+}
+
+TEST_F(Tree_Bench1, bulk_load) {
+  /* sorted input:  repeated insert vs. bottom-up bulk_load */
+  vector<std::pair<string, string>> kvs;
+  kvs.reserve(bench_keys);
+  for (uint32_t ix = 0; ix < bench_keys; ++ix) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "/sub1/docrequest/D/DOC%012u", ix);
+    kvs.emplace_back(buf, "v");
+  }
+  Tree t_ins("Tree_Bench1_bulk_ins", bench_fanout);
+  auto t0 = std::chrono::steady_clock::now();
+  for (const auto& [k, v] : kvs) {
+    ASSERT_EQ(t_ins.insert(k, v), 0);
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  Tree t_bulk("Tree_Bench1_bulk", bench_fanout);
+  ASSERT_EQ(t_bulk.bulk_load(kvs.begin(), kvs.end()), 0);
+  auto t2 = std::chrono::steady_clock::now();
+  std::chrono::duration<double> ins_s = t1 - t0;
+  std::chrono::duration<double> bulk_s = t2 - t1;
+  std::cout << "bulk_load: " << kvs.size() << " keys fanout "
+	    << bench_fanout << "; insert " << ins_s.count() << "s height "
+	    << t_ins.height() << ", bulk_load " << bulk_s.count()
+	    << "s height " << t_bulk.height() << " ("
+	    << ins_s.count() / bulk_s.count() << "x)" << std::endl;
+}
+
+TEST_F(Tree_Bench1, mixed_mt) {
+  /* 9:1 insert/list mix, same total ops at each thread count */
+  uint32_t max_threads = std::max(4u, std::thread::hardware_concurrency());
+  double base_rate{0};
+  for (uint32_t nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+    string tree_name = "Tree_Bench1_mixed_" + std::to_string(nthreads);
+    Tree t(tree_name, bench_fanout);
+    uint32_t ops_per_thread = bench_keys / nthreads;
+    std::vector<std::thread> workers;
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint32_t tix = 0; tix < nthreads; ++tix) {
+      workers.emplace_back(
+	[&t, tix, ops_per_thread]() {
+	  std::mt19937_64 tmt(seed + tix);
+	  auto count_key =
+	    [] (const std::string *k, const std::string *v) -> int {
+	      return 0;
+	    };
+	  char buf[32];
+	  for (uint32_t ix = 0; ix < ops_per_thread; ++ix) {
+	    snprintf(buf, sizeof(buf), "%016lx", uint64_t(tmt()));
+	    if (ix % 10 == 9) {
+	      t.list(string(buf, 4), count_key, 10);
+	    } else {
+	      t.insert(buf, "v");
+	    }
+	  }
+	});
+    }
+    for (auto& w : workers) {
+      w.join();
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    std::chrono::duration<double> secs = t1 - t0;
+    double rate = (ops_per_thread * nthreads) / secs.count();
+    if (nthreads == 1) {
+      base_rate = rate;
+    }
+    std::cout << tree_name << ": " << nthreads << " threads "
+	      << uint64_t(rate) << " ops/s"
+	      << " speedup " << (rate / base_rate)
+	      << " height " << t.height()
+	      << std::endl;
+  }
+}
+
+TEST_F(Tree_Bench1, cache) {
+  /* point lookups, uniform and skewed, as the cache shrinks below the
+   * tree's footprint;  nodes are evicted to (and fetched from) an
+   * in-memory store */
+  Tree t("Tree_Bench1_cache", bench_fanout);
+  vector<string> keys;
+  keys.reserve(bench_keys);
+  for (uint32_t ix = 0; ix < bench_keys; ++ix) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%016lx", uint64_t(mt()));
+    keys.push_back(buf);
+    t.insert(keys.back(), "v");
+  }
+  /* hot keys are a key range, so a subtree */
+  std::sort(keys.begin(), keys.end());
+  /* written back (and re-measured) before shrinking */
+  io.set_store(cache_store);
+  ASSERT_EQ(io.cache.flush(), 0);
+  size_t tree_bytes = io.cache.get_stats().bytes;
+  auto count_key =
+    [] (const std::string *k, const std::string *v) -> int {
+      return 0;
+    };
+  uint32_t nlookups = bench_keys / 2;
+  for (uint32_t div : {1, 2, 4, 8, 16}) {
+    io.cache.set_capacity(tree_bytes / div);
+    for (bool skewed : {false, true}) {
+      auto st0 = io.cache.get_stats();
+      auto t0 = std::chrono::steady_clock::now();
+      for (uint32_t ix = 0; ix < nlookups; ++ix) {
+	/* skewed:  90% of lookups go to the first 10% of keys */
+	uint64_t r = mt();
+	size_t kix = (skewed && (r % 10 != 0))
+	  ? (r >> 8) % (keys.size() / 10) : (r >> 8) % keys.size();
+	t.list(keys[kix], count_key, 1);
+      }
+      auto t1 = std::chrono::steady_clock::now();
+      std::chrono::duration<double> secs = t1 - t0;
+      auto st = io.cache.get_stats();
+      uint64_t hits = st.hits - st0.hits;
+      uint64_t misses = st.misses - st0.misses;
+      std::cout << "cache: capacity 1/" << div << " of " << tree_bytes
+		<< "B " << (skewed ? "skewed " : "uniform ")
+		<< uint64_t(nlookups / secs.count()) << " lookups/s hit rate "
+		<< double(hits) / (hits + misses)
+		<< " evictions " << (st.evictions - st0.evictions)
+		<< " writebacks " << (st.writebacks - st0.writebacks)
+		<< std::endl;
+    }
+  }
+  io.cache.set_capacity(IO::default_cache_bytes);
+}
+
 TEST_F(Strings_Min1, cpref1) {
   std::string r1 = common_prefix(s1, s2, 5);
   if (verbose) {
@@ -295,6 +2733,72 @@ TEST_F(Strings_Min1, pref_eq1) {
   ASSERT_EQ(lk3.to_string(pv), s1);
 }
 
+TEST_F(Strings_Min1, find_delim1) {
+  string p{"/sub1/docrequest/"};
+  sv_tuple k1{p, "D/DOC597z85"};
+  ASSERT_EQ(find(k1, "/", 0), 0);
+  ASSERT_EQ(find(k1, "/", 1), 5);
+  ASSERT_EQ(find(k1, "/", 17), 18);
+  ASSERT_EQ(find(k1, "/D", 6), 16); // across the split
+  ASSERT_EQ(find(k1, "st/D/", 0), 14);
+  ASSERT_EQ(find(k1, "/", 19), string::npos);
+  ASSERT_EQ(prefix_successor("a/"), "a0");
+  ASSERT_EQ(prefix_successor("a\xff"), "b");
+  ASSERT_EQ(prefix_successor("\xff\xff"), std::nullopt);
+}
+
+TEST_F(Strings_Min1, starts_with1) {
+  string p{"/sub1/docrequest/"};
+  sv_tuple k1{p, "D/DOC597z85"};
+  sv_tuple k2{nullstr, s1};
+  ASSERT_TRUE(starts_with(k1, "/sub1/"));
+  ASSERT_TRUE(starts_with(k1, "/sub1/docrequest/D/"));
+  ASSERT_TRUE(starts_with(k1, s1));
+  ASSERT_TRUE(starts_with(k2, "/sub1/docrequest/D/"));
+  ASSERT_FALSE(starts_with(k1, "/sub1/docrequest/P"));
+  ASSERT_FALSE(starts_with(k1, s1 + "x"));
+  ASSERT_FALSE(starts_with(k2, "/sub2"));
+}
+
+TEST_F(Strings_Min1, cpref2) {
+  /* argument order and lhs/rhs length don't matter */
+  ASSERT_EQ(common_prefix(s4, s3, 5), "orange ");
+  ASSERT_EQ(common_prefix(s3, s4, 5), "orange ");
+  ASSERT_EQ(common_prefix(s1, s1 + "x", 5), s1);
+}
+
+TEST_F(Strings_Min1, compare1) {
+  /* split-key kernels agree with std::string (unsigned bytes) at
+   * every split point */
+  std::mt19937_64 mt{seed};
+  const string alpha{"ab/\x7f\x80\xff"};
+  auto rand_str = [&mt, &alpha] (size_t slen) {
+    string str;
+    for (size_t ix = 0; ix < slen; ++ix) {
+      str += alpha[mt() % alpha.length()];
+    }
+    return str;
+  };
+  for (int ix = 0; ix < 20000; ++ix) {
+    string common = rand_str(mt() % 80);
+    string l = common + rand_str(mt() % 40);
+    string r = (ix % 4) ? common + rand_str(mt() % 40) : l;
+    size_t lsplit = mt() % (l.length() + 1);
+    size_t rsplit = mt() % (r.length() + 1);
+    std::string_view lv{l}, rv{r};
+    sv_tuple lt{lv.substr(0, lsplit), lv.substr(lsplit)};
+    sv_tuple rt{rv.substr(0, rsplit), rv.substr(rsplit)};
+    int expect = l.compare(r);
+    int res = compare(lt, rt);
+    ASSERT_EQ((res < 0), (expect < 0)) << l << " " << r;
+    ASSERT_EQ((res == 0), (expect == 0)) << l << " " << r;
+    ASSERT_EQ(less_than(lt, rt), (l < r));
+    size_t cpl = std::mismatch(l.begin(), l.begin() + std::min(l.size(), r.size()),
+			       r.begin()).first - l.begin();
+    ASSERT_EQ(common_prefix_len(lt, rt), cpl);
+  }
+}
+
 TEST_F(Strings_Min1, pref_lt1) {
   vector<string> pv = {"abc", "def"};
   leaf_key lk1{pv[0], "_apple"};
@@ -319,15 +2823,26 @@ int main(int argc, char **argv)
 
     opts.add_options()
       ("verbose", "be verbose about things")
+      ("bench", "run benchmark tests")
+      ("bench-keys", po::value<uint32_t>(&bench_keys),
+       "keys per benchmark run (default 1000000)")
+      ("bench-fanout", po::value<uint32_t>(&bench_fanout),
+       "node fanout for benchmark runs (default 100)")
       ;
 
     po::variables_map::iterator vm_iter;
-    po::store(po::parse_command_line(argc, argv, opts), vm);
+    /* leave --gtest_* options for InitGoogleTest */
+    po::store(po::command_line_parser(argc, argv).options(opts)
+	      .allow_unregistered().run(), vm);
 
     if (vm.count("verbose")) {
       verbose = true;
     }
 
+    if (vm.count("bench")) {
+      bench = true;
+    }
+
     po::notify(vm);
 
     ::testing::InitGoogleTest(&argc, argv);
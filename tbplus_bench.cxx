@@ -0,0 +1,826 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2019 Red Hat, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation. See file COPYING.
+ *
+ */
+
+/* microbenchmarks for the node, key and tree hot paths;  for
+ * results to compare across builds, run e.g.
+ *
+ *   tbplus_bench --benchmark_out=bplus.json --benchmark_out_format=json
+ *
+ * (--benchmark_filter=<regex> selects, --benchmark_repetitions=<n>
+ * gives spread) */
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <filesystem>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bplus_tree.h"
+#include "bplus_paged.h"
+#include "bplus_wal.h"
+
+namespace {
+
+  using namespace rgw::bplus;
+  using std::string;
+  using std::vector;
+
+  static constexpr uint64_t seed = 8675309;
+
+  /* count keys of klen bytes, the first plen of them shared (an
+   * S3-ish path), the rest random;  sorted, unique */
+  vector<string> make_keys(uint32_t count, uint32_t klen, uint32_t plen) {
+    static constexpr char alnum[] =
+      "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+    std::mt19937_64 mt{seed};
+    string pref;
+    while (pref.length() < plen) {
+      pref += "/sub1/docrequest/D/";
+    }
+    pref.resize(plen);
+    uint32_t slen = std::max(klen, plen + 8) - plen;
+    vector<string> keys;
+    keys.reserve(count);
+    while (keys.size() < count) {
+      string k{pref};
+      for (uint32_t ix = 0; ix < slen; ++ix) {
+	k += alnum[mt() % (sizeof(alnum) - 1)];
+      }
+      keys.push_back(std::move(k));
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    return keys;
+  }
+
+  vector<string> shuffled(vector<string> keys) {
+    std::mt19937_64 mt{seed};
+    std::shuffle(keys.begin(), keys.end(), mt);
+    return keys;
+  }
+
+  /* node benchmark args:  fanout, key length, shared prefix length,
+   * prefix_min_len (65535 turns prefixing off) */
+  void node_args(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"fanout", "klen", "plen", "pml"});
+    b->ArgsProduct({{20, 100, 400}, {32, 128}, {0, 24}, {2, 16, 65535}});
+  }
+
+  /* key benchmark args:  key length, shared prefix length */
+  void key_args(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"klen", "plen"});
+    b->ArgsProduct({{16, 32, 128, 512}, {0, 8, 24, 100}});
+  }
+
+  /* tree benchmark args:  fanout, key length, shared prefix length */
+  void tree_args(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"fanout", "klen", "plen"});
+    b->ArgsProduct({{20, 100}, {32, 128}, {0, 24}});
+  }
+
+  struct node_params {
+    uint32_t fanout;
+    uint32_t klen;
+    uint32_t plen;
+    uint16_t prefix_min_len;
+
+    explicit node_params(const benchmark::State& state)
+      : fanout(state.range(0)), klen(state.range(1)),
+	plen(state.range(2)), prefix_min_len(state.range(3)) {}
+  };
+
+  void fill_node(leaf_node& ln, const vector<string>& keys) {
+    for (const auto& k : keys) {
+      ln.insert(leaf_key(k), "v");
+    }
+  }
+
+  /* insert fanout keys in random order into an empty leaf;  the
+   * counters give what prefixing saved, per key */
+  void BM_node_insert(benchmark::State& state) {
+    node_params p(state);
+    auto keys = shuffled(make_keys(p.fanout, p.klen, p.plen));
+    leaf_node::key_stats ks;
+    for (auto _ : state) {
+      leaf_node ln(p.fanout, p.prefix_min_len);
+      fill_node(ln, keys);
+      state.PauseTiming();
+      ks = ln.get_key_stats();
+      state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    state.counters["saved_per_key"] =
+      double(ks.logical - ks.stored) / keys.size();
+    state.counters["prefixes"] = ks.prefixes;
+  }
+  BENCHMARK(BM_node_insert)->Apply(node_args);
+
+  /* remove every key of a full leaf, in random order */
+  void BM_node_remove(benchmark::State& state) {
+    node_params p(state);
+    auto keys = shuffled(make_keys(p.fanout, p.klen, p.plen));
+    for (auto _ : state) {
+      state.PauseTiming();
+      leaf_node ln(p.fanout, p.prefix_min_len);
+      fill_node(ln, keys);
+      state.ResumeTiming();
+      for (const auto& k : keys) {
+	ln.remove(leaf_key(k));
+      }
+      benchmark::DoNotOptimize(ln.size());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+  }
+  BENCHMARK(BM_node_remove)->Apply(node_args);
+
+  /* point lookups of every key of a full leaf, in random order */
+  void BM_node_get(benchmark::State& state) {
+    node_params p(state);
+    auto keys = make_keys(p.fanout, p.klen, p.plen);
+    leaf_node ln(p.fanout, p.prefix_min_len);
+    fill_node(ln, keys);
+    vector<leaf_key> lks;
+    for (const auto& k : shuffled(keys)) {
+      lks.emplace_back(k);
+    }
+    for (auto _ : state) {
+      for (const auto& k : lks) {
+	benchmark::DoNotOptimize(ln.get(k));
+      }
+    }
+    state.SetItemsProcessed(state.iterations() * lks.size());
+  }
+  BENCHMARK(BM_node_get)->Apply(node_args);
+
+  /* zero-copy listing of a full leaf */
+  void BM_node_list(benchmark::State& state) {
+    node_params p(state);
+    auto keys = make_keys(p.fanout, p.klen, p.plen);
+    leaf_node ln(p.fanout, p.prefix_min_len);
+    fill_node(ln, keys);
+    for (auto _ : state) {
+      size_t bytes{0};
+      ln.list(std::nullopt,
+	      [&bytes](const sv_tuple& k, const std::string_view& v) -> int {
+		bytes += len(k) + v.length();
+		return 0;
+	      }, std::nullopt);
+      benchmark::DoNotOptimize(bytes);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+  }
+  BENCHMARK(BM_node_list)->Apply(node_args);
+
+  /* one traversal step:  find_floor in a full branch, for random
+   * keys;  warm (cold:0) searches one branch, cold (cold:1) a random
+   * one of enough copies to spill out of the last-level cache */
+  void BM_branch_find_floor(benchmark::State& state) {
+    static constexpr size_t cold_bytes = 256 << 20;
+    uint32_t fanout = state.range(0);
+    auto keys = make_keys(fanout - 1, state.range(1), 0);
+    size_t nnodes = state.range(2)
+      ? std::max<size_t>(1, cold_bytes / (fanout * (state.range(1) + 96)))
+      : 1;
+    vector<std::unique_ptr<branch_node>> bns;
+    for (size_t ix = 0; ix < nnodes; ++ix) {
+      vector<std::pair<string, string>> seps{{"", "child"}};
+      for (const auto& k : keys) {
+	seps.emplace_back(k, "child");
+      }
+      bns.emplace_back(new branch_node(fanout, 2));
+      bns.back()->load_sorted(seps.begin(), seps.end());
+    }
+    /* coprime counts, so (node, probe) pairs don't soon repeat */
+    vector<fence_key> probes;
+    for (const auto& k : shuffled(make_keys(4093, state.range(1), 0))) {
+      probes.emplace_back(k);
+    }
+    std::mt19937_64 mt{seed};
+    vector<uint32_t> order(1 << 16);
+    for (auto& o : order) {
+      o = mt() % nnodes;
+    }
+    size_t ix{0};
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(
+	bns[order[ix % order.size()]]->find_floor(probes[ix % probes.size()]));
+      ++ix;
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["nodes"] = nnodes;
+  }
+  BENCHMARK(BM_branch_find_floor)
+  ->ArgNames({"fanout", "klen", "cold"})
+  ->ArgsProduct({{100, 250, 500, 1000}, {32}, {0, 1}});
+
+  void BM_serialize(benchmark::State& state) {
+    node_params p(state);
+    leaf_node ln(p.fanout, p.prefix_min_len);
+    fill_node(ln, make_keys(p.fanout, p.klen, p.plen));
+    size_t bytes{0};
+    for (auto _ : state) {
+      auto flat = ln.serialize();
+      bytes = flat.size();
+      benchmark::DoNotOptimize(flat.data());
+    }
+    state.SetBytesProcessed(state.iterations() * bytes);
+  }
+  BENCHMARK(BM_serialize)->Apply(node_args);
+
+  void BM_from_flexbuffers(benchmark::State& state) {
+    node_params p(state);
+    leaf_node ln(p.fanout, p.prefix_min_len);
+    fill_node(ln, make_keys(p.fanout, p.klen, p.plen));
+    auto flat = ln.serialize();
+    for (auto _ : state) {
+      auto node = node_factory::from_flexbuffers(flat);
+      std::visit([](auto n) { delete n; }, node);
+    }
+    state.SetBytesProcessed(state.iterations() * flat.size());
+  }
+  BENCHMARK(BM_from_flexbuffers)->Apply(node_args);
+
+  /* write back a full leaf after each single-key update, as a
+   * delta (arg delta:1, folded whole every log_max_records) or
+   * whole (delta:0);  bytes_per_second is bytes written */
+  void BM_writeback(benchmark::State& state) {
+    node_params p(state);
+    bool can_delta = state.range(4);
+    auto keys = make_keys(p.fanout, p.klen, p.plen);
+    leaf_node ln(p.fanout, p.prefix_min_len);
+    fill_node(ln, keys);
+    string k = keys.back();
+    ln.remove(leaf_key(k));
+    bool delta;
+    ln.writeback(can_delta, &delta);
+    size_t bytes{0};
+    bool present{false};
+    for (auto _ : state) {
+      if (present) {
+	ln.remove(leaf_key(k));
+      } else {
+	ln.insert(leaf_key(k), "v");
+      }
+      present = ! present;
+      bytes += ln.writeback(can_delta, &delta).size();
+    }
+    state.SetBytesProcessed(bytes);
+    state.counters["bytes_per_write"] = benchmark::Counter(
+      bytes, benchmark::Counter::kAvgIterations);
+  }
+  BENCHMARK(BM_writeback)
+  ->ArgNames({"fanout", "klen", "plen", "pml", "delta"})
+  ->ArgsProduct({{20, 100, 400}, {32, 128}, {24}, {2}, {0, 1}});
+
+  /* adjacent keys, which differ only after the shared prefix */
+  void BM_less_than(benchmark::State& state) {
+    auto keys = make_keys(2, state.range(0), state.range(1));
+    string nil;
+    auto lhs = std::tie(nil, keys[0]);
+    auto rhs = std::tie(nil, keys[1]);
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(less_than(lhs, rhs));
+    }
+  }
+  BENCHMARK(BM_less_than)->Apply(key_args);
+
+  /* equal keys, one prefix-compressed and one not:  the worst case,
+   * a full comparison across the prefix boundary */
+  void BM_equal_to(benchmark::State& state) {
+    auto keys = make_keys(1, state.range(0), state.range(1));
+    uint32_t plen = std::min<uint32_t>(state.range(1), keys[0].length());
+    prefix_vector pv{keys[0].substr(0, plen)};
+    leaf_key lk(uint16_t(0), keys[0].substr(plen));
+    leaf_key rk(keys[0]);
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(equal_to(pv, lk, rk));
+    }
+  }
+  BENCHMARK(BM_equal_to)->Apply(key_args);
+
+  /* prefix-compress each key against its predecessor, as an
+   * in-order fill does */
+  void BM_make_prefix_key(benchmark::State& state) {
+    static constexpr uint32_t nkeys = 64;
+    auto keys = make_keys(nkeys, state.range(0), state.range(1));
+    vector<leaf_key> lks(keys.begin(), keys.end());
+    for (auto _ : state) {
+      prefix_vector pv;
+      for (uint32_t ix = 1; ix < nkeys; ++ix) {
+	benchmark::DoNotOptimize(make_prefix_key(pv, lks[ix], lks[ix-1], 2));
+      }
+    }
+    state.SetItemsProcessed(state.iterations() * (nkeys - 1));
+  }
+  BENCHMARK(BM_make_prefix_key)->Apply(key_args);
+
+  static constexpr uint32_t tree_keys = 100000;
+
+  /* random-order inserts into a new tree, in its own cache */
+  void BM_tree_insert(benchmark::State& state) {
+    auto keys = shuffled(make_keys(tree_keys, state.range(1),
+				   state.range(2)));
+    for (auto _ : state) {
+      IO tio;
+      Tree t("BM_tree_insert", state.range(0), 2, tio);
+      for (const auto& k : keys) {
+	t.insert(k, "v");
+      }
+      state.PauseTiming(); // exclude teardown
+      state.counters["height"] = t.height();
+      state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+  }
+  BENCHMARK(BM_tree_insert)->Apply(tree_args)->Unit(benchmark::kMillisecond);
+
+  /* the same inserts, in batches of the given size */
+  void BM_tree_insert_batch(benchmark::State& state) {
+    auto keys = shuffled(make_keys(tree_keys, state.range(1),
+				   state.range(2)));
+    size_t bsize = state.range(3);
+    for (auto _ : state) {
+      IO tio;
+      Tree t("BM_tree_insert_batch", state.range(0), 2, tio);
+      for (size_t ix = 0; ix < keys.size(); ix += bsize) {
+	Tree::kv_vec kvs;
+	for (size_t jx = ix; jx < std::min(ix + bsize, keys.size()); ++jx) {
+	  kvs.emplace_back(keys[jx], "v");
+	}
+	t.insert_batch(std::move(kvs));
+      }
+      state.PauseTiming(); // exclude teardown
+      state.counters["height"] = t.height();
+      state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+  }
+  BENCHMARK(BM_tree_insert_batch)
+  ->ArgNames({"fanout", "klen", "plen", "batch"})
+  ->ArgsProduct({{20, 100}, {32, 128}, {0, 24}, {100, 10000}})
+  ->Unit(benchmark::kMillisecond);
+
+  /* short range scans (scan_keys from a random key) of a bulk-loaded
+   * tree */
+  void BM_tree_scan(benchmark::State& state) {
+    static constexpr uint32_t scan_keys = 64;
+    auto keys = make_keys(tree_keys, state.range(1), state.range(2));
+    IO tio;
+    Tree t("BM_tree_scan", state.range(0), 2, tio);
+    t.bulk_load(
+      [&keys, ix = size_t(0)](string& k, string& v) mutable -> bool {
+	if (ix == keys.size()) {
+	  return false;
+	}
+	k = keys[ix++];
+	v = "v";
+	return true;
+      });
+    std::mt19937_64 mt{seed};
+    size_t nkeys{0};
+    for (auto _ : state) {
+      nkeys += t.list(keys[mt() % keys.size()],
+		      [](const sv_tuple& k, const std::string_view& v) -> int {
+			return 0;
+		      }, scan_keys);
+    }
+    state.SetItemsProcessed(nkeys);
+  }
+  BENCHMARK(BM_tree_scan)->Apply(tree_args);
+
+  /* delimited listing of the root of a tree of 16 pseudo-directories
+   * (delim:0 lists every key instead) */
+  void BM_tree_list_delim(benchmark::State& state) {
+    static constexpr uint32_t ndirs = 16;
+    uint32_t per_dir = state.range(1);
+    IO tio;
+    Tree t("BM_tree_list_delim", state.range(0), 2, tio);
+    Tree::kv_vec kvs;
+    for (uint32_t dix = 0; dix < ndirs; ++dix) {
+      for (uint32_t ix = 0; ix < per_dir; ++ix) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "dir%02u/obj%08u", dix, ix);
+	kvs.emplace_back(buf, "v");
+      }
+    }
+    t.insert_batch(std::move(kvs));
+    string delim = state.range(2) ? "/" : "";
+    size_t nlisted{0};
+    for (auto _ : state) {
+      nlisted += t.list({}, delim,
+			[](const sv_tuple& k, const std::string_view& v,
+			   bool is_prefix) -> int {
+			  return 0;
+			}, {});
+    }
+    state.SetItemsProcessed(nlisted);
+  }
+  BENCHMARK(BM_tree_list_delim)
+  ->ArgNames({"fanout", "per_dir", "delim"})
+  ->ArgsProduct({{20, 100}, {1000, 100000}, {0, 1}});
+
+  /* node names, from threads that create nodes at once */
+  void BM_gen_node_name(benchmark::State& state) {
+    static Tree t("BM_gen_node_name", 100);
+    size_t len{0};
+    for (auto _ : state) {
+      len += t.gen_node_name().length();
+    }
+    benchmark::DoNotOptimize(len);
+    state.SetItemsProcessed(state.iterations());
+  }
+  BENCHMARK(BM_gen_node_name)->ThreadRange(1, 4);
+
+  /* placement of node names over 32 shards */
+  void BM_place(benchmark::State& state) {
+    Tree t("BM_place", 100);
+    vector<string> names;
+    for (int ix = 0; ix < 4096; ++ix) {
+      names.push_back(t.gen_node_name());
+    }
+    size_t ix{0};
+    uint32_t sum{0};
+    for (auto _ : state) {
+      sum += place(names[ix++ % names.size()], 32);
+    }
+    benchmark::DoNotOptimize(sum);
+    state.SetItemsProcessed(state.iterations());
+  }
+  BENCHMARK(BM_place);
+
+  /* node fetches (4KiB objects) from a file_store, qd at a time, as
+   * get_nodes makes them:  engine:0 reads synchronously, one after
+   * another, 1 as a read_batch on the thread pool (qd threads), 2 as
+   * a read_batch through io_uring;  cold:1 drops each batch's files
+   * from the page cache first;  p99_us is the latency of a batch,
+   * until its last fetch is in */
+  void BM_store_fetch(benchmark::State& state) {
+    static constexpr int nobjs = 1024;
+    static constexpr size_t obj_size = 4096;
+    using clock = std::chrono::steady_clock;
+    uint32_t engine = state.range(0);
+    uint32_t qd = state.range(1);
+    bool cold = state.range(2);
+    char tmpl[] = "/tmp/tbplus_bench.XXXXXX";
+    if (! mkdtemp(tmpl)) {
+      state.SkipWithError("mkdtemp failed");
+      return;
+    }
+    string dir{tmpl};
+    {
+      file_store fs(dir, false, qd,
+		    (engine == 2) ? aio_engine::uring : aio_engine::threads);
+      if ((engine == 2) && (fs.engine() != aio_engine::uring)) {
+	state.SkipWithError("io_uring unavailable");
+      }
+      vector<string> names;
+      for (int ix = 0; ix < nobjs; ++ix) {
+	names.push_back("node-" + std::to_string(ix));
+	fs.write(names.back(), std::vector<uint8_t>(obj_size, uint8_t(ix)));
+      }
+      std::mt19937_64 mt{seed};
+      vector<double> lat; // us, per batch
+      std::vector<uint8_t> bytes;
+      vector<string> batch(qd);
+      std::vector<std::vector<uint8_t>> batch_bytes;
+      std::vector<int> rets;
+      auto evict = [&dir](const string& name) {
+	/* node-<n> is its own file name */
+	int fd = ::open((dir + "/" + name).c_str(), O_RDONLY);
+	if (fd >= 0) {
+	  ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	  ::close(fd);
+	}
+      };
+      for (auto _ : state) {
+	for (uint32_t ix = 0; ix < qd; ++ix) {
+	  batch[ix] = names[mt() % nobjs];
+	}
+	if (cold) {
+	  state.PauseTiming();
+	  for (const auto& name : batch) {
+	    evict(name);
+	  }
+	  state.ResumeTiming();
+	}
+	auto t0 = clock::now();
+	if (engine == 0) {
+	  for (const auto& name : batch) {
+	    fs.read(name, bytes);
+	  }
+	} else {
+	  fs.read_batch(batch, batch_bytes, rets);
+	}
+	lat.push_back(
+	  std::chrono::duration<double, std::micro>(clock::now() - t0).count());
+      }
+      if (! lat.empty()) {
+	std::sort(lat.begin(), lat.end());
+	state.counters["p99_us"] = lat[lat.size() * 99 / 100];
+      }
+      state.SetItemsProcessed(state.iterations() * qd);
+    }
+    std::filesystem::remove_all(dir);
+  }
+  BENCHMARK(BM_store_fetch)
+  ->ArgNames({"engine", "qd", "cold"})
+  ->ArgsProduct({{0, 1, 2}, {1, 4, 16, 64}, {0, 1}})
+  ->UseRealTime();
+
+} /* namespace */
+
+  /* point lookups in a tree of 200k keys, reopened with a cache of
+   * 1MiB (a small fraction of it):  store:0 is a file_store (a file
+   * per node), 1 a paged_store opened writable (misses copied out of
+   * the mapping and decoded into the cache), 2 the same file opened
+   * read-only (misses read in place, through node views);  cold:1
+   * drops the files from the page cache first */
+  void BM_tree_lookup_store(benchmark::State& state) {
+    static constexpr uint32_t nkeys = 200000;
+    static constexpr uint32_t fanout = 100;
+    static constexpr size_t cache_bytes = 1 << 20;
+    uint32_t store = state.range(0);
+    bool cold = state.range(1);
+    char tmpl[] = "/tmp/tbplus_bench.XXXXXX";
+    if (! mkdtemp(tmpl)) {
+      state.SkipWithError("mkdtemp failed");
+      return;
+    }
+    string dir{tmpl};
+    string path = dir + "/tree.pages";
+    auto open_store = [&](bool read_only) -> std::shared_ptr<object_store> {
+      if (store == 0) {
+	return std::make_shared<file_store>(dir);
+      }
+      return paged_store::open(path, read_only);
+    };
+    auto keys = make_keys(nkeys, 32, 0);
+    {
+      IO io1(IO::default_cache_bytes, 4);
+      io1.set_store(open_store(false));
+      Tree t("BM_tree_lookup_store", fanout, 2, io1);
+      size_t ix{0};
+      t.bulk_load(
+	[&keys, &ix](string& k, string& v) -> bool {
+	  if (ix == keys.size()) {
+	    return false;
+	  }
+	  k = keys[ix];
+	  v = "val-" + std::to_string(ix++);
+	  return true;
+	});
+      io1.sync();
+    }
+    if (cold) {
+      for (const auto& e : std::filesystem::directory_iterator(dir)) {
+	int fd = ::open(e.path().c_str(), O_RDONLY);
+	if (fd >= 0) {
+	  ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	  ::close(fd);
+	}
+      }
+    }
+    {
+      IO io2(cache_bytes, 4);
+      io2.set_store(open_store(store == 2));
+      Tree t("BM_tree_lookup_store", fanout, 2, io2);
+      std::mt19937_64 mt{seed};
+      string val;
+      uint32_t misses{0};
+      for (auto _ : state) {
+	if (t.get(keys[mt() % keys.size()], &val) != 0) {
+	  ++misses;
+	}
+      }
+      if (misses > 0) {
+	state.SkipWithError("key not found");
+      }
+      state.SetItemsProcessed(state.iterations());
+      state.counters["cached"] = io2.cache.get_stats().nodes;
+    }
+    std::filesystem::remove_all(dir);
+  }
+  BENCHMARK(BM_tree_lookup_store)
+  ->ArgNames({"store", "cold"})
+  ->ArgsProduct({{0, 1, 2}, {0, 1}})
+  ->UseRealTime();
+
+  /* a slow paginated listing (pages of 1000 keys, each key costing
+   * its consumer ~1us) against ingest into the same range by another
+   * thread:  snap:0 lists the live tree, each leaf latched across its
+   * callbacks, snap:1 a snapshot taken per page;  ingest_per_s is the
+   * writer's rate meanwhile, and ingest_p99_us/ingest_max_us the
+   * latency of its inserts (a stall behind a listing shows there) */
+  void BM_list_ingest(benchmark::State& state) {
+    static constexpr uint32_t nkeys = 100000;
+    static constexpr uint32_t page = 1000;
+    using clock = std::chrono::steady_clock;
+    bool snap = state.range(0);
+    Tree t("BM_list_ingest", 100);
+    auto keys = make_keys(nkeys, 32, 0);
+    t.bulk_load(
+      [&keys, ix = size_t(0)](string& k, string& v) mutable -> bool {
+	if (ix == keys.size()) {
+	  return false;
+	}
+	k = keys[ix++];
+	v = "v";
+	return true;
+      });
+    std::atomic<bool> done{false};
+    vector<double> lat; // us, per insert
+    std::thread writer([&]() {
+	std::mt19937_64 mt{seed};
+	while (! done.load(std::memory_order_relaxed)) {
+	  string k = keys[mt() % keys.size()] + std::to_string(mt() % 1000);
+	  auto t0 = clock::now();
+	  t.insert(k, "w");
+	  lat.push_back(std::chrono::duration<double, std::micro>(
+			  clock::now() - t0).count());
+	}
+      });
+    auto slow_cb = [](const string* k, const string* v) -> int {
+      auto until = clock::now() + std::chrono::microseconds(1);
+      while (clock::now() < until) {
+      }
+      return 0;
+    };
+    std::mt19937_64 mt{seed + 1};
+    auto t0 = clock::now();
+    for (auto _ : state) {
+      const string& from = keys[mt() % keys.size()];
+      if (snap) {
+	t.snapshot().list(from, slow_cb, page);
+      } else {
+	t.list(from, slow_cb, page);
+      }
+    }
+    std::chrono::duration<double> secs = clock::now() - t0;
+    done = true;
+    writer.join();
+    if (! lat.empty()) {
+      state.counters["ingest_per_s"] = lat.size() / secs.count();
+      std::sort(lat.begin(), lat.end());
+      state.counters["ingest_p99_us"] = lat[lat.size() * 99 / 100];
+      state.counters["ingest_max_us"] = lat.back();
+    }
+    state.SetItemsProcessed(state.iterations() * page);
+  }
+  BENCHMARK(BM_list_ingest)
+  ->ArgNames({"snap"})
+  ->Arg(0)->Arg(1)
+  ->UseRealTime();
+
+  /* durable inserts from nthreads writers:  mode 0 syncs the tree's
+   * nodes after each (file_store, fsyncing), 1 logs them with group
+   * commit and no window, 2 with a 200us window */
+  void BM_wal_insert(benchmark::State& state) {
+    static constexpr uint32_t per_thread = 64;
+    int mode = state.range(0);
+    uint32_t nthreads = state.range(1);
+    char tmpl[] = "/tmp/tbplus_bench.XXXXXX";
+    if (! mkdtemp(tmpl)) {
+      state.SkipWithError("mkdtemp failed");
+      return;
+    }
+    string dir{tmpl};
+    std::filesystem::create_directory(dir + "/nodes");
+    std::filesystem::create_directory(dir + "/wal");
+    std::shared_ptr<wal> w;
+    {
+      IO io1(IO::default_cache_bytes, 4);
+      io1.set_store(std::make_shared<file_store>(dir + "/nodes", true));
+      Tree t("BM_wal_insert", 100, 2, io1);
+      if (mode > 0) {
+	wal::options opts;
+	opts.window = std::chrono::microseconds((mode == 2) ? 200 : 0);
+	w = wal::open(dir + "/wal", opts);
+	t.set_wal(w);
+      }
+      std::atomic<uint64_t> next{0};
+      for (auto _ : state) {
+	vector<std::thread> writers;
+	for (uint32_t tix = 0; tix < nthreads; ++tix) {
+	  writers.emplace_back([&]() {
+	      std::mt19937_64 mt{seed + next.fetch_add(1)};
+	      for (uint32_t ix = 0; ix < per_thread; ++ix) {
+		t.insert(std::to_string(mt()), "v");
+		if (mode == 0) {
+		  io1.sync();
+		}
+	      }
+	    });
+	}
+	for (auto& th : writers) {
+	  th.join();
+	}
+      }
+      state.SetItemsProcessed(state.iterations() * nthreads * per_thread);
+      if (w) {
+	auto st = w->get_stats();
+	state.counters["batch_avg"] = double(st.records) / st.batches;
+	state.counters["commit_p50_us"] = wal::percentile(st.commit_hist, 0.5);
+	state.counters["commit_p99_us"] =
+	  wal::percentile(st.commit_hist, 0.99);
+      }
+    }
+    std::filesystem::remove_all(dir);
+  }
+  BENCHMARK(BM_wal_insert)
+  ->ArgNames({"mode", "threads"})
+  ->ArgsProduct({{0, 1, 2}, {1, 8}})
+  ->UseRealTime();
+
+  /* lookups of absent keys in a tree of 200k keys, in a paged_store
+   * reopened read-only with a cache of 1MiB:  filter:0 searches every
+   * leaf reached, 1 stores leaves with 1% filters, refused in the
+   * node views, 2 adds a 1% tree filter (built by a scan on open),
+   * refused before any descent */
+  void BM_tree_lookup_absent(benchmark::State& state) {
+    static constexpr uint32_t nkeys = 200000;
+    static constexpr uint32_t fanout = 100;
+    static constexpr size_t cache_bytes = 1 << 20;
+    uint32_t filter = state.range(0);
+    char tmpl[] = "/tmp/tbplus_bench.XXXXXX";
+    if (! mkdtemp(tmpl)) {
+      state.SkipWithError("mkdtemp failed");
+      return;
+    }
+    string dir{tmpl};
+    string path = dir + "/tree.pages";
+    auto keys = make_keys(nkeys, 32, 0);
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    {
+      IO io1(IO::default_cache_bytes, 4);
+      io1.set_store(paged_store::open(path));
+      Tree t("BM_tree_lookup_absent", fanout, 2, io1);
+      if (filter > 0) {
+	Tree::filter_options opts;
+	opts.leaf_fpr = 0.01;
+	t.set_filters(opts);
+      }
+      size_t ix{0};
+      t.bulk_load(
+	[&keys, &ix](string& k, string& v) -> bool {
+	  if (ix == keys.size()) {
+	    return false;
+	  }
+	  k = keys[ix];
+	  v = "val-" + std::to_string(ix++);
+	  return true;
+	});
+      io1.sync();
+    }
+    {
+      IO io2(cache_bytes, 4);
+      io2.set_store(paged_store::open(path, true));
+      Tree t("BM_tree_lookup_absent", fanout, 2, io2);
+      if (filter == 2) {
+	Tree::filter_options opts;
+	opts.tree_fpr = 0.01;
+	t.set_filters(opts);
+      }
+      std::mt19937_64 mt{seed};
+      uint32_t found{0};
+      for (auto _ : state) {
+	/* between present keys, so the descent reaches a leaf */
+	if (t.get(keys[mt() % keys.size()] + "~") == 0) {
+	  ++found;
+	}
+      }
+      if (found > 0) {
+	state.SkipWithError("absent key found");
+      }
+      state.SetItemsProcessed(state.iterations());
+      auto st = t.get_filter_stats();
+      state.counters["false_pos"] =
+	double(st.false_positives) / std::max<uint64_t>(1, state.iterations());
+      state.counters["tree_bytes"] = st.tree_bytes;
+    }
+    std::filesystem::remove_all(dir);
+  }
+  BENCHMARK(BM_tree_lookup_absent)
+  ->ArgNames({"filter"})
+  ->Arg(0)->Arg(1)->Arg(2)
+  ->UseRealTime();
+
+BENCHMARK_MAIN();